@@ -8,7 +8,18 @@
 #include <pwd.h>
 #include <grp.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
 #include "crc32.h"
+#include "MerkleTree.h"
+#include "ChunkFormat.h"
 
 /**
  * Initializes the chunk file parser, opening the chunk file at the specified
@@ -52,16 +63,285 @@ ChunkFileParser::~ChunkFileParser() {
 
 /**
  * Parse the chunk header to ensure it's valid.
+ *
+ * For version 1 chunks, this walks all entries once to build an offset table,
+ * so entries can be accessed by index just like in version 2 chunks.
  */
 void ChunkFileParser::_parseHeader() {
-	chunk_header_t *header = (chunk_header_t *) this->mappedFile;
+	CHECK(this->size >= sizeof(uint32_t)) << "File is too small to be a chunk";
+	this->version = *((uint32_t *) this->mappedFile);
 
 	// Check version
-	LOG(INFO) << "Chunk version 0x" << std::hex << header->version << std::dec;
+	LOG(INFO) << "Chunk version 0x" << std::hex << this->version << std::dec;
+
+	if(this->version == CHUNK_VERSION_1) {
+		CHECK(this->size >= sizeof(chunk_header_t)) << "Header is larger than file";
+
+		chunk_header_t *header = (chunk_header_t *) this->mappedFile;
+
+		this->numEntries = header->numFileEntries;
+		this->merkle = &header->merkle;
+
+		uint8_t *fileEntryStart = (uint8_t *) &header->entry;
+		uint8_t *fileEnd = ((uint8_t *) this->mappedFile) + this->size;
+
+		for(size_t i = 0; i < this->numEntries; i++) {
+			// Make sure the entry (and its name) lies within the file
+			size_t bytesLeft = fileEnd - fileEntryStart;
+			chunk_file_entry_t *fileEntry = (chunk_file_entry_t *) fileEntryStart;
+
+			if(bytesLeft < sizeof(chunk_file_entry_t) ||
+			   fileEntry->nameLenBytes > (bytesLeft - sizeof(chunk_file_entry_t))) {
+				LOG(ERROR) << "Entry " << i << " of " << this->numEntries
+						   << " extends past the end of the file; ignoring it "
+						   << "and all entries after it";
+
+				this->numEntries = i;
+				this->headerValid = false;
+				break;
+			}
+
+			this->v1Entries.push_back(fileEntry);
+
+			fileEntryStart += sizeof(chunk_file_entry_t) + fileEntry->nameLenBytes;
+		}
+	} else if(this->version == CHUNK_VERSION_2) {
+		CHECK(this->size >= sizeof(chunk_header_v2_t)) << "Header is larger than file";
+
+		chunk_header_v2_t *header = (chunk_header_v2_t *) this->mappedFile;
+
+		this->numEntries = header->numFileEntries;
+		this->merkle = &header->merkle;
+
+		CHECK(ChunkFormat::checkHeader(header, this->size))
+			<< "Header is larger than file, or refers to data outside of it";
+
+		// Validate the header checksum
+		uint32_t crc = ChunkFormat::headerChecksum(header, header->headerLenBytes);
+
+		if(crc != header->headerChecksum) {
+			LOG(ERROR) << "HEADER CHECKSUM MISMATCH; ENTRIES MAY BE CORRUPTED!";
+			LOG(ERROR) << "Calculated " << std::hex << crc << ", expected "
+					   << header->headerChecksum << std::dec;
+
+			this->headerValid = false;
+		}
+	} else {
+		LOG(FATAL) << "This tool only supports versions 0x" << std::hex
+				   << CHUNK_VERSION_1 << " and 0x" << CHUNK_VERSION_2;
+	}
+
+	// Make sure the Merkle tree lies within the file before it's used
+	this->merkleValid = ChunkFormat::checkMerkleInfo(*this->merkle, this->size);
+
+	if(!this->merkleValid) {
+		LOG(ERROR) << "Merkle tree is invalid: hash type " << this->merkle->hashType
+				   << ", " << this->merkle->numSegments << " segments of "
+				   << this->merkle->segmentSize << " bytes";
+	} else if(this->merkle->hashType != CHUNK_HASH_NONE) {
+		LOG(INFO) << "Chunk has a Merkle tree: " << this->merkle->numSegments
+				  << " segments of " << this->merkle->segmentSize << " bytes";
+	}
+}
+
+/**
+ * Decodes the entry at the given index; returns false if it's malformed, or
+ * its blob doesn't lie within the file.
+ */
+bool ChunkFileParser::_entryAtIndex(size_t index, chunk_entry_t *entry) {
+	CHECK(index < this->numEntries) << "Entry " << index << " out of range";
+
+	if(this->version == CHUNK_VERSION_1) {
+		ChunkFormat::entryFromV1(this->v1Entries[index], entry);
+		return _blobInFile(*entry);
+	}
+
+	// Look up the entry's offset in the table
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->mappedFile;
+	uint8_t *base = (uint8_t *) this->mappedFile;
+
+	uint32_t *entryTable = (uint32_t *) (base + header->entryTableOff);
+	uint32_t offset = entryTable[index];
+
+	if(offset >= header->entriesLenBytes) {
+		return false;
+	}
+
+	uint8_t *entryStart = base + header->entriesOff + offset;
+	size_t maxLen = header->entriesLenBytes - offset;
+
+	return (ChunkFormat::decodeEntry(entryStart, maxLen, header->flags,
+									 entry) != 0 && _blobInFile(*entry));
+}
+
+/**
+ * Checks that the entry's blob lies within the file.
+ */
+bool ChunkFileParser::_blobInFile(const chunk_entry_t &entry) {
+	return (entry.blobStartOff <= this->size &&
+			entry.blobLenBytes <= (this->size - entry.blobStartOff));
+}
+
+/**
+ * Finds the index of the entry with the given path. In version 2 chunks, the
+ * entry for the root the path lies under is found first, then each remaining
+ * component is looked up with a binary search over the name index; version 1
+ * chunks are searched linearly. Returns -1 if there's no such entry.
+ */
+off_t ChunkFileParser::_indexForPath(std::string path) {
+	chunk_entry_t entry;
+
+	if(this->version == CHUNK_VERSION_1) {
+		for(size_t i = 0; i < this->numEntries; i++) {
+			if(_entryAtIndex(i, &entry) && entry.name == path) {
+				return i;
+			}
+		}
 
-	if(header->version != 0x00010000) {
-		LOG(WARNING) << "\tThis tool only supports version 0x00010000.";
+		return -1;
 	}
+
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->mappedFile;
+	uint32_t *nameIndex = (uint32_t *) (((uint8_t *) this->mappedFile)
+										+ header->nameIndexOff);
+
+	/*
+	 * Entries without a parent (which store their full path) sort first in the
+	 * name index; find the one the path is underneath.
+	 */
+	off_t current = -1;
+	std::string remainder;
+
+	for(size_t i = 0; i < this->numEntries; i++) {
+		if(!_entryAtIndex(nameIndex[i], &entry)) {
+			LOG(ERROR) << "Entry " << nameIndex[i] << " is malformed";
+			return -1;
+		} else if(entry.parentIndex != 0) {
+			break;
+		}
+
+		std::string prefix = entry.name;
+
+		if(path == prefix) {
+			return nameIndex[i];
+		}
+
+		if(prefix.empty() || prefix.back() != '/') {
+			prefix.push_back('/');
+		}
+
+		if(path.compare(0, prefix.size(), prefix) == 0) {
+			current = nameIndex[i];
+			remainder = path.substr(prefix.size());
+			break;
+		}
+	}
+
+	if(current == -1) {
+		return -1;
+	}
+
+	// Then, walk down the tree one component at a time
+	size_t pos = 0;
+
+	while(pos < remainder.size()) {
+		size_t end = remainder.find('/', pos);
+
+		if(end == std::string::npos) {
+			end = remainder.size();
+		}
+
+		// Ignore empty components, i.e. repeated slashes
+		if(end != pos) {
+			current = _indexForChild(current + 1, remainder.substr(pos, end - pos));
+
+			if(current == -1) {
+				return -1;
+			}
+		}
+
+		pos = end + 1;
+	}
+
+	return current;
+}
+
+/**
+ * Performs a binary search over the name index, to find the entry with the
+ * given parent index and name. Returns -1 if there's no such entry.
+ */
+off_t ChunkFileParser::_indexForChild(uint64_t parentIndex, std::string name) {
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->mappedFile;
+	uint32_t *nameIndex = (uint32_t *) (((uint8_t *) this->mappedFile)
+										+ header->nameIndexOff);
+
+	chunk_entry_t key, entry;
+	key.parentIndex = parentIndex;
+	key.name = name;
+
+	size_t low = 0, high = this->numEntries;
+
+	while(low < high) {
+		size_t mid = low + ((high - low) / 2);
+
+		if(!_entryAtIndex(nameIndex[mid], &entry)) {
+			LOG(ERROR) << "Entry " << nameIndex[mid] << " is malformed";
+			return -1;
+		}
+
+		if(ChunkFormat::entryLessThan(entry, key)) {
+			low = mid + 1;
+		} else if(ChunkFormat::entryLessThan(key, entry)) {
+			high = mid;
+		} else {
+			return nameIndex[mid];
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Rebuilds the full path of the entry at the given index, by walking up its
+ * chain of parents.
+ */
+std::string ChunkFileParser::_pathForIndex(size_t index) {
+	chunk_entry_t entry;
+	std::vector<std::string> components;
+
+	// A well-formed chunk can't have a chain longer than its number of entries
+	for(size_t depth = 0; depth <= this->numEntries; depth++) {
+		if(!_entryAtIndex(index, &entry)) {
+			LOG(ERROR) << "Entry " << index << " is malformed";
+			return "";
+		}
+
+		components.push_back(entry.name);
+
+		if(entry.parentIndex == 0) {
+			break;
+		} else if(entry.parentIndex > this->numEntries) {
+			LOG(ERROR) << "Entry " << index << " has invalid parent "
+					   << entry.parentIndex;
+			return "";
+		}
+
+		index = entry.parentIndex - 1;
+	}
+
+	if(entry.parentIndex != 0) {
+		LOG(ERROR) << "Parent chain of entry " << index << " has a loop";
+		return "";
+	}
+
+	// Join them, starting at the root
+	boost::filesystem::path path;
+
+	for(auto it = components.rbegin(); it != components.rend(); it++) {
+		path /= *it;
+	}
+
+	return path.string();
 }
 
 
@@ -71,21 +351,22 @@ void ChunkFileParser::_parseHeader() {
  * taken into account.
  */
 void ChunkFileParser::extractAtIndex(off_t index) {
-	off_t i = 0;
+	chunk_entry_t entry;
+	chunk_entry_t *fileEntry = &entry;
 
 	// Locate this file's entry.
-	chunk_header_t *header = (chunk_header_t *) this->mappedFile;
-	uint8_t *fileEntryStart = (uint8_t *) &header->entry;
+	if(index < 0 || (size_t) index >= this->numEntries) {
+		LOG(ERROR) << "There is no file at index " << index;
+		return;
+	}
 
-	for(i = 0; i < index; i++) {
-		// Print info about it
-		chunk_file_entry_t *fileEntry = (chunk_file_entry_t *) fileEntryStart;
-		fileEntryStart += sizeof(chunk_file_entry_t) + fileEntry->nameLenBytes;
+	if(!_entryAtIndex(index, fileEntry)) {
+		LOG(ERROR) << "Entry " << index << " is malformed";
+		return;
 	}
 
 	// Print file info
-	chunk_file_entry_t *fileEntry = (chunk_file_entry_t *) fileEntryStart;
-	_printFileInfo(i, fileEntry);
+	_printFileInfo(index, fileEntry);
 
 	if(fileEntry->blobLenBytes != fileEntry->size) {
 		LOG(WARNING) << "NOTE: The file's entire data is not contained in this "
@@ -93,20 +374,33 @@ void ChunkFileParser::extractAtIndex(off_t index) {
 					 << "with any subsequent chunks.";
 	}
 
-	// Seek to its data and calculate the CRC
+	// Seek to its data and validate it
 	void *dataOffset = ((uint8_t *) this->mappedFile) + fileEntry->blobStartOff;
 
- 	uint32_t crc = crc32c(0, dataOffset, fileEntry->blobLenBytes);
-
-	if(crc != fileEntry->checksum) {
-		LOG(ERROR) << "CRC MISMATCH DETECTED; THIS FILE MAY HAVE BEEN CORRUPTED!";
-		LOG(ERROR) << "Calculated " << std::hex << crc << ", expected "
-				   << fileEntry->checksum << std::dec
-				   << "; proceeding with extraction anyways.";
+	if(this->merkle->hashType != CHUNK_HASH_NONE) {
+		// Only the segments holding the blob need to be checked
+		if(!_verifyRange(fileEntry->blobStartOff, fileEntry->blobLenBytes)) {
+			LOG(ERROR) << "HASH MISMATCH DETECTED; THIS FILE MAY HAVE BEEN CORRUPTED!";
+			LOG(ERROR) << "Proceeding with extraction anyways.";
+		}
+	} else {
+	 	uint32_t crc = crc32c(0, dataOffset, fileEntry->blobLenBytes);
+
+		if(crc != fileEntry->checksum) {
+			LOG(ERROR) << "CRC MISMATCH DETECTED; THIS FILE MAY HAVE BEEN CORRUPTED!";
+			LOG(ERROR) << "Calculated " << std::hex << crc << ", expected "
+					   << fileEntry->checksum << std::dec
+					   << "; proceeding with extraction anyways.";
+		}
 	}
 
 	// Gather the pathname
 	boost::filesystem::path path(fileEntry->name);
+
+	if(fileEntry->type == kTypeDirectory) {
+		LOG(INFO) << "Entry is a directory; nothing to extract.";
+		return;
+	}
 	const char *name = path.filename().c_str();
 
 	LOG(INFO) << "Attempting to open file for writing at " << name;
@@ -127,21 +421,233 @@ void ChunkFileParser::extractAtIndex(off_t index) {
 }
 
 
+/**
+ * Extracts the file with the given path, which is the full path of the file
+ * when it was backed up.
+ */
+void ChunkFileParser::extractPath(std::string path) {
+	off_t index = _indexForPath(path);
+
+	if(index == -1) {
+		LOG(ERROR) << "No file with path " << path << " in this chunk";
+		return;
+	}
+
+	extractAtIndex(index);
+}
+
+/**
+ * Verifies the checksums of every blob in the chunk, as well as the Merkle tree
+ * if the chunk has one, using the given number of threads. Throughput for
+ * each pass is logged. Returns true if everything matched.
+ */
+bool ChunkFileParser::verify(unsigned int numThreads) {
+	bool success = true;
+
+	if(numThreads == 0) {
+		numThreads = 1;
+	}
+
+	LOG(INFO) << "Verifying chunk using " << numThreads << " thread(s)";
+
+	success &= this->headerValid;
+	success &= _verifyChecksums(numThreads);
+	success &= _verifyMerkleTree(numThreads);
+
+	if(success) {
+		LOG(INFO) << "Chunk verified successfully.";
+	} else {
+		LOG(ERROR) << "CHUNK FAILED VERIFICATION!";
+	}
+
+	return success;
+}
+
+/**
+ * Checks the CRC of each blob; blobs are handed out to the threads one at a
+ * time, so a single large blob is still checksummed serially.
+ */
+bool ChunkFileParser::_verifyChecksums(unsigned int numThreads) {
+	// Collect all file entries first
+	std::vector<chunk_entry_t> entries;
+	uint64_t totalBytes = 0;
+
+	for(size_t i = 0; i < this->numEntries; i++) {
+		chunk_entry_t fileEntry;
+
+		if(!_entryAtIndex(i, &fileEntry)) {
+			LOG(ERROR) << "Entry " << i << " is malformed";
+			return false;
+		}
+
+		if(fileEntry.type != kTypeDirectory) {
+			entries.push_back(fileEntry);
+			totalBytes += fileEntry.blobLenBytes;
+		}
+	}
+
+	// Have every thread take the next unchecked entry
+	std::atomic<size_t> nextEntry(0);
+	std::atomic<size_t> mismatches(0);
+
+	auto worker = [&]() {
+		size_t i;
+
+		while((i = nextEntry++) < entries.size()) {
+			chunk_entry_t *fileEntry = &entries[i];
+			void *data = ((uint8_t *) this->mappedFile) + fileEntry->blobStartOff;
+
+			uint32_t crc = crc32c(0, data, fileEntry->blobLenBytes);
+
+			if(crc != fileEntry->checksum) {
+				LOG(ERROR) << "CRC mismatch on " << fileEntry->name << ": got 0x"
+						   << std::hex << crc << ", expected 0x"
+						   << fileEntry->checksum << std::dec;
+				mismatches++;
+			}
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < numThreads; i++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(auto it = threads.begin(); it != threads.end(); it++) {
+		it->join();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	LOG(INFO) << "CRC: checked " << entries.size() << " blobs (" << totalBytes
+			  << " bytes) in " << elapsed.count() << " sec; "
+			  << (totalBytes / elapsed.count() / 1e9) << " GB/s";
+
+	return (mismatches == 0);
+}
+
+/**
+ * Re-hashes all segments of the chunk's data area in parallel, and compares
+ * them, as well as the root derived from them, against the stored tree.
+ */
+bool ChunkFileParser::_verifyMerkleTree(unsigned int numThreads) {
+	const chunk_merkle_info_t *merkle = this->merkle;
+	uint8_t *base = (uint8_t *) this->mappedFile;
+
+	if(!this->merkleValid) {
+		LOG(ERROR) << "Merkle: tree is invalid; can't verify it";
+		return false;
+	} else if(merkle->hashType == CHUNK_HASH_NONE) {
+		LOG(INFO) << "Merkle: chunk has no tree; skipping";
+		return true;
+	}
+
+	const uint8_t *leaves = base + merkle->leavesStartOff;
+	std::vector<uint8_t> computed(merkle->numSegments * MERKLE_HASH_SIZE);
+
+	auto start = std::chrono::steady_clock::now();
+
+	MerkleTree::hashSegmentsParallel(base + merkle->dataStartOff,
+									 merkle->dataLenBytes,
+									 merkle->segmentSize,
+									 computed.data(), numThreads);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	LOG(INFO) << "Merkle: hashed " << merkle->numSegments << " segments ("
+			  << merkle->dataLenBytes << " bytes) in " << elapsed.count()
+			  << " sec; " << (merkle->dataLenBytes / elapsed.count() / 1e9)
+			  << " GB/s";
+
+	// Compare each leaf, so we can say which segments are bad
+	bool success = true;
+
+	for(size_t i = 0; i < merkle->numSegments; i++) {
+		if(memcmp(&computed[i * MERKLE_HASH_SIZE], leaves + (i * MERKLE_HASH_SIZE),
+				  MERKLE_HASH_SIZE) != 0) {
+			LOG(ERROR) << "Merkle: segment " << i << " (chunk offset "
+					   << (merkle->dataStartOff + (i * merkle->segmentSize))
+					   << ") does not match";
+			success = false;
+		}
+	}
+
+	// Lastly, check the stored leaves against the root
+	uint8_t root[MERKLE_HASH_SIZE];
+	MerkleTree::computeRoot(leaves, merkle->numSegments, root);
+
+	if(memcmp(root, merkle->rootHash, MERKLE_HASH_SIZE) != 0) {
+		LOG(ERROR) << "Merkle: root hash does not match";
+		success = false;
+	}
+
+	return success;
+}
+
+/**
+ * Validates only the segments of the Merkle tree that cover the given range of
+ * the chunk. The leaves are checked against the root first.
+ */
+bool ChunkFileParser::_verifyRange(uint64_t offset, uint64_t length) {
+	const chunk_merkle_info_t *merkle = this->merkle;
+	uint8_t *base = (uint8_t *) this->mappedFile;
+
+	if(!this->merkleValid) {
+		LOG(ERROR) << "Merkle tree is invalid; can't verify range";
+		return false;
+	}
+
+	// The range must lie in the data area the tree covers
+	if(offset < merkle->dataStartOff ||
+	   (offset - merkle->dataStartOff) > merkle->dataLenBytes ||
+	   length > merkle->dataLenBytes - (offset - merkle->dataStartOff)) {
+		LOG(ERROR) << "Range at " << offset << " (" << length << " bytes) isn't "
+				   << "covered by the Merkle tree";
+		return false;
+	}
+
+	const uint8_t *leaves = base + merkle->leavesStartOff;
+
+	// Make sure the leaves haven't been tampered with
+	uint8_t root[MERKLE_HASH_SIZE];
+	MerkleTree::computeRoot(leaves, merkle->numSegments, root);
+
+	if(memcmp(root, merkle->rootHash, MERKLE_HASH_SIZE) != 0) {
+		LOG(ERROR) << "Merkle root hash does not match";
+		return false;
+	}
+
+	if(length == 0) {
+		return true;
+	}
+
+	// Figure out which segments the range lies in
+	uint64_t relative = offset - merkle->dataStartOff;
+
+	size_t first = relative / merkle->segmentSize;
+	size_t last = (relative + length - 1) / merkle->segmentSize;
+
+	return MerkleTree::verifySegments(base + merkle->dataStartOff,
+									  merkle->dataLenBytes,
+									  merkle->segmentSize, leaves,
+									  first, (last - first) + 1);
+}
+
 /**
  * Lists all files found in this chunk.
  */
 void ChunkFileParser::listFiles() {
-	chunk_header_t *header = (chunk_header_t *) this->mappedFile;
-
-	uint8_t *fileEntryStart = (uint8_t *) &header->entry;
+	chunk_entry_t fileEntry;
 
-	for(off_t i = 0; i < header->numFileEntries; i++) {
+	for(size_t i = 0; i < this->numEntries; i++) {
 		// Print info about it
-		chunk_file_entry_t *fileEntry = (chunk_file_entry_t *) fileEntryStart;
-		_printFileInfo(i, fileEntry);
+		if(!_entryAtIndex(i, &fileEntry)) {
+			LOG(ERROR) << "Entry " << i << " is malformed";
+			continue;
+		}
 
-		// Increment by the size
-		fileEntryStart += sizeof(chunk_file_entry_t) + fileEntry->nameLenBytes;
+		_printFileInfo(i, &fileEntry);
 	}
 }
 
@@ -149,10 +655,21 @@ void ChunkFileParser::listFiles() {
 /**
  * Prints info about a file, given its file entry structure.
  */
-void ChunkFileParser::_printFileInfo(size_t i, chunk_file_entry_t *fileEntry) {
+void ChunkFileParser::_printFileInfo(size_t i, chunk_entry_t *fileEntry) {
 	LOG(INFO) << "File " << i << " \t"
 			  << ((fileEntry->type == kTypeDirectory) ? "DIR" : "FILE");
-	LOG(INFO) << "\tName: " << fileEntry->name;
+	if(fileEntry->fileId != 0) {
+		LOG(INFO) << "\tID: " << fileEntry->fileId;
+	} else {
+		boost::uuids::uuid uuid;
+		std::copy(fileEntry->fileUuid, fileEntry->fileUuid + sizeof(uuid.data),
+				  uuid.begin());
+
+		LOG(INFO) << "\tUUID: " << uuid;
+	}
+
+	LOG(INFO) << "\tName: " << fileEntry->name << " (path: "
+			  << _pathForIndex(i) << ")";
 	LOG(INFO) << "\tMode: " << std::oct << fileEntry->mode << std::dec
 			  << "; owner " << _nameForUid(fileEntry->owner) << "("
 			  << fileEntry->owner << ")"
@@ -163,7 +680,8 @@ void ChunkFileParser::_printFileInfo(size_t i, chunk_file_entry_t *fileEntry) {
 			  << fileEntry->blobLenBytes << ", original file offset = "
 			  << fileEntry->blobFileOffset << ")";
 	LOG(INFO) << "\tFlags: "
-			  << ((fileEntry->size != fileEntry->blobLenBytes) ? "PART" : "")
+			  << ((fileEntry->size != fileEntry->blobLenBytes) ? "PART " : "")
+			  << ((fileEntry->flags & kEntryFlagReference) ? "REF" : "")
 			  << "\tChecksum: 0x" << std::hex << fileEntry->checksum << std::dec;
 }
 
@@ -8,8 +8,11 @@
 #include <boost/filesystem.hpp>
 
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "TapeStructs.h"
+#include "ChunkFormat.h"
 
 class ChunkFileParser {
 	public:
@@ -19,16 +22,43 @@ class ChunkFileParser {
 		void listFiles();
 
 		void extractAtIndex(off_t);
+		void extractPath(std::string);
+
+		bool verify(unsigned int);
 
 	private:
 		FILE *fd;
 		void *mappedFile;
 		size_t size;
 
+		// chunk version, and the number of file entries
+		uint32_t version;
+		size_t numEntries = 0;
+
+		// cleared if the header checksum didn't match
+		bool headerValid = true;
+
+		// Merkle tree description, wherever it is in the header; cleared if
+		// its hash type is unknown, or it doesn't fit in the file
+		const chunk_merkle_info_t *merkle = NULL;
+		bool merkleValid = true;
+
+		// for version 1 chunks: location of each file entry
+		std::vector<const chunk_file_entry_t *> v1Entries;
+
 
 		void _parseHeader();
+		bool _entryAtIndex(size_t, chunk_entry_t *);
+		bool _blobInFile(const chunk_entry_t &);
+		off_t _indexForPath(std::string);
+		off_t _indexForChild(uint64_t, std::string);
+		std::string _pathForIndex(size_t);
+
+		bool _verifyChecksums(unsigned int);
+		bool _verifyMerkleTree(unsigned int);
+		bool _verifyRange(uint64_t, uint64_t);
 
-		void _printFileInfo(size_t, chunk_file_entry_t *);
+		void _printFileInfo(size_t, chunk_entry_t *);
 		const char *_nameForUid(int);
 		const char *_nameForGid(int);
 };
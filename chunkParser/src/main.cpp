@@ -2,6 +2,7 @@
 #include "ChunkFileParser.hpp"
 
 #include <iostream>
+#include <thread>
 
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -15,6 +16,7 @@ int main(int argc, char *argv[]) {
 	Logging::setUp(argv);
 
 	ChunkFileParser *parser = NULL;
+	int ret = 0;
 
 	// Declare the supported options.
 	po::options_description desc("Allowed options");
@@ -22,6 +24,9 @@ int main(int argc, char *argv[]) {
 	    ("help", "Secrete this help message")
 	    ("in", po::value<std::string>(), "Path to chunk file")
 	    ("extract", po::value<int>(), "Index of the file to extract")
+	    ("path", po::value<std::string>(), "Path of the file to extract")
+	    ("verify", "Verify all checksums and the Merkle tree, if present")
+	    ("threads", po::value<unsigned int>(), "Number of threads to verify with")
 	;
 
 	po::variables_map vm;
@@ -43,7 +48,22 @@ int main(int argc, char *argv[]) {
 		parser = new ChunkFileParser(boost::filesystem::path(path));
 
 		// List if we're not extracting any files.
-		if(vm.count("extract") == 0) {
+		if(vm.count("verify")) {
+			unsigned int threads = std::thread::hardware_concurrency();
+
+			if(vm.count("threads")) {
+				threads = vm["threads"].as<unsigned int>();
+			}
+
+			if(!parser->verify(threads)) {
+				ret = 1;
+			}
+		} else if(vm.count("path")) {
+			std::string filePath = vm["path"].as<std::string>();
+			LOG(INFO) << "Attempting to extract file " << filePath;
+
+			parser->extractPath(filePath);
+		} else if(vm.count("extract") == 0) {
 			parser->listFiles();
 		} else {
 			int fileIdx = vm["extract"].as<int>();
@@ -60,5 +80,5 @@ int main(int argc, char *argv[]) {
 		delete parser;
 	}
 
-    return 0;
+    return ret;
 }
@@ -0,0 +1,288 @@
+#include "ChunkFormat.h"
+
+#include <cstring>
+#include <cstddef>
+
+#include "crc32.h"
+#include "MerkleTree.h"
+
+// Maximum length of a varint encoding a 64-bit and 32-bit value, respectively
+static const size_t kMaxVarint64Len = 10;
+static const size_t kMaxVarint32Len = 5;
+
+/**
+ * Returns the largest number of bytes an entry with a name of the given length
+ * could take up when encoded.
+ */
+size_t ChunkFormat::maxEntrySize(size_t nameLen) {
+	return sizeof(((chunk_entry_t *) 0)->fileUuid)		// file ID or UUID
+		 + (kMaxVarint32Len * 2)					// type, flags
+		 + kMaxVarint64Len							// parent index
+		 + (kMaxVarint64Len * 2)					// timestamp, size
+		 + (kMaxVarint32Len * 3)					// owner, group, mode
+		 + sizeof(uint32_t)							// checksum
+		 + (kMaxVarint64Len * 3)					// blob location
+		 + kMaxVarint32Len + nameLen;				// name
+}
+
+/**
+ * Encodes the given entry into the buffer, which must be at least as large as
+ * maxEntrySize() indicates. The chunk's header flags determine whether the
+ * file's ID or UUID is written. Returns the number of bytes written.
+ */
+size_t ChunkFormat::encodeEntry(const chunk_entry_t &entry, uint32_t headerFlags,
+								uint8_t *out) {
+	uint8_t *ptr = out;
+
+	if(headerFlags & kChunkFlagFileUuids) {
+		memcpy(ptr, entry.fileUuid, sizeof(entry.fileUuid));
+		ptr += sizeof(entry.fileUuid);
+	} else {
+		ptr += encodeVarint(entry.fileId, ptr);
+	}
+
+	ptr += encodeVarint(entry.type, ptr);
+	ptr += encodeVarint(entry.flags, ptr);
+	ptr += encodeVarint(entry.parentIndex, ptr);
+	ptr += encodeVarint(entry.timeModified, ptr);
+	ptr += encodeVarint(entry.size, ptr);
+
+	ptr += encodeVarint(entry.owner, ptr);
+	ptr += encodeVarint(entry.group, ptr);
+	ptr += encodeVarint(entry.mode, ptr);
+
+	// checksum is fixed size, since it's effectively random
+	for(size_t i = 0; i < sizeof(uint32_t); i++) {
+		*ptr++ = (entry.checksum >> (i * 8)) & 0xFF;
+	}
+
+	ptr += encodeVarint(entry.blobStartOff, ptr);
+	ptr += encodeVarint(entry.blobLenBytes, ptr);
+	ptr += encodeVarint(entry.blobFileOffset, ptr);
+
+	ptr += encodeVarint(entry.name.size(), ptr);
+	memcpy(ptr, entry.name.data(), entry.name.size());
+	ptr += entry.name.size();
+
+	return (ptr - out);
+}
+
+/**
+ * Decodes an entry from the given buffer, which holds at most `len` bytes, in a
+ * chunk with the given header flags. Returns the number of bytes consumed, or
+ * 0 if the entry is malformed.
+ */
+size_t ChunkFormat::decodeEntry(const uint8_t *in, size_t len,
+								uint32_t headerFlags, chunk_entry_t *entry) {
+	const uint8_t *ptr = in;
+	const uint8_t *end = in + len;
+
+	uint64_t value;
+	size_t read;
+
+	// Reads a varint into the given field, bailing out if it's malformed
+	#define READ_VARINT(field) \
+		if((read = decodeVarint(ptr, (end - ptr), &value)) == 0) return 0; \
+		ptr += read; \
+		field = (decltype(field)) value;
+
+	if(headerFlags & kChunkFlagFileUuids) {
+		if((size_t) (end - ptr) < sizeof(entry->fileUuid)) {
+			return 0;
+		}
+
+		entry->fileId = 0;
+		memcpy(entry->fileUuid, ptr, sizeof(entry->fileUuid));
+		ptr += sizeof(entry->fileUuid);
+	} else {
+		memset(entry->fileUuid, 0, sizeof(entry->fileUuid));
+		READ_VARINT(entry->fileId);
+	}
+
+	READ_VARINT(entry->type);
+	READ_VARINT(entry->flags);
+	READ_VARINT(entry->parentIndex);
+	READ_VARINT(entry->timeModified);
+	READ_VARINT(entry->size);
+
+	READ_VARINT(entry->owner);
+	READ_VARINT(entry->group);
+	READ_VARINT(entry->mode);
+
+	if((size_t) (end - ptr) < sizeof(uint32_t)) {
+		return 0;
+	}
+
+	entry->checksum = 0;
+	for(size_t i = 0; i < sizeof(uint32_t); i++) {
+		entry->checksum |= ((uint32_t) *ptr++) << (i * 8);
+	}
+
+	READ_VARINT(entry->blobStartOff);
+	READ_VARINT(entry->blobLenBytes);
+	READ_VARINT(entry->blobFileOffset);
+
+	size_t nameLen;
+	READ_VARINT(nameLen);
+
+	if((size_t) (end - ptr) < nameLen) {
+		return 0;
+	}
+
+	entry->name.assign((const char *) ptr, nameLen);
+	ptr += nameLen;
+
+	#undef READ_VARINT
+
+	return (ptr - in);
+}
+
+/**
+ * Converts a version 1 file entry into the decoded form.
+ */
+void ChunkFormat::entryFromV1(const chunk_file_entry_t *in, chunk_entry_t *out) {
+	out->fileId = 0;
+	memcpy(out->fileUuid, in->fileUuid, sizeof(out->fileUuid));
+
+	out->type = in->type;
+	out->flags = 0;
+	out->timeModified = in->timeModified;
+	out->size = in->size;
+
+	out->owner = in->owner;
+	out->group = in->group;
+	out->mode = in->mode;
+
+	out->checksum = in->checksum;
+
+	out->blobStartOff = in->blobStartOff;
+	out->blobLenBytes = in->blobLenBytes;
+	out->blobFileOffset = in->blobFileOffset;
+
+	// version 1 entries always hold the full path
+	out->parentIndex = 0;
+
+	// the length includes the NULL terminator
+	out->name = std::string(in->name, strnlen(in->name, in->nameLenBytes));
+}
+
+/**
+ * Writes the value as an unsigned LEB128 varint; returns the number of bytes
+ * written, which is at most 10.
+ */
+size_t ChunkFormat::encodeVarint(uint64_t value, uint8_t *out) {
+	size_t written = 0;
+
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+
+		if(value != 0) {
+			byte |= 0x80;
+		}
+
+		out[written++] = byte;
+	} while(value != 0);
+
+	return written;
+}
+
+/**
+ * Reads an unsigned LEB128 varint from the buffer, which holds at most `len`
+ * bytes. Returns the number of bytes consumed, or 0 if the varint is invalid.
+ */
+size_t ChunkFormat::decodeVarint(const uint8_t *in, size_t len, uint64_t *out) {
+	uint64_t value = 0;
+
+	for(size_t i = 0; i < len && i < kMaxVarint64Len; i++) {
+		value |= ((uint64_t) (in[i] & 0x7F)) << (i * 7);
+
+		if((in[i] & 0x80) == 0) {
+			*out = value;
+			return (i + 1);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Calculates the CRC32C over a version 2 header area of the given length, as
+ * though the checksum field in it were zero.
+ */
+uint32_t ChunkFormat::headerChecksum(const void *header, size_t len) {
+	static const uint8_t zeroes[sizeof(uint32_t)] = { 0 };
+
+	const uint8_t *bytes = static_cast<const uint8_t *>(header);
+	const size_t fieldOff = offsetof(chunk_header_v2_t, headerChecksum);
+	const size_t fieldEnd = fieldOff + sizeof(uint32_t);
+
+	uint32_t crc = crc32c(0, bytes, fieldOff);
+	crc = crc32c(crc, zeroes, sizeof(zeroes));
+	crc = crc32c(crc, bytes + fieldEnd, len - fieldEnd);
+
+	return crc;
+}
+
+/**
+ * Checks whether `count` items of `size` bytes each, starting at `off`, lie
+ * within the first `len` bytes; this can't overflow.
+ */
+static bool _inRange(uint64_t off, uint64_t count, uint64_t size, uint64_t len) {
+	return (off <= len && count <= ((len - off) / size));
+}
+
+/**
+ * Checks that the tables and entries a version 2 header refers to lie within
+ * its header area, and that the header area fits in a chunk of `chunkLen`
+ * bytes. This must be done before the header checksum is calculated, or any of
+ * its offsets are used.
+ */
+bool ChunkFormat::checkHeader(const chunk_header_v2_t *header, uint64_t chunkLen) {
+	const uint64_t headerLen = header->headerLenBytes;
+
+	if(headerLen < sizeof(chunk_header_v2_t) || headerLen > chunkLen) {
+		return false;
+	}
+
+	return (_inRange(header->entryTableOff, header->numFileEntries, sizeof(uint32_t), headerLen) &&
+			_inRange(header->nameIndexOff, header->numFileEntries, sizeof(uint32_t), headerLen) &&
+			_inRange(header->entriesOff, header->entriesLenBytes, 1, headerLen));
+}
+
+/**
+ * Checks that a chunk's Merkle tree has a known hash type, that its segments
+ * cover its data area, and that the data area and leaves lie within a chunk of
+ * `chunkLen` bytes. A chunk without a tree passes.
+ */
+bool ChunkFormat::checkMerkleInfo(const chunk_merkle_info_t &merkle, uint64_t chunkLen) {
+	if(merkle.hashType == CHUNK_HASH_NONE) {
+		return true;
+	} else if(merkle.hashType != CHUNK_HASH_SHA256) {
+		return false;
+	}
+
+	if(merkle.segmentSize == 0 ||
+	   !_inRange(merkle.dataStartOff, merkle.dataLenBytes, 1, chunkLen)) {
+		return false;
+	}
+
+	if(merkle.numSegments != MerkleTree::numSegmentsForLength(merkle.dataLenBytes,
+															  merkle.segmentSize)) {
+		return false;
+	}
+
+	return _inRange(merkle.leavesStartOff, merkle.numSegments, MERKLE_HASH_SIZE, chunkLen);
+}
+
+/**
+ * Ordering used for the name index: entries are sorted by their parent index
+ * first, then by their names.
+ */
+bool ChunkFormat::entryLessThan(const chunk_entry_t &a, const chunk_entry_t &b) {
+	if(a.parentIndex != b.parentIndex) {
+		return (a.parentIndex < b.parentIndex);
+	}
+
+	return (a.name < b.name);
+}
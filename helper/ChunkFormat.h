@@ -0,0 +1,86 @@
+/**
+ * Helpers for the version 2 chunk format: encoding and decoding of the variable
+ * length file entries, and the header checksum. This is shared between the
+ * daemon (which writes chunks) and any tools that need to read them.
+ *
+ * An encoded entry consists of the following fields, in order; unless noted,
+ * all fields are unsigned LEB128 varints:
+ *
+ * - File ID; or if kChunkFlagFileUuids is set in the header, the file UUID (16
+ *   bytes, raw)
+ * - Type, flags
+ * - Parent index: the index of the parent directory's entry in the same chunk
+ *   plus one, or zero if the entry has no parent
+ * - Modification timestamp
+ * - Size
+ * - Owner, group, mode
+ * - Blob CRC32C (4 bytes, little endian)
+ * - Blob start offset, blob length, offset of the blob in the original file
+ * - Name length, followed by that many bytes of UTF-8 name (not terminated)
+ *
+ * Entries with a parent only store the last component of their path as their
+ * name; the full path is rebuilt by walking the chain of parents. Since every
+ * ancestor of a file is included in a chunk (as a reference entry, if it was
+ * backed up elsewhere) this can always be done with a single chunk.
+ */
+#ifndef CHUNKFORMAT_H
+#define CHUNKFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "TapeStructs.h"
+
+/**
+ * Decoded form of a file entry; this is the same for all chunk versions.
+ */
+typedef struct {
+	// ID of the file within the job; zero if the file has an UUID instead
+	uint64_t fileId;
+	uint8_t fileUuid[16];
+
+	chunk_file_type_t type;
+	uint32_t flags;
+
+	// index of the parent entry in the same chunk + 1, or 0 for none
+	uint64_t parentIndex;
+
+	uint64_t timeModified;
+	uint64_t size;
+
+	uint32_t owner, group;
+	uint32_t mode;
+
+	uint32_t checksum;
+
+	uint64_t blobStartOff;
+	uint64_t blobLenBytes;
+	uint64_t blobFileOffset;
+
+	// last path component; the full path if the entry has no parent
+	std::string name;
+} chunk_entry_t;
+
+class ChunkFormat {
+	public:
+		static size_t maxEntrySize(size_t);
+
+		static size_t encodeEntry(const chunk_entry_t &, uint32_t, uint8_t *);
+		static size_t decodeEntry(const uint8_t *, size_t, uint32_t,
+								  chunk_entry_t *);
+
+		static void entryFromV1(const chunk_file_entry_t *, chunk_entry_t *);
+
+		static size_t encodeVarint(uint64_t, uint8_t *);
+		static size_t decodeVarint(const uint8_t *, size_t, uint64_t *);
+
+		static uint32_t headerChecksum(const void *, size_t);
+
+		static bool checkHeader(const chunk_header_v2_t *, uint64_t);
+		static bool checkMerkleInfo(const chunk_merkle_info_t &, uint64_t);
+
+		static bool entryLessThan(const chunk_entry_t &, const chunk_entry_t &);
+};
+
+#endif
@@ -2,9 +2,35 @@
 
 #include <glog/logging.h>
 #include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <map>
+#include <mutex>
+
+/**
+ * Path of the library that's loaded, unless the environment variable below is
+ * set; that way, a different backend (i.e. a file-backed stand-in for testing)
+ * can be used without rebuilding.
+ */
+#define IOLIB_DEFAULT_PATH	"./iolib.so"
+#define IOLIB_PATH_ENV		"IOLIB_PATH"
 
 static void *lib = NULL;
 static void *resolveSymbol(const char *name);
+static void *resolveOptionalSymbol(const char *name, void *fallback);
+
+static size_t fallbackWriteVectored(iolib_drive_t, const struct iovec *, int, iolib_error_t *);
+static size_t fallbackGetQueueDepth(iolib_drive_t);
+static iolib_error_t fallbackSubmitWrite(iolib_drive_t, iolib_io_request_t *);
+static iolib_error_t fallbackSubmitRead(iolib_drive_t, iolib_io_request_t *);
+static iolib_io_request_t *fallbackCompleteRequest(iolib_drive_t, iolib_error_t *);
+static int fallbackGetInventory(iolib_loader_t, iolib_element_record_t *, size_t, iolib_error_t *);
+static size_t fallbackGetBlockSize(iolib_drive_t);
+static off_t fallbackGetBlockPosition(iolib_drive_t, iolib_error_t *);
+static iolib_error_t fallbackLocateBlock(iolib_drive_t, off_t);
+static iolib_error_t fallbackWriteFileMarks(iolib_drive_t, size_t, bool);
 
 // Define variables for all of the functions.
 _iolib_init_t iolibInit;
@@ -30,6 +56,18 @@ _iolib_drive_write_filemark_t iolibDriveWriteFileMark;
 _iolib_drive_read_t iolibDriveRead;
 _iolib_drive_is_at_end_t iolibDriveIsEOM;
 
+_iolib_drive_write_vectored_t iolibDriveWriteVectored;
+_iolib_drive_get_queue_depth_t iolibDriveGetQueueDepth;
+_iolib_drive_submit_t iolibDriveSubmitWrite;
+_iolib_drive_submit_t iolibDriveSubmitRead;
+_iolib_drive_complete_t iolibDriveCompleteRequest;
+
+_iolib_drive_get_block_size_t iolibDriveGetBlockSize;
+_iolib_drive_get_block_position_t iolibDriveGetBlockPosition;
+_iolib_drive_locate_block_t iolibDriveLocateBlock;
+
+_iolib_drive_write_filemarks_t iolibDriveWriteFileMarks;
+
 _iolib_loader_get_name_t iolibLoaderGetName;
 _iolib_loader_get_uuid_t iolibLoaderGetUuid;
 _iolib_loader_get_devfile_t iolibLoaderGetDevFile;
@@ -38,6 +76,7 @@ _iolib_loader_do_inventory_t iolibLoaderPerformInventory;
 _iolib_loader_move_t iolibLoaderMove;
 _iolib_loader_exchange_t iolibLoaderExchange;
 _iolib_loader_get_elements_t iolibLoaderGetElements;
+_iolib_loader_get_inventory_t iolibLoaderGetInventory;
 
 _iolib_element_get_address_t iolibElementGetAddress;
 _iolib_element_get_uuid_t iolibElementGetUuid;
@@ -50,6 +89,9 @@ _iolib_close_session_t iolibCloseSession;
 
 // Generates an entry in the symbol loading table
 #define IOLIB_RESOLVE_FUNC(name) *((void **) &name) = resolveSymbol(#name)
+// Same, but for a function that's substituted if the library doesn't have it
+#define IOLIB_RESOLVE_OPTIONAL_FUNC(name, fallback) \
+    *((void **) &name) = resolveOptionalSymbol(#name, (void *) &fallback)
 
 /**
  * Initializes the library function pointers by loading the library. This will
@@ -57,8 +99,16 @@ _iolib_close_session_t iolibCloseSession;
  */
 void iolibLoadLib() {
     // Load the library
-    lib = dlopen("./iolib.so", RTLD_NOW);
-    CHECK(lib != NULL) << "Could not load iolib.so: " << dlerror();
+    const char *path = getenv(IOLIB_PATH_ENV);
+
+    if(path == NULL) {
+        path = IOLIB_DEFAULT_PATH;
+    }
+
+    lib = dlopen(path, RTLD_NOW);
+    CHECK(lib != NULL) << "Could not load " << path << ": " << dlerror();
+
+    LOG(INFO) << "Loaded iolib from " << path;
 
     // Attempt to resolve functions.
     IOLIB_RESOLVE_FUNC(iolibInit);
@@ -84,6 +134,18 @@ void iolibLoadLib() {
     IOLIB_RESOLVE_FUNC(iolibDriveRead);
     IOLIB_RESOLVE_FUNC(iolibDriveIsEOM);
 
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveWriteVectored, fallbackWriteVectored);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveGetQueueDepth, fallbackGetQueueDepth);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveSubmitWrite, fallbackSubmitWrite);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveSubmitRead, fallbackSubmitRead);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveCompleteRequest, fallbackCompleteRequest);
+
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveGetBlockSize, fallbackGetBlockSize);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveGetBlockPosition, fallbackGetBlockPosition);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveLocateBlock, fallbackLocateBlock);
+
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibDriveWriteFileMarks, fallbackWriteFileMarks);
+
     IOLIB_RESOLVE_FUNC(iolibLoaderGetName);
 	IOLIB_RESOLVE_FUNC(iolibLoaderGetUuid);
 	IOLIB_RESOLVE_FUNC(iolibLoaderGetDevFile);
@@ -92,6 +154,7 @@ void iolibLoadLib() {
     IOLIB_RESOLVE_FUNC(iolibLoaderMove);
     IOLIB_RESOLVE_FUNC(iolibLoaderExchange);
     IOLIB_RESOLVE_FUNC(iolibLoaderGetElements);
+    IOLIB_RESOLVE_OPTIONAL_FUNC(iolibLoaderGetInventory, fallbackGetInventory);
 
     IOLIB_RESOLVE_FUNC(iolibElementGetAddress);
 	IOLIB_RESOLVE_FUNC(iolibElementGetUuid);
@@ -112,3 +175,261 @@ static void *resolveSymbol(const char *name) {
 
     return ptr;
 }
+
+/**
+ * Attempts to fetch the address of the specified symbol; if the library doesn't
+ * have it, the fallback is returned instead.
+ */
+static void *resolveOptionalSymbol(const char *name, void *fallback) {
+    void *ptr = dlsym(lib, name);
+
+    if(ptr == NULL) {
+        LOG(INFO) << "iolib doesn't provide " << name << "; using synchronous fallback";
+        return fallback;
+    }
+
+    return ptr;
+}
+
+
+//////////////////////// Fallbacks for Optional Functions ///////////////////////
+// the request that each drive has outstanding with the fallbacks; it was
+// already performed when it was submitted
+static std::map<iolib_drive_t, iolib_io_request_t *> fallbackRequests;
+static std::mutex fallbackRequestsLock;
+
+/**
+ * Writes each buffer in turn with iolibDriveWrite, stopping at the first one
+ * that isn't written completely.
+ */
+static size_t fallbackWriteVectored(iolib_drive_t drive, const struct iovec *iov,
+                                    int iovcnt, iolib_error_t *outErr) {
+    size_t total = 0;
+
+    for(int i = 0; i < iovcnt; i++) {
+        size_t written = iolibDriveWrite(drive, iov[i].iov_base, iov[i].iov_len,
+                                         false, outErr);
+
+        if((ssize_t) written < 0) {
+            return (total == 0) ? written : total;
+        }
+
+        total += written;
+
+        if(written < iov[i].iov_len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Without a library implementation, only one request can be outstanding.
+ */
+static size_t fallbackGetQueueDepth(iolib_drive_t drive) {
+    return 1;
+}
+
+/**
+ * Records a request that was performed synchronously as outstanding; fails if
+ * the drive has one already.
+ */
+static iolib_error_t fallbackAddRequest(iolib_drive_t drive, iolib_io_request_t *req) {
+    std::lock_guard<std::mutex> lk(fallbackRequestsLock);
+
+    if(fallbackRequests.count(drive)) {
+        return IOLIB_ERROR_QUEUE_FULL;
+    }
+
+    fallbackRequests[drive] = req;
+    return 0;
+}
+
+/**
+ * Performs the write right away, then queues the request for completion.
+ */
+static iolib_error_t fallbackSubmitWrite(iolib_drive_t drive, iolib_io_request_t *req) {
+    {
+        std::lock_guard<std::mutex> lk(fallbackRequestsLock);
+
+        if(fallbackRequests.count(drive)) {
+            return IOLIB_ERROR_QUEUE_FULL;
+        }
+    }
+
+    req->error = 0;
+    req->transferred = fallbackWriteVectored(drive, req->iov, req->iovcnt, &req->error);
+
+    return fallbackAddRequest(drive, req);
+}
+
+/**
+ * Performs the read right away, then queues the request for completion. The
+ * read stops at the first buffer that isn't filled completely.
+ */
+static iolib_error_t fallbackSubmitRead(iolib_drive_t drive, iolib_io_request_t *req) {
+    {
+        std::lock_guard<std::mutex> lk(fallbackRequestsLock);
+
+        if(fallbackRequests.count(drive)) {
+            return IOLIB_ERROR_QUEUE_FULL;
+        }
+    }
+
+    req->error = 0;
+    req->transferred = 0;
+
+    for(int i = 0; i < req->iovcnt; i++) {
+        size_t read = iolibDriveRead(drive, req->iov[i].iov_base,
+                                     req->iov[i].iov_len, &req->error);
+
+        if((ssize_t) read < 0) {
+            if(req->transferred == 0) {
+                req->transferred = read;
+            }
+
+            break;
+        }
+
+        req->transferred += read;
+
+        if(read < req->iov[i].iov_len) {
+            break;
+        }
+    }
+
+    return fallbackAddRequest(drive, req);
+}
+
+/**
+ * Returns the drive's outstanding request, which is always complete.
+ */
+static iolib_io_request_t *fallbackCompleteRequest(iolib_drive_t drive,
+                                                   iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(fallbackRequestsLock);
+
+    auto it = fallbackRequests.find(drive);
+
+    if(it == fallbackRequests.end()) {
+        if(outErr != NULL) {
+            *outErr = EINVAL;
+        }
+
+        return NULL;
+    }
+
+    iolib_io_request_t *req = it->second;
+    fallbackRequests.erase(it);
+
+    return req;
+}
+
+/**
+ * Without a library implementation, blocks can't be located.
+ */
+static size_t fallbackGetBlockSize(iolib_drive_t drive) {
+    return 0;
+}
+
+/**
+ * Fails, since the block position isn't known.
+ */
+static off_t fallbackGetBlockPosition(iolib_drive_t drive, iolib_error_t *outErr) {
+    if(outErr != NULL) {
+        *outErr = ENOTSUP;
+    }
+
+    return -1;
+}
+
+/**
+ * Fails, since blocks can't be located.
+ */
+static iolib_error_t fallbackLocateBlock(iolib_drive_t drive, off_t block) {
+    return ENOTSUP;
+}
+
+/**
+ * Writes each filemark immediately, since they can't be buffered.
+ */
+static iolib_error_t fallbackWriteFileMarks(iolib_drive_t drive, size_t count,
+                                            bool immediate) {
+    for(size_t i = 0; i < count; i++) {
+        iolib_error_t err = iolibDriveWriteFileMark(drive);
+
+        if(err != 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Copies a string returned by the library into a fixed size buffer, cutting it
+ * short if needed, and frees it.
+ */
+static void fallbackCopyString(iolib_string_t str, char *out, size_t len) {
+    memset(out, 0, len);
+
+    if(str != NULL) {
+        strncpy(out, str, len - 1);
+        iolibStringFree(str);
+    }
+}
+
+/**
+ * Builds the inventory by querying each element individually.
+ */
+static int fallbackGetInventory(iolib_loader_t loader, iolib_element_record_t *out,
+                                size_t max, iolib_error_t *outErr) {
+    static const iolib_storage_element_type_t types[] = {
+        kStorageElementTransport,
+        kStorageElementDrive,
+        kStorageElementPortal,
+        kStorageElementSlot
+    };
+
+    size_t total = 0;
+
+    for(size_t i = 0; i < (sizeof(types) / sizeof(*types)); i++) {
+        size_t num = iolibLoaderGetNumElements(loader, types[i]);
+
+        if(num == 0) {
+            continue;
+        }
+
+        iolib_storage_element_t *elements = new iolib_storage_element_t[num];
+        iolib_error_t err = iolibLoaderGetElements(loader, types[i], elements, num);
+
+        if(err != 0) {
+            delete[] elements;
+
+            if(outErr != NULL) {
+                *outErr = err;
+            }
+
+            return -1;
+        }
+
+        for(size_t j = 0; j < num && (total + j) < max; j++) {
+            iolib_element_record_t *record = &out[total + j];
+
+            record->element = elements[j];
+            record->address = iolibElementGetAddress(elements[j]);
+            record->type = iolibElementGetType(elements[j]);
+            record->flags = iolibElementGetFlags(elements[j]);
+
+            fallbackCopyString(iolibElementGetLabel(elements[j]), record->label,
+                               sizeof(record->label));
+            fallbackCopyString(iolibElementGetUuid(elements[j]), record->uuid,
+                               sizeof(record->uuid));
+        }
+
+        delete[] elements;
+        total += num;
+    }
+
+    return total;
+}
@@ -38,6 +38,9 @@ extern "C" {
 /**
  * Initializes the library function pointers by loading the library. This will
  * raise an exception if it cannot find the library/symbols cannot be resolved.
+ *
+ * The library is loaded from the path in the IOLIB_PATH environment variable,
+ * or ./iolib.so if it isn't set.
  */
 extern "C++" void iolibLoadLib();
 
@@ -109,13 +112,15 @@ typedef iolib_error_t (*_iolib_drive_get_status_t)(iolib_drive_t, iolib_drive_st
 IOLIB_EXTERN _iolib_drive_get_status_t iolibDriveGetStatus;
 
 /**
- * Returns the drive's current logical block position.
+ * Returns the tape file the drive is currently positioned in, i.e. the number
+ * of filemarks before the position. See iolibDriveGetBlockPosition for the
+ * position at block granularity.
  */
 typedef off_t (*_iolib_drive_get_position_t)(iolib_drive_t, iolib_error_t *);
 IOLIB_EXTERN _iolib_drive_get_position_t iolibDriveGetPosition;
 
 /**
- * Seeks the drive to the specified logical block position. The drive must NOT
+ * Seeks the drive to the start of the specified tape file. The drive must NOT
  * be pre-occupied performing any other operation.
  */
 typedef iolib_error_t (*_iolib_drive_set_position_t)(iolib_drive_t, off_t);
@@ -214,6 +219,121 @@ typedef bool (*_iolib_drive_is_at_end_t)(iolib_drive_t, iolib_error_t *);
 IOLIB_EXTERN _iolib_drive_is_at_end_t iolibDriveIsEOM;
 
 
+/////////////////////////// Vectored and Async I/O /////////////////////////////
+/**
+ * NOTE: The functions in this section are optional. If the library doesn't
+ * export them, iolibLoadLib() substitutes implementations that are built on the
+ * synchronous calls above; these can only have a single request outstanding,
+ * which is performed as it's submitted.
+ */
+
+/**
+ * Writes the given buffers, in order, to the tape at the drive's current
+ * logical position, as if they were a single buffer passed to iolibDriveWrite.
+ * The return value and errors are the same as for that call.
+ */
+typedef size_t (*_iolib_drive_write_vectored_t)(iolib_drive_t, const struct iovec *, int, iolib_error_t *);
+IOLIB_EXTERN _iolib_drive_write_vectored_t iolibDriveWriteVectored;
+
+/**
+ * Returns the number of asynchronous requests that may be outstanding on the
+ * drive at a time; this is at least one. Requests that have completed, but
+ * haven't been returned by iolibDriveCompleteRequest, are still outstanding.
+ */
+typedef size_t (*_iolib_drive_get_queue_depth_t)(iolib_drive_t);
+IOLIB_EXTERN _iolib_drive_get_queue_depth_t iolibDriveGetQueueDepth;
+
+/**
+ * Submits an asynchronous write of the request's buffers, and returns right
+ * away; if the queue is full, IOLIB_ERROR_QUEUE_FULL is returned instead, and
+ * the request isn't submitted.
+ *
+ * Requests are performed one after another, in the order they were submitted,
+ * and each continues where the one before it left off. If a request fails, or
+ * transfers less data than requested (i.e. at the end of the medium, or at a
+ * file mark when reading), all requests submitted after it are completed with
+ * IOLIB_ERROR_CANCELLED without being performed, so that data never ends up
+ * out of order on tape. This continues until every outstanding request has
+ * been completed; requests submitted after that are performed again.
+ */
+typedef iolib_error_t (*_iolib_drive_submit_t)(iolib_drive_t, iolib_io_request_t *);
+IOLIB_EXTERN _iolib_drive_submit_t iolibDriveSubmitWrite;
+
+/**
+ * Submits an asynchronous read into the request's buffers. This works just like
+ * iolibDriveSubmitWrite; a read that runs into a file mark is cut short, as
+ * with iolibDriveRead.
+ */
+IOLIB_EXTERN _iolib_drive_submit_t iolibDriveSubmitRead;
+
+/**
+ * Waits for the oldest outstanding request on the drive to complete, and
+ * returns it, with its result filled in. If no requests are outstanding, NULL
+ * is returned, and the error is set.
+ */
+typedef iolib_io_request_t *(*_iolib_drive_complete_t)(iolib_drive_t, iolib_error_t *);
+IOLIB_EXTERN _iolib_drive_complete_t iolibDriveCompleteRequest;
+
+
+////////////////////////////// Block Addressing ////////////////////////////////
+/**
+ * NOTE: The functions in this section are optional. If the library doesn't
+ * export them, the block size is reported as zero, and the other calls fail
+ * with ENOTSUP.
+ *
+ * Logical blocks are numbered from the beginning of the tape, and each filemark
+ * takes up one block number, as with SCSI logical object identifiers.
+ */
+
+/**
+ * Returns the size of the blocks the drive writes data in. A write is split
+ * into blocks of this size, and only its last block may be shorter; so as long
+ * as every write into a tape file (but the last) is a multiple of the block
+ * size, byte `n` of the file is in block `n / size` counted from its start.
+ *
+ * Returns zero if the drive can't locate to blocks.
+ */
+typedef size_t (*_iolib_drive_get_block_size_t)(iolib_drive_t);
+IOLIB_EXTERN _iolib_drive_get_block_size_t iolibDriveGetBlockSize;
+
+/**
+ * Returns the logical block the drive is positioned at; if it's in the middle
+ * of a block, that's the next block. If an error occurs, -1 is returned, and
+ * the error is written to the optional error pointer.
+ */
+typedef off_t (*_iolib_drive_get_block_position_t)(iolib_drive_t, iolib_error_t *);
+IOLIB_EXTERN _iolib_drive_get_block_position_t iolibDriveGetBlockPosition;
+
+/**
+ * Positions the drive at the start of the given logical block, without reading
+ * the data before it. If the block is a filemark, the next read returns no
+ * data, and continues in the next tape file after that.
+ */
+typedef iolib_error_t (*_iolib_drive_locate_block_t)(iolib_drive_t, off_t);
+IOLIB_EXTERN _iolib_drive_locate_block_t iolibDriveLocateBlock;
+
+
+////////////////////////////// Buffered Filemarks //////////////////////////////
+/**
+ * NOTE: The function in this section is optional. If the library doesn't export
+ * it, filemarks are written one at a time with iolibDriveWriteFileMark, which
+ * always waits for them to reach the medium.
+ */
+
+/**
+ * Writes the given number of filemarks at the current position, like
+ * iolibDriveWriteFileMark. If `immediate` is false, the filemarks are buffered:
+ * the call returns without waiting for the drive to flush its buffer to the
+ * medium, so a drive that's streaming doesn't have to stop and reposition.
+ *
+ * Errors writing buffered data or filemarks may then only be reported by a
+ * later write, or by the next immediate filemark; writing an immediate filemark
+ * ensures everything before it is on the medium.
+ */
+typedef iolib_error_t (*_iolib_drive_write_filemarks_t)(iolib_drive_t, size_t, bool);
+IOLIB_EXTERN _iolib_drive_write_filemarks_t iolibDriveWriteFileMarks;
+
+
 /////////////////////////////// Loader Handling ////////////////////////////////
 /**
  * Returns a string that describes this loaders's capabilities. This is just
@@ -242,6 +362,22 @@ IOLIB_EXTERN _iolib_loader_get_devfile_t iolibLoaderGetDevFile;
 typedef size_t (*_iolib_loader_get_num_elements_t)(iolib_loader_t, iolib_storage_element_type_t);
 IOLIB_EXTERN _iolib_loader_get_num_elements_t iolibLoaderGetNumElements;
 
+/**
+ * Describes all storage elements of the loader in a single call: up to `max`
+ * records are written to the given array, grouped by type (transports, drives,
+ * portals, then slots) and ordered by address within each type. This reports
+ * the loader's current status information; it doesn't perform an inventory.
+ *
+ * Returns the total number of elements the loader has, which may be more than
+ * were written; if an error occurs, -1 is returned, and the error is written
+ * to the optional error pointer.
+ *
+ * NOTE: This function is optional. If the library doesn't export it, it is
+ * emulated through the individual element calls below.
+ */
+typedef int (*_iolib_loader_get_inventory_t)(iolib_loader_t, iolib_element_record_t *, size_t, iolib_error_t *);
+IOLIB_EXTERN _iolib_loader_get_inventory_t iolibLoaderGetInventory;
+
 /**
  * Force the specified loader to perform an inventory of all tapes. This will
  * update the loader's internal status information. If the loader has the
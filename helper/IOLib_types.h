@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #define IOLIB_EXTERN extern
 
@@ -41,6 +42,11 @@ typedef int iolib_error_t;
 
 /// Indicates that the end of the media has been reached.
 #define IOLIB_ERROR_EOM 	-90000
+/// An asynchronous request was not performed, because a request submitted
+/// before it failed, or was cut short.
+#define IOLIB_ERROR_CANCELLED	-90001
+/// The drive already has as many asynchronous requests outstanding as it can.
+#define IOLIB_ERROR_QUEUE_FULL	-90002
 
 /**
  * IOLib strings; these are really just char * pointers, but have a special type
@@ -118,6 +124,25 @@ typedef struct {
     size_t bytesReadError;
 } iolib_drive_status_t;
 
+/**
+ * An asynchronous read or write request. The caller sets up the buffers to
+ * transfer (in order) and may use the context however it likes; neither the
+ * request nor the buffers may be touched until the request has been returned
+ * by iolibDriveCompleteRequest, which fills in the result.
+ */
+typedef struct {
+    // buffers to write from, or read into
+    const struct iovec *iov;
+    int iovcnt;
+
+    // for use by the caller
+    void *context;
+
+    // bytes actually transferred, and the error (if any); set on completion
+    size_t transferred;
+    iolib_error_t error;
+} iolib_io_request_t;
+
 /**
  * Opaque pointer to a loader object. This object should only be manipulated
  * through the methods in the IOLib.
@@ -170,6 +195,28 @@ typedef enum {
 	kStorageElementSupportsImport = (1 << 9)
 } iolib_storage_element_flags_t;
 
+/// Maximum length of an element's volume tag, as reported in its record
+#define IOLIB_ELEMENT_LABEL_MAX		32
+/// Length of a stringified UUID
+#define IOLIB_UUID_STRING_LEN		36
+
+/**
+ * Snapshot of a single storage element, as reported by a loader's inventory.
+ * The strings are NUL terminated; the label is empty if the element is empty,
+ * or its medium has no label.
+ */
+typedef struct {
+    // the element itself, for use with the other loader calls
+    iolib_storage_element_t element;
+
+    off_t address;
+    iolib_storage_element_type_t type;
+    iolib_storage_element_flags_t flags;
+
+    char label[IOLIB_ELEMENT_LABEL_MAX + 1];
+    char uuid[IOLIB_UUID_STRING_LEN + 1];
+} iolib_element_record_t;
+
 #ifdef __cplusplus
 inline iolib_storage_element_flags_t operator|(iolib_storage_element_flags_t a, iolib_storage_element_flags_t b) {
     return static_cast<iolib_storage_element_flags_t>(static_cast<int>(a) | static_cast<int>(b));
@@ -0,0 +1,138 @@
+#include "MerkleTree.h"
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <thread>
+
+#include <cryptopp/sha.h>
+
+// Prefixes used to separate leaves from interior nodes
+static const uint8_t kLeafPrefix = 0x00;
+static const uint8_t kNodePrefix = 0x01;
+
+/**
+ * Returns the number of segments of the given size needed to cover `len`
+ * bytes of data.
+ */
+size_t MerkleTree::numSegmentsForLength(size_t len, size_t segmentSize) {
+	return (len + segmentSize - 1) / segmentSize;
+}
+
+/**
+ * Hashes `count` segments, starting with the segment at index `first`, out of
+ * the `len` bytes of data at `data`. The leaf hashes are written into the
+ * appropriate positions in the `leavesOut` array, which holds ALL leaves.
+ */
+void MerkleTree::hashSegments(const void *data, size_t len, size_t segmentSize,
+							  size_t first, size_t count, uint8_t *leavesOut) {
+	CryptoPP::SHA256 hash;
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	for(size_t i = first; i < (first + count); i++) {
+		size_t offset = i * segmentSize;
+		size_t segLen = std::min(segmentSize, len - offset);
+
+		hash.Update(&kLeafPrefix, 1);
+		hash.Update(bytes + offset, segLen);
+		hash.Final(leavesOut + (i * MERKLE_HASH_SIZE));
+	}
+}
+
+/**
+ * Hashes all segments in the data, spreading the work over the given number of
+ * threads.
+ */
+void MerkleTree::hashSegmentsParallel(const void *data, size_t len,
+									  size_t segmentSize, uint8_t *leavesOut,
+									  unsigned int numThreads) {
+	size_t numSegments = numSegmentsForLength(len, segmentSize);
+
+	if(numThreads < 2 || numSegments < 2) {
+		hashSegments(data, len, segmentSize, 0, numSegments, leavesOut);
+		return;
+	}
+
+	// Give each thread a contiguous range of segments
+	std::vector<std::thread> threads;
+	size_t perThread = (numSegments + numThreads - 1) / numThreads;
+
+	for(size_t first = 0; first < numSegments; first += perThread) {
+		size_t count = std::min(perThread, numSegments - first);
+
+		threads.push_back(std::thread(&MerkleTree::hashSegments, data, len,
+									  segmentSize, first, count, leavesOut));
+	}
+
+	for(auto it = threads.begin(); it != threads.end(); it++) {
+		it->join();
+	}
+}
+
+/**
+ * Calculates the root hash over the given leaves. If there are no leaves, the
+ * root is all zeroes.
+ */
+void MerkleTree::computeRoot(const uint8_t *leaves, size_t numLeaves,
+							 uint8_t *rootOut) {
+	if(numLeaves == 0) {
+		memset(rootOut, 0, MERKLE_HASH_SIZE);
+		return;
+	}
+
+	CryptoPP::SHA256 hash;
+
+	std::vector<uint8_t> level(leaves, leaves + (numLeaves * MERKLE_HASH_SIZE));
+	size_t levelSize = numLeaves;
+
+	// Reduce each level in place until only the root is left
+	while(levelSize > 1) {
+		size_t nextSize = 0;
+
+		for(size_t i = 0; i < levelSize; i += 2) {
+			uint8_t *out = &level[nextSize * MERKLE_HASH_SIZE];
+
+			if((i + 1) < levelSize) {
+				hash.Update(&kNodePrefix, 1);
+				hash.Update(&level[i * MERKLE_HASH_SIZE], MERKLE_HASH_SIZE * 2);
+				hash.Final(out);
+			} else {
+				// odd node out is promoted unchanged
+				memmove(out, &level[i * MERKLE_HASH_SIZE], MERKLE_HASH_SIZE);
+			}
+
+			nextSize++;
+		}
+
+		levelSize = nextSize;
+	}
+
+	memcpy(rootOut, &level[0], MERKLE_HASH_SIZE);
+}
+
+/**
+ * Re-hashes `count` segments starting at index `first`, and compares them
+ * against the stored leaves. Returns true if all of them match.
+ */
+bool MerkleTree::verifySegments(const void *data, size_t len,
+								size_t segmentSize, const uint8_t *leaves,
+								size_t first, size_t count) {
+	CryptoPP::SHA256 hash;
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint8_t digest[MERKLE_HASH_SIZE];
+
+	for(size_t i = first; i < (first + count); i++) {
+		size_t offset = i * segmentSize;
+		size_t segLen = std::min(segmentSize, len - offset);
+
+		hash.Update(&kLeafPrefix, 1);
+		hash.Update(bytes + offset, segLen);
+		hash.Final(digest);
+
+		if(memcmp(digest, leaves + (i * MERKLE_HASH_SIZE), MERKLE_HASH_SIZE) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
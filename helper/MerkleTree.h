@@ -0,0 +1,37 @@
+/**
+ * Helpers to build and verify the Merkle tree that may be stored in a chunk.
+ * This is shared between the daemon (which builds the tree) and any tools that
+ * need to verify a chunk.
+ *
+ * Leaves are the SHA-256 over a single segment of data, prefixed with a zero
+ * byte; interior nodes are the SHA-256 over the concatenation of both children,
+ * prefixed with a one byte. If a level has an odd number of nodes, the last one
+ * is promoted to the next level unchanged.
+ */
+#ifndef MERKLETREE_H
+#define MERKLETREE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Size of a single hash in the tree, in bytes.
+ */
+#define MERKLE_HASH_SIZE		32
+
+class MerkleTree {
+	public:
+		static size_t numSegmentsForLength(size_t, size_t);
+
+		static void hashSegments(const void *, size_t, size_t, size_t, size_t,
+								 uint8_t *);
+		static void hashSegmentsParallel(const void *, size_t, size_t,
+										 uint8_t *, unsigned int);
+
+		static void computeRoot(const uint8_t *, size_t, uint8_t *);
+
+		static bool verifySegments(const void *, size_t, size_t, const uint8_t *,
+								   size_t, size_t);
+};
+
+#endif
@@ -13,6 +13,12 @@
 #define CHUNK_ENCRYPTION_AES128	0x4145532D31323820LL
 #define CHUNK_ENCRYPTION_AES256	0x4145532D32353620LL
 
+#define CHUNK_VERSION_1			0x00010000
+#define CHUNK_VERSION_2			0x00020000
+
+#define CHUNK_HASH_NONE			0x00000000
+#define CHUNK_HASH_SHA256		0x00000001
+
 /**
  * File types to back up
  */
@@ -21,6 +27,15 @@
 	 kTypeDirectory		= 0x1000,
  } chunk_file_type_t;
 
+/**
+ * Flags for version 2 file entries.
+ */
+typedef enum {
+	/// The entry only exists so that paths of other entries can be built; the
+	/// file itself is backed up in a different chunk.
+	kEntryFlagReference	= 0x0001,
+} chunk_entry_flags_t;
+
 /**
  * File entry; specifies information about a single file in a chunk.
  */
@@ -58,10 +73,38 @@ typedef struct __attribute__((packed)) {
 } chunk_file_entry_t;
 
 /**
- * Chunk header definition
+ * Describes the (optional) Merkle tree over the chunk's data area. The data
+ * area is split into fixed size segments, each of which is hashed to form a
+ * leaf; the leaves are stored as a flat array somewhere in the chunk. This
+ * allows verification to be split across several threads, and a part of a
+ * blob to be validated without reading the entire data area.
+ *
+ * If the hash type is CHUNK_HASH_NONE, there is no tree.
+ */
+typedef struct __attribute__((packed)) {
+	// Hash used for the leaves and interior nodes
+	uint32_t hashType;
+	// Size of a single segment, in bytes; the last segment may be shorter.
+	uint32_t segmentSize;
+	// Number of segments (and thus leaves)
+	uint64_t numSegments;
+
+	// Offset and length of the region covered by the tree
+	uint64_t dataStartOff;
+	uint64_t dataLenBytes;
+
+	// Offset within the chunk to the array of leaf hashes
+	uint64_t leavesStartOff;
+
+	// Root of the tree
+	uint8_t rootHash[32];
+} chunk_merkle_info_t;
+
+/**
+ * Version 1 chunk header definition
  */
 typedef struct  __attribute__((packed)) {
-	// Chunk header version; currently 0x00010000.
+	// Chunk header version; 0x00010000.
 	uint32_t version;
 	// Identifier of the backup job; can be cross-referenced with database.
     uint8_t jobUuid[16];
@@ -79,8 +122,12 @@ typedef struct  __attribute__((packed)) {
 		uint8_t iv[32];
 	} encryption;
 
+	// Merkle tree over the data area; this used to be part of the reserved area,
+	// so it is zeroed (i.e. no tree) in older chunks.
+	chunk_merkle_info_t merkle;
+
 	// Reserved for future expansion
-	uint8_t reserved[0x4000];
+	uint8_t reserved[0x4000 - sizeof(chunk_merkle_info_t)];
 
 	// Number of files contained in this chunk.
 	uint32_t numFileEntries;
@@ -88,5 +135,124 @@ typedef struct  __attribute__((packed)) {
 	chunk_file_entry_t entry[];
 } chunk_header_t;
 
+/**
+ * Flags for the version 2 chunk header.
+ */
+typedef enum {
+	/// File entries are identified by a random 16 byte UUID, rather than a
+	/// compact ID that is unique within the backup job.
+	kChunkFlagFileUuids	= 0x0001,
+} chunk_header_flags_t;
+
+/**
+ * Version 2 chunk header definition.
+ *
+ * This is followed by an entry offset table, the name index, and then the file
+ * entries themselves. Entries are variable-length, with all integer fields
+ * encoded as LEB128 varints, so the offset table is used to locate an entry by
+ * its index without walking all entries before it.
+ *
+ * The header area (headerLenBytes) is covered by a CRC32C, calculated with the
+ * headerChecksum field set to zero.
+ */
+typedef struct __attribute__((packed)) {
+	// Chunk header version; 0x00020000. Must be first, as in version 1.
+	uint32_t version;
+	// CRC32C over the entire header area
+	uint32_t headerChecksum;
+
+	// Identifier of the backup job; can be cross-referenced with database.
+	uint8_t jobUuid[16];
+	// Index of this chunk in the backup; first chunk is zero.
+	uint64_t chunkIndex;
+	// Size of this chunk, in bytes.
+	uint64_t chunkLenBytes;
+	// Size of the header area (this struct, tables and entries) in bytes.
+	uint64_t headerLenBytes;
+
+	// Encryption data
+	struct {
+		// Specifies the encryption methodl 0 if cleartext.
+		uint64_t method;
+
+		// IV used to encrypt this block
+		uint8_t iv[32];
+	} encryption;
+
+	// Merkle tree over the data area
+	chunk_merkle_info_t merkle;
+
+	// Number of files contained in this chunk.
+	uint32_t numFileEntries;
+	// Flags (chunk_header_flags_t) that affect how the chunk is interpreted
+	uint32_t flags;
+
+	// Offset to the entry offset table: one uint32_t per entry, which is the
+	// offset of that entry relative to entriesOff.
+	uint64_t entryTableOff;
+	// Offset to the name index: one uint32_t per entry, which is the index of
+	// an entry; these are sorted by the entries' parent index, then by their
+	// names (compared bytewise.)
+	uint64_t nameIndexOff;
+	// Offset to the first encoded file entry, and the length of all entries.
+	uint64_t entriesOff;
+	uint64_t entriesLenBytes;
+} chunk_header_v2_t;
+
+/**
+ * Tape index, written as its own tape file at the end of data on every tape.
+ * It lists the position of each chunk that was written to the tape, so that a
+ * single chunk can be restored by seeking straight to it, even without the
+ * local catalog.
+ */
+#define TAPE_INDEX_MAGIC		0x54415045494E4458LL
+#define TAPE_INDEX_VERSION		0x00010000
+
+/**
+ * Sentinel for a position that isn't known.
+ */
+#define TAPE_POSITION_UNKNOWN	0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * A single chunk in the tape index.
+ */
+typedef struct __attribute__((packed)) {
+	// Backup job the chunk belongs to, and its index in that job
+	uint8_t jobUuid[16];
+	uint64_t chunkIndex;
+	// Size of the chunk, in bytes
+	uint64_t chunkLenBytes;
+
+	// Tape file the chunk was written to, i.e. the number of filemarks before
+	// it on the tape, and the chunk's offset in bytes within that file; this
+	// is nonzero if several chunks were written to the same tape file
+	uint64_t fileNumber;
+	uint64_t fileOffset;
+	// Logical block the chunk starts at, and the block its data (the first
+	// blob, right after the header) starts at; TAPE_POSITION_UNKNOWN if the
+	// drive doesn't report blocks
+	uint64_t block;
+	uint64_t dataBlock;
+} tape_index_entry_t;
+
+/**
+ * Header of the tape index; it's immediately followed by the entries.
+ */
+typedef struct __attribute__((packed)) {
+	// Identifies the index; TAPE_INDEX_MAGIC.
+	uint64_t magic;
+	// Index version; TAPE_INDEX_VERSION.
+	uint32_t version;
+	// CRC32C over the header and all entries, with this field set to zero
+	uint32_t checksum;
+
+	// Label of the tape, if known; NUL padded
+	char label[32];
+
+	// Number of entries that follow
+	uint64_t numEntries;
+	tape_index_entry_t entries[];
+} tape_index_t;
+
 
 #endif
@@ -26,10 +26,17 @@ class Drive {
 		off_t getLogicalBlkPos();
 		iolib_error_t seekToLogicalBlkPos(off_t);
 
+		size_t getBlockSize() {
+			return this->maxBlockSz;
+		}
+		off_t getBlockPosition(iolib_error_t *);
+		iolib_error_t locateBlock(off_t);
+
 		iolib_error_t rewind();
 		iolib_error_t eject();
 
 		iolib_error_t writeFileMark();
+		iolib_error_t writeFileMarks(size_t, bool);
 		iolib_error_t skipFileMark();
 
 		size_t writeTape(void *, size_t, iolib_error_t *);
@@ -51,6 +58,8 @@ class Drive {
 		void _createCtrlDevice();
 		void _getMaxIOSize();
 
+		iolib_error_t _spaceFiles(short, off_t);
+
 		void _openSa();
 		void _openSaCtl();
 		void _closeSa();
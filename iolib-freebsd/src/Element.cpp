@@ -5,6 +5,8 @@
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <cstring>
+
 #include <sys/chio.h>
 
 namespace iolibbsd {
@@ -94,4 +96,19 @@ std::string Element::getUuid() {
 	return boost::uuids::to_string(this->uuid);
 }
 
+/**
+ * Describes the element in an inventory record.
+ */
+void Element::_fillRecord(iolib_element_record_t *record) {
+    memset(record, 0, sizeof(*record));
+
+    record->element = this;
+    record->address = this->address;
+    record->type = this->type;
+    record->flags = this->flags;
+
+    strncpy(record->label, this->volTag.c_str(), IOLIB_ELEMENT_LABEL_MAX);
+    strncpy(record->uuid, getUuid().c_str(), IOLIB_UUID_STRING_LEN);
+}
+
 } // namespace iolibbsd
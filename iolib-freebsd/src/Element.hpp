@@ -64,6 +64,8 @@ class Element {
 
         void _parseChElementFlags(u_char);
         std::string _stringFromChVolTag(changer_voltag_t);
+
+        void _fillRecord(iolib_element_record_t *);
 };
 
 } // namespace iolibbsd
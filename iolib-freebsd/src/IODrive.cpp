@@ -137,35 +137,99 @@ off_t Drive::getLogicalBlkPos() {
 }
 
 /**
- * Seeks the drive to the given logical block position.
+ * Seeks the drive to the start of the given tape file.
+ *
+ * Spacing forward over a filemark leaves the drive on its far side, which is
+ * the start of the next file; spacing backward leaves it on the near (BOT)
+ * side, which is the end of the previous file. So, to go back to a file, the
+ * drive spaces back past the filemark before it, then forward over that one
+ * again. The same is done to go to the start of the current file, since the
+ * drive may be in the middle of it.
  */
 iolib_error_t Drive::seekToLogicalBlkPos(off_t inPos) {
     int err = 0;
-    struct mtop mt_com;
 
     // Ensure device is open
     _openSa();
 
-    // Calculate the difference between the current position and this position.
-    int difference = getLogicalBlkPos() - inPos;
+    off_t current = getLogicalBlkPos();
 
-    mt_com.mt_count = std::abs(difference);
+    if(inPos == 0 || current < 0) {
+        // The first file has no filemark before it; also, go from the start
+        // if the drive doesn't know where it is
+        err = _spaceFiles(MTREW, 1);
 
-    // If it's positive, execute the "forward space file" command.
-    if(difference > 0) {
-        mt_com.mt_op = MTFSF;
+        if(err == 0 && inPos > 0) {
+            err = _spaceFiles(MTFSF, inPos);
+        }
+    } else if(inPos > current) {
+        err = _spaceFiles(MTFSF, inPos - current);
+    } else {
+        err = _spaceFiles(MTBSF, current - inPos + 1);
 
-        err = ioctl(this->fdSa, MTIOCTOP, &mt_com);
-        PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCTOP MTFSF on " << this->devSa;
+        if(err == 0) {
+            err = _spaceFiles(MTFSF, 1);
+        }
     }
-    // If negative, run "backward space file" command.
-    else if(difference < 0) {
-        mt_com.mt_op = MTBSF;
 
-        err = ioctl(this->fdSa, MTIOCTOP, &mt_com);
-        PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCTOP MTBSF on " << this->devSa;
+    // Close device once we're done.
+    _closeSa();
+    return err;
+}
+
+/**
+ * Executes the given positioning operation (MTFSF, MTBSF or MTREW) with the
+ * given count. The device must be open.
+ */
+iolib_error_t Drive::_spaceFiles(short op, off_t count) {
+    struct mtop mt_com;
+
+    mt_com.mt_op = op;
+    mt_com.mt_count = count;
+
+    int err = ioctl(this->fdSa, MTIOCTOP, &mt_com);
+    PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCTOP " << op << " (count "
+                             << count << ") on " << this->devSa;
+
+    return err;
+}
+
+/**
+ * Reads the drive's logical block position (as reported by READ POSITION.)
+ * Data is always written in blocks of the maximum I/O size.
+ */
+off_t Drive::getBlockPosition(iolib_error_t *outErr) {
+    int err = 0;
+    u_int32_t block = 0;
+
+    // Ensure device is open
+    _openSa();
+
+    err = ioctl(this->fdSa, MTIOCRDSPOS, &block);
+    PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCRDSPOS on " << this->devSa;
+
+    if(err != 0 && outErr != NULL) {
+        *outErr = errno;
     }
-    // …And if the difference is zero, we do nothing.
+
+    // Close device once we're done.
+    _closeSa();
+
+    return (err == 0) ? (off_t) block : -1;
+}
+
+/**
+ * Locates the drive directly to the given logical block.
+ */
+iolib_error_t Drive::locateBlock(off_t inBlock) {
+    int err = 0;
+    u_int32_t block = inBlock;
+
+    // Ensure device is open
+    _openSa();
+
+    err = ioctl(this->fdSa, MTIOCSLOCATE, &block);
+    PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCSLOCATE on " << this->devSa;
 
     // Close device once we're done.
     _closeSa();
@@ -247,6 +311,15 @@ iolib_error_t Drive::eject() {
  * Writes a file mark at the current position on tape.
  */
 iolib_error_t Drive::writeFileMark() {
+    return this->writeFileMarks(1, true);
+}
+
+/**
+ * Writes the given number of file marks at the current position on tape. If
+ * they're not immediate, the drive doesn't flush its buffer to the medium
+ * before returning, if the driver supports that.
+ */
+iolib_error_t Drive::writeFileMarks(size_t count, bool immediate) {
     int err = 0;
 
     // Ensure device is open
@@ -255,11 +328,19 @@ iolib_error_t Drive::writeFileMark() {
     // Perform the ioctl
     struct mtop mt_com;
 
-    mt_com.mt_count = 1;
+    mt_com.mt_count = count;
     mt_com.mt_op = MTWEOF;
 
+#ifdef MTWEOFI
+    if(!immediate) {
+        mt_com.mt_op = MTWEOFI;
+    }
+#endif
+
     err = ioctl(this->fdSa, MTIOCTOP, &mt_com);
-    PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCTOP MTWEOF on " << this->devSa;
+    PLOG_IF(ERROR, err != 0) << "Couldn't execute MTIOCTOP "
+                             << ((mt_com.mt_op == MTWEOF) ? "MTWEOF" : "MTWEOFI")
+                             << " on " << this->devSa;
 
     // Close device once we're done.
     _closeSa();
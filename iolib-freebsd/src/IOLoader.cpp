@@ -106,6 +106,37 @@ void Loader::getElementsForType(iolib_storage_element_type_t type, size_t len, E
     }
 }
 
+/**
+ * Describes up to `max` elements, grouped by type, in the given array. This
+ * uses the cached inventory. Returns the total number of elements.
+ */
+size_t Loader::getInventory(iolib_element_record_t *out, size_t max) {
+    static const iolib_storage_element_type_t types[] = {
+        kStorageElementTransport,
+        kStorageElementDrive,
+        kStorageElementPortal,
+        kStorageElementSlot
+    };
+
+    size_t total = 0;
+
+    for(size_t i = 0; i < (sizeof(types) / sizeof(*types)); i++) {
+        for(auto it = this->elements.begin(); it < this->elements.end(); it++) {
+            if(it->getType() != types[i]) {
+                continue;
+            }
+
+            if(total < max) {
+                it->_fillRecord(&out[total]);
+            }
+
+            total++;
+        }
+    }
+
+    return total;
+}
+
 /**
  * Moves the element from `source` to `dest`. This assumes that dest is empty;
  * if it isn't, the results are undefined, and Bad Things may happen.
@@ -141,6 +172,43 @@ iolib_error_t Loader::moveElement(Element *src, Element *dest) {
     return err;
 }
 
+/**
+ * Exchanges the media in `first` and `second`; both elements must be full. The
+ * medium in `first` ends up in `second`, and vice versa.
+ */
+iolib_error_t Loader::exchangeElements(Element *first, Element *second) {
+    int err = 0;
+
+    // Check that these are our elements
+    CHECK(first != NULL) << "First element must be specified";
+    CHECK(second != NULL) << "Second element must be specified";
+
+    CHECK(first->parent == this) << "First element is not from this loader";
+    CHECK(second->parent == this) << "Second element is not from this loader";
+
+    // Ensure driver is open
+    _openCh();
+
+    // Move first to second, and second back to where first was
+    struct changer_exchange exchange;
+
+    exchange.ce_srctype = _convertToChType(first->getType());
+    exchange.ce_srcunit = first->getAddress();
+    exchange.ce_fdsttype = _convertToChType(second->getType());
+    exchange.ce_fdstunit = second->getAddress();
+    exchange.ce_sdsttype = exchange.ce_srctype;
+    exchange.ce_sdstunit = exchange.ce_srcunit;
+    exchange.ce_flags = 0;
+
+    // Run the ioctl
+    err = ioctl(this->fdCh, CHIOEXCHANGE, &exchange);
+    PLOG_IF(ERROR, err != 0) << "Couldn't execute CHIOEXCHANGE on " << this->devCh;
+
+    // Close driver
+    _closeCh();
+
+    return err;
+}
 
 /**
  * Sends the SCSI INITIALIZE ELEMENT STATUS command, to force the drive to re-
@@ -30,9 +30,11 @@ class Loader {
 
         size_t getNumElementsForType(iolib_storage_element_type_t);
         void getElementsForType(iolib_storage_element_type_t, size_t, Element **);
+        size_t getInventory(iolib_element_record_t *, size_t);
 
         iolib_error_t performInventory();
         iolib_error_t moveElement(Element *, Element *);
+        iolib_error_t exchangeElements(Element *, Element *);
 
     private:
 		boost::uuids::uuid uuid;
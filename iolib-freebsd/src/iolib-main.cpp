@@ -84,10 +84,18 @@ IOLIB_EXPORT int iolibEnumerateDevices(iolib_library_t *lib, size_t max, iolib_e
 }
 
 /**
- * Frees all library structures previously inserted into the specified array.
+ * Frees all library structures previously inserted into the specified array;
+ * that is, their id and name strings. The drives and loaders are owned by the
+ * library, and stay valid.
  */
 IOLIB_EXPORT void iolibEnumerateDevicesFree(iolib_library_t *lib, size_t num) {
-    // This doesn't do anything, since we didn't allocate any memory.
+    for(size_t i = 0; i < num; i++) {
+        free(lib[i].id);
+        free(lib[i].name);
+
+        lib[i].id = NULL;
+        lib[i].name = NULL;
+    }
 }
 
 //////////////////////////////// Drive Handling ////////////////////////////////
@@ -161,6 +169,34 @@ IOLIB_EXPORT iolib_error_t iolibDriveSeekToPosition(iolib_drive_t _drive, off_t
     return drive->seekToLogicalBlkPos(block);
 }
 
+/**
+ * Returns the size of the blocks that data is written in; this is the maximum
+ * I/O size of the drive.
+ */
+IOLIB_EXPORT size_t iolibDriveGetBlockSize(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getBlockSize();
+}
+
+/**
+ * Returns the drive's current logical block position.
+ */
+IOLIB_EXPORT off_t iolibDriveGetBlockPosition(iolib_drive_t _drive, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getBlockPosition(outErr);
+}
+
+/**
+ * Locates the drive to the given logical block.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveLocateBlock(iolib_drive_t _drive, off_t block) {
+    GET_CLASS(Drive, drive);
+
+    return drive->locateBlock(block);
+}
+
 /**
  * Determines the drive's current operation, if such information is currently
  * available from the drive.
@@ -259,6 +295,17 @@ IOLIB_EXPORT iolib_error_t iolibDriveWriteFileMark(iolib_drive_t _drive) {
     return drive->writeFileMark();
 }
 
+/**
+ * Writes the given number of file marks at the current position; unless they
+ * are immediate, this doesn't wait for the drive to flush its buffer.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveWriteFileMarks(iolib_drive_t _drive, size_t count,
+                                                    bool immediate) {
+    GET_CLASS(Drive, drive);
+
+    return drive->writeFileMarks(count, immediate);
+}
+
 /**
  * Performs a read operation on the tape, starting at the drive's current
  * logical position. Note that the operation may be completed as several smaller
@@ -381,10 +428,7 @@ IOLIB_EXPORT iolib_error_t iolibLoaderExchange(iolib_loader_t _loader,
     GET_CLASS(Element, src);
     GET_CLASS(Element, dest);
 
-    LOG(FATAL) << "iolibLoaderExchange not implemented";
-
-    // TODO: implement
-    return -1;
+    return loader->exchangeElements(src, dest);
 }
 
 /**
@@ -407,6 +451,18 @@ IOLIB_EXPORT iolib_error_t iolibLoaderGetElements(iolib_loader_t _loader,
     return 0;
 }
 
+/**
+ * Describes all of the loader's elements in a single call, from the cached
+ * inventory. Returns the total number of elements; at most `max` records are
+ * written.
+ */
+IOLIB_EXPORT int iolibLoaderGetInventory(iolib_loader_t _loader, iolib_element_record_t *out,
+                                         size_t max, iolib_error_t *outErr) {
+    GET_CLASS(Loader, loader);
+
+    return loader->getInventory(out, max);
+}
+
 /////////////////////////// Storage Element Handling ///////////////////////////
 /**
  * Returns the logical address of the storage element. This is specific to the
@@ -0,0 +1,120 @@
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Cartridge.hpp"
+
+namespace iolibvirtual {
+
+/**
+ * Creates a cartridge with the given label, whose data lives in the given
+ * directory. The directory is created if needed; any data in it is kept.
+ */
+Cartridge::Cartridge(std::string label, std::string dir, uint64_t capacity) {
+    this->label = label;
+    this->dir = dir;
+    this->capacity = capacity;
+
+    int err = mkdir(this->dir.c_str(), 0755);
+    PCHECK(err == 0 || errno == EEXIST) << "Couldn't create " << this->dir;
+
+    // A blank tape consists of a single, empty file
+    if(this->getNumFiles() == 0) {
+        FILE *f = fopen(this->pathForFile(0).c_str(), "w");
+        PCHECK(f != NULL) << "Couldn't create " << this->pathForFile(0);
+        fclose(f);
+    }
+}
+
+/**
+ * There's nothing to clean up; the data stays on disk.
+ */
+Cartridge::~Cartridge() {
+
+}
+
+/**
+ * Returns the number of tape files on the cartridge. All but the last one are
+ * followed by a filemark.
+ */
+size_t Cartridge::getNumFiles() {
+    size_t num = 0;
+    struct stat sb;
+
+    while(stat(this->pathForFile(num).c_str(), &sb) == 0) {
+        num++;
+    }
+
+    return num;
+}
+
+/**
+ * Returns the path of the file holding the given tape file's data.
+ */
+std::string Cartridge::pathForFile(size_t file) {
+    char name[16];
+    snprintf(name, sizeof(name), "%06zu", file);
+
+    return this->dir + "/" + name;
+}
+
+/**
+ * Returns the number of bytes in the given tape file.
+ */
+uint64_t Cartridge::getFileSize(size_t file) {
+    struct stat sb;
+
+    if(stat(this->pathForFile(file).c_str(), &sb) != 0) {
+        return 0;
+    }
+
+    return sb.st_size;
+}
+
+/**
+ * Returns the number of bytes in all tape files before the given one.
+ */
+uint64_t Cartridge::bytesBefore(size_t file) {
+    uint64_t bytes = 0;
+    struct stat sb;
+
+    for(size_t i = 0; i < file; i++) {
+        if(stat(this->pathForFile(i).c_str(), &sb) != 0) {
+            break;
+        }
+
+        bytes += sb.st_size;
+    }
+
+    return bytes;
+}
+
+/**
+ * Discards all data after the given offset into the given tape file, as
+ * happens when a tape is written to at that position.
+ */
+void Cartridge::truncateAt(size_t file, off_t offset) {
+    size_t numFiles = this->getNumFiles();
+
+    // Remove all later files, from the end so the numbering stays contiguous
+    for(size_t i = numFiles; i > (file + 1); i--) {
+        int err = unlink(this->pathForFile(i - 1).c_str());
+        PLOG_IF(ERROR, err != 0) << "Couldn't remove " << this->pathForFile(i - 1);
+    }
+
+    // Then cut off (or create) the file itself
+    int fd = open(this->pathForFile(file).c_str(), O_WRONLY | O_CREAT, 0644);
+    PCHECK(fd != -1) << "Couldn't open " << this->pathForFile(file);
+
+    int err = ftruncate(fd, offset);
+    PLOG_IF(ERROR, err != 0) << "Couldn't truncate " << this->pathForFile(file);
+
+    close(fd);
+}
+
+} // namespace iolibvirtual
@@ -0,0 +1,45 @@
+/**
+ * A virtual tape cartridge. Its data lives in a directory, with one file per
+ * tape file; writing a filemark ends the current file and starts the next one.
+ * Like on a real tape, writing anywhere but at the end of the data discards
+ * everything after that point.
+ */
+#ifndef CARTRIDGE_HPP
+#define CARTRIDGE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+namespace iolibvirtual {
+
+class Cartridge {
+	public:
+		Cartridge(std::string, std::string, uint64_t);
+		~Cartridge();
+
+		std::string getLabel() {
+			return this->label;
+		}
+		uint64_t getCapacity() {
+			return this->capacity;
+		}
+
+		size_t getNumFiles();
+		std::string pathForFile(size_t);
+
+		uint64_t getFileSize(size_t);
+		uint64_t bytesBefore(size_t);
+		void truncateAt(size_t, off_t);
+
+	private:
+		std::string label;
+		std::string dir;
+
+		uint64_t capacity;
+};
+
+} // namespace iolibvirtual
+
+#endif
@@ -0,0 +1,149 @@
+/**
+ * Virtual tape drive. A cartridge is inserted into it by the loader (or at
+ * startup); it then takes a while to load, after which it can be read and
+ * written. Data is streamed at the configured rate.
+ *
+ * Positions are tape file numbers, as with the FreeBSD IOLib. Blocks are of a
+ * fixed size: a tape file takes up as many as its data needs, plus one for the
+ * filemark after it.
+ *
+ * Asynchronous requests are performed in order by a per-drive thread, which is
+ * started when the first one is submitted.
+ */
+#ifndef DRIVE_HPP
+#define DRIVE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <IOLib_types.h>
+
+#include "Cartridge.hpp"
+
+namespace iolibvirtual {
+
+class VirtualIOLib;
+
+class Drive {
+	friend class Loader;
+	friend class VirtualIOLib;
+
+	public:
+		Drive(VirtualIOLib *, size_t);
+		~Drive();
+
+		std::string getUuid();
+		std::string getName();
+
+		iolib_string_t getDeviceFile();
+
+		iolib_error_t getDriveStatus(iolib_drive_status_t *);
+		iolib_drive_operation_t getDriveOp();
+
+		off_t getPosition(iolib_error_t *);
+		iolib_error_t seekToPosition(off_t);
+
+		size_t getBlockSize();
+		off_t getBlockPosition(iolib_error_t *);
+		iolib_error_t locateBlock(off_t);
+
+		iolib_error_t rewind();
+		iolib_error_t eject();
+		iolib_error_t lockMedium(bool);
+
+		iolib_error_t writeFileMark();
+		iolib_error_t writeFileMarks(size_t, bool);
+		iolib_error_t skipFileMark();
+
+		size_t writeTape(void *, size_t, iolib_error_t *);
+		size_t readTape(void *, size_t, iolib_error_t *);
+
+		size_t writeTapeVectored(const struct iovec *, int, iolib_error_t *);
+		size_t readTapeVectored(const struct iovec *, int, iolib_error_t *);
+
+		size_t getQueueDepth();
+		iolib_error_t submitRequest(iolib_io_request_t *, bool);
+		iolib_io_request_t *completeRequest(iolib_error_t *);
+
+		bool isEOM(iolib_error_t *);
+
+	private:
+		VirtualIOLib *lib;
+		size_t index;
+
+		boost::uuids::uuid uuid;
+		std::string devFile;
+
+		// protects all state below
+		std::mutex lock;
+
+		// cartridge in the drive, whether it's loaded (i.e. was not ejected),
+		// and when it's ready after being inserted
+		Cartridge *cartridge = NULL;
+		bool loaded = false;
+		std::chrono::steady_clock::time_point readyAt;
+
+		bool locked = false;
+
+		// current tape file, and offset into it
+		size_t fileNo = 0;
+		off_t offset = 0;
+		// data file of the current tape file, if open
+		int fd = -1;
+		// whether data after the position has been discarded for writing, and
+		// if so, how much data is on the tape
+		bool appending = false;
+		uint64_t bytesOnTape = 0;
+
+		// what the drive is doing; this can be read without the lock
+		std::atomic<iolib_drive_operation_t> currentOp;
+
+		// counters reported in the status
+		size_t bytesWritten = 0, bytesWrittenError = 0;
+		size_t bytesRead = 0, bytesReadError = 0;
+
+		// an asynchronous request, and whether it's a write
+		typedef struct {
+			iolib_io_request_t *req;
+			bool write;
+		} async_request_t;
+
+		// protects the asynchronous request state below; this is separate from
+		// the drive's lock, so requests can be submitted while one is performed
+		std::mutex requestLock;
+		std::condition_variable requestsChanged;
+
+		// outstanding requests, oldest first; the first numPerformed of them
+		// are complete
+		std::deque<async_request_t> requests;
+		size_t numPerformed = 0;
+		// set when a request fails, until all outstanding ones are completed
+		bool requestFailed = false;
+
+		std::thread requestThread;
+		bool shutdown = false;
+
+
+		void _insert(Cartridge *);
+		Cartridge *_remove();
+		bool _canRemove();
+
+		iolib_error_t _waitReady();
+		void _setPosition(size_t);
+		uint64_t _blocksForBytes(uint64_t);
+		iolib_error_t _prepareWrite();
+		void _stream(size_t);
+
+		void _requestEntry();
+};
+
+} // namespace iolibvirtual
+
+#endif
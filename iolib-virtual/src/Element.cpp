@@ -0,0 +1,104 @@
+#include "Element.hpp"
+#include "Loader.hpp"
+
+#include <glog/logging.h>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <cstring>
+
+namespace iolibvirtual {
+
+/**
+ * Creates a new, empty element in the given loader. Drive elements also get
+ * the drive they belong to.
+ */
+Element::Element(Loader *loader, iolib_storage_element_type_t type,
+                 off_t address, Drive *drive) {
+    CHECK(loader != NULL) << "Element must be created with a parent";
+
+    this->parent = loader;
+    this->type = type;
+    this->address = address;
+    this->drive = drive;
+
+	// Generate UUID
+	boost::uuids::basic_random_generator<boost::mt19937> gen;
+	this->uuid = gen();
+}
+
+/**
+ * There's not really anything to do here.
+ */
+Element::~Element() {
+
+}
+
+/**
+ * Returns the flags describing the element: all elements can be reached by the
+ * picker, and portals can import and export media.
+ */
+iolib_storage_element_flags_t Element::getFlags() {
+    std::lock_guard<std::mutex> lk(this->parent->stateLock);
+
+    return _getFlags();
+}
+
+/**
+ * Returns the label of the cartridge in the element; it's empty if there is no
+ * cartridge.
+ */
+std::string Element::getVolumeTag() {
+    std::lock_guard<std::mutex> lk(this->parent->stateLock);
+
+    if(this->cartridge == NULL) {
+        return "";
+    }
+
+    return this->cartridge->getLabel();
+}
+
+/**
+ * Return a stringified version of the UUID.
+ */
+std::string Element::getUuid() {
+	return boost::uuids::to_string(this->uuid);
+}
+
+/**
+ * Works out the element's flags. The loader's state lock must be held.
+ */
+iolib_storage_element_flags_t Element::_getFlags() {
+    iolib_storage_element_flags_t flags = kStorageElementAccessible;
+
+    if(this->cartridge != NULL) {
+        flags = flags | kStorageElementFull;
+    }
+
+    if(this->type == kStorageElementPortal) {
+        flags = flags | kStorageElementSupportsImport | kStorageElementSupportsExport;
+    }
+
+    return flags;
+}
+
+/**
+ * Describes the element in an inventory record. The loader's state lock must be
+ * held.
+ */
+void Element::_fillRecord(iolib_element_record_t *record) {
+    memset(record, 0, sizeof(*record));
+
+    record->element = this;
+    record->address = this->address;
+    record->type = this->type;
+    record->flags = _getFlags();
+
+    if(this->cartridge != NULL) {
+        strncpy(record->label, this->cartridge->getLabel().c_str(), IOLIB_ELEMENT_LABEL_MAX);
+    }
+
+    strncpy(record->uuid, getUuid().c_str(), IOLIB_UUID_STRING_LEN);
+}
+
+} // namespace iolibvirtual
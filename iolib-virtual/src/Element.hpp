@@ -0,0 +1,64 @@
+/**
+ * A storage element of the virtual loader: a picker, slot, portal or drive.
+ * Each can hold at most one cartridge; drive elements pass theirs on to the
+ * drive they belong to.
+ */
+#ifndef ELEMENT_HPP
+#define ELEMENT_HPP
+
+#include <string>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <IOLib_types.h>
+
+#include "Cartridge.hpp"
+
+namespace iolibvirtual {
+
+class Loader;
+class Drive;
+
+class Element {
+	friend class Loader;
+	friend class VirtualIOLib;
+
+	public:
+		Element(Loader *, iolib_storage_element_type_t, off_t, Drive *);
+		~Element();
+
+		iolib_storage_element_type_t getType() {
+			return this->type;
+		}
+		off_t getAddress() {
+			return this->address;
+		}
+
+		iolib_storage_element_flags_t getFlags();
+		std::string getVolumeTag();
+
+		std::string getUuid();
+
+	private:
+		Loader *parent;
+
+		boost::uuids::uuid uuid;
+
+		// Type of the element, and its address among elements of that type
+		iolib_storage_element_type_t type;
+		off_t address;
+
+		// Drive that this element belongs to, if it's a drive element
+		Drive *drive;
+
+		// Cartridge in the element, if any; protected by the loader's lock
+		Cartridge *cartridge = NULL;
+
+
+		iolib_storage_element_flags_t _getFlags();
+		void _fillRecord(iolib_element_record_t *);
+};
+
+} // namespace iolibvirtual
+
+#endif
@@ -0,0 +1,781 @@
+#include <glog/logging.h>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Drive.hpp"
+#include "VirtualIOLib.hpp"
+
+/**
+ * Stores an error code in the optional error pointer.
+ */
+#define SET_ERROR(ptr, value) \
+    if((ptr) != NULL) *(ptr) = (value);
+
+namespace iolibvirtual {
+
+/**
+ * Creates the drive with the given index in the library.
+ */
+Drive::Drive(VirtualIOLib *lib, size_t index) : currentOp(kDriveStatusIdle) {
+    this->lib = lib;
+    this->index = index;
+
+    this->devFile = lib->getDirectory() + "/drive" + std::to_string(index);
+
+	// Generate UUID
+	boost::uuids::basic_random_generator<boost::mt19937> gen;
+	this->uuid = gen();
+}
+
+/**
+ * Stops the request thread, and closes the data file of the current tape file,
+ * if it's open.
+ */
+Drive::~Drive() {
+    {
+        std::lock_guard<std::mutex> lk(this->requestLock);
+        this->shutdown = true;
+    }
+
+    this->requestsChanged.notify_all();
+
+    if(this->requestThread.joinable()) {
+        this->requestThread.join();
+    }
+
+    if(this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+/**
+ * Return a stringified version of the UUID.
+ */
+std::string Drive::getUuid() {
+	return boost::uuids::to_string(this->uuid);
+}
+
+/**
+ * Returns a descriptive name for the drive.
+ */
+std::string Drive::getName() {
+    return "Virtual Drive " + std::to_string(this->index);
+}
+
+/**
+ * Returns a copy of the drive's (virtual) device path.
+ */
+iolib_string_t Drive::getDeviceFile() {
+    return strdup(this->devFile.c_str());
+}
+
+/**
+ * Gets status information from the drive.
+ */
+iolib_error_t Drive::getDriveStatus(iolib_drive_status_t *status) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    memset(status, 0, sizeof(*status));
+
+    status->deviceStatus = this->currentOp;
+    status->deviceError = 0;
+
+    status->bytesWritten = this->bytesWritten;
+    status->bytesWrittenError = this->bytesWrittenError;
+    status->bytesRead = this->bytesRead;
+    status->bytesReadError = this->bytesReadError;
+
+    return 0;
+}
+
+/**
+ * Returns what the drive is currently doing.
+ */
+iolib_drive_operation_t Drive::getDriveOp() {
+    return this->currentOp;
+}
+
+/**
+ * Returns the tape file the drive is positioned in.
+ */
+off_t Drive::getPosition(iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    if(this->cartridge == NULL || !this->loaded) {
+        SET_ERROR(outErr, ENOMEDIUM);
+        return -1;
+    }
+
+    return this->fileNo;
+}
+
+/**
+ * Positions the drive at the start of the given tape file.
+ */
+iolib_error_t Drive::seekToPosition(off_t file) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    if(file < 0 || (size_t) file >= this->cartridge->getNumFiles()) {
+        LOG(ERROR) << "Can't locate file " << file << " on " << this->devFile;
+        return EIO;
+    }
+
+    this->currentOp = (file < (off_t) this->fileNo) ? kDriveStatusSeekingBackwards
+                                                    : kDriveStatusSeekingForwards;
+    this->lib->sleep(this->lib->getConfig().locateTime);
+
+    _setPosition(file);
+
+    this->currentOp = kDriveStatusIdle;
+    return 0;
+}
+
+/**
+ * Returns the size of the drive's blocks.
+ */
+size_t Drive::getBlockSize() {
+    return std::max((size_t) 1, this->lib->getConfig().blockSize);
+}
+
+/**
+ * Returns the logical block the drive is positioned at: all blocks of the tape
+ * files before the current one (and their filemarks), plus the blocks of the
+ * current file before the position.
+ */
+off_t Drive::getBlockPosition(iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    if(this->cartridge == NULL || !this->loaded) {
+        SET_ERROR(outErr, ENOMEDIUM);
+        return -1;
+    }
+
+    uint64_t block = 0;
+
+    for(size_t i = 0; i < this->fileNo; i++) {
+        block += _blocksForBytes(this->cartridge->getFileSize(i)) + 1;
+    }
+
+    return block + _blocksForBytes(this->offset);
+}
+
+/**
+ * Positions the drive at the start of the given logical block. If that's the
+ * filemark after a tape file, the drive is positioned at the end of that file.
+ */
+iolib_error_t Drive::locateBlock(off_t block) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    // Find the tape file the block is in
+    size_t numFiles = this->cartridge->getNumFiles();
+    uint64_t fileStart = 0;
+
+    for(size_t i = 0; block >= 0 && i < numFiles; i++) {
+        uint64_t size = this->cartridge->getFileSize(i);
+        uint64_t blocks = _blocksForBytes(size);
+
+        if((uint64_t) block <= fileStart + blocks) {
+            this->currentOp = (i < this->fileNo) ? kDriveStatusSeekingBackwards
+                                                 : kDriveStatusSeekingForwards;
+            this->lib->sleep(this->lib->getConfig().locateTime);
+
+            _setPosition(i);
+            this->offset = std::min(size, (block - fileStart) * getBlockSize());
+
+            this->currentOp = kDriveStatusIdle;
+            return 0;
+        }
+
+        fileStart += blocks + 1;
+    }
+
+    LOG(ERROR) << "Can't locate block " << block << " on " << this->devFile;
+    return EIO;
+}
+
+/**
+ * Rewinds the tape to the beginning.
+ */
+iolib_error_t Drive::rewind() {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    this->currentOp = kDriveStatusRewinding;
+    this->lib->sleep(this->lib->getConfig().rewindTime);
+
+    _setPosition(0);
+
+    this->currentOp = kDriveStatusIdle;
+    return 0;
+}
+
+/**
+ * Skips ahead to the start of the next tape file.
+ */
+iolib_error_t Drive::skipFileMark() {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    if((this->fileNo + 1) >= this->cartridge->getNumFiles()) {
+        return EIO;
+    }
+
+    _setPosition(this->fileNo + 1);
+    return 0;
+}
+
+/**
+ * Rewinds and unloads the tape; the loader can then take it out of the drive.
+ */
+iolib_error_t Drive::eject() {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    if(this->locked) {
+        return EBUSY;
+    }
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    this->currentOp = kDriveStatusUnloading;
+    this->lib->sleep(this->lib->getConfig().unloadTime);
+
+    _setPosition(0);
+    this->loaded = false;
+
+    this->currentOp = kDriveStatusIdle;
+    return 0;
+}
+
+/**
+ * Prevents (or allows again) the tape from being ejected.
+ */
+iolib_error_t Drive::lockMedium(bool lockFlag) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    this->locked = lockFlag;
+    return 0;
+}
+
+/**
+ * Writes a filemark at the current position, which ends the current tape file
+ * and discards anything after it.
+ */
+iolib_error_t Drive::writeFileMark() {
+    return this->writeFileMarks(1, true);
+}
+
+/**
+ * Writes the given number of filemarks at the current position; each of them
+ * but the last is followed by an empty tape file. Immediate filemarks take as
+ * long as the drive needs to flush its buffer and get back up to speed.
+ */
+iolib_error_t Drive::writeFileMarks(size_t count, bool immediate) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        return err;
+    }
+
+    if((err = _prepareWrite()) != 0) {
+        return err;
+    }
+
+    // Start the next file; it's empty until written to
+    if(this->fd != -1) {
+        close(this->fd);
+        this->fd = -1;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        this->fileNo++;
+        this->offset = 0;
+
+        this->cartridge->truncateAt(this->fileNo, 0);
+    }
+
+    if(immediate) {
+        this->lib->sleep(this->lib->getConfig().filemarkTime);
+    }
+
+    return 0;
+}
+
+/**
+ * Writes data at the current position, discarding anything after it. If the
+ * write reaches the early warning zone, it stops there, and IOLIB_ERROR_EOM is
+ * returned as the error; after that, writes may continue up to the physical
+ * end of the tape.
+ */
+size_t Drive::writeTape(void *buf, size_t len, iolib_error_t *outErr) {
+    struct iovec iov = { buf, len };
+
+    return writeTapeVectored(&iov, 1, outErr);
+}
+
+/**
+ * Writes the given buffers one after another, as a single write. This behaves
+ * exactly like writeTape otherwise.
+ */
+size_t Drive::writeTapeVectored(const struct iovec *iov, int iovcnt,
+                                iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    size_t len = 0;
+
+    for(int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        SET_ERROR(outErr, err);
+        return -1;
+    }
+
+    // Maybe fail the write
+    if(this->lib->injectFault(this->lib->getConfig().writeErrorRate)) {
+        LOG(WARNING) << "Injecting write error on " << this->devFile;
+
+        this->bytesWrittenError += len;
+        SET_ERROR(outErr, EIO);
+        return -1;
+    }
+
+    if((err = _prepareWrite()) != 0) {
+        SET_ERROR(outErr, err);
+        return -1;
+    }
+
+    // Only write up to the early warning, or the end once past it
+    uint64_t capacity = this->cartridge->getCapacity();
+    uint64_t earlyWarning = capacity - std::min(capacity, this->lib->getConfig().earlyWarning);
+
+    uint64_t end = (this->bytesOnTape < earlyWarning) ? earlyWarning : capacity;
+    uint64_t space = (this->bytesOnTape < end) ? (end - this->bytesOnTape) : 0;
+    size_t toWrite = std::min((uint64_t) len, space);
+
+    this->currentOp = kDriveStatusWritingData;
+
+    size_t written = 0;
+
+    for(int i = 0; i < iovcnt && written < toWrite; i++) {
+        const uint8_t *ptr = static_cast<const uint8_t *>(iov[i].iov_base);
+        size_t segment = std::min(iov[i].iov_len, toWrite - written);
+        size_t done = 0;
+
+        while(done < segment) {
+            ssize_t ret = pwrite(this->fd, ptr + done, segment - done,
+                                 this->offset + written);
+
+            if(ret == -1) {
+                PLOG(ERROR) << "Couldn't write to " << this->cartridge->pathForFile(this->fileNo);
+
+                this->currentOp = kDriveStatusIdle;
+                this->bytesWrittenError += (len - written);
+                SET_ERROR(outErr, errno);
+                return -1;
+            }
+
+            done += ret;
+            written += ret;
+        }
+    }
+
+    this->offset += written;
+    this->bytesOnTape += written;
+    this->bytesWritten += written;
+
+    _stream(written);
+
+    this->currentOp = kDriveStatusIdle;
+
+    // Did we hit the end of the tape?
+    if(written < len) {
+        this->bytesWrittenError += (len - written);
+        SET_ERROR(outErr, IOLIB_ERROR_EOM);
+        return -1;
+    }
+
+    return written;
+}
+
+/**
+ * Reads data from the current position. If the end of the tape file is hit,
+ * the read is cut short, and the drive is positioned at the start of the next
+ * tape file (if there is one.)
+ */
+size_t Drive::readTape(void *buf, size_t len, iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    iolib_error_t err = _waitReady();
+
+    if(err != 0) {
+        SET_ERROR(outErr, err);
+        return -1;
+    }
+
+    // Maybe fail the read
+    if(this->lib->injectFault(this->lib->getConfig().readErrorRate)) {
+        LOG(WARNING) << "Injecting read error on " << this->devFile;
+
+        this->bytesReadError += len;
+        SET_ERROR(outErr, EIO);
+        return -1;
+    }
+
+    std::string path = this->cartridge->pathForFile(this->fileNo);
+
+    if(this->fd == -1) {
+        this->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+        if(this->fd == -1) {
+            PLOG(ERROR) << "Couldn't open " << path;
+            SET_ERROR(outErr, errno);
+            return -1;
+        }
+    }
+
+    this->currentOp = kDriveStatusReading;
+
+    uint8_t *ptr = static_cast<uint8_t *>(buf);
+    size_t read = 0;
+
+    while(read < len) {
+        ssize_t ret = pread(this->fd, ptr + read, len - read, this->offset + read);
+
+        if(ret == -1) {
+            PLOG(ERROR) << "Couldn't read from " << path;
+
+            this->currentOp = kDriveStatusIdle;
+            this->bytesReadError += (len - read);
+            SET_ERROR(outErr, errno);
+            return -1;
+        } else if(ret == 0) {
+            break;
+        }
+
+        read += ret;
+    }
+
+    this->offset += read;
+    this->bytesRead += read;
+
+    _stream(read);
+
+    this->currentOp = kDriveStatusIdle;
+
+    // Ran into a filemark?
+    if(read < len && (this->fileNo + 1) < this->cartridge->getNumFiles()) {
+        _setPosition(this->fileNo + 1);
+    }
+
+    return read;
+}
+
+/**
+ * Reads into the given buffers one after another, stopping at the first one
+ * that isn't filled, i.e. when a filemark is hit.
+ */
+size_t Drive::readTapeVectored(const struct iovec *iov, int iovcnt,
+                               iolib_error_t *outErr) {
+    size_t total = 0;
+
+    for(int i = 0; i < iovcnt; i++) {
+        size_t read = readTape(iov[i].iov_base, iov[i].iov_len, outErr);
+
+        if((ssize_t) read < 0) {
+            return (total == 0) ? read : total;
+        }
+
+        total += read;
+
+        if(read < iov[i].iov_len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Returns how many asynchronous requests may be outstanding at a time.
+ */
+size_t Drive::getQueueDepth() {
+    return std::max((size_t) 1, this->lib->getConfig().queueDepth);
+}
+
+/**
+ * Queues an asynchronous read or write; it's performed by the request thread,
+ * which is started if needed.
+ */
+iolib_error_t Drive::submitRequest(iolib_io_request_t *req, bool write) {
+    {
+        std::lock_guard<std::mutex> lk(this->requestLock);
+
+        if(this->requests.size() >= getQueueDepth()) {
+            return IOLIB_ERROR_QUEUE_FULL;
+        }
+
+        req->transferred = 0;
+        req->error = 0;
+
+        this->requests.push_back({ req, write });
+
+        if(!this->requestThread.joinable()) {
+            this->requestThread = std::thread(&Drive::_requestEntry, this);
+        }
+    }
+
+    this->requestsChanged.notify_all();
+    return 0;
+}
+
+/**
+ * Waits for the oldest outstanding request to be performed, and returns it.
+ */
+iolib_io_request_t *Drive::completeRequest(iolib_error_t *outErr) {
+    std::unique_lock<std::mutex> lk(this->requestLock);
+
+    if(this->requests.empty()) {
+        SET_ERROR(outErr, EINVAL);
+        return NULL;
+    }
+
+    this->requestsChanged.wait(lk, [this]{
+        return (this->numPerformed > 0);
+    });
+
+    iolib_io_request_t *req = this->requests.front().req;
+
+    this->requests.pop_front();
+    this->numPerformed--;
+
+    // Once the caller has seen all requests, new ones may be performed again
+    if(this->requests.empty()) {
+        this->requestFailed = false;
+    }
+
+    return req;
+}
+
+/**
+ * Performs asynchronous requests in the order they were submitted. Once one
+ * fails or comes up short, those after it are cancelled.
+ */
+void Drive::_requestEntry() {
+    std::unique_lock<std::mutex> lk(this->requestLock);
+
+    while(true) {
+        this->requestsChanged.wait(lk, [this]{
+            return (this->shutdown || this->requests.size() > this->numPerformed);
+        });
+
+        if(this->shutdown) {
+            return;
+        }
+
+        async_request_t request = this->requests[this->numPerformed];
+        iolib_io_request_t *req = request.req;
+
+        if(this->requestFailed) {
+            req->error = IOLIB_ERROR_CANCELLED;
+        } else {
+            size_t len = 0;
+
+            for(int i = 0; i < req->iovcnt; i++) {
+                len += req->iov[i].iov_len;
+            }
+
+            // Perform it without holding the lock, so more can be queued
+            lk.unlock();
+
+            iolib_error_t err = 0;
+            size_t done = request.write ? writeTapeVectored(req->iov, req->iovcnt, &err)
+                                        : readTapeVectored(req->iov, req->iovcnt, &err);
+
+            lk.lock();
+
+            req->transferred = done;
+            req->error = err;
+
+            if(err != 0 || done != len) {
+                this->requestFailed = true;
+            }
+        }
+
+        this->numPerformed++;
+        this->requestsChanged.notify_all();
+    }
+}
+
+/**
+ * Checks whether the tape is full.
+ */
+bool Drive::isEOM(iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lk(this->lock);
+
+    if(this->cartridge == NULL || !this->loaded) {
+        SET_ERROR(outErr, ENOMEDIUM);
+        return false;
+    }
+
+    uint64_t used = this->cartridge->bytesBefore(this->fileNo) + this->offset;
+    uint64_t capacity = this->cartridge->getCapacity();
+
+    return (used + std::min(capacity, this->lib->getConfig().earlyWarning) >= capacity);
+}
+
+/**
+ * Inserts a cartridge into the drive, which starts loading it. The lock must be
+ * held.
+ */
+void Drive::_insert(Cartridge *cartridge) {
+    this->cartridge = cartridge;
+    this->loaded = true;
+
+    this->readyAt = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(this->lib->getConfig().loadTime));
+
+    _setPosition(0);
+}
+
+/**
+ * Takes the cartridge out of the drive. The lock must be held.
+ */
+Cartridge *Drive::_remove() {
+    Cartridge *cartridge = this->cartridge;
+
+    _setPosition(0);
+
+    this->cartridge = NULL;
+    this->loaded = false;
+
+    return cartridge;
+}
+
+/**
+ * Whether the loader may take the cartridge out; it must have been ejected.
+ * The lock must be held.
+ */
+bool Drive::_canRemove() {
+    return (this->cartridge != NULL && !this->loaded && !this->locked);
+}
+
+/**
+ * Waits for a freshly inserted tape to finish loading. Returns an error if
+ * there's no loaded tape. The lock must be held.
+ */
+iolib_error_t Drive::_waitReady() {
+    if(this->cartridge == NULL || !this->loaded) {
+        return ENOMEDIUM;
+    }
+
+    if(std::chrono::steady_clock::now() < this->readyAt) {
+        this->currentOp = kDriveStatusLoading;
+        std::this_thread::sleep_until(this->readyAt);
+        this->currentOp = kDriveStatusIdle;
+    }
+
+    return 0;
+}
+
+/**
+ * Moves to the start of the given tape file. The lock must be held.
+ */
+void Drive::_setPosition(size_t file) {
+    if(this->fd != -1) {
+        close(this->fd);
+        this->fd = -1;
+    }
+
+    this->fileNo = file;
+    this->offset = 0;
+    this->appending = false;
+}
+
+/**
+ * Returns the number of blocks that the given number of bytes take up.
+ */
+uint64_t Drive::_blocksForBytes(uint64_t bytes) {
+    size_t blockSize = getBlockSize();
+
+    return (bytes + blockSize - 1) / blockSize;
+}
+
+/**
+ * Gets ready to write at the current position: everything after it is
+ * discarded the first time, and the current tape file is opened. The lock must
+ * be held.
+ */
+iolib_error_t Drive::_prepareWrite() {
+    if(!this->appending) {
+        this->cartridge->truncateAt(this->fileNo, this->offset);
+
+        this->bytesOnTape = this->cartridge->bytesBefore(this->fileNo) + this->offset;
+        this->appending = true;
+    }
+
+    if(this->fd == -1) {
+        std::string path = this->cartridge->pathForFile(this->fileNo);
+        this->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+        if(this->fd == -1) {
+            PLOG(ERROR) << "Couldn't open " << path;
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Takes as long as streaming the given number of bytes at the configured rate
+ * would. The lock must be held.
+ */
+void Drive::_stream(size_t bytes) {
+    double speed = this->lib->getConfig().speed;
+
+    if(speed > 0) {
+        this->lib->sleep(bytes / speed);
+    }
+}
+
+} // namespace iolibvirtual
@@ -0,0 +1,291 @@
+#include <glog/logging.h>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+#include "Loader.hpp"
+#include "VirtualIOLib.hpp"
+
+namespace iolibvirtual {
+
+/**
+ * Creates the loader, with one picker and the configured number of slots and
+ * portals, and a drive element for each of the given drives.
+ */
+Loader::Loader(VirtualIOLib *lib, std::vector<Drive *> drives) {
+    this->lib = lib;
+    this->devFile = lib->getDirectory() + "/changer";
+
+    const virtual_library_config_t &config = lib->getConfig();
+
+    this->elements.push_back(new Element(this, kStorageElementTransport, 0, NULL));
+
+    for(size_t i = 0; i < config.numSlots; i++) {
+        this->elements.push_back(new Element(this, kStorageElementSlot, i, NULL));
+    }
+
+    for(size_t i = 0; i < config.numPortals; i++) {
+        this->elements.push_back(new Element(this, kStorageElementPortal, i, NULL));
+    }
+
+    for(size_t i = 0; i < drives.size(); i++) {
+        this->elements.push_back(new Element(this, kStorageElementDrive, i, drives[i]));
+    }
+
+    VLOG(1) << "Virtual loader with " << config.numSlots << " slots, "
+            << config.numPortals << " portals, " << drives.size() << " drives";
+
+	// Generate UUID
+	boost::uuids::basic_random_generator<boost::mt19937> gen;
+	this->uuid = gen();
+}
+
+/**
+ * Deletes all elements; the cartridges belong to the library.
+ */
+Loader::~Loader() {
+    for(auto it = this->elements.begin(); it != this->elements.end(); it++) {
+        delete *it;
+    }
+}
+
+/**
+ * Return a stringified version of the UUID.
+ */
+std::string Loader::getUuid() {
+	return boost::uuids::to_string(this->uuid);
+}
+
+/**
+ * Returns a copy of the loader's (virtual) device path.
+ */
+iolib_string_t Loader::getDeviceFile() {
+    return strdup(this->devFile.c_str());
+}
+
+/**
+ * Returns the number of elements for a given element type.
+ */
+size_t Loader::getNumElementsForType(iolib_storage_element_type_t type) {
+    size_t num = 0;
+
+    for(auto it = this->elements.begin(); it != this->elements.end(); it++) {
+        if((*it)->getType() & type) {
+            num++;
+        }
+    }
+
+    return num;
+}
+
+/**
+ * Gets n elements of the specified type, writing pointers to them into the
+ * given buffer.
+ */
+void Loader::getElementsForType(iolib_storage_element_type_t type, size_t len, Element **out) {
+    size_t itemsWritten = 0;
+
+    CHECK(out != NULL || len == 0) << "Output array may not be NULL";
+
+    for(auto it = this->elements.begin(); it != this->elements.end(); it++) {
+        // If we've writen as many items as the array is long, exit.
+        if(itemsWritten == len) {
+            break;
+        }
+
+        if((*it)->getType() & type) {
+            out[itemsWritten++] = *it;
+        }
+    }
+}
+
+/**
+ * Describes up to `max` elements, grouped by type, in the given array. All of
+ * them are read at once, so the records are consistent with each other.
+ * Returns the total number of elements.
+ */
+size_t Loader::getInventory(iolib_element_record_t *out, size_t max) {
+    static const iolib_storage_element_type_t types[] = {
+        kStorageElementTransport,
+        kStorageElementDrive,
+        kStorageElementPortal,
+        kStorageElementSlot
+    };
+
+    std::lock_guard<std::mutex> lk(this->stateLock);
+    size_t total = 0;
+
+    for(size_t i = 0; i < (sizeof(types) / sizeof(*types)); i++) {
+        for(auto it = this->elements.begin(); it != this->elements.end(); it++) {
+            if((*it)->getType() != types[i]) {
+                continue;
+            }
+
+            if(total < max) {
+                (*it)->_fillRecord(&out[total]);
+            }
+
+            total++;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Performs an inventory. The virtual loader always knows what's where, so this
+ * only takes the configured time.
+ */
+iolib_error_t Loader::performInventory() {
+    std::lock_guard<std::mutex> robot(this->robotLock);
+
+    this->lib->sleep(this->lib->getConfig().inventoryTime);
+    return 0;
+}
+
+/**
+ * Moves the cartridge in `src` into `dest`, which must be empty. Cartridges
+ * can only be taken out of a drive once they've been ejected.
+ */
+iolib_error_t Loader::moveElement(Element *src, Element *dest) {
+    iolib_error_t err = 0;
+
+    // Check that these are our elements
+    CHECK(src != NULL) << "Source must be specified";
+    CHECK(dest != NULL) << "Destination must be specified";
+
+    CHECK(src->parent == this) << "Source element is not from this loader";
+    CHECK(dest->parent == this) << "Destination element is not from this loader";
+
+    std::lock_guard<std::mutex> robot(this->robotLock);
+
+    {
+        std::lock_guard<std::mutex> lk(this->stateLock);
+
+        if(src->cartridge == NULL || dest->cartridge != NULL) {
+            LOG(ERROR) << "Can't move from element " << src->getAddress()
+                       << " to " << dest->getAddress() << ": source empty or "
+                       << "destination full";
+            return EINVAL;
+        }
+    }
+
+    // Maybe fail the move, after the picker tried for a while
+    if(this->lib->injectFault(this->lib->getConfig().moveErrorRate)) {
+        this->lib->sleep(this->lib->getConfig().moveTime);
+
+        LOG(WARNING) << "Injecting error moving from element " << src->getAddress();
+        return EIO;
+    }
+
+    Cartridge *cartridge;
+
+    if((err = _take(src, &cartridge)) != 0) {
+        return err;
+    }
+
+    this->lib->sleep(this->lib->getConfig().moveTime);
+
+    _put(dest, cartridge);
+
+    this->lib->saveInventory();
+    return 0;
+}
+
+/**
+ * Exchanges the cartridges in `first` and `second`; both must be full. This
+ * takes as long as two moves.
+ */
+iolib_error_t Loader::exchangeElements(Element *first, Element *second) {
+    iolib_error_t err = 0;
+
+    // Check that these are our elements
+    CHECK(first != NULL) << "First element must be specified";
+    CHECK(second != NULL) << "Second element must be specified";
+
+    CHECK(first->parent == this) << "First element is not from this loader";
+    CHECK(second->parent == this) << "Second element is not from this loader";
+
+    std::lock_guard<std::mutex> robot(this->robotLock);
+
+    {
+        std::lock_guard<std::mutex> lk(this->stateLock);
+
+        if(first->cartridge == NULL || second->cartridge == NULL) {
+            LOG(ERROR) << "Can't exchange elements " << first->getAddress()
+                       << " and " << second->getAddress() << ": one is empty";
+            return EINVAL;
+        }
+    }
+
+    // Maybe fail the exchange
+    if(this->lib->injectFault(this->lib->getConfig().moveErrorRate)) {
+        this->lib->sleep(this->lib->getConfig().moveTime);
+
+        LOG(WARNING) << "Injecting error exchanging element " << first->getAddress();
+        return EIO;
+    }
+
+    Cartridge *a, *b;
+
+    if((err = _take(first, &a)) != 0) {
+        return err;
+    }
+
+    if((err = _take(second, &b)) != 0) {
+        _put(first, a);
+        return err;
+    }
+
+    this->lib->sleep(this->lib->getConfig().moveTime * 2);
+
+    _put(first, b);
+    _put(second, a);
+
+    this->lib->saveInventory();
+    return 0;
+}
+
+/**
+ * Takes the cartridge out of an element. For drives, this fails if the tape
+ * hasn't been ejected.
+ */
+iolib_error_t Loader::_take(Element *element, Cartridge **out) {
+    if(element->drive != NULL) {
+        std::lock_guard<std::mutex> lk(element->drive->lock);
+
+        if(!element->drive->_canRemove()) {
+            LOG(ERROR) << "Tape in drive " << element->getAddress()
+                       << " hasn't been ejected";
+            return EBUSY;
+        }
+
+        element->drive->_remove();
+    }
+
+    std::lock_guard<std::mutex> lk(this->stateLock);
+
+    *out = element->cartridge;
+    element->cartridge = NULL;
+
+    return 0;
+}
+
+/**
+ * Puts a cartridge into an element; drives start loading it.
+ */
+void Loader::_put(Element *element, Cartridge *cartridge) {
+    {
+        std::lock_guard<std::mutex> lk(this->stateLock);
+        element->cartridge = cartridge;
+    }
+
+    if(element->drive != NULL) {
+        std::lock_guard<std::mutex> lk(element->drive->lock);
+        element->drive->_insert(cartridge);
+    }
+}
+
+} // namespace iolibvirtual
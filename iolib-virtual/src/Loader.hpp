@@ -0,0 +1,67 @@
+/**
+ * Virtual loader. It has a single picker, and moves cartridges between slots,
+ * portals and drives; each move takes the configured time, and may fail if
+ * fault injection is enabled. A cartridge can only be taken out of a drive
+ * once it has been ejected.
+ *
+ * The virtual library always knows where all cartridges are, so an inventory
+ * only takes time.
+ */
+#ifndef LOADER_HPP
+#define LOADER_HPP
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <IOLib_types.h>
+
+#include "Element.hpp"
+#include "Drive.hpp"
+
+namespace iolibvirtual {
+
+class VirtualIOLib;
+
+class Loader {
+	friend class Element;
+	friend class VirtualIOLib;
+
+	public:
+		Loader(VirtualIOLib *, std::vector<Drive *>);
+		~Loader();
+
+		std::string getUuid();
+		iolib_string_t getDeviceFile();
+
+		size_t getNumElementsForType(iolib_storage_element_type_t);
+		void getElementsForType(iolib_storage_element_type_t, size_t, Element **);
+		size_t getInventory(iolib_element_record_t *, size_t);
+
+		iolib_error_t performInventory();
+		iolib_error_t moveElement(Element *, Element *);
+		iolib_error_t exchangeElements(Element *, Element *);
+
+	private:
+		VirtualIOLib *lib;
+
+		boost::uuids::uuid uuid;
+		std::string devFile;
+
+		std::vector<Element *> elements;
+
+		// held for the duration of any loader operation, as there's only one
+		// picker; and protecting the contents of all elements
+		std::mutex robotLock;
+		std::mutex stateLock;
+
+
+		iolib_error_t _take(Element *, Cartridge **);
+		void _put(Element *, Cartridge *);
+};
+
+} // namespace iolibvirtual
+
+#endif
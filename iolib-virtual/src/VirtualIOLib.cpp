@@ -0,0 +1,397 @@
+#include <glog/logging.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "VirtualIOLib.hpp"
+
+namespace iolibvirtual {
+
+/**
+ * Creates the IOLib: reads the configuration, then creates the cartridges,
+ * drives and loader, and puts the cartridges where the inventory says they
+ * are.
+ */
+VirtualIOLib::VirtualIOLib() {
+    const char *dir = getenv("IOLIB_VIRTUAL_DIR");
+    this->dir = (dir != NULL) ? dir : "./virtual-library";
+
+    int err = mkdir(this->dir.c_str(), 0755);
+    PCHECK(err == 0 || errno == EEXIST) << "Couldn't create " << this->dir;
+
+    err = mkdir((this->dir + "/tapes").c_str(), 0755);
+    PCHECK(err == 0 || errno == EEXIST) << "Couldn't create " << this->dir << "/tapes";
+
+    // Read config
+    _parseConfigFile();
+    this->faultGenerator.seed(this->config.faultSeed);
+
+    if(this->config.earlyWarning == 0) {
+        this->config.earlyWarning = this->config.capacity / 100;
+    }
+
+    // Create the devices
+    _createCartridges();
+
+    for(size_t i = 0; i < this->config.numDrives; i++) {
+        this->drives.push_back(new Drive(this, i));
+    }
+
+    if(this->config.numSlots > 0 || this->config.numPortals > 0) {
+        this->loader = new Loader(this, this->drives);
+    }
+
+    // Then, figure out where all the tapes are
+    _loadInventory();
+
+    LOG(INFO) << "Virtual library in " << this->dir << ": "
+              << this->config.numDrives << " drives, " << this->config.numSlots
+              << " slots, " << this->config.numPortals << " portals, "
+              << this->cartridges.size() << " tapes";
+}
+
+/**
+ * Saves the inventory, then deletes all objects we created.
+ */
+VirtualIOLib::~VirtualIOLib() {
+    saveInventory();
+
+    if(this->loader != NULL) {
+        delete this->loader;
+    }
+
+    for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+        delete *it;
+    }
+
+    for(auto it = this->cartridges.begin(); it != this->cartridges.end(); it++) {
+        delete *it;
+    }
+}
+
+/**
+ * Outputs the single virtual library, with all its drives and its loader.
+ */
+int VirtualIOLib::enumerateLibraries(iolib_library_t *libOut, size_t max) {
+    if(max == 0) {
+        return 0;
+    }
+
+    memset(libOut, 0, sizeof(iolib_library_t));
+
+    libOut->id = strdup("virtual");
+    libOut->name = strdup("Virtual Library");
+
+    // Copy drives
+    libOut->numDrives = std::min(this->drives.size(), (size_t) IOLIB_LIBRARY_MAX_DRIVES);
+
+    for(size_t i = 0; i < libOut->numDrives; i++) {
+        libOut->drives[i] = reinterpret_cast<iolib_drive_t>(this->drives[i]);
+    }
+
+    // And the loader
+    if(this->loader != NULL) {
+        libOut->numLoaders = 1;
+        libOut->loaders[0] = reinterpret_cast<iolib_loader_t>(this->loader);
+    }
+
+    return 1;
+}
+
+/**
+ * Decides whether an operation with the given failure probability should fail.
+ */
+bool VirtualIOLib::injectFault(double rate) {
+    if(rate <= 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(this->faultLock);
+
+    std::uniform_real_distribution<double> dist(0, 1);
+    return (dist(this->faultGenerator) < rate);
+}
+
+/**
+ * Waits for the given number of seconds, to emulate a slow operation.
+ */
+void VirtualIOLib::sleep(double seconds) {
+    if(seconds > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    }
+}
+
+/**
+ * Writes out which element holds which cartridge. The file is replaced
+ * atomically, so it's always complete.
+ */
+void VirtualIOLib::saveInventory() {
+    std::string path = this->dir + "/inventory";
+    std::ofstream out(path + ".tmp");
+
+    if(this->loader != NULL) {
+        std::lock_guard<std::mutex> lk(this->loader->stateLock);
+
+        for(auto it = this->loader->elements.begin(); it != this->loader->elements.end(); it++) {
+            Element *element = *it;
+
+            if(element->cartridge == NULL) {
+                continue;
+            }
+
+            switch(element->getType()) {
+                case kStorageElementSlot:
+                    out << "slot";
+                    break;
+                case kStorageElementPortal:
+                    out << "portal";
+                    break;
+                case kStorageElementDrive:
+                    out << "drive";
+                    break;
+                default:
+                    out << "picker";
+                    break;
+            }
+
+            out << " " << element->getAddress() << " "
+                << element->cartridge->getLabel() << std::endl;
+        }
+    } else {
+        for(size_t i = 0; i < this->drives.size(); i++) {
+            std::lock_guard<std::mutex> lk(this->drives[i]->lock);
+
+            if(this->drives[i]->cartridge != NULL) {
+                out << "drive " << i << " "
+                    << this->drives[i]->cartridge->getLabel() << std::endl;
+            }
+        }
+    }
+
+    out.close();
+
+    int err = rename((path + ".tmp").c_str(), path.c_str());
+    PLOG_IF(ERROR, err != 0) << "Couldn't write " << path;
+}
+
+/**
+ * Reads the configuration file, if there is one. Any keys that aren't in it
+ * keep their defaults.
+ */
+void VirtualIOLib::_parseConfigFile() {
+    std::string path = this->dir + "/library.conf";
+    std::ifstream in(path);
+
+    if(!in.is_open()) {
+        LOG(INFO) << "No " << path << "; using the default configuration";
+        return;
+    }
+
+    std::string line;
+    size_t lineNo = 0;
+
+    while(std::getline(in, line)) {
+        lineNo++;
+
+        // Strip comments and whitespace
+        line = line.substr(0, line.find('#'));
+
+        size_t equals = line.find('=');
+
+        if(equals == std::string::npos) {
+            LOG_IF(WARNING, line.find_first_not_of(" \t\r") != std::string::npos)
+                << path << ":" << lineNo << ": expected `key = value`";
+            continue;
+        }
+
+        std::string key, value;
+        std::istringstream(line.substr(0, equals)) >> key;
+        std::istringstream(line.substr(equals + 1)) >> value;
+
+        // Apply it
+        virtual_library_config_t *c = &this->config;
+
+        if(key == "drives") {
+            c->numDrives = std::stoul(value);
+        } else if(key == "slots") {
+            c->numSlots = std::stoul(value);
+        } else if(key == "portals") {
+            c->numPortals = std::stoul(value);
+        } else if(key == "tapes") {
+            c->numTapes = std::stoul(value);
+        } else if(key == "label_prefix") {
+            c->labelPrefix = value;
+        } else if(key == "capacity_mb") {
+            c->capacity = std::stoull(value) * 1024 * 1024;
+        } else if(key == "early_warning_mb") {
+            c->earlyWarning = std::stoull(value) * 1024 * 1024;
+        } else if(key == "speed_mbps") {
+            c->speed = std::stod(value) * 1024 * 1024;
+        } else if(key == "queue_depth") {
+            c->queueDepth = std::stoul(value);
+        } else if(key == "block_size_kb") {
+            c->blockSize = std::stoul(value) * 1024;
+        } else if(key == "load_sec") {
+            c->loadTime = std::stod(value);
+        } else if(key == "unload_sec") {
+            c->unloadTime = std::stod(value);
+        } else if(key == "rewind_sec") {
+            c->rewindTime = std::stod(value);
+        } else if(key == "locate_sec") {
+            c->locateTime = std::stod(value);
+        } else if(key == "filemark_sec") {
+            c->filemarkTime = std::stod(value);
+        } else if(key == "move_sec") {
+            c->moveTime = std::stod(value);
+        } else if(key == "inventory_sec") {
+            c->inventoryTime = std::stod(value);
+        } else if(key == "write_error_rate") {
+            c->writeErrorRate = std::stod(value);
+        } else if(key == "read_error_rate") {
+            c->readErrorRate = std::stod(value);
+        } else if(key == "move_error_rate") {
+            c->moveErrorRate = std::stod(value);
+        } else if(key == "fault_seed") {
+            c->faultSeed = std::stoul(value);
+        } else {
+            LOG(WARNING) << path << ":" << lineNo << ": unknown key '" << key << "'";
+        }
+    }
+
+    CHECK(this->config.numDrives <= IOLIB_LIBRARY_MAX_DRIVES)
+        << "At most " << IOLIB_LIBRARY_MAX_DRIVES << " drives are supported";
+}
+
+/**
+ * Creates the configured number of cartridges. Their data is kept from any
+ * previous runs.
+ */
+void VirtualIOLib::_createCartridges() {
+    for(size_t i = 0; i < this->config.numTapes; i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s%04zu", this->config.labelPrefix.c_str(), i);
+
+        std::string path = this->dir + "/tapes/" + label;
+        this->cartridges.push_back(new Cartridge(label, path, this->config.capacity));
+    }
+}
+
+/**
+ * Puts all cartridges where the inventory file says they are. Without one (or
+ * for cartridges not in it), the first cartridges go into the drives, and the
+ * rest into the slots.
+ */
+void VirtualIOLib::_loadInventory() {
+    std::vector<Cartridge *> unplaced;
+    std::map<std::string, Cartridge *> byLabel;
+
+    for(auto it = this->cartridges.begin(); it != this->cartridges.end(); it++) {
+        byLabel[(*it)->getLabel()] = *it;
+    }
+
+    // Read the saved inventory, if any
+    std::ifstream in(this->dir + "/inventory");
+    std::string kind, label;
+    off_t address;
+
+    while(in >> kind >> address >> label) {
+        auto it = byLabel.find(label);
+
+        if(it == byLabel.end()) {
+            LOG(WARNING) << "Ignoring unknown tape '" << label << "' in inventory";
+            continue;
+        }
+
+        if(_placeCartridge(kind, address, it->second)) {
+            byLabel.erase(it);
+        }
+    }
+
+    // Place any remaining cartridges in the first empty drive or slot
+    for(auto it = this->cartridges.begin(); it != this->cartridges.end(); it++) {
+        if(byLabel.count((*it)->getLabel()) == 0) {
+            continue;
+        }
+
+        bool placed = false;
+
+        for(size_t i = 0; i < this->config.numDrives && !placed; i++) {
+            placed = _placeCartridge("drive", i, *it);
+        }
+
+        for(size_t i = 0; i < this->config.numSlots && !placed; i++) {
+            placed = _placeCartridge("slot", i, *it);
+        }
+
+        LOG_IF(WARNING, !placed) << "No room for tape '" << (*it)->getLabel() << "'";
+    }
+
+    saveInventory();
+}
+
+/**
+ * Puts a cartridge into the given element, if it's empty; drives have it
+ * loaded right away. Returns whether the cartridge was placed.
+ */
+bool VirtualIOLib::_placeCartridge(std::string kind, off_t address, Cartridge *cartridge) {
+    // Without a loader, only drives exist
+    if(this->loader == NULL) {
+        if(kind != "drive" || address < 0 || (size_t) address >= this->drives.size()) {
+            return false;
+        }
+
+        Drive *drive = this->drives[address];
+        std::lock_guard<std::mutex> lk(drive->lock);
+
+        if(drive->cartridge != NULL) {
+            return false;
+        }
+
+        drive->_insert(cartridge);
+        drive->readyAt = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // Otherwise, find the element
+    iolib_storage_element_type_t type;
+
+    if(kind == "slot") {
+        type = kStorageElementSlot;
+    } else if(kind == "portal") {
+        type = kStorageElementPortal;
+    } else if(kind == "drive") {
+        type = kStorageElementDrive;
+    } else {
+        return false;
+    }
+
+    for(auto it = this->loader->elements.begin(); it != this->loader->elements.end(); it++) {
+        Element *element = *it;
+
+        if(element->getType() != type || element->getAddress() != address) {
+            continue;
+        } else if(element->cartridge != NULL) {
+            return false;
+        }
+
+        this->loader->_put(element, cartridge);
+
+        if(element->drive != NULL) {
+            element->drive->readyAt = std::chrono::steady_clock::now();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace iolibvirtual
@@ -0,0 +1,136 @@
+/**
+ * This is the wrapper that contains all the other objects for the virtual IO
+ * lib: a tape library that's entirely backed by files, so that the daemon can
+ * be run (and benchmarked) without any tape hardware.
+ *
+ * Everything lives in a single directory, given by the IOLIB_VIRTUAL_DIR
+ * environment variable (./virtual-library if it isn't set):
+ *
+ * - library.conf: describes the library and how it behaves; see below. All
+ *   keys are optional.
+ * - tapes/<label>/: one directory per cartridge, holding one file per tape
+ *   file. A filemark ends a file, and starts the next one.
+ * - inventory: which element holds which cartridge. This is written whenever a
+ *   tape is moved, and read back at startup; if it doesn't exist, all tapes
+ *   start out in the slots, and the first few are loaded into the drives.
+ *
+ * The configuration file holds `key = value` lines; `#` starts a comment. The
+ * following keys are understood:
+ *
+ * - drives, slots, portals: number of each kind of element. Without slots or
+ *   portals, the library has no loader.
+ * - tapes: number of cartridges; label_prefix is prepended to their number to
+ *   form their labels. capacity_mb is the capacity of each cartridge.
+ * - early_warning_mb: size of the early warning zone at the end of each
+ *   cartridge (1% of the capacity by default.) Writes stop with EOM when they
+ *   reach it, but once past it, data can be written up to the capacity.
+ * - speed_mbps: rate at which drives stream data; 0 is unlimited.
+ * - queue_depth: number of asynchronous requests each drive accepts at a time.
+ * - block_size_kb: size of the blocks that data is written in. Every tape file
+ *   takes up as many blocks as its data needs, plus one for its filemark.
+ * - load_sec, unload_sec, rewind_sec, locate_sec: time taken by a drive to
+ *   load (thread) a tape, to rewind and unload it, to rewind it, and to locate
+ *   a tape file.
+ * - filemark_sec: time taken to write an immediate filemark, for which the
+ *   drive flushes its buffer, stops and repositions; buffered filemarks take
+ *   no time.
+ * - move_sec, inventory_sec: time taken by the loader to move a tape, and to
+ *   perform an inventory.
+ * - write_error_rate, read_error_rate, move_error_rate: probability that any
+ *   single write, read or move fails with EIO. fault_seed seeds the generator
+ *   these are drawn from, so failures are reproducible.
+ */
+#ifndef VIRTUALIOLIB_H
+#define VIRTUALIOLIB_H
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Drive.hpp"
+#include "Loader.hpp"
+#include "Cartridge.hpp"
+
+namespace iolibvirtual {
+
+/**
+ * Configuration of the virtual library, as read from library.conf.
+ */
+typedef struct {
+	size_t numDrives = 1;
+	size_t numSlots = 8;
+	size_t numPortals = 1;
+
+	size_t numTapes = 8;
+	std::string labelPrefix = "VT";
+	uint64_t capacity = (64ULL * 1024 * 1024 * 1024);
+	// 0 means 1% of the capacity
+	uint64_t earlyWarning = 0;
+
+	// bytes/sec; 0 is unlimited
+	double speed = 0;
+	// asynchronous requests per drive
+	size_t queueDepth = 4;
+	// bytes per logical block
+	size_t blockSize = (256 * 1024);
+
+	// drive and loader latencies, in seconds
+	double loadTime = 0;
+	double unloadTime = 0;
+	double rewindTime = 0;
+	double locateTime = 0;
+	double filemarkTime = 0;
+	double moveTime = 0;
+	double inventoryTime = 0;
+
+	// probability of any single operation failing
+	double writeErrorRate = 0;
+	double readErrorRate = 0;
+	double moveErrorRate = 0;
+	unsigned int faultSeed = 0;
+} virtual_library_config_t;
+
+class VirtualIOLib {
+	public:
+		VirtualIOLib();
+		~VirtualIOLib();
+
+		int enumerateLibraries(iolib_library_t *, size_t);
+
+		const virtual_library_config_t &getConfig() {
+			return this->config;
+		}
+		std::string getDirectory() {
+			return this->dir;
+		}
+
+		bool injectFault(double);
+		void sleep(double);
+
+		void saveInventory();
+
+	private:
+		// directory the library lives in
+		std::string dir;
+		virtual_library_config_t config;
+
+		std::vector<Cartridge *> cartridges;
+		std::vector<Drive *> drives;
+		Loader *loader = NULL;
+
+		// generator for injected faults
+		std::mutex faultLock;
+		std::mt19937 faultGenerator;
+
+
+		void _parseConfigFile();
+		void _createCartridges();
+
+		void _loadInventory();
+		bool _placeCartridge(std::string, off_t, Cartridge *);
+};
+
+} // namespace iolibvirtual
+#endif
@@ -0,0 +1,576 @@
+#include <mutex>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <glog/logging.h>
+
+#include <IOLib_types.h>
+#include <IOLib_lib.h>
+#include "VirtualIOLib.hpp"
+
+using namespace iolibvirtual;
+
+/**
+ * This macro converts the given void (or any other generic type) pointer into
+ * that of the specified class. It's assumed that the variable name of the in
+ * pointer is the same as the out pointer, but with a prepended underscore.
+ */
+#define GET_CLASS(className, varName) \
+    className *varName = static_cast<className *>(_##varName);
+
+/**
+ * Writes an error code into the optional error pointer.
+ */
+#define SET_ERROR(outErr, code) \
+    if((outErr) != NULL) { *(outErr) = (code); }
+
+// Shared IO lib class - this is what's created by the init function.
+static VirtualIOLib *_ioLibShared = NULL;
+std::mutex _ioLibSharedLock;
+
+// Whether a session is open; the virtual library only allows one at a time.
+static bool _sessionOpen = false;
+
+/**
+ * Copies the given string into a newly allocated IOLib string.
+ */
+static iolib_string_t _copyString(std::string str) {
+    char *buf = static_cast<char *>(malloc(str.size() + 1));
+    memset(buf, 0, (str.size() + 1));
+    strncpy(buf, str.c_str(), str.size());
+
+    return static_cast<iolib_string_t>(buf);
+}
+
+//////////////////////// Initialization and Destructors ////////////////////////
+/**
+ * Global library initializer.
+ */
+IOLIB_EXPORT iolib_error_t iolibInit(void) {
+    std::unique_lock<std::mutex> lck(_ioLibSharedLock,std::defer_lock);
+
+    // Create the IOLib.
+    lck.lock();
+
+    if(_ioLibShared != NULL) {
+        LOG(WARNING) << "_ioLibShared was not NULL when iolibInit was called";
+        delete _ioLibShared;
+    }
+
+    _ioLibShared = new VirtualIOLib();
+    _sessionOpen = false;
+
+    // done
+    lck.unlock();
+    return (_ioLibShared != NULL) ? 0 : -1;
+}
+
+/**
+ * Global library destructor. This writes out the inventory, and closes any
+ * tape files that are still open.
+ */
+IOLIB_EXPORT iolib_error_t iolibExit(void) {
+    std::unique_lock<std::mutex> lck(_ioLibSharedLock,std::defer_lock);
+
+    // Delete the IOLib object
+    lck.lock();
+
+    CHECK(_ioLibShared != NULL) << "_ioLibShared was NULL when iolibExit was called";
+
+    delete _ioLibShared;
+    _ioLibShared = NULL;
+
+    // done
+    lck.unlock();
+    return 0;
+}
+
+/**
+ * Frees an IOLib string.
+ */
+IOLIB_EXPORT void iolibStringFree(iolib_string_t string) {
+    free(string);
+}
+
+///////////////////////////// Hardware Enumeration /////////////////////////////
+/**
+ * Enumerates the tape libraries; there is always exactly one virtual library.
+ *
+ * Returns a positive number (including zero) up to `max` number of libraries
+ * that were found in the system. If an error occurs, -1 is returned, and the
+ * error value is written in the optional int pointer.
+ */
+IOLIB_EXPORT int iolibEnumerateDevices(iolib_library_t *lib, size_t max, iolib_error_t *outErr) {
+    SET_ERROR(outErr, 0);
+
+    return _ioLibShared->enumerateLibraries(lib, max);
+}
+
+/**
+ * Frees all library structures previously inserted into the specified array.
+ * Only the strings are allocated; devices are owned by the library.
+ */
+IOLIB_EXPORT void iolibEnumerateDevicesFree(iolib_library_t *lib, size_t num) {
+    for(size_t i = 0; i < num; i++) {
+        free(lib[i].id);
+        free(lib[i].name);
+
+        lib[i].id = NULL;
+        lib[i].name = NULL;
+    }
+}
+
+//////////////////////////////// Drive Handling ////////////////////////////////
+/**
+ * Returns a string that describes this tape drive. This is just intended for
+ * display to the user more than anything.
+ */
+IOLIB_EXPORT iolib_string_t iolibDriveGetName(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return _copyString(drive->getName());
+}
+
+/**
+ * Returns a stringified UUID for this drive. The UUID is not persistent.
+ */
+IOLIB_EXPORT iolib_string_t iolibDriveGetUuid(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return _copyString(drive->getUuid());
+}
+
+/**
+ * Returns a string containing the path to this drive's (virtual) device node.
+ */
+IOLIB_EXPORT iolib_string_t iolibDriveGetDevFile(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getDeviceFile();
+}
+
+/**
+ * Gets the drive's status, populating the specified struct.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveGetStatus(iolib_drive_t _drive, iolib_drive_status_t *outStatus) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getDriveStatus(outStatus);
+}
+
+/**
+ * Returns the drive's current position. Like the FreeBSD library, this is the
+ * number of the tape file the drive is positioned in.
+ */
+IOLIB_EXPORT off_t iolibDriveGetPosition(iolib_drive_t _drive, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getPosition(outErr);
+}
+
+/**
+ * Seeks the drive to the start of the given tape file.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveSeekToPosition(iolib_drive_t _drive, off_t block) {
+    GET_CLASS(Drive, drive);
+
+    return drive->seekToPosition(block);
+}
+
+/**
+ * Returns the size of the drive's logical blocks.
+ */
+IOLIB_EXPORT size_t iolibDriveGetBlockSize(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getBlockSize();
+}
+
+/**
+ * Returns the logical block the drive is positioned at.
+ */
+IOLIB_EXPORT off_t iolibDriveGetBlockPosition(iolib_drive_t _drive, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getBlockPosition(outErr);
+}
+
+/**
+ * Positions the drive at the start of the given logical block.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveLocateBlock(iolib_drive_t _drive, off_t block) {
+    GET_CLASS(Drive, drive);
+
+    return drive->locateBlock(block);
+}
+
+/**
+ * Determines the drive's current operation.
+ */
+IOLIB_EXPORT iolib_drive_operation_t iolibDriveGetCurrentOperation(iolib_drive_t _drive, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    SET_ERROR(outErr, 0);
+    return drive->getDriveOp();
+}
+
+/**
+ * Rewinds the tape to the beginning. This call will block until the rewind
+ * operation has completed.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveRewind(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->rewind();
+}
+
+/**
+ * Skips ahead one file. This can be used at the end of an exact size read to
+ * start the next read at the beginning of the next tape file.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveSkipFile(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->skipFileMark();
+}
+
+/**
+ * Ejects the tape from the drive, so the loader may remove it. This fails if
+ * the medium is locked.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveEject(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->eject();
+}
+
+/**
+ * Locks the medium in the drive, preventing it from being ejected. To lock the
+ * medium, pass true for the second argument; false unlocks it.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveLockMedium(iolib_drive_t _drive, bool lockFlag) {
+    GET_CLASS(Drive, drive);
+
+    return drive->lockMedium(lockFlag);
+}
+
+/**
+ * Performs a write operation on the tape, starting at the drive's current
+ * position. Writing anywhere but at the end of the data discards everything
+ * after the position, as on a real tape.
+ *
+ * Returns the actual number of bytes that were written. If the cartridge is
+ * full, -1 is returned, and the error is IOLIB_ERROR_EOM.
+ */
+IOLIB_EXPORT size_t iolibDriveWrite(iolib_drive_t _drive, void *buf, size_t len,
+                                    bool writeFileMark, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    size_t written = drive->writeTape(buf, len, outErr);
+
+    if(writeFileMark && written == len) {
+        iolib_error_t err = drive->writeFileMark();
+
+        if(err != 0) {
+            SET_ERROR(outErr, err);
+        }
+    }
+
+    return written;
+}
+
+/**
+ * Writes a file mark to tape at the current position, which starts a new tape
+ * file.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveWriteFileMark(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->writeFileMark();
+}
+
+/**
+ * Writes the given number of file marks at the current position; unless they
+ * are immediate, this doesn't wait for the drive to flush its buffer.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveWriteFileMarks(iolib_drive_t _drive, size_t count,
+                                                    bool immediate) {
+    GET_CLASS(Drive, drive);
+
+    return drive->writeFileMarks(count, immediate);
+}
+
+/**
+ * Performs a read operation on the tape, starting at the drive's current
+ * position.
+ *
+ * Returns the actual number of bytes that were read. This can be negative if an
+ * error occurred, between 0 and (`max` - 1) if a file mark was encountered.
+ */
+IOLIB_EXPORT size_t iolibDriveRead(iolib_drive_t _drive, void *buf,
+                                   size_t len, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->readTape(buf, len, outErr);
+}
+
+/**
+ * Checks whether the drive has reached the end of the medium.
+ */
+IOLIB_EXPORT bool iolibDriveIsEOM(iolib_drive_t _drive, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->isEOM(outErr);
+}
+
+
+/**
+ * Writes the given buffers to tape, one after another, as a single write.
+ */
+IOLIB_EXPORT size_t iolibDriveWriteVectored(iolib_drive_t _drive, const struct iovec *iov,
+                                            int iovcnt, iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->writeTapeVectored(iov, iovcnt, outErr);
+}
+
+/**
+ * Returns the number of asynchronous requests the drive accepts at a time.
+ */
+IOLIB_EXPORT size_t iolibDriveGetQueueDepth(iolib_drive_t _drive) {
+    GET_CLASS(Drive, drive);
+
+    return drive->getQueueDepth();
+}
+
+/**
+ * Queues an asynchronous write; it's performed once all requests before it are.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveSubmitWrite(iolib_drive_t _drive, iolib_io_request_t *req) {
+    GET_CLASS(Drive, drive);
+
+    return drive->submitRequest(req, true);
+}
+
+/**
+ * Queues an asynchronous read; it's performed once all requests before it are.
+ */
+IOLIB_EXPORT iolib_error_t iolibDriveSubmitRead(iolib_drive_t _drive, iolib_io_request_t *req) {
+    GET_CLASS(Drive, drive);
+
+    return drive->submitRequest(req, false);
+}
+
+/**
+ * Waits for the drive's oldest outstanding request to complete, and returns it.
+ */
+IOLIB_EXPORT iolib_io_request_t *iolibDriveCompleteRequest(iolib_drive_t _drive,
+                                                           iolib_error_t *outErr) {
+    GET_CLASS(Drive, drive);
+
+    return drive->completeRequest(outErr);
+}
+
+/////////////////////////////// Loader Handling ////////////////////////////////
+/**
+ * Returns a string that describes this loader.
+ */
+IOLIB_EXPORT iolib_string_t iolibLoaderGetName(iolib_loader_t _loader) {
+    GET_CLASS(Loader, loader);
+
+    return _copyString("Virtual Loader");
+}
+
+/**
+ * Returns a stringified UUID for this loader. The UUID is not persistent.
+ */
+IOLIB_EXPORT iolib_string_t iolibLoaderGetUuid(iolib_loader_t _loader) {
+    GET_CLASS(Loader, loader);
+
+    return _copyString(loader->getUuid());
+}
+
+/**
+ * Returns a string containing the path to this loader's (virtual) device node.
+ */
+IOLIB_EXPORT iolib_string_t iolibLoaderGetDevFile(iolib_loader_t _loader) {
+    GET_CLASS(Loader, loader);
+
+    return loader->getDeviceFile();
+}
+
+/**
+ * Returns the number of storage elements of the given type that the loader
+ * has.
+ */
+IOLIB_EXPORT size_t iolibLoaderGetNumElements(iolib_loader_t _loader,
+                                              iolib_storage_element_type_t type) {
+    GET_CLASS(Loader, loader);
+
+    return loader->getNumElementsForType(type);
+}
+
+/**
+ * Performs an inventory of all tapes. The library always knows where all tapes
+ * are, so this just takes the configured amount of time.
+ */
+IOLIB_EXPORT iolib_error_t iolibLoaderPerformInventory(iolib_loader_t _loader) {
+    GET_CLASS(Loader, loader);
+
+    return loader->performInventory();
+}
+
+/**
+ * Moves the tape in the first storage element to the second. This call will
+ * block while the move is taking place.
+ */
+IOLIB_EXPORT iolib_error_t iolibLoaderMove(iolib_loader_t _loader,
+                                           iolib_storage_element_t _src,
+                                           iolib_storage_element_t _dest) {
+    GET_CLASS(Loader, loader);
+    GET_CLASS(Element, src);
+    GET_CLASS(Element, dest);
+
+    return loader->moveElement(src, dest);
+}
+
+/**
+ * Exchanges the media in the first storage element with that in the second.
+ * This call will block while the move is taking place.
+ */
+IOLIB_EXPORT iolib_error_t iolibLoaderExchange(iolib_loader_t _loader,
+                                               iolib_storage_element_t _src,
+                                               iolib_storage_element_t _dest) {
+    GET_CLASS(Loader, loader);
+    GET_CLASS(Element, src);
+    GET_CLASS(Element, dest);
+
+    return loader->exchangeElements(src, dest);
+}
+
+/**
+ * Populates an array with up to `outLen` storage elements of the given type.
+ *
+ * NOTE: Storage element objects are shared objects, i.e. every invocation will
+ * return the same objects. Do not attempt to free these elements.
+ */
+IOLIB_EXPORT iolib_error_t iolibLoaderGetElements(iolib_loader_t _loader,
+                                                  iolib_storage_element_type_t type,
+                                                  iolib_storage_element_t *out,
+                                                  size_t outLen) {
+    GET_CLASS(Loader, loader);
+
+    Element **outBuf = reinterpret_cast<Element **>(out);
+    loader->getElementsForType(type, outLen, outBuf);
+    return 0;
+}
+
+/**
+ * Describes all of the loader's elements in a single call. Returns the total
+ * number of elements; at most `max` records are written.
+ */
+IOLIB_EXPORT int iolibLoaderGetInventory(iolib_loader_t _loader, iolib_element_record_t *out,
+                                         size_t max, iolib_error_t *outErr) {
+    GET_CLASS(Loader, loader);
+
+    SET_ERROR(outErr, 0);
+    return loader->getInventory(out, max);
+}
+
+/////////////////////////// Storage Element Handling ///////////////////////////
+/**
+ * Returns the address of the storage element among elements of its type.
+ */
+IOLIB_EXPORT off_t iolibElementGetAddress(iolib_storage_element_t _element) {
+    GET_CLASS(Element, element);
+
+    return element->getAddress();
+}
+
+/**
+ * Returns a stringified UUID for this element. The UUID is not persistent.
+ */
+IOLIB_EXPORT iolib_string_t iolibElementGetUuid(iolib_storage_element_t _element) {
+    GET_CLASS(Element, element);
+
+    return _copyString(element->getUuid());
+}
+
+/**
+ * Get some flags that describe this storage element.
+ *
+ * NOTE: Flags are logically ORed together.
+ */
+IOLIB_EXPORT iolib_storage_element_flags_t iolibElementGetFlags(iolib_storage_element_t _element) {
+    GET_CLASS(Element, element);
+
+    return element->getFlags();
+}
+
+/**
+ * Return the label of the cartridge in the specified element. If the element
+ * is empty, NULL is returned.
+ */
+IOLIB_EXPORT iolib_string_t iolibElementGetLabel(iolib_storage_element_t _element) {
+    GET_CLASS(Element, element);
+
+    std::string tag = element->getVolumeTag();
+
+    if(tag.empty()) {
+        return NULL;
+    }
+
+    return _copyString(tag);
+}
+
+/**
+ * Gets the type of element.
+ */
+IOLIB_EXPORT iolib_storage_element_type_t iolibElementGetType(iolib_storage_element_t _element) {
+    GET_CLASS(Element, element);
+
+    return element->getType();
+}
+
+/////////////////////////////// Session Handling ///////////////////////////////
+/**
+ * Opens a session on the given library. Only a single session may be open at
+ * a time; the session handle is the library itself.
+ *
+ * Returns NULL if the library is unknown (ENODEV) or already in use (EBUSY.)
+ */
+IOLIB_EXPORT iolib_session_t iolibOpenSession(iolib_library_t *lib, iolib_error_t *outErr) {
+    std::lock_guard<std::mutex> lck(_ioLibSharedLock);
+
+    if(_ioLibShared == NULL || lib == NULL || lib->id == NULL ||
+       strcmp(lib->id, "virtual") != 0) {
+        SET_ERROR(outErr, ENODEV);
+        return NULL;
+    } else if(_sessionOpen) {
+        SET_ERROR(outErr, EBUSY);
+        return NULL;
+    }
+
+    _sessionOpen = true;
+
+    SET_ERROR(outErr, 0);
+    return static_cast<iolib_session_t>(_ioLibShared);
+}
+
+/**
+ * Closes a previously opened session, writing out the inventory.
+ */
+IOLIB_EXPORT iolib_error_t iolibCloseSession(iolib_session_t *session) {
+    std::lock_guard<std::mutex> lck(_ioLibSharedLock);
+
+    if(session == NULL || *session != _ioLibShared || !_sessionOpen) {
+        return EINVAL;
+    }
+
+    _ioLibShared->saveInventory();
+
+    _sessionOpen = false;
+    *session = NULL;
+
+    return 0;
+}
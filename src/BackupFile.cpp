@@ -3,8 +3,10 @@
 #include <glog/logging.h>
 
 #include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
 
 #include <boost/uuid/uuid_generators.hpp>
 
@@ -13,25 +15,27 @@ using boost::filesystem::path;
 /**
  * Creates a file object from the file with the given path. This does not load
  * any data from disk yet - metadata is only loaded when requested.
+ *
+ * The file is identified by an ID (or UUID) taken from the given allocator.
  */
-BackupFile::BackupFile(boost::filesystem::path path, BackupFile *parent) {
+BackupFile::BackupFile(boost::filesystem::path path, BackupFile *parent,
+					   FileIdAllocator *ids) {
 	this->path = path;
 	this->parent = parent;
 
-	// Create an UUID for the file
-	boost::uuids::basic_random_generator<boost::mt19937> gen;
-	this->uuid = gen();
+	if(ids->usesUuids()) {
+		this->uuid = ids->nextUuid();
+	} else {
+		this->id = ids->nextId();
+		this->uuid = boost::uuids::nil_uuid();
+	}
 }
 
 /**
  * Cleans up any stored information.
  */
 BackupFile::~BackupFile() {
-	// finish reading, if needed
-	this->finishedReading();
 
-	// De-allocate some buffers
-	free(this->fileEntry);
 }
 
 /**
@@ -85,6 +89,10 @@ int BackupFile::fetchMetadata() {
 /**
  * Prepares the file for reading. This will allocate its metadata structure for
  * more accurate file size tracking, and fetches all metadata.
+ *
+ * This must be called once, before the file is added to any chunk; chunks only
+ * read the metadata, since they may be built in parallel. The metadata must
+ * have been fetched already.
  */
 void BackupFile::prepareChunkMetadata() {
 	// Return if the chunk has already been prepared.
@@ -93,66 +101,45 @@ void BackupFile::prepareChunkMetadata() {
 	}
 	this->hasBeenPrepared = true;
 
-	// Fetch file data
-	CHECK(fetchMetadata() == 0) << "Could not read file metadata";
+	CHECK(this->hasMetadata) << "Metadata of " << this->path << " wasn't fetched";
 
-	// Calculate the size of the metadata header
-	size_t structSize = sizeof(chunk_file_entry_t);
-	size_t nameLength = strlen(this->path.c_str()) + 1; // +1 for NULL byte
+	/*
+	 * Write all the info we have into the entry. Only the root of the job has
+	 * its full path stored; everything else is relative to its parent.
+	 */
+	if(this->parent != NULL) {
+		this->fileEntry.name = this->path.filename().string();
+	} else {
+		this->fileEntry.name = this->path.string();
+	}
 
-	size_t fullSize = (structSize + nameLength);
-	this->fileEntrySize = fullSize;
+	this->fileEntry.flags = 0;
+	this->fileEntry.parentIndex = 0;
 
-	// Allocate the struct and write all the info we have into it
-	this->fileEntry = (chunk_file_entry_t *) malloc(fullSize + 16);
-	memset(this->fileEntry, 0, fullSize);
+	this->fileEntry.type = (this->isDirectory) ? kTypeDirectory : kTypeFile;
 
-	this->fileEntry->nameLenBytes = nameLength;
-	memcpy(&this->fileEntry->name, this->path.c_str(), nameLength);
+	this->fileEntry.timeModified = this->lastModified;
 
-	this->fileEntry->type = (this->isDirectory) ? kTypeDirectory : kTypeFile;
+	this->fileEntry.owner = this->owner;
+	this->fileEntry.group = this->group;
+	this->fileEntry.mode = this->mode;
 
-	this->fileEntry->timeModified = this->lastModified;
+	this->fileEntry.size = this->size;
 
-	this->fileEntry->owner = this->owner;
-	this->fileEntry->group = this->group;
-	this->fileEntry->mode = this->mode;
+	this->fileEntry.checksum = 0;
+	this->fileEntry.blobStartOff = 0;
+	this->fileEntry.blobLenBytes = 0;
+	this->fileEntry.blobFileOffset = 0;
 
-	this->fileEntry->size = this->size;
+	this->fileEntry.fileId = this->id;
+	std::copy(this->uuid.begin(), this->uuid.end(), this->fileEntry.fileUuid);
 
-	std::copy(this->uuid.begin(), this->uuid.end(), this->fileEntry->fileUuid);
-}
-
-/**
- * Prepares the file for reading, by mapping the entire file into virtual memory in
- * read-only mode.
- */
-void BackupFile::beginReading() {
-	// open the file and map it into memory.
-	if(this->isDirectory == false) {
-		this->fd = fopen(this->path.c_str(), "rb");
-		PLOG_IF(FATAL, this->fd == NULL) << "Couldn't open file " << this->path
-										 << " for reading";
-
-		int fd = fileno(this->fd);
-
-		this->mappedFile = mmap(NULL, this->size, PROT_READ, MAP_SHARED, fd, 0);
-		PLOG_IF(FATAL, this->mappedFile == MAP_FAILED) << "Couldn't map file";
-	}
-}
-
-/**
- * Unmaps the file from memory, and cleans up some temporary buffers that were
- * used while the file was being read.
- */
-void BackupFile::finishedReading() {
-	if(this->mappedFile != NULL) {
-		// get rid of the mapping, then close the file
-		munmap(this->mappedFile, this->size);
-		fclose(this->fd);
-
-		this->mappedFile = this->fd = NULL;
-	}
+	/*
+	 * Reserve space for the largest possible encoding of the entry, plus its
+	 * slots in the chunk's offset table and name index.
+	 */
+	this->fileEntrySize = ChunkFormat::maxEntrySize(this->fileEntry.name.size())
+						+ (sizeof(uint32_t) * 2);
 }
 
 /**
@@ -163,12 +150,33 @@ size_t BackupFile::bytesRemaining() {
 }
 
 /**
- * Copies `len` bytes from the memory mapped file region, starting at `offset` and
- * ending up in the buffer `dest.`
+ * Reads `len` bytes of the file, starting at `offset`, into the buffer `dest`.
+ * Each call opens the file itself, so different parts of a file may be read
+ * by several chunk builders in parallel.
  */
 void BackupFile::getDataOfLength(size_t len, off_t offset, void *dest) {
-	this->wasWrittenToChunk = true;
+	int fd = open(this->path.c_str(), O_RDONLY);
+	PLOG_IF(FATAL, fd == -1) << "Couldn't open file " << this->path
+							 << " for reading";
+
+	uint8_t *ptr = (uint8_t *) dest;
+
+	while(len > 0) {
+		ssize_t read = pread(fd, ptr, len, offset);
+
+		if(read == -1 && errno == EINTR) {
+			continue;
+		}
+
+		PLOG_IF(FATAL, read == -1) << "Couldn't read " << len << " bytes at "
+								   << offset << " from " << this->path;
+		CHECK(read != 0) << "Unexpected end of file " << this->path << " at "
+						 << offset << "; was it truncated?";
+
+		ptr += read;
+		offset += read;
+		len -= read;
+	}
 
-	void *ptr = (void *) (((uint8_t *) this->mappedFile) + offset);
-	memcpy(dest, ptr, len);
+	close(fd);
 }
@@ -12,20 +12,30 @@
 #include <boost/uuid/uuid.hpp>
 
 #include <TapeStructs.h>
+#include <ChunkFormat.h>
+
+#include "FileIdAllocator.hpp"
 
 class BackupFile {
 	// allow the Chunk class to access private methods
 	friend class Chunk;
 
 	public:
-		BackupFile(boost::filesystem::path, BackupFile *);
+		BackupFile(boost::filesystem::path, BackupFile *, FileIdAllocator *);
 		~BackupFile();
 
 		int fetchMetadata();
+		void prepareChunkMetadata();
 
 		boost::filesystem::path getPath() {
 			return this->path;
 		}
+		std::size_t getSize() {
+			return this->size;
+		}
+		bool isDir() {
+			return this->isDirectory;
+		}
 
 	protected:
 		boost::filesystem::path path;
@@ -44,31 +54,25 @@ class BackupFile {
 		// Set when the metadata has been read.
 		bool hasBeenPrepared = false;
 
+		// range most recently added to a chunk, when the file is split
 		struct {
 			off_t fileOffset = 0;
 			size_t length = 0;
-
-			off_t blobOffsetInChunk = 0;
 		} rangeInChunk;
-
-		// file descriptor for the file
-		FILE *fd = NULL;
-		// memory-mapped file
-		void *mappedFile = NULL;
-		// buffer to the generated file entry structure
-		chunk_file_entry_t *fileEntry = NULL;
+		// the file's entry; blob fields are filled in when the chunk is written
+		chunk_entry_t fileEntry;
+		// space reserved for the entry in the chunk header
 		size_t fileEntrySize = 0;
 
-		void prepareChunkMetadata();
-		void beginReading();
-		void finishedReading();
-
 		// how many bytes of the file are left to read
 		size_t bytesRemaining();
-		// reads len bytes at off to the buffer given
+		// reads len bytes at off to the buffer given; may be called from
+		// several threads at once
 		void getDataOfLength(size_t, off_t, void *);
 
 	private:
+		// identifies the file; only one of these is set, depending on mode
+		uint64_t id = 0;
 		boost::uuids::uuid uuid;
 
 		bool hasMetadata = false;
@@ -1,31 +1,89 @@
 #include "BackupJob.hpp"
 
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "NumaTopology.hpp"
+
 #include <glog/logging.h>
 
 #include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 using namespace boost::filesystem;
 
+std::map<std::string, BackupJob *> BackupJob::allJobs;
+std::mutex BackupJob::allJobsLock;
+
 /**
  * Creates a backup job, backing up the entire directory tree underneath the
  * specified root.
  */
-BackupJob::BackupJob(std::string root) {
+BackupJob::BackupJob(std::string root) : scanQueue("scan", SCAN_QUEUE_DEPTH),
+	buildQueue("build", _buildersPerNode()) {
     this->root = root;
 	this->rootPath = boost::filesystem::path(this->root);
 
     // Generate an UUID for the job
 	boost::uuids::basic_random_generator<boost::mt19937> gen;
 	this->uuid = gen();
+	this->id = boost::uuids::to_string(this->uuid);
+
+	// Files are identified relative to the job
+	this->fileIds = new FileIdAllocator(FILE_ID_USE_UUIDS);
 
 	// Create the thread pool
 	this->threadPool = new ctpl::thread_pool(DIR_ITERATOR_POOL_SZ);
 	LOG(INFO) << "Using " << DIR_ITERATOR_POOL_SZ << " threads for directory iteration";
 
+	/*
+	 * Set up the chunk sizer; chunks may be in flight while being created,
+	 * between being built and put back in order, waiting to be written, and
+	 * being written.
+	 */
+	this->totalBytes = 0;
+	this->sizer = new ChunkSizer(CHUNK_MIN_SIZE, CHUNK_MAX_SIZE,
+								 CHUNK_REORDER_WINDOW + MAX_CHUNKS_WAITING + 2);
+
+	// Create the pool that chunks are built on; every node gets its share
+	size_t numNodes = this->buildQueue.getNumNodes();
+	size_t numBuilders = _buildersPerNode() * numNodes;
+
+	this->builderPool = new ctpl::thread_pool(numBuilders);
+	LOG(INFO) << "Using " << numBuilders << " threads for building chunks";
+
+	for(size_t i = 0; i < numBuilders; i++) {
+		this->builderPool->push(boost::bind(&BackupJob::_builderEntry, this,
+											(int) (i % numNodes)));
+	}
+
 	// Create and configure chunk postprocessor
-	this->postProcessor = new ChunkPostprocessor(this->uuid);
+	this->postProcessor = new ChunkPostprocessor(this->uuid, this->sizer,
+												 &this->stats);
+
+	// Every drive can be writing a chunk, with more waiting for it
+	size_t numDrives = this->postProcessor->getNumDrives();
+	size_t inFlight = CHUNK_REORDER_WINDOW +
+					  (numDrives * (MAX_CHUNKS_WAITING + 1)) + 1;
+
+	// The spool holds some more, waiting for and being written to disk, and
+	// being read back
+	if(this->postProcessor->isSpooling()) {
+		inFlight += CHUNK_SPOOL_MAX_CHUNKS_WAITING + 2;
+	}
+
+	this->sizer->setChunksInFlight(inFlight);
+
+	// Make the job visible to the API
+	std::lock_guard<std::mutex> lk(allJobsLock);
+	allJobs[this->id] = this;
 }
 
 /**
@@ -34,17 +92,26 @@ BackupJob::BackupJob(std::string root) {
 BackupJob::~BackupJob() {
 	// Cancel the job
 	this->cancel();
+
+	// Release all files
+	for(auto it = this->backupFiles.begin(); it != this->backupFiles.end(); it++) {
+		delete *it;
+	}
+
+	delete this->fileIds;
+	delete this->sizer;
 }
 
 /**
  * Starts the backup job.
  */
 void BackupJob::start() {
-	// Start the directory scan.
-	this->_beginDirectoryScan();
+	// Start the directory scan; chunks are created from its results as it runs
+	std::thread scanner(&BackupJob::_beginDirectoryScan, this);
 
-	// TODO: Make this run on its own thread pls
 	this->_chunkCreatorEntry();
+
+	scanner.join();
 }
 
 /**
@@ -52,25 +119,54 @@ void BackupJob::start() {
  * blocking call.
  */
 void BackupJob::cancel() {
-	// Kill the thread pool
+	// Remove the job from the list first, so nobody reads its stats anymore
+	{
+		std::lock_guard<std::mutex> lk(allJobsLock);
+		allJobs.erase(this->id);
+	}
+
+	// Nothing to do if the job was already cancelled
+	if(this->postProcessor == NULL) {
+		return;
+	}
+
+	// Stop accepting work
+	this->scanQueue.close();
+	this->buildQueue.close();
+
+	// Kill the thread pools
 	this->threadPool->stop(true);
 	delete this->threadPool;
 
+	this->builderPool->stop(true);
+	delete this->builderPool;
+
 	// Get rid of the post-processor
 	delete this->postProcessor;
+
+	this->threadPool = this->builderPool = NULL;
+	this->postProcessor = NULL;
 }
 
 
 /**
  * Builds the list of files to be backed up, i.e. iterating a directory in a
- * recursive manner.
+ * recursive manner. Files are pushed onto the scan queue as they're found;
+ * it's closed once the scan is done.
  */
 void BackupJob::_beginDirectoryScan() {
 	// Submit the initial job to the thread pool
 	this->threadPool->push(boost::bind(&BackupJob::_directoryScannerEntry, this));
 
 	this->threadPool->stop(true);
-	LOG(INFO) << "Found " << this->backupFiles.size() << " files/directories";
+	LOG(INFO) << "Found " << this->backupFiles.size() << " files/directories ("
+			  << this->totalBytes << " bytes)";
+
+	// Chunks never need to be larger than the job
+	this->sizer->setJobSize(this->totalBytes);
+
+	// Let the chunk creator know there won't be any more files
+	this->scanQueue.close();
 }
 
 /**
@@ -80,19 +176,30 @@ void BackupJob::_directoryScannerEntry() {
 	LOG(INFO) << "Beginning directory scan of " << this->rootPath;
 
 	// Create a file entry for the root directory
-	BackupFile root = BackupFile(this->rootPath, NULL);
-	this->backupFiles.push_back(root);
+	BackupFile *root = new BackupFile(this->rootPath, NULL, this->fileIds);
+	CHECK(root->fetchMetadata() == 0) << "Couldn't read " << this->rootPath;
 
-	this->backupFiles.reserve(10000);
+	{
+		std::lock_guard<std::mutex> lock(this->backupFilesLock);
+
+		this->backupFiles.reserve(10000);
+		this->backupFiles.push_back(root);
+	}
+
+	this->stats.filesScanned.add(1);
+	this->scanQueue.push(root);
 
 	// Begin scanning the root directory.
-	this->_scanDirectory(this->rootPath, &root);
+	this->_scanDirectory(this->rootPath, root);
 }
 
 /**
  * Scans a single directory. This function is called recursively.
  */
 void BackupJob::_scanDirectory(path inPath, BackupFile *parent) {
+	Trace::setThreadName("scanner");
+	TraceScope trace("scan", "directory");
+
 	// if it's a directory, recurse through it
     if(is_directory(inPath)) {
         for(auto& entry : boost::make_iterator_range(directory_iterator(inPath), {})) {
@@ -106,50 +213,115 @@ void BackupJob::_scanDirectory(path inPath, BackupFile *parent) {
 			path newPath(entry);
 
 			//if(!newPath.filename_is_dot() && !newPath.filename_is_dot_dot()) {
-				BackupFile file = BackupFile(newPath, parent);
-				this->backupFiles.push_back(file);
+				BackupFile *file = new BackupFile(newPath, parent, this->fileIds);
+
+				/*
+				 * Get its metadata while we're in a worker thread; the chunk
+				 * creator uses it as is. Files that vanished (or can't be read)
+				 * since the directory was listed are skipped.
+				 */
+				if(file->fetchMetadata() != 0) {
+					LOG(WARNING) << "Skipping " << newPath << ", since its metadata "
+								 << "couldn't be read";
+
+					delete file;
+					continue;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(this->backupFilesLock);
+					this->backupFiles.push_back(file);
+				}
+
+				if(!file->isDir()) {
+					this->totalBytes += file->getSize();
+					this->stats.bytesScanned.add(file->getSize());
+				}
+
+				// This may block, if chunk creation is falling behind; if it
+				// stopped (since the job failed), so does the scan
+				if(!this->scanQueue.push(file)) {
+					return;
+				}
 
 	            // Is what we found a directory?
-				if(is_directory(entry)) {
+				if(file->isDir()) {
 					// If so, submit a job to scan it to the thread pool
 					this->threadPool->push(boost::bind(&BackupJob::_scanDirectory, this,
-													   newPath, &file));
+													   newPath, file));
 				}
+
+				this->stats.filesScanned.add(1);
 			//}
 		}
     }
 }
 
 /**
- * Pulls files out of the queue one by one, creating new chunks for them. When
- * a chunk is completed, it's pushed onto the chunk queue.
+ * Pulls files out of the scan queue one by one, creating new chunks for them.
+ * When a chunk is completed, it's handed to the builder pool.
+ *
+ * Files that are larger than a chunk skip the usual fill heuristics; they're
+ * cut into chunk-sized segments up front, each of which gets its own chunk.
+ *
+ * If one of the job's chunks couldn't be written, the job failed; no more
+ * chunks are created, and the scan stops queuing files.
  */
 void BackupJob::_chunkCreatorEntry() {
-	LOG(INFO) << "Beginning chunk creation (chunk size = " << CHUNK_MAX_SIZE << ")";
+	Trace::setThreadName("chunk creator");
+
+	LOG(INFO) << "Beginning chunk creation (chunk size = "
+			  << this->sizer->getChunkSize() << ")";
 
 	Chunk *chunk = NULL;
 	int status;
 
-	for(auto it = this->backupFiles.begin(); it != this->backupFiles.end(); it++) {
+	BackupFile *file;
+
+	while(this->scanQueue.pop(&file)) {
+		if(this->postProcessor->hasFailed()) {
+			LOG(ERROR) << "Stopping chunk creation, since job " << this->id << " failed";
+
+			this->scanQueue.close();
+			break;
+		}
+
+		size_t chunkSize = this->sizer->getChunkSize();
+
+		/*
+		 * Build the file's entry here, once, rather than in the chunks: a file
+		 * (or directory) can be in several chunks that are built in parallel.
+		 * Directories are queued before anything in them, so every ancestor is
+		 * prepared before a chunk that refers to it is built.
+		 */
+		file->prepareChunkMetadata();
+
+		// Large files take the fast path
+		if(!file->isDir() &&
+		   file->getSize() > (chunkSize - Chunk::kHeaderAreaReservedSpace)) {
+			_chunkAddLargeFile(file, chunkSize);
+			continue;
+		}
+
 		do {
 			// If there isn't a chunk, create one
 			if(chunk == NULL) {
-				chunk = new Chunk(CHUNK_MAX_SIZE);
+				chunk = _newChunk(chunkSize);
 				DLOG(INFO) << "Crated new chunk";
 			}
 
 			// Attempt to add it
-			status = _chunkAddFile(&(*it), chunk);
+			status = _chunkAddFile(file, chunk);
 
 			// Check for errors
 			if(status == -1) {
-				LOG(FATAL) << "Error adding file " << (*it).getPath();
+				LOG(FATAL) << "Error adding file " << file->getPath();
 				break;
 			}
 
 			// If this chunk is done, get rid of it.
 			if(status == 1) {
-				_chunkFinished(chunk);
+				_buildChunk(chunk);
 
 				// NULL will create a new chunk on the next iteration
 				chunk = NULL;
@@ -159,22 +331,147 @@ void BackupJob::_chunkCreatorEntry() {
 		} while(status != 0);
 	}
 
-	// done
-	_chunkFinished(chunk);
+	// done; if the job failed, the last chunk isn't worth building
+	if(chunk != NULL && this->postProcessor->hasFailed()) {
+		delete chunk;
+	} else if(chunk != NULL) {
+		_buildChunk(chunk);
+	}
+
+	_waitForBuilds();
 	LOG(INFO) << "Finished generating chunks";
 }
 
 /**
- * Moves the chunk indicated to the finished chunk queue, where it is picked up by
- * the post-processor thread.
+ * Allocates a new, empty chunk of the given size for this job.
+ */
+Chunk *BackupJob::_newChunk(size_t size) {
+	Chunk *chunk = new Chunk(size);
+
+	chunk->setMerkleSegmentSize(CHUNK_MERKLE_SEGMENT_SIZE);
+	chunk->setUsesFileUuids(this->fileIds->usesUuids());
+
+	return chunk;
+}
+
+/**
+ * Cuts a file that is larger than a chunk into segments that fill an entire
+ * chunk each (the last one being whatever is left) and builds their chunks in
+ * parallel.
+ */
+void BackupJob::_chunkAddLargeFile(BackupFile *file, size_t chunkSize) {
+	const size_t pageSz = sysconf(_SC_PAGESIZE);
+
+	// Segments are a multiple of the page size, like split files' blobs
+	size_t segmentSize = chunkSize - Chunk::kHeaderAreaReservedSpace;
+	segmentSize -= (segmentSize % pageSz);
+
+	size_t fileSize = file->getSize();
+	size_t numSegments = (fileSize + segmentSize - 1) / segmentSize;
+
+	LOG(INFO) << "Splitting " << file->getPath() << " (" << fileSize
+			  << " bytes) into " << numSegments << " segments of "
+			  << segmentSize << " bytes";
+
+	for(size_t offset = 0; offset < fileSize; offset += segmentSize) {
+		if(this->postProcessor->hasFailed()) {
+			break;
+		}
+
+		size_t length = std::min(segmentSize, fileSize - offset);
+
+		Chunk *chunk = _newChunk(chunkSize);
+		chunk->addFileSegment(file, offset, length);
+
+		_buildChunk(chunk);
+	}
+}
+
+/**
+ * Assigns the chunk its index, then queues it to be built by the builder pool,
+ * where it's finalized and sent to the post-processor. If all builders are busy,
+ * this blocks until one is free, so that there are never more chunks waiting
+ * than builders.
+ */
+void BackupJob::_buildChunk(Chunk *chunk) {
+	// Number chunks in the order they're created; this may block
+	chunk->setChunkNumber(this->postProcessor->reserveChunkIndex());
+
+	/*
+	 * Place the chunk on the node the drive is attached to, so it can be
+	 * written without crossing the interconnect. If that isn't known, spread
+	 * chunks over all nodes. It's built and post-processed on that node, too.
+	 */
+	int node = this->postProcessor->getNumaNode();
+
+	if(node < 0) {
+		node = chunk->getChunkNumber() % this->buildQueue.getNumNodes();
+	}
+
+	chunk->setNumaNode(node);
+
+	bool queued = this->buildQueue.push(chunk, node);
+
+	CHECK(queued) << "Tried to build a chunk after the job was cancelled";
+}
+
+/**
+ * Returns the number of chunk builders for each node; the pool is split evenly
+ * between all nodes, but each of them gets at least one builder.
+ */
+size_t BackupJob::_buildersPerNode() {
+	return std::max((size_t) 1, CHUNK_BUILDER_POOL_SZ / NumaTopology::getNumNodes());
+}
+
+/**
+ * Entry point for the chunk builder threads; builds chunks placed on the given
+ * node until the queue is closed and empty.
+ */
+void BackupJob::_builderEntry(int node) {
+	Chunk *chunk;
+
+	Trace::setThreadName("chunk builder");
+	NumaTopology::bindThread(node);
+
+	while(this->buildQueue.pop(node, &chunk)) {
+		_chunkFinished(chunk);
+	}
+}
+
+/**
+ * Waits for all chunks that were handed to the builder pool to be built. No
+ * more chunks may be built afterwards.
+ */
+void BackupJob::_waitForBuilds() {
+	this->buildQueue.close();
+
+	this->builderPool->stop(true);
+}
+
+/**
+ * Builds the chunk, then moves it to the finished chunk queue, where it is
+ * picked up by the post-processor thread. This runs on the builder pool.
  */
 void BackupJob::_chunkFinished(Chunk *chunk) {
 	// finalize the chunk
-	chunk->finalize();
+	auto start = std::chrono::steady_clock::now();
+
+	{
+		TraceScope trace("build", "finalize", "chunk", chunk->getChunkNumber());
+		chunk->finalize();
+	}
+
+	std::chrono::duration<double> finalizeTime = std::chrono::steady_clock::now() - start;
+	Metrics::chunkFinalizeTime.observe(finalizeTime.count());
+	Metrics::chunkBuildTime.observe(chunk->getAge());
+	Metrics::chunksBuilt.add(1);
+
+	this->stats.chunksBuilt.add(1);
+	this->stats.bytesRead.add(chunk->getDataSize());
 
 	// send it off to the post processor
 	DLOG(INFO) << "Finished chunk: " << chunk->getUsedSpace()
-			   << " bytes used (out of " << CHUNK_MAX_SIZE << ")";
+			   << " bytes used (out of " << chunk->getMaxSize() << ")";
 
 	// Notify chunk postprocessor
 	this->postProcessor->newChunkAvailable(chunk);
@@ -191,7 +488,10 @@ int BackupJob::_chunkAddFile(BackupFile *file, Chunk *chunk) {
 	Chunk::Add_File_Status status;
 
 	// Attempt to add this file to the chunk
-	status = chunk->addFile(file);
+	{
+		TraceScope trace("create", "addFile");
+		status = chunk->addFile(file);
+	}
 
 	// DLOG(INFO) << "Added " << file->getPath() << ": " << status;
 
@@ -223,3 +523,81 @@ int BackupJob::_chunkAddFile(BackupFile *file, Chunk *chunk) {
 			return 0;
 	}
 }
+
+
+/**
+ * Returns the IDs of all jobs that currently exist.
+ */
+std::vector<std::string> BackupJob::getJobIds() {
+	std::lock_guard<std::mutex> lk(allJobsLock);
+	std::vector<std::string> ids;
+
+	for(auto it = allJobs.begin(); it != allJobs.end(); it++) {
+		ids.push_back(it->first);
+	}
+
+	return ids;
+}
+
+/**
+ * Takes a snapshot of the counters of the job with the given ID. Returns false
+ * if there is no such job.
+ */
+bool BackupJob::getStatsForJob(std::string id, job_stats_snapshot_t *out) {
+	std::lock_guard<std::mutex> lk(allJobsLock);
+
+	auto it = allJobs.find(id);
+
+	if(it == allJobs.end()) {
+		return false;
+	}
+
+	it->second->_fillStats(out);
+	return true;
+}
+
+/**
+ * Gets the tape locations of all chunks the job with the given ID has written
+ * so far. Returns false if there is no such job.
+ */
+bool BackupJob::getChunkLocationsForJob(std::string id,
+										std::vector<chunk_location_t> *out) {
+	std::lock_guard<std::mutex> lk(allJobsLock);
+
+	auto it = allJobs.find(id);
+
+	if(it == allJobs.end()) {
+		return false;
+	}
+
+	*out = it->second->postProcessor->getChunkLocations();
+	return true;
+}
+
+/**
+ * Fills in the snapshot for this job: its counters, as well as the state of the
+ * queues between each stage, and how long each stage spent waiting on them.
+ */
+void BackupJob::_fillStats(job_stats_snapshot_t *out) {
+	out->id = this->id;
+	out->root = this->root;
+
+	this->stats.fill(out);
+
+	bounded_queue_stats_t scan = this->scanQueue.getStats();
+	bounded_queue_stats_t build = this->buildQueue.getStats();
+
+	out->queues["scan"] = scan;
+	out->queues["build"] = build;
+
+	// The chunk creator may also wait for the writer to catch up
+	double indexWait = this->postProcessor->getIndexWaitTime();
+
+	out->stages["scan"] = { 0, scan.pushWaitTime };
+	out->stages["create"] = { scan.popWaitTime, build.pushWaitTime + indexWait };
+
+	// Post-processing and writing stages
+	this->postProcessor->fillStats(out);
+
+	out->stages["build"] = { build.popWaitTime, out->queues["postprocess"].pushWaitTime };
+}
@@ -13,24 +13,58 @@
 #define DIR_ITERATOR_POOL_SZ 4
 
 /**
- * Maximum chunk size, in bytes.
+ * Maximum number of files found by the directory scan that may be waiting to
+ * be added to chunks.
  */
+#define SCAN_QUEUE_DEPTH 4096
+
+/**
+ * Number of threads that build (finalize) chunks in parallel; they are split
+ * evenly between NUMA nodes. Each node can also have as many chunks waiting to
+ * be built as it has builders.
+ */
+#define CHUNK_BUILDER_POOL_SZ 4
+
+/**
+ * Bounds for the chunk size, in bytes. The actual size is picked for each job
+ * at runtime, based on the job size, drive speed and available memory.
+ */
+#define CHUNK_MIN_SIZE ((size_t) (1024LL * 1024 * 64))
 #define CHUNK_MAX_SIZE ((size_t) (1024LL * 1024 * 1024 * 2))
 
+/**
+ * Size of the segments that a chunk's data is split into for its Merkle tree,
+ * in bytes. Set to 0 to not generate a tree.
+ */
+#define CHUNK_MERKLE_SEGMENT_SIZE ((size_t) (1024 * 1024))
+
+/**
+ * Set to 1 to identify files by random UUIDs, as older versions did, rather
+ * than by compact IDs that are unique within the job.
+ */
+#define FILE_ID_USE_UUIDS 0
+
 #include <string>
 #include <ctime>
 #include <queue>
 #include <vector>
+#include <map>
 #include <mutex>
+#include <atomic>
 
 #include <boost/filesystem.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/thread.hpp>
 #include <CTPL/ctpl.h>
 
+#include "BoundedQueue.hpp"
+#include "NumaQueue.hpp"
 #include "Chunk.hpp"
 #include "BackupFile.hpp"
+#include "FileIdAllocator.hpp"
 #include "ChunkPostprocessor.hpp"
+#include "ChunkSizer.hpp"
+#include "JobStats.hpp"
 
 
 class BackupJob {
@@ -41,23 +75,62 @@ class BackupJob {
 		void start();
 		void cancel();
 
+		std::string getId() {
+			return this->id;
+		}
+
+		static std::vector<std::string> getJobIds();
+		static bool getStatsForJob(std::string, job_stats_snapshot_t *);
+		static bool getChunkLocationsForJob(std::string,
+											std::vector<chunk_location_t> *);
+
     private:
         std::string root;
     	boost::filesystem::path rootPath;
 
     	boost::uuids::uuid uuid;
+    	// string form of the UUID, used to refer to the job in the API
+    	std::string id;
+    	FileIdAllocator *fileIds;
+
+        // files are heap allocated so their addresses stay valid as parents
+        std::vector<BackupFile *> backupFiles;
+        std::mutex backupFilesLock;
+        // bytes of file data found by the scan
+        std::atomic<uint64_t> totalBytes;
 
-        std::vector<BackupFile> backupFiles;
+		ChunkSizer *sizer;
+
+		JobStats stats;
 
 		ctpl::thread_pool *threadPool;
 		ChunkPostprocessor *postProcessor;
 
+		// files found by the scan, in the order they were found
+		BoundedQueue<BackupFile *> scanQueue;
+
+		// finished chunks waiting to be built, on the node they're placed on
+		NumaQueue<Chunk *> buildQueue;
+		ctpl::thread_pool *builderPool;
+
 		void _beginDirectoryScan();
 		void _scanDirectory(boost::filesystem::path path, BackupFile *);
 
 		void _directoryScannerEntry();
 
+		void _fillStats(job_stats_snapshot_t *);
+
+		// all jobs that currently exist, by their ID
+		static std::map<std::string, BackupJob *> allJobs;
+		static std::mutex allJobsLock;
+
 		void _chunkCreatorEntry();
+		Chunk *_newChunk(size_t);
+		void _chunkAddLargeFile(BackupFile *, size_t);
+		void _buildChunk(Chunk *);
+		static size_t _buildersPerNode();
+		void _builderEntry(int);
+		void _waitForBuilds();
 		void _chunkFinished(Chunk *chunk);
 		int _chunkAddFile(BackupFile *file, Chunk *chunk);
 };
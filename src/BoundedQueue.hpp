@@ -0,0 +1,199 @@
+/**
+ * A bounded, blocking multi-producer/multi-consumer queue, used to pass work
+ * between the stages of a backup job (scan, chunk build, post-processing and
+ * writing.) Producers block while the queue is full, which throttles any stage
+ * that runs ahead of the ones after it.
+ *
+ * Once a queue is closed, no more items can be pushed; consumers can still pop
+ * all items that remain, after which pop() returns false. Every queue tracks
+ * its depth, and how often producers and consumers had to wait.
+ */
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "Trace.hpp"
+
+/**
+ * Counters describing a queue's use.
+ */
+typedef struct {
+	size_t depth;
+	size_t capacity;
+	// largest depth the queue has had
+	size_t maxDepth;
+
+	uint64_t pushed;
+	uint64_t popped;
+
+	// number of times a producer found the queue full, or a consumer found it
+	// empty, and the total time (in seconds) they spent waiting
+	uint64_t pushWaits;
+	uint64_t popWaits;
+
+	double pushWaitTime;
+	double popWaitTime;
+} bounded_queue_stats_t;
+
+template <typename T> class BoundedQueue {
+	public:
+		/**
+		 * Creates a queue that holds at most `capacity` items; the name is only
+		 * used for logging.
+		 */
+		BoundedQueue(std::string name, size_t capacity) {
+			this->name = name;
+			this->capacity = (capacity == 0) ? 1 : capacity;
+		}
+
+		/**
+		 * Adds an item to the queue, blocking as long as it's full. Returns
+		 * false, without adding the item, if the queue was closed.
+		 */
+		bool push(T item) {
+			std::unique_lock<std::mutex> lk(this->lock);
+
+			if(this->items.size() >= this->capacity && !this->closed) {
+				TraceScope trace("queue push wait", this->name.c_str());
+				auto start = std::chrono::steady_clock::now();
+
+				this->notFull.wait(lk, [this] {
+					return (this->items.size() < this->capacity || this->closed);
+				});
+
+				this->pushWaits++;
+				this->pushWaitTime += std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+			}
+
+			if(this->closed) {
+				return false;
+			}
+
+			this->items.push(item);
+			this->pushed++;
+
+			if(this->items.size() > this->maxDepth) {
+				this->maxDepth = this->items.size();
+			}
+
+			lk.unlock();
+			this->notEmpty.notify_one();
+
+			return true;
+		}
+
+		/**
+		 * Removes the item at the head of the queue, blocking as long as it's
+		 * empty. Returns false if the queue is closed and no items are left.
+		 */
+		bool pop(T *out) {
+			std::unique_lock<std::mutex> lk(this->lock);
+
+			if(this->items.empty() && !this->closed) {
+				TraceScope trace("queue pop wait", this->name.c_str());
+				auto start = std::chrono::steady_clock::now();
+
+				this->notEmpty.wait(lk, [this] {
+					return (!this->items.empty() || this->closed);
+				});
+
+				this->popWaits++;
+				this->popWaitTime += std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+			}
+
+			if(this->items.empty()) {
+				return false;
+			}
+
+			*out = this->items.front();
+			this->items.pop();
+			this->popped++;
+
+			lk.unlock();
+			this->notFull.notify_one();
+
+			return true;
+		}
+
+		/**
+		 * Closes the queue, waking up all producers and consumers waiting on
+		 * it, and logs its counters.
+		 */
+		void close() {
+			{
+				std::lock_guard<std::mutex> lk(this->lock);
+
+				if(this->closed) {
+					return;
+				}
+
+				this->closed = true;
+			}
+
+			this->notFull.notify_all();
+			this->notEmpty.notify_all();
+
+			bounded_queue_stats_t stats = this->getStats();
+
+			LOG(INFO) << "Queue '" << this->name << "' closed: " << stats.pushed
+					  << " items pushed, max depth " << stats.maxDepth << "/"
+					  << stats.capacity << "; producers waited "
+					  << stats.pushWaits << " times (" << stats.pushWaitTime
+					  << " sec), consumers waited " << stats.popWaits
+					  << " times (" << stats.popWaitTime << " sec)";
+		}
+
+		/**
+		 * Returns a snapshot of the queue's counters.
+		 */
+		bounded_queue_stats_t getStats() {
+			std::lock_guard<std::mutex> lk(this->lock);
+
+			bounded_queue_stats_t stats;
+
+			stats.depth = this->items.size();
+			stats.capacity = this->capacity;
+			stats.maxDepth = this->maxDepth;
+			stats.pushed = this->pushed;
+			stats.popped = this->popped;
+			stats.pushWaits = this->pushWaits;
+			stats.popWaits = this->popWaits;
+			stats.pushWaitTime = this->pushWaitTime;
+			stats.popWaitTime = this->popWaitTime;
+
+			return stats;
+		}
+
+		std::string getName() {
+			return this->name;
+		}
+
+	private:
+		std::string name;
+		size_t capacity;
+
+		std::mutex lock;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+
+		std::queue<T> items;
+		bool closed = false;
+
+		size_t maxDepth = 0;
+		uint64_t pushed = 0, popped = 0;
+		uint64_t pushWaits = 0, popWaits = 0;
+		double pushWaitTime = 0, popWaitTime = 0;
+};
+
+#endif
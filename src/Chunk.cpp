@@ -5,8 +5,17 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
 #include "TapeStructs.h"
 #include "crc32.h"
+#include "MerkleTree.h"
+#include "ChunkFormat.h"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "NumaTopology.hpp"
 
 /**
  * When this is set, we attempt to use superpages to allocate the backing store,
@@ -33,6 +42,16 @@ Chunk::Chunk(size_t size) {
 	// Store the size of the chunk
 	this->backingStoreMaxSize = size;
 	this->backingStoreBytesUsed = this->backingStoreActualSize = 0;
+
+	this->creationTime = std::chrono::steady_clock::now();
+}
+
+/**
+ * Returns the time since the chunk was created, in seconds.
+ */
+double Chunk::getAge() {
+	std::chrono::duration<double> age = std::chrono::steady_clock::now() - this->creationTime;
+	return age.count();
 }
 
 /**
@@ -53,6 +72,7 @@ void Chunk::_allocateBackingStore() {
 
 			use_superpages = false;
 			_allocateBackingStore();
+			return;
 		}
 	} else {
 		// Attempt a regular allocation.
@@ -66,6 +86,14 @@ void Chunk::_allocateBackingStore() {
 						<< this->backingStoreActualSize << " using normal pages";
 		}
 	}
+
+	// Place the pages on the chunk's node; nothing has touched them yet
+	if(this->numaNode >= 0) {
+		NumaTopology::bindMemory(this->backingStore, this->backingStoreActualSize,
+								 this->numaNode);
+	}
+
+	Metrics::chunkBufferBytesAllocated.add(this->backingStoreActualSize);
 }
 
 /**
@@ -80,6 +108,8 @@ Chunk::~Chunk() {
 	if(err != 0) {
 		PLOG(ERROR) << "Couldn't unmap 0x" << std::hex << this->backingStore
 					<< std::dec << " (chunk backing store)";
+	} else {
+		Metrics::chunkBufferBytesFreed.add(this->backingStoreActualSize);
 	}
 }
 
@@ -98,8 +128,7 @@ Chunk::Add_File_Status Chunk::addFile(BackupFile *file) {
 	size_t bytesFree = this->backingStoreMaxSize - this->backingStoreBytesUsed
 												 - kHeaderAreaReservedSpace;
 
-	// Read metadata and prepare internal structures, if needed
-	file->prepareChunkMetadata();
+	CHECK(file->hasBeenPrepared) << "Metadata of " << file->path << " wasn't prepared";
 
 	/*
 	 * If the file we've been handed is a directory, add it to the chunk without any
@@ -107,7 +136,7 @@ Chunk::Add_File_Status Chunk::addFile(BackupFile *file) {
 	 * that space, as directories have no real data.
 	 */
 	if(file->isDirectory) {
-		this->files.push_back(file);
+		this->files.push_back({ file, 0, 0 });
 
 		file->wasWrittenToChunk = file->fullyWrittenToChunk = true;
 		return Add_File_Status::Success;
@@ -145,7 +174,7 @@ Chunk::Add_File_Status Chunk::addFile(BackupFile *file) {
 		file->rangeInChunk.length = file->size;
 
 		// Add to storage
-		this->files.push_back(file);
+		this->files.push_back({ file, 0, file->size });
 		this->backingStoreBytesUsed += file->size + file->fileEntrySize;
 
 		/*bytesFree = this->backingStoreMaxSize - this->backingStoreBytesUsed;
@@ -199,7 +228,8 @@ Chunk::Add_File_Status Chunk::_addFilePartial(BackupFile *file) {
 				   << ", length " << file->rangeInChunk.length;
 
 		// Store it
-		this->files.push_back(file);
+		this->files.push_back({ file, file->rangeInChunk.fileOffset,
+								file->rangeInChunk.length });
 		return Add_File_Status::Success;
 	}
 
@@ -223,10 +253,23 @@ Chunk::Add_File_Status Chunk::_addFilePartial(BackupFile *file) {
 			   << ", length " << file->rangeInChunk.length;
 
 	// This file can be partially added.
-	this->files.push_back(file);
+	this->files.push_back({ file, file->rangeInChunk.fileOffset,
+							file->rangeInChunk.length });
 	return Add_File_Status::Partial;
 }
 
+/**
+ * Adds the given range of a file's data to the chunk, without checking whether
+ * there is space for it; this is used for large files, which are cut into
+ * segments up front.
+ */
+void Chunk::addFileSegment(BackupFile *file, off_t offset, size_t length) {
+	CHECK(file->hasBeenPrepared) << "Metadata of " << file->path << " wasn't prepared";
+
+	this->files.push_back({ file, offset, length });
+	this->backingStoreBytesUsed += length + file->fileEntrySize;
+}
+
 
 /**
  * Actually creates the raw chunk data in memory for all files.
@@ -234,15 +277,57 @@ Chunk::Add_File_Status Chunk::_addFilePartial(BackupFile *file) {
 void Chunk::finalize() {
 	const size_t pageSz = sysconf(_SC_PAGESIZE);
 
-	// Calculate how many bytes we need for headers and data
-	size_t headerSz = sizeof(chunk_header_t);
+	/*
+	 * Every ancestor directory of a file needs to have an entry in this chunk,
+	 * so paths can be reconstructed from it alone. Directories that were added
+	 * to a different chunk get a reference entry after all of our own files;
+	 * they were prepared before any of their children.
+	 */
+	std::vector<BackupFile *> entryFiles;
+	std::unordered_map<BackupFile *, size_t> entryIndex;
+
+	const size_t numFiles = this->files.size();
+
+	for(size_t i = 0; i < numFiles; i++) {
+		entryFiles.push_back(this->files[i].file);
+		entryIndex.emplace(this->files[i].file, i);
+	}
+
+	for(size_t i = 0; i < numFiles; i++) {
+		BackupFile *parent = this->files[i].file->parent;
+
+		while(parent != NULL && entryIndex.count(parent) == 0) {
+			CHECK(parent->hasBeenPrepared) << "Metadata of " << parent->path
+										   << " wasn't prepared";
+
+			entryIndex.emplace(parent, entryFiles.size());
+			entryFiles.push_back(parent);
+
+			parent = parent->parent;
+		}
+	}
+
+	/*
+	 * Calculate how many bytes we need for headers and data. Each file reserves
+	 * space for the largest possible encoding of its entry, since the blob
+	 * offsets in it aren't known until the header size is.
+	 */
+	size_t numEntries = entryFiles.size();
+
+	size_t entryTableOff = sizeof(chunk_header_v2_t);
+	size_t nameIndexOff = entryTableOff + (numEntries * sizeof(uint32_t));
+	size_t entriesOff = nameIndexOff + (numEntries * sizeof(uint32_t));
+
+	size_t headerSz = sizeof(chunk_header_v2_t);
 	size_t dataSz = 0;
 
-	for(auto it = this->files.begin(); it != this->files.end(); it++) {
+	for(auto it = entryFiles.begin(); it != entryFiles.end(); it++) {
 		headerSz += (*it)->fileEntrySize;
+	}
 
+	for(auto it = this->files.begin(); it != this->files.end(); it++) {
 		// Calculate how much space in the blob area the file needs
-		size_t blobSpaceUsed = (*it)->rangeInChunk.length;
+		size_t blobSpaceUsed = it->length;
 
 		if((blobSpaceUsed % pageSz) != 0) {
 			blobSpaceUsed += pageSz - (blobSpaceUsed % pageSz);
@@ -258,9 +343,21 @@ void Chunk::finalize() {
 
 	off_t dataOffset = headerSz;
 
+	// If a Merkle tree is desired, reserve space for its leaves after the data
+	size_t numSegments = 0, leavesSz = 0;
+
+	if(this->merkleSegmentSize != 0 && dataSz != 0) {
+		numSegments = MerkleTree::numSegmentsForLength(dataSz, this->merkleSegmentSize);
+		leavesSz = numSegments * MERKLE_HASH_SIZE;
+
+		if((leavesSz % pageSz) != 0) {
+			leavesSz += pageSz - (leavesSz % pageSz);
+		}
+	}
+
 
 	// Calculate how much space we need to allocate in RAM
-	size_t bufferSize = headerSz + dataSz;
+	size_t bufferSize = headerSz + dataSz + leavesSz;
 
 	if((bufferSize % pageSz) != 0) {
 		bufferSize += pageSz - (bufferSize % pageSz);
@@ -273,37 +370,70 @@ void Chunk::finalize() {
 
 
 	// Fill chunk header
-	chunk_header_t *header = (chunk_header_t *) this->backingStore;
-	memset(header, 0, sizeof(chunk_header_t));
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->backingStore;
+	memset(header, 0, sizeof(chunk_header_v2_t));
 
-	header->version = 0x00010000;
-	header->numFileEntries = this->files.size();
+	header->version = CHUNK_VERSION_2;
+	header->chunkIndex = this->chunkIndex;
+	header->numFileEntries = numEntries;
+	header->flags = (this->fileUuids) ? kChunkFlagFileUuids : 0;
 	header->chunkLenBytes = this->backingStoreActualSize;
+	header->headerLenBytes = headerSz;
 	header->encryption.method = CHUNK_ENCRYPTION_NONE;
 
+	header->entryTableOff = entryTableOff;
+	header->nameIndexOff = nameIndexOff;
+	header->entriesOff = entriesOff;
+
+	// Describe the Merkle tree; the hashes are calculated in post-processing.
+	if(numSegments != 0) {
+		header->merkle.hashType = CHUNK_HASH_SHA256;
+		header->merkle.segmentSize = this->merkleSegmentSize;
+		header->merkle.numSegments = numSegments;
+		header->merkle.dataStartOff = headerSz;
+		header->merkle.dataLenBytes = dataSz;
+		header->merkle.leavesStartOff = headerSz + dataSz;
+	}
 
-	// Copy all the file headers, as well as file data itself
-	uint8_t *fileEntries = (uint8_t *) &header->entry;
-	for(auto it = this->files.begin(); it != this->files.end(); it++) {
-		BackupFile *file = *it;
-		chunk_file_entry_t *entry = (chunk_file_entry_t *) fileEntries;
 
-		std::string name(((char *) &file->fileEntry->name),
-						 file->fileEntry->nameLenBytes);
-		// LOG(INFO) << "Placing file " << name;
+	// Copy the file data itself, then encode all the file entries
+	uint8_t *base = (uint8_t *) this->backingStore;
+
+	uint32_t *entryTable = (uint32_t *) (base + entryTableOff);
+	uint8_t *entriesBase = base + entriesOff;
+	size_t entriesLen = 0;
+
+	// Entries are copied, since split files show up in several chunks
+	std::vector<chunk_entry_t> entries;
+	entries.reserve(numEntries);
 
-		// Copy the entry into the header and increment the write ptr
-		memcpy(entry, file->fileEntry, file->fileEntrySize);
-		fileEntries += file->fileEntrySize;
+	// time spent checksumming, which is reported once all data is copied
+	std::chrono::steady_clock::duration crcTime(0);
 
+	for(size_t i = 0; i < numEntries; i++) {
+		BackupFile *file = entryFiles[i];
 
+		entries.push_back(file->fileEntry);
+		chunk_entry_t *entry = &entries.back();
+
+		// Point to the parent's entry in this chunk
+		entry->parentIndex = 0;
+
+		if(file->parent != NULL) {
+			entry->parentIndex = entryIndex[file->parent] + 1;
+		}
+
+		// Reference entries don't have any data in this chunk
+		if(i >= numFiles) {
+			entry->flags |= kEntryFlagReference;
+		}
 		// Perform additional steps if the file has data
-		if(file->isDirectory == false) {
-			file->beginReading();
+		else if(file->isDirectory == false) {
+			const file_range_t &range = this->files[i];
 
 			// Determine the location of the file
-			file->rangeInChunk.blobOffsetInChunk = dataOffset;
-			dataOffset += file->rangeInChunk.length;
+			off_t blobOffset = dataOffset;
+			dataOffset += range.length;
 
 			/*
 			 * Round up the location where the next file is placed to be a multiple
@@ -316,36 +446,108 @@ void Chunk::finalize() {
 			}
 
 			// Populate the location of the blob
-			entry->blobFileOffset = file->rangeInChunk.fileOffset;
-			entry->blobLenBytes = file->rangeInChunk.length;
-			entry->blobStartOff = file->rangeInChunk.blobOffsetInChunk;
+			entry->blobFileOffset = range.fileOffset;
+			entry->blobLenBytes = range.length;
+			entry->blobStartOff = blobOffset;
 
 			/*DLOG(INFO) << "\tWriting " << entry->blobLenBytes << " to "
 					   << entry->blobStartOff;*/
 
 
 			// Copy the data
-			void *dataDst = ((uint8_t *) this->backingStore) + entry->blobStartOff;
+			void *dataDst = base + entry->blobStartOff;
 			file->getDataOfLength(entry->blobLenBytes, entry->blobFileOffset, dataDst);
 
 			// Calculate CRC-32
-			entry->checksum = crc32c(0, dataDst, entry->blobLenBytes);
+			auto crcStart = std::chrono::steady_clock::now();
+			{
+				TraceScope trace("build", "crc", "bytes", entry->blobLenBytes);
+				entry->checksum = crc32c(0, dataDst, entry->blobLenBytes);
+			}
+			crcTime += std::chrono::steady_clock::now() - crcStart;
 
-			// We don't need the file's data anymore.
-			file->finishedReading();
+			this->dataBytes += entry->blobLenBytes;
 		}
+
+		// Encode the entry and record where it went
+		entryTable[i] = entriesLen;
+		entriesLen += ChunkFormat::encodeEntry(*entry, header->flags,
+												 entriesBase + entriesLen);
+	}
+
+	header->entriesLenBytes = entriesLen;
+
+	Metrics::crcBytes.add(this->dataBytes);
+	Metrics::crcTime.add(std::chrono::duration_cast<std::chrono::nanoseconds>(crcTime).count());
+
+	/*
+	 * Build the name index, so entries can be found by binary search; they are
+	 * sorted by parent first, so all children of a directory are adjacent.
+	 */
+	uint32_t *nameIndex = (uint32_t *) (base + nameIndexOff);
+
+	for(size_t i = 0; i < numEntries; i++) {
+		nameIndex[i] = i;
 	}
+
+	std::sort(nameIndex, nameIndex + numEntries, [&entries](uint32_t a, uint32_t b) {
+		return ChunkFormat::entryLessThan(entries[a], entries[b]);
+	});
+}
+
+/**
+ * Hashes every segment of the data area into the leaves of the Merkle tree,
+ * then calculates its root. This is a no-op if the chunk has no tree.
+ */
+void Chunk::buildMerkleTree() {
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->backingStore;
+
+	if(header->merkle.hashType == CHUNK_HASH_NONE) {
+		return;
+	}
+
+	uint8_t *base = (uint8_t *) this->backingStore;
+	uint8_t *leaves = base + header->merkle.leavesStartOff;
+
+	MerkleTree::hashSegments(base + header->merkle.dataStartOff,
+							 header->merkle.dataLenBytes,
+							 header->merkle.segmentSize, 0,
+							 header->merkle.numSegments, leaves);
+	MerkleTree::computeRoot(leaves, header->merkle.numSegments,
+							header->merkle.rootHash);
 }
 
 /**
  * Writes the backup job UUID into the header.
  */
 void Chunk::setJobUuid(boost::uuids::uuid uuid) {
-	chunk_header_t *header = (chunk_header_t *) this->backingStore;
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->backingStore;
 
 	std::copy(uuid.begin(), uuid.end(), header->jobUuid);
 }
 
+/**
+ * Reads the backup job UUID from the header.
+ */
+boost::uuids::uuid Chunk::getJobUuid() {
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->backingStore;
+	boost::uuids::uuid uuid;
+
+	std::copy(header->jobUuid, header->jobUuid + sizeof(header->jobUuid), uuid.begin());
+	return uuid;
+}
+
+/**
+ * Calculates the checksum over the header area. This must be done after all
+ * other header fields (including the Merkle tree root) are filled in.
+ */
+void Chunk::updateHeaderChecksum() {
+	chunk_header_v2_t *header = (chunk_header_v2_t *) this->backingStore;
+
+	header->headerChecksum = ChunkFormat::headerChecksum(header,
+														 header->headerLenBytes);
+}
+
 /**
  * Changes the protection flags on the backing store to disallow any further writes,
  * once the chunk is ready to be written out.
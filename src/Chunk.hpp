@@ -6,6 +6,7 @@
 #define CHUNK_H
 
 #include <vector>
+#include <chrono>
 #include <cstdint>
 
 #include "BackupFile.hpp"
@@ -13,6 +14,8 @@
 class Chunk {
 	friend class ChunkPostprocessor;
 	friend class TapeWriter;
+	friend class DriveWriter;
+	friend class ChunkSpool;
 
 	public:
 		typedef enum {
@@ -36,25 +39,54 @@ class Chunk {
 			Error = -1,
 		} Add_File_Status;
 
+	public:
+		// length of the reserved header area, in bytes
+		static const std::size_t kHeaderAreaReservedSpace = (1024 * 512);
+
 	public:
 		Chunk(std::size_t);
 		~Chunk();
 
 		Add_File_Status addFile(BackupFile *);
+		void addFileSegment(BackupFile *, off_t, size_t);
 
 		size_t getUsedSpace() { return this->backingStoreBytesUsed; }
+		size_t getMaxSize() { return this->backingStoreMaxSize; }
+		size_t getDataSize() { return this->dataBytes; }
+
+		double getAge();
 
 		void finalize();
+		void buildMerkleTree();
+		void updateHeaderChecksum();
 		void stopWriting();
 
+		void setMerkleSegmentSize(size_t size) {
+			this->merkleSegmentSize = size;
+		}
+		void setUsesFileUuids(bool uuids) {
+			this->fileUuids = uuids;
+		}
+
+		// the index is assigned at creation, and written to the header when
+		// the chunk is finalized
 		void setChunkNumber(uint64_t idx) {
-			((chunk_header_t *) this->backingStore)->chunkIndex = idx;
+			this->chunkIndex = idx;
 		}
 		uint64_t getChunkNumber() {
-			return ((chunk_header_t *) this->backingStore)->chunkIndex;
+			return this->chunkIndex;
+		}
+
+		// node the backing store is allocated on, or -1 for any node
+		void setNumaNode(int node) {
+			this->numaNode = node;
+		}
+		int getNumaNode() {
+			return this->numaNode;
 		}
 
 		void setJobUuid(boost::uuids::uuid);
+		boost::uuids::uuid getJobUuid();
 
 	protected:
 
@@ -66,12 +98,31 @@ class Chunk {
 
 		void *backingStore;
 
-		// length of the reserved header area, in bytes
-		static const std::size_t kHeaderAreaReservedSpace = (1024 * 512);
+		// size of the segments hashed into the Merkle tree; 0 to disable it
+		std::size_t merkleSegmentSize = 0;
+		// whether entries hold file UUIDs instead of IDs
+		bool fileUuids = false;
+		// index of the chunk within the job
+		uint64_t chunkIndex = 0;
+		// bytes of file data in the chunk; set when finalized
+		std::size_t dataBytes = 0;
+		// when the chunk was created
+		std::chrono::steady_clock::time_point creationTime;
+		// NUMA node the backing store should be placed on
+		int numaNode = -1;
+
 		// minimum amount of free space to add a file
 		static const std::size_t kMinFreeSpace = (1024 * 1024);
 
-		std::vector<BackupFile *> files;
+		// a file, and the part of its data that is stored in this chunk
+		typedef struct {
+			BackupFile *file;
+
+			off_t fileOffset;
+			size_t length;
+		} file_range_t;
+
+		std::vector<file_range_t> files;
 
 
 		Add_File_Status _addFilePartial(BackupFile *file);
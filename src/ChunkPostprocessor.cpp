@@ -1,90 +1,170 @@
 #include "ChunkPostprocessor.hpp"
 
+#include "Trace.hpp"
+#include "NumaTopology.hpp"
+
 #include <glog/logging.h>
 #include <boost/thread.hpp>
 
+#include <algorithm>
+
 /**
- * Creates the chunk postprocessor, including the worker thread. The worker
- * thread will sleep until it is signaled that a new chunk is available.
+ * Creates the chunk postprocessor, including the worker threads. The workers
+ * sleep until a new chunk is available.
+ *
+ * The tape writer reports its measurements to the given chunk sizer, and all
+ * stages update the given job counters.
  */
-ChunkPostprocessor::ChunkPostprocessor(boost::uuids::uuid uuid) {
-	this->lastChunkIndex = 0;
-
+ChunkPostprocessor::ChunkPostprocessor(boost::uuids::uuid uuid, ChunkSizer *sizer,
+									   JobStats *stats) :
+	queue("postprocess", _threadsPerNode()) {
 	this->backupJobUuid = uuid;
+	this->stats = stats;
+
+	// Set up tape writer, which may be shared with other jobs; chunks are put
+	// back in order (and maybe spooled) before reaching it
+	this->writer = TapeWriter::acquire();
+	this->writer->addJob(uuid, sizer, stats);
+
+	std::string spoolDir = CHUNK_SPOOL_DIR;
+
+	if(!spoolDir.empty()) {
+		this->spool = new ChunkSpool(spoolDir, uuid, this->writer);
+	}
+
+	this->reorder = new ChunkReorderBuffer(this->writer, this->spool);
 
-	// Create worker thread
-	this->threadPool = new ctpl::thread_pool(POSTPROCESSOR_THREAD_POOL_SIZE);
-	LOG(INFO) << "Using " << POSTPROCESSOR_THREAD_POOL_SIZE
-			  << " threads for chunk postprocessing";
+	// Create worker threads; every node gets its share
+	size_t numNodes = this->queue.getNumNodes();
+	size_t numThreads = _threadsPerNode() * numNodes;
 
-	this->threadPool->push(boost::bind(&ChunkPostprocessor::_workerEntry, this));
+	this->threadPool = new ctpl::thread_pool(numThreads);
+	LOG(INFO) << "Using " << numThreads << " threads for chunk postprocessing";
 
-	// Set up tape writer
-	this->writer = new TapeWriter();
+	for(size_t i = 0; i < numThreads; i++) {
+		this->threadPool->push(boost::bind(&ChunkPostprocessor::_workerEntry, this,
+										   (int) (i % numNodes)));
+	}
 }
 
 /**
- * Cleans up the postprocessor.
+ * Cleans up the postprocessor. Any chunks that are still queued are processed
+ * and handed to the writer first.
  */
 ChunkPostprocessor::~ChunkPostprocessor() {
-	// Empty the chunk queue
-	this->queueMutex.lock();
+	// Close the queue, then wait for the workers to drain it
+	this->queue.close();
 
-	while(!this->queue.empty()) {
-		delete this->queue.front();
-		this->queue.pop();
-	}
+	this->threadPool->stop(true);
+	delete this->threadPool;
 
-	this->queueMutex.unlock();
+	// Drain the spool, then wait for the rest of the job to be written
+	delete this->reorder;
 
-	// Stop the main worker thread
-	this->shouldRun = false;
-	this->chunkSignal.notify_all();
+	if(this->spool) {
+		delete this->spool;
+	}
 
-	// Wait for all other worker processes to stop
-	this->threadPool->stop(true);
-	delete this->threadPool;
+	this->writer->removeJob(this->backupJobUuid);
+	TapeWriter::release(this->writer);
+}
 
-	// Delete the writer
-	delete this->writer;
+/**
+ * Returns the index for the next chunk that is created. This blocks while too
+ * many chunks are waiting to be written, so that chunks are only created as
+ * fast as they can be written out.
+ */
+uint64_t ChunkPostprocessor::reserveChunkIndex() {
+	return this->reorder->reserveIndex();
 }
 
 /**
- * Signals the condition variable that the worker thread is sleeping on, telling
- * it that a new chunk is available to process.
+ * Returns the node that chunks should be placed on, so that they're close to
+ * the drive they are written to; -1 if it isn't known.
+ */
+int ChunkPostprocessor::getNumaNode() {
+	return this->writer->getNumaNode();
+}
+
+/**
+ * Queues a chunk for post-processing on its node. This blocks while all of the
+ * node's workers are busy and its queue is full.
  */
 void ChunkPostprocessor::newChunkAvailable(Chunk *chunk) {
-	// Push chunk onto queue
-    std::lock_guard<std::mutex> lock(this->queueMutex);
-	this->queue.push(chunk);
+	bool queued = this->queue.push(chunk, chunk->getNumaNode());
 
-	// Notify worker thread
-	this->chunkSignal.notify_all();
+	CHECK(queued) << "Tried to queue a chunk after the postprocessor was shut down";
 }
 
 /**
- * Worker thread entry point
+ * Adds the state of the post-processing and writing stages, and of the drives,
+ * to the snapshot.
  */
-void ChunkPostprocessor::_workerEntry() {
-	while(this->shouldRun) {
-		// Wait for the thread to be woken
-		std::mutex m;
-	    std::unique_lock<std::mutex> lk(m);
-		this->chunkSignal.wait(lk);
+void ChunkPostprocessor::fillStats(job_stats_snapshot_t *out) {
+	bounded_queue_stats_t postprocess = this->queue.getStats();
+	bounded_queue_stats_t write = this->writer->getQueueStats();
 
+	out->queues["postprocess"] = postprocess;
+	out->queues["write"] = write;
 
-		// Fetch a chunk from the head of the queue
-		this->queueMutex.lock();
+	// Chunks only reach the write queue through the reorder buffer, and the
+	// spool if there is one
+	out->hasSpool = (this->spool != NULL);
 
-		Chunk *chunk = this->queue.front();
-		this->queue.pop();
+	if(this->spool) {
+		bounded_queue_stats_t spool = this->spool->getQueueStats();
+		out->spool = this->spool->getStats();
 
-		this->queueMutex.unlock();
+		out->queues["spool"] = spool;
 
+		out->stages["postprocess"] = { postprocess.popWaitTime, spool.pushWaitTime };
+		out->stages["spool"] = { spool.popWaitTime, out->spool.spaceWaitTime };
+	} else {
+		out->stages["postprocess"] = { postprocess.popWaitTime, write.pushWaitTime };
+	}
 
-		// Do shit to this chunk
-		this->threadPool->push(boost::bind(&ChunkPostprocessor::_processChunk,
-										   this, chunk));
+	out->stages["write"] = { write.popWaitTime, 0 };
+
+	TapeVerifier *verifier = this->writer->getVerifier();
+
+	out->hasVerifier = (verifier != NULL);
+
+	if(verifier) {
+		out->verify = verifier->getStats();
+	}
+
+	std::vector<tape_drive_stats_t> drives = this->writer->getDriveStats();
+	out->drives.insert(out->drives.end(), drives.begin(), drives.end());
+}
+
+/**
+ * Returns the total time spent waiting for a chunk index, in seconds.
+ */
+double ChunkPostprocessor::getIndexWaitTime() {
+	return this->reorder->getWindowWaitTime();
+}
+
+/**
+ * Returns the number of worker threads for each node; the pool is split evenly
+ * between all nodes, but each of them gets at least one thread.
+ */
+size_t ChunkPostprocessor::_threadsPerNode() {
+	return std::max((size_t) 1, POSTPROCESSOR_THREAD_POOL_SIZE /
+								NumaTopology::getNumNodes());
+}
+
+/**
+ * Worker thread entry point; processes chunks placed on the given node until
+ * the queue is closed and empty.
+ */
+void ChunkPostprocessor::_workerEntry(int node) {
+	Chunk *chunk;
+
+	Trace::setThreadName("postprocessor");
+	NumaTopology::bindThread(node);
+
+	while(this->queue.pop(node, &chunk)) {
+		_processChunk(chunk);
 	}
 }
 
@@ -93,15 +173,23 @@ void ChunkPostprocessor::_workerEntry() {
  */
 void ChunkPostprocessor::_processChunk(Chunk *chunk) {
 	DLOG(INFO) << "Got chunk to post-process";
+	TraceScope trace("postprocess", "postprocess", "chunk", chunk->getChunkNumber());
 
-	// Set the chunk index, write backup UUID, then encrypt if needed
-	chunk->setChunkNumber(this->lastChunkIndex++);
+	// Write backup UUID, then encrypt if needed
 	chunk->setJobUuid(this->backupJobUuid);
 
+	// Hash the data area into the Merkle tree, if the chunk has one
+	chunk->buildMerkleTree();
+
+	// All header fields are now final, so it can be checksummed.
+	chunk->updateHeaderChecksum();
+
 	// Disallow any further writes to the chunk.
 	chunk->stopWriting();
 
-	// When we're done, forward it to the tape writer.
+	// When we're done, forward it to the tape writer, in order.
 	DLOG(INFO) << "Finished post-processing chunk " << chunk->getChunkNumber();
-	this->writer->addChunkToQueue(chunk);
+	this->stats->chunksProcessed.add(1);
+
+	this->reorder->insert(chunk);
 }
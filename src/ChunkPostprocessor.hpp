@@ -8,44 +8,63 @@
 
 /**
  * Defines how many threads should be allocated for post-processing chunks prior
- * to writing them to the tape.
+ * to writing them to the tape. They are split evenly between NUMA nodes.
  */
 #define POSTPROCESSOR_THREAD_POOL_SIZE	4
 
-#include <queue>
-#include <mutex>
-#include <condition_variable>
-#include <atomic>
-
 #include <CTPL/ctpl.h>
 #include <boost/uuid/uuid.hpp>
 
+#include "NumaQueue.hpp"
 #include "Chunk.hpp"
 #include "TapeWriter.hpp"
+#include "ChunkReorderBuffer.hpp"
+#include "ChunkSpool.hpp"
+#include "ChunkSizer.hpp"
+#include "JobStats.hpp"
 
 class ChunkPostprocessor {
 	public:
-		ChunkPostprocessor(boost::uuids::uuid);
+		ChunkPostprocessor(boost::uuids::uuid, ChunkSizer *, JobStats *);
 		~ChunkPostprocessor();
 
+		uint64_t reserveChunkIndex();
+		int getNumaNode();
 		void newChunkAvailable(Chunk *);
 
+		void fillStats(job_stats_snapshot_t *);
+		double getIndexWaitTime();
+
+		bool isSpooling() {
+			return (this->spool != NULL);
+		}
+		size_t getNumDrives() {
+			return this->writer->getNumDrives();
+		}
+		std::vector<chunk_location_t> getChunkLocations() {
+			return this->writer->getChunkLocations(this->backupJobUuid);
+		}
+		bool hasFailed() {
+			return this->writer->hasJobFailed(this->backupJobUuid);
+		}
+
 	private:
 		boost::uuids::uuid backupJobUuid;
+		JobStats *stats;
 
 		ctpl::thread_pool *threadPool;
 
-		std::mutex queueMutex;
-		std::queue<Chunk *> queue;
-
-		std::condition_variable chunkSignal;
-		bool shouldRun = true;
-
-		std::atomic<uint64_t> lastChunkIndex;
+		// chunks are processed on the node their memory is on
+		NumaQueue<Chunk *> queue;
 
 		TapeWriter *writer;
+		ChunkReorderBuffer *reorder;
+		// stages chunks on disk before they're written; NULL if disabled
+		ChunkSpool *spool = NULL;
+
+		static size_t _threadsPerNode();
 
-		void _workerEntry();
+		void _workerEntry(int);
 		void _processChunk(Chunk *);
 };
 
@@ -0,0 +1,126 @@
+#include "ChunkReorderBuffer.hpp"
+
+#include "Trace.hpp"
+
+#include <glog/logging.h>
+
+#include <chrono>
+
+/**
+ * Creates a reorder buffer that releases chunks to the given writer, or to the
+ * spool if one is given.
+ */
+ChunkReorderBuffer::ChunkReorderBuffer(TapeWriter *writer, ChunkSpool *spool) {
+	this->writer = writer;
+	this->spool = spool;
+}
+
+/**
+ * Deletes any chunks that could not be released, because a chunk ahead of them
+ * never arrived (i.e. the job was cancelled.)
+ */
+ChunkReorderBuffer::~ChunkReorderBuffer() {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	if(!this->pending.empty()) {
+		LOG(WARNING) << "Discarding " << this->pending.size() << " chunk(s) "
+					 << "still waiting for chunk " << this->nextRelease;
+	}
+
+	for(auto it = this->pending.begin(); it != this->pending.end(); it++) {
+		delete it->second;
+	}
+}
+
+/**
+ * Returns the index for the next chunk. This blocks while there are already
+ * CHUNK_REORDER_WINDOW chunks that have not been released to the writer.
+ */
+uint64_t ChunkReorderBuffer::reserveIndex() {
+	std::unique_lock<std::mutex> lk(this->lock);
+
+	if(this->nextIndex >= (this->nextRelease + CHUNK_REORDER_WINDOW)) {
+		DLOG(INFO) << "Reorder window full; waiting for chunk " << this->nextRelease;
+
+		TraceScope trace("reorder wait", "window", "waitingFor", this->nextRelease);
+		auto start = std::chrono::steady_clock::now();
+
+		this->windowSignal.wait(lk, [this] {
+			return (this->nextIndex < (this->nextRelease + CHUNK_REORDER_WINDOW));
+		});
+
+		this->windowWaitTime += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	return this->nextIndex++;
+}
+
+/**
+ * Returns the total time the chunk creator has spent waiting for the window to
+ * move, in seconds.
+ */
+double ChunkReorderBuffer::getWindowWaitTime() {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	return this->windowWaitTime;
+}
+
+/**
+ * Adds a post-processed chunk to the buffer. If it is the next chunk to be
+ * written, it (and any chunks after it that are already waiting) is handed to
+ * the writer; this may block if the writer's queue is full.
+ */
+void ChunkReorderBuffer::insert(Chunk *chunk) {
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		uint64_t index = chunk->getChunkNumber();
+
+		CHECK(index >= this->nextRelease && index < this->nextIndex)
+			<< "Chunk " << index << " is outside the reorder window ["
+			<< this->nextRelease << ", " << this->nextIndex << ")";
+
+		this->pending[index] = chunk;
+	}
+
+	this->_release();
+}
+
+/**
+ * Hands all chunks that are next in sequence to the writer. Only one thread
+ * releases chunks at a time.
+ */
+void ChunkReorderBuffer::_release() {
+	std::lock_guard<std::mutex> rl(this->releaseLock);
+
+	while(true) {
+		Chunk *chunk;
+
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+			auto it = this->pending.find(this->nextRelease);
+
+			if(it == this->pending.end()) {
+				return;
+			}
+
+			chunk = it->second;
+			this->pending.erase(it);
+		}
+
+		if(this->spool) {
+			this->spool->addChunk(chunk);
+		} else {
+			this->writer->addChunkToQueue(chunk);
+		}
+
+		// Move the window forward
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->nextRelease++;
+		}
+
+		this->windowSignal.notify_all();
+	}
+}
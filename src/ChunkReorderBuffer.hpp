@@ -0,0 +1,63 @@
+/**
+ * Sits in front of the tape writer, and releases chunks to it strictly in the
+ * order of their indexes, even though they finish post-processing in any order.
+ * If the job spools chunks to disk, they're released to the spool instead.
+ *
+ * The buffer is bounded by only handing out a chunk index if it is within a
+ * window of the next index to be released; the chunk creator blocks until the
+ * window moves. All chunks between creation and release therefore fit into the
+ * window, and the chunk the writer is waiting on can always make progress.
+ */
+#ifndef CHUNKREORDERBUFFER_H
+#define CHUNKREORDERBUFFER_H
+
+/**
+ * Maximum number of chunks that may exist between having their index assigned,
+ * and being released to the writer.
+ */
+#define CHUNK_REORDER_WINDOW	8
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "Chunk.hpp"
+#include "TapeWriter.hpp"
+#include "ChunkSpool.hpp"
+
+class ChunkReorderBuffer {
+	public:
+		ChunkReorderBuffer(TapeWriter *, ChunkSpool *);
+		~ChunkReorderBuffer();
+
+		uint64_t reserveIndex();
+		void insert(Chunk *);
+
+		double getWindowWaitTime();
+
+	private:
+		TapeWriter *writer;
+		// chunks are released to the spool instead, if there is one
+		ChunkSpool *spool;
+
+		std::mutex lock;
+		std::condition_variable windowSignal;
+
+		// index the next chunk will get, and the next one to be released
+		uint64_t nextIndex = 0;
+		uint64_t nextRelease = 0;
+
+		// total time spent waiting for the window to move, in seconds
+		double windowWaitTime = 0;
+
+		// chunks that finished before the ones ahead of them
+		std::map<uint64_t, Chunk *> pending;
+
+		// held while releasing chunks, so they reach the writer in order
+		std::mutex releaseLock;
+
+		void _release();
+};
+
+#endif
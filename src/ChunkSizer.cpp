@@ -0,0 +1,170 @@
+#include "ChunkSizer.hpp"
+
+#include <glog/logging.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "Chunk.hpp"
+
+// Chunk sizes are rounded to a multiple of this
+static const size_t kSizeGranularity = (1024 * 1024);
+
+/**
+ * Creates a chunk sizer that picks sizes between the given minimum and maximum,
+ * assuming that at most `chunksInFlight` chunks exist at any given time.
+ */
+ChunkSizer::ChunkSizer(size_t minSize, size_t maxSize, unsigned int chunksInFlight) {
+	this->minSize = minSize;
+	this->maxSize = std::max(minSize, maxSize);
+	this->chunksInFlight = std::max(chunksInFlight, 1U);
+
+	// Figure out the memory budget
+	uint64_t physMem = (uint64_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	this->memoryBudget = (uint64_t) (physMem * CHUNK_SIZER_MEMORY_FRACTION);
+
+	LOG(INFO) << "Chunk size bounds: " << this->minSize << " - " << this->maxSize
+			  << " bytes; memory budget " << this->memoryBudget << " bytes for "
+			  << this->chunksInFlight << " chunks in flight";
+
+	this->chunkSize = 0;
+
+	std::lock_guard<std::mutex> lk(this->lock);
+	this->_recalculate("initial size");
+}
+
+/**
+ * Sets the total number of bytes in the job, once it is known. No chunk needs
+ * to be larger than that.
+ */
+void ChunkSizer::setJobSize(uint64_t bytes) {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	this->jobSize = bytes;
+	this->_recalculate("job size is " + std::to_string(bytes) + " bytes");
+}
+
+/**
+ * Updates the number of chunks that may exist at once; this changes as the
+ * number of drives the chunks are written to is known.
+ */
+void ChunkSizer::setChunksInFlight(unsigned int chunksInFlight) {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	this->chunksInFlight = std::max(chunksInFlight, 1U);
+	this->_recalculate(std::to_string(this->chunksInFlight) + " chunks in flight");
+}
+
+/**
+ * Records that `bytes` of chunk data were written to the drive in `seconds`
+ * seconds, excluding any fixed costs.
+ */
+void ChunkSizer::recordWrite(uint64_t bytes, double seconds) {
+	if(seconds < CHUNK_SIZER_MIN_SAMPLE_TIME || bytes == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	double rate = bytes / seconds;
+
+	if(this->haveRate) {
+		this->writeRate += CHUNK_SIZER_EWMA_WEIGHT * (rate - this->writeRate);
+	} else {
+		this->writeRate = rate;
+		this->haveRate = true;
+	}
+
+	this->_recalculate("drive rate is " + std::to_string((uint64_t) this->writeRate)
+					   + " bytes/sec");
+}
+
+/**
+ * Records the fixed cost of a chunk (such as the time to write a filemark or to
+ * swap a tape) in seconds.
+ */
+void ChunkSizer::recordFixedCost(double seconds) {
+	if(seconds < 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	if(this->haveFixedCost) {
+		this->fixedCost += CHUNK_SIZER_EWMA_WEIGHT * (seconds - this->fixedCost);
+	} else {
+		this->fixedCost = seconds;
+		this->haveFixedCost = true;
+	}
+
+	this->_recalculate("fixed cost per chunk is " + std::to_string(this->fixedCost)
+					   + " sec");
+}
+
+/**
+ * Calculates the chunk size from the current state, and logs it if it
+ * changed. The lock must be held.
+ */
+void ChunkSizer::_recalculate(std::string reason) {
+	/*
+	 * Start out with the size at which the fixed costs are the target fraction
+	 * of the time spent writing; then apply all the limits.
+	 */
+	double ideal = (this->writeRate * this->fixedCost) / CHUNK_SIZER_TARGET_OVERHEAD;
+
+	uint64_t size = this->maxSize;
+	std::string limit = "maximum size";
+
+	// Clamp it while it's a double, since casting one that's out of range is
+	// undefined
+	if(ideal < (double) this->maxSize) {
+		size = (uint64_t) ideal;
+		limit = "drive throughput";
+	}
+
+	uint64_t memLimit = this->memoryBudget / this->chunksInFlight;
+
+	if(size > memLimit) {
+		size = memLimit;
+		limit = "memory budget";
+	}
+
+	uint64_t jobLimit = this->jobSize + Chunk::kHeaderAreaReservedSpace;
+
+	if(this->jobSize != 0 && size > jobLimit) {
+		size = jobLimit;
+		limit = "job size";
+	}
+
+	if(size < this->minSize) {
+		size = this->minSize;
+		limit = "minimum size";
+	}
+
+	// Round up to the granularity, but never past the maximum
+	size = ((size + kSizeGranularity - 1) / kSizeGranularity) * kSizeGranularity;
+	size = std::min(size, (uint64_t) this->maxSize);
+
+	// Only change the size if the difference is large enough
+	size_t current = this->chunkSize;
+
+	if(current != 0) {
+		double change = std::fabs((double) size - current) / current;
+
+		if(change <= CHUNK_SIZER_HYSTERESIS) {
+			return;
+		}
+	}
+
+	this->chunkSize = size;
+
+	if(current == 0) {
+		LOG(INFO) << "Chunk size set to " << size << " bytes (" << reason
+				  << "; limited by " << limit << ")";
+	} else {
+		LOG(INFO) << "Chunk size changed from " << current << " to " << size
+				  << " bytes (" << reason << "; limited by " << limit << ")";
+	}
+}
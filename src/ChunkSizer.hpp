@@ -0,0 +1,97 @@
+/**
+ * Picks the size of chunks for a backup job at runtime. Chunks should be large
+ * enough that fixed per-chunk costs (writing a filemark, loader latency) are a
+ * small fraction of the time spent streaming data to the drive, but no larger
+ * than the job itself, and small enough that all chunks in flight fit into the
+ * memory budget.
+ *
+ * The size is recalculated whenever the job size is known, or when the tape
+ * writer reports new measurements; the result is always within the configured
+ * minimum and maximum.
+ */
+#ifndef CHUNKSIZER_H
+#define CHUNKSIZER_H
+
+/**
+ * Drive write rate assumed until one has been measured, in bytes per second.
+ */
+#define CHUNK_SIZER_DEFAULT_RATE		((double) (300LL * 1024 * 1024))
+
+/**
+ * Fixed cost of each chunk (filemark, loader latency) assumed until one has
+ * been measured, in seconds.
+ */
+#define CHUNK_SIZER_DEFAULT_FIXED_COST	2.0
+
+/**
+ * The fixed costs of a chunk should take no more than this fraction of the
+ * time spent writing it.
+ */
+#define CHUNK_SIZER_TARGET_OVERHEAD		0.02
+
+/**
+ * Fraction of physical memory that chunks in flight may take up.
+ */
+#define CHUNK_SIZER_MEMORY_FRACTION		0.25
+
+/**
+ * Weight given to a new measurement in the moving averages of the write rate
+ * and fixed costs.
+ */
+#define CHUNK_SIZER_EWMA_WEIGHT			0.25
+
+/**
+ * The chunk size is only changed if the new size differs from the current one
+ * by more than this fraction, to avoid logging every small fluctuation.
+ */
+#define CHUNK_SIZER_HYSTERESIS			0.1
+
+/**
+ * Writes shorter than this (in seconds) are too noisy to measure the rate.
+ */
+#define CHUNK_SIZER_MIN_SAMPLE_TIME		0.05
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+class ChunkSizer {
+	public:
+		ChunkSizer(size_t, size_t, unsigned int);
+
+		size_t getChunkSize() {
+			return this->chunkSize;
+		}
+
+		void setJobSize(uint64_t);
+		void setChunksInFlight(unsigned int);
+
+		void recordWrite(uint64_t, double);
+		void recordFixedCost(double);
+
+	private:
+		// configured bounds
+		size_t minSize, maxSize;
+		// how many chunks may exist at once
+		unsigned int chunksInFlight;
+		// memory all chunks in flight may use, in bytes
+		uint64_t memoryBudget;
+
+		std::mutex lock;
+
+		// total size of the job; 0 if not known yet
+		uint64_t jobSize = 0;
+
+		// moving averages of the measurements
+		double writeRate = CHUNK_SIZER_DEFAULT_RATE;
+		double fixedCost = CHUNK_SIZER_DEFAULT_FIXED_COST;
+		bool haveRate = false, haveFixedCost = false;
+
+		std::atomic<size_t> chunkSize;
+
+		void _recalculate(std::string);
+};
+
+#endif
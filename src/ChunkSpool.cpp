@@ -0,0 +1,346 @@
+#include "ChunkSpool.hpp"
+
+#include "Trace.hpp"
+
+#include <glog/logging.h>
+#include <boost/thread.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+static_assert(CHUNK_SPOOL_DRAIN_START <= CHUNK_SPOOL_HIGH_WATER,
+			  "The spool must start draining before it's full");
+
+/**
+ * Sets up a spool in the given directory for the chunks of a job, and starts
+ * its threads; drained chunks are handed to the given writer.
+ */
+ChunkSpool::ChunkSpool(std::string dir, boost::uuids::uuid job, TapeWriter *writer) :
+	spoolQueue("spool", CHUNK_SPOOL_MAX_CHUNKS_WAITING) {
+	this->dir = dir;
+	this->prefix = boost::uuids::to_string(job);
+	this->writer = writer;
+
+	this->directIo = true;
+	this->stats = chunk_spool_stats_t();
+
+	// Make sure the directory exists, and see how much space it has
+	boost::filesystem::create_directories(this->dir);
+	boost::filesystem::space_info space = boost::filesystem::space(this->dir);
+
+	this->highWater = CHUNK_SPOOL_HIGH_WATER;
+
+	if(space.available < this->highWater) {
+		LOG(WARNING) << "Spool " << this->dir << " only has " << space.available
+					 << " bytes available; limiting spool to that";
+		this->highWater = space.available;
+	}
+
+	this->stats.highWater = this->highWater;
+
+	LOG(INFO) << "Spooling chunks to " << this->dir << " (up to "
+			  << this->highWater << " bytes)";
+
+	// Start the threads
+	this->spoolThread = std::thread(boost::bind(&ChunkSpool::_spoolEntry, this));
+	this->drainThread = std::thread(boost::bind(&ChunkSpool::_drainEntry, this));
+}
+
+/**
+ * Spools all chunks that are still queued, then waits for the spool to be
+ * drained to the writer.
+ */
+ChunkSpool::~ChunkSpool() {
+	this->spoolQueue.close();
+	this->spoolThread.join();
+
+	// Everything is on disk; drain whatever is left
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->closed = true;
+	}
+
+	this->chunksAvailable.notify_all();
+	this->drainThread.join();
+
+	LOG(INFO) << "Spool drained " << this->stats.chunksDrained << " chunks in "
+			  << this->stats.drains << " drains; max usage "
+			  << this->stats.maxBytesUsed << " bytes";
+}
+
+/**
+ * Queues a chunk to be spooled. This blocks while the spool is full, and the
+ * chunks already queued can't be written to it.
+ */
+void ChunkSpool::addChunk(Chunk *chunk) {
+	bool queued = this->spoolQueue.push(chunk);
+
+	CHECK(queued) << "Tried to spool chunk " << chunk->getChunkNumber()
+				  << " after the spool was shut down";
+}
+
+/**
+ * Returns a copy of the spool's counters; the drain time includes any drain
+ * that is in progress.
+ */
+chunk_spool_stats_t ChunkSpool::getStats() {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	chunk_spool_stats_t stats = this->stats;
+
+	if(this->draining) {
+		stats.drainTime += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - this->drainStart).count();
+	}
+
+	stats.draining = this->draining;
+
+	return stats;
+}
+
+/**
+ * Entry point for the thread that writes chunks to the spool.
+ */
+void ChunkSpool::_spoolEntry() {
+	Chunk *chunk;
+
+	Trace::setThreadName("spool writer");
+
+	while(this->spoolQueue.pop(&chunk)) {
+		_spoolChunk(chunk);
+	}
+}
+
+/**
+ * Writes a chunk to the spool, then frees it. If the spool doesn't have enough
+ * space for it, this waits for it to drain; a chunk is always accepted if the
+ * spool is empty, however large it is.
+ */
+void ChunkSpool::_spoolChunk(Chunk *chunk) {
+	TraceScope trace("spool", "spool write", "chunk", chunk->getChunkNumber());
+
+	spooled_chunk_t spooled;
+
+	spooled.index = chunk->getChunkNumber();
+	spooled.length = chunk->backingStoreActualSize;
+	spooled.spoolBytes = _alignedLength(spooled.length);
+	spooled.path = this->dir + "/" + this->prefix + "-" +
+				   std::to_string(spooled.index) + ".chunk";
+
+	// Wait for space; a full spool must drain, even if it's below the mark
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+
+		if((this->stats.bytesUsed + spooled.spoolBytes) > this->highWater &&
+		   !this->chunks.empty()) {
+			auto start = std::chrono::steady_clock::now();
+
+			if(!this->draining) {
+				this->draining = true;
+				this->drainStart = start;
+				this->stats.drains++;
+
+				this->chunksAvailable.notify_all();
+			}
+
+			this->spaceAvailable.wait(lk, [this, &spooled] {
+				return ((this->stats.bytesUsed + spooled.spoolBytes) <= this->highWater ||
+						this->chunks.empty());
+			});
+
+			this->stats.spaceWaitTime += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	// Write out the chunk; the backing store is page aligned
+	auto start = std::chrono::steady_clock::now();
+
+	int fd = _open(spooled.path, O_WRONLY | O_CREAT | O_TRUNC);
+	const uint8_t *buf = static_cast<const uint8_t *>(chunk->backingStore);
+
+	for(uint64_t off = 0; off < spooled.spoolBytes; ) {
+		ssize_t written = pwrite(fd, buf + off, spooled.spoolBytes - off, off);
+
+		if(written < 0 && errno == EINTR) {
+			continue;
+		}
+
+		PCHECK(written > 0) << "Couldn't write chunk " << spooled.index
+							<< " to spool " << spooled.path;
+		off += written;
+	}
+
+	close(fd);
+
+	double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	DLOG(INFO) << "Spooled chunk " << spooled.index << " (" << spooled.length
+			   << " bytes) in " << time << " sec";
+
+	delete chunk;
+
+	// Then, make it available for draining
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		this->chunks.push_back(spooled);
+
+		this->stats.bytesUsed += spooled.spoolBytes;
+		this->stats.maxBytesUsed = std::max(this->stats.maxBytesUsed,
+											this->stats.bytesUsed);
+		this->stats.chunksSpooled++;
+		this->stats.bytesSpooled += spooled.length;
+		this->stats.spoolTime += time;
+
+		if(!this->draining && this->stats.bytesUsed >= CHUNK_SPOOL_DRAIN_START) {
+			this->draining = true;
+			this->drainStart = std::chrono::steady_clock::now();
+			this->stats.drains++;
+		}
+	}
+
+	this->chunksAvailable.notify_all();
+}
+
+/**
+ * Entry point for the thread that drains the spool. Once draining starts, it
+ * continues until the spool is empty; once all chunks have been spooled, the
+ * rest is always drained.
+ */
+void ChunkSpool::_drainEntry() {
+	Trace::setThreadName("spool drain");
+
+	while(true) {
+		spooled_chunk_t spooled;
+
+		// Wait for the spool to start draining
+		{
+			std::unique_lock<std::mutex> lk(this->lock);
+
+			this->chunksAvailable.wait(lk, [this] {
+				return (this->closed || (this->draining && !this->chunks.empty()));
+			});
+
+			if(this->chunks.empty()) {
+				break;
+			}
+
+			if(!this->draining) {
+				this->draining = true;
+				this->drainStart = std::chrono::steady_clock::now();
+				this->stats.drains++;
+			}
+
+			spooled = this->chunks.front();
+		}
+
+		// Read it back, and free up its space in the spool
+		Chunk *chunk = _unspoolChunk(spooled);
+
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+
+			this->chunks.pop_front();
+
+			this->stats.bytesUsed -= spooled.spoolBytes;
+			this->stats.chunksDrained++;
+			this->stats.bytesDrained += spooled.length;
+		}
+
+		this->spaceAvailable.notify_all();
+
+		// This blocks while the drives are busy
+		this->writer->addChunkToQueue(chunk);
+
+		// Stop draining once the spool is empty
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		if(this->chunks.empty() && this->draining) {
+			this->draining = false;
+			this->stats.drainTime += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - this->drainStart).count();
+		}
+	}
+}
+
+/**
+ * Reads a spooled chunk back into memory, placed close to the drives, and
+ * removes it from the spool.
+ */
+Chunk *ChunkSpool::_unspoolChunk(spooled_chunk_t &spooled) {
+	TraceScope trace("spool", "spool read", "chunk", spooled.index);
+
+	// Allocate a chunk to hold it; the mapping covers whole pages
+	Chunk *chunk = new Chunk(spooled.length);
+
+	chunk->setChunkNumber(spooled.index);
+	chunk->setNumaNode(this->writer->getNumaNode());
+
+	chunk->backingStoreActualSize = chunk->backingStoreBytesUsed = spooled.length;
+	chunk->_allocateBackingStore();
+
+	// Read the data
+	int fd = _open(spooled.path, O_RDONLY);
+	uint8_t *buf = static_cast<uint8_t *>(chunk->backingStore);
+
+	for(uint64_t off = 0; off < spooled.spoolBytes; ) {
+		ssize_t read = pread(fd, buf + off, spooled.spoolBytes - off, off);
+
+		if(read < 0 && errno == EINTR) {
+			continue;
+		}
+
+		PCHECK(read > 0) << "Couldn't read chunk " << spooled.index
+						 << " from spool " << spooled.path;
+		off += read;
+	}
+
+	close(fd);
+
+	int err = unlink(spooled.path.c_str());
+	PLOG_IF(ERROR, err != 0) << "Couldn't remove " << spooled.path;
+
+	chunk->stopWriting();
+
+	return chunk;
+}
+
+/**
+ * Opens a spool file for direct I/O. If the filesystem doesn't support that,
+ * all further I/O on the spool is buffered instead.
+ */
+int ChunkSpool::_open(std::string path, int flags) {
+	int fd = -1;
+
+	if(this->directIo) {
+		fd = open(path.c_str(), flags | O_DIRECT, 0600);
+
+		if(fd < 0 && errno == EINVAL) {
+			LOG(WARNING) << "Spool " << this->dir << " doesn't support direct "
+						 << "I/O; using buffered I/O instead";
+			this->directIo = false;
+		}
+	}
+
+	if(!this->directIo) {
+		fd = open(path.c_str(), flags, 0600);
+	}
+
+	PCHECK(fd >= 0) << "Couldn't open spool file " << path;
+
+	return fd;
+}
+
+/**
+ * Rounds the length up to the direct I/O alignment.
+ */
+uint64_t ChunkSpool::_alignedLength(size_t length) {
+	return ((length + CHUNK_SPOOL_ALIGNMENT - 1) / CHUNK_SPOOL_ALIGNMENT) *
+		   CHUNK_SPOOL_ALIGNMENT;
+}
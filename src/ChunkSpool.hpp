@@ -0,0 +1,128 @@
+/**
+ * Stages finished chunks on local disk before they are written to tape, for
+ * sources that can't keep up with the drives (many small files, slow network
+ * filesystems.) Without it, the drives would have to stop and start between
+ * chunks, and their throughput collapses.
+ *
+ * Chunks are written to the spool directory (ideally on a fast SSD) with
+ * O_DIRECT as they're released, and their memory is freed right away. Nothing
+ * is written to tape until enough data is spooled; then, the spool is drained
+ * to the writer until it's empty, which is fast enough for the drives to
+ * stream the whole time. The spool never holds more than a high-water mark;
+ * releasing chunks blocks while it's full.
+ */
+#ifndef CHUNKSPOOL_H
+#define CHUNKSPOOL_H
+
+/**
+ * Directory that chunks are spooled to. Leave empty to write chunks to tape
+ * directly, without spooling them.
+ */
+#define CHUNK_SPOOL_DIR				""
+
+/**
+ * Maximum number of bytes that may be spooled at a time. If the filesystem has
+ * less space available, the spool is limited to that instead.
+ */
+#define CHUNK_SPOOL_HIGH_WATER		(1024ULL * 1024 * 1024 * 256)
+
+/**
+ * Number of bytes that must be spooled before the spool starts draining to
+ * tape; once draining, it continues until the spool is empty.
+ */
+#define CHUNK_SPOOL_DRAIN_START		(1024ULL * 1024 * 1024 * 32)
+
+/**
+ * Maximum number of chunks that may be waiting to be written to the spool.
+ */
+#define CHUNK_SPOOL_MAX_CHUNKS_WAITING	2
+
+/**
+ * Alignment of buffers, offsets and lengths for direct I/O on the spool.
+ */
+#define CHUNK_SPOOL_ALIGNMENT		4096
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <cstdint>
+
+#include <boost/uuid/uuid.hpp>
+
+#include "BoundedQueue.hpp"
+#include "Chunk.hpp"
+#include "JobStats.hpp"
+#include "TapeWriter.hpp"
+
+class ChunkSpool {
+	public:
+		ChunkSpool(std::string, boost::uuids::uuid, TapeWriter *);
+		~ChunkSpool();
+
+		void addChunk(Chunk *);
+
+		bounded_queue_stats_t getQueueStats() {
+			return this->spoolQueue.getStats();
+		}
+		chunk_spool_stats_t getStats();
+
+	private:
+		// a chunk that's on disk, waiting to be written to tape
+		typedef struct {
+			uint64_t index;
+			std::string path;
+
+			// length of the chunk, and the space it takes up in the spool
+			size_t length;
+			uint64_t spoolBytes;
+		} spooled_chunk_t;
+
+		std::string dir;
+		// prefix for spool files, so several jobs can share a directory
+		std::string prefix;
+
+		TapeWriter *writer;
+
+		// chunks waiting to be spooled
+		BoundedQueue<Chunk *> spoolQueue;
+
+		std::thread spoolThread;
+		std::thread drainThread;
+
+		// whether files are opened with O_DIRECT; cleared if the filesystem
+		// doesn't support it
+		std::atomic<bool> directIo;
+
+		// spooled chunks, in order; the state below is protected by the lock
+		std::mutex lock;
+		std::condition_variable spaceAvailable;
+		std::condition_variable chunksAvailable;
+
+		std::deque<spooled_chunk_t> chunks;
+
+		// set once all chunks have been spooled
+		bool closed = false;
+		bool draining = false;
+
+		uint64_t highWater;
+		chunk_spool_stats_t stats;
+
+		// when the current drain started
+		std::chrono::steady_clock::time_point drainStart;
+
+
+		void _spoolEntry();
+		void _drainEntry();
+
+		void _spoolChunk(Chunk *);
+		Chunk *_unspoolChunk(spooled_chunk_t &);
+
+		int _open(std::string, int);
+		static uint64_t _alignedLength(size_t);
+};
+
+#endif
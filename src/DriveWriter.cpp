@@ -0,0 +1,571 @@
+#include "DriveWriter.hpp"
+
+#include "TapeWriter.hpp"
+#include "TapeReader.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "NumaTopology.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+
+#include <glog/logging.h>
+#include <boost/thread.hpp>
+
+#include "TapeStructs.h"
+
+/**
+ * Sets up the writer for the given drive. Chunks are taken from the write
+ * queue, reported to the tape writer once they've been written, and then
+ * pushed to the release queue. Full tapes are replaced through the changer, if
+ * one is given.
+ */
+DriveWriter::DriveWriter(iolib_drive_t drive, MediaChanger *changer,
+						 BoundedQueue<Chunk *> *writeQueue,
+						 BoundedQueue<Chunk *> *releaseQueue, TapeWriter *writer) {
+	this->drive = drive;
+	this->changer = changer;
+	this->writeQueue = writeQueue;
+	this->releaseQueue = releaseQueue;
+	this->writer = writer;
+
+	// Get the drive's device, and the node it's attached to
+	iolib_string_t devFile = iolibDriveGetDevFile(this->drive);
+	this->name = devFile;
+	iolibStringFree(devFile);
+
+	this->numaNode = NumaTopology::nodeForDevice(this->name);
+
+	if(this->changer) {
+		this->tapeLabel = this->changer->getLabel(this->drive);
+	}
+
+	this->driveStats = tape_drive_stats_t();
+	this->driveStats.drive = this->name;
+	this->driveStats.tape = this->tapeLabel;
+}
+
+/**
+ * Waits for the I/O thread to exit, if it was started.
+ */
+DriveWriter::~DriveWriter() {
+	this->join();
+}
+
+/**
+ * Starts the I/O thread.
+ */
+void DriveWriter::start() {
+	this->ioThread = std::thread(boost::bind(&DriveWriter::_ioEntry, this));
+}
+
+/**
+ * Waits for the I/O thread to finish; it does so once the write queue is
+ * closed and empty.
+ */
+void DriveWriter::join() {
+	if(this->ioThread.joinable()) {
+		this->ioThread.join();
+	}
+}
+
+/**
+ * Returns a copy of the drive's counters.
+ */
+tape_drive_stats_t DriveWriter::getStats() {
+	std::lock_guard<std::mutex> lk(this->lock);
+	return this->driveStats;
+}
+
+/**
+ * Returns the locations of all chunks this drive has written.
+ */
+std::vector<chunk_location_t> DriveWriter::getChunkLocations() {
+	std::lock_guard<std::mutex> lk(this->lock);
+	return this->locations;
+}
+
+/**
+ * I/O thread entry point; writes chunks until the queue is closed and empty.
+ * The last tape is then verified, if tapes are.
+ *
+ * Any time the drive has to wait for the next chunk is recorded; if it waits
+ * long enough that its buffer likely ran dry, that's counted as an underrun.
+ */
+void DriveWriter::_ioEntry() {
+	Chunk *chunk;
+	bool first = true;
+
+	Trace::setThreadName("tape writer");
+
+	// Run close to the drive
+	NumaTopology::bindThread(this->numaNode);
+
+	auto idleStart = std::chrono::steady_clock::now();
+
+	while(this->writeQueue->pop(&chunk)) {
+		std::chrono::duration<double> idle = std::chrono::steady_clock::now() - idleStart;
+
+		// The drive's idle time until the first chunk doesn't count
+		if(!first) {
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->driveStats.idleTime += idle.count();
+
+			if(idle.count() >= TAPE_UNDERRUN_MIN_IDLE) {
+				this->driveStats.underruns++;
+				Metrics::tapeUnderruns.add(1);
+
+				DLOG(INFO) << "Drive " << this->name << " waited "
+						   << idle.count() << " sec for chunk "
+						   << chunk->getChunkNumber();
+			}
+		}
+
+		first = false;
+
+		// If the tape is full, continue on a new one
+		iolib_error_t err = IOLIB_ERROR_EOM;
+
+		if(!this->outOfTapes && (err = _seekToEndOfData()) == 0) {
+			while((err = _writeChunk(chunk)) == IOLIB_ERROR_EOM && this->changer) {
+				if(!_changeTape()) {
+					this->outOfTapes = true;
+					break;
+				}
+			}
+		}
+
+		// Otherwise, the chunk is lost, and so is its job
+		if(err != 0) {
+			this->writer->chunkFailed(chunk, err);
+		}
+
+		idleStart = std::chrono::steady_clock::now();
+
+		// Let another thread free the chunk, so the next write starts now
+		this->releaseQueue->push(chunk);
+	}
+
+	// Finish off the last tape, then read it back right where it is
+	bool wroteTape = !this->tapeLocations.empty();
+
+	_writeIndex();
+
+	TapeVerifier *verifier = this->writer->getVerifier();
+
+	if(wroteTape && verifier) {
+		verifier->verifyTape(this->drive, this->tapeLabel);
+	}
+}
+
+/**
+ * Positions the drive after the data already on its tape, unless it's there
+ * already, so that earlier backups aren't written over; the drive may have
+ * been at the start of the tape, or anywhere on it.
+ */
+iolib_error_t DriveWriter::_seekToEndOfData() {
+	if(this->atEndOfData) {
+		return 0;
+	}
+
+	TraceScope trace("tape", "seek to end of data");
+	iolib_error_t err = TapeReader::seekToEndOfData(this->drive);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't go to end of data on tape '" << this->tapeLabel
+				   << "' in " << this->name << ": " << err;
+		return err;
+	}
+
+	off_t file = iolibDriveGetPosition(this->drive, &err);
+	LOG(INFO) << "Appending to tape '" << this->tapeLabel << "' in "
+			  << this->name << " at tape file " << file;
+
+	this->atEndOfData = true;
+	return 0;
+}
+
+/**
+ * Writes a chunk to tape, followed by a filemark once the tape file has as many
+ * chunks as it should, and records where it went. This is a blocking
+ * operation; if an error occurs during writing, it's returned. If the tape is
+ * at the end, that's IOLIB_ERROR_EOM, so that a new tape can be swapped in and
+ * the write retried, if there's a loader. Otherwise, the chunk isn't recorded,
+ * and the tape file it was in is ended, so the next chunk starts a new one.
+ */
+iolib_error_t DriveWriter::_writeChunk(Chunk *chunk) {
+	LOG(INFO) << "Writing chunk " << chunk->getChunkNumber() << " to " << this->name;
+
+	iolib_error_t err = 0;
+	size_t len = chunk->backingStoreActualSize;
+
+	// Note the tape file the chunk will be in, and where in it
+	off_t fileNumber = iolibDriveGetPosition(this->drive, &err);
+	uint64_t fileOffset = this->fileBytes;
+
+	if(err != 0) {
+		LOG(WARNING) << "Couldn't get position of " << this->name << ": " << err;
+		fileNumber = -1;
+	}
+
+	// And the block it starts at, if the drive can report it
+	off_t block = -1, dataBlock = -1;
+	size_t blockSize = iolibDriveGetBlockSize(this->drive);
+
+	if(blockSize != 0) {
+		block = iolibDriveGetBlockPosition(this->drive, &err);
+
+		if(block < 0) {
+			LOG(WARNING) << "Couldn't get block position of " << this->name << ": " << err;
+			block = -1;
+		} else {
+			// The header is followed by the blobs; requests are whole blocks,
+			// so this is the block holding the first byte after the header
+			chunk_header_v2_t *header = reinterpret_cast<chunk_header_v2_t *>(chunk->backingStore);
+			dataBlock = block + (header->headerLenBytes / blockSize);
+		}
+	}
+
+	err = 0;
+
+	// Chunks that share a tape file are padded to whole blocks, so that each
+	// one starts on a block boundary
+	size_t padLen = 0;
+
+	if(TAPE_CHUNKS_PER_FILE > 1 && blockSize != 0 && (len % blockSize) != 0) {
+		padLen = blockSize - (len % blockSize);
+	}
+
+	// Write the chunk's data
+	auto start = std::chrono::steady_clock::now();
+	size_t written;
+
+	{
+		TraceScope trace("tape", "drive write", "chunk", chunk->getChunkNumber());
+		written = _writeData(chunk->backingStore, len, padLen, &err);
+	}
+
+	std::chrono::duration<double> writeTime = std::chrono::steady_clock::now() - start;
+
+	if(written != (len + padLen)) {
+		if(err == IOLIB_ERROR_EOM && this->changer) {
+			LOG(WARNING) << "Reached end of tape in " << this->name
+						 << " while writing chunk " << chunk->getChunkNumber();
+			return err;
+		}
+
+		LOG(ERROR) << "Couldn't write chunk " << chunk->getChunkNumber() << " to "
+				   << this->name << ": wrote " << (ssize_t) written << " of "
+				   << (len + padLen) << " bytes (error " << err << ")";
+
+		// Leave whatever made it to tape in a tape file of its own
+		iolib_error_t endErr = _endFile();
+		LOG_IF(WARNING, endErr != 0) << "Couldn't end tape file on " << this->name
+									 << ": " << endErr;
+
+		return (err != 0) ? err : EIO;
+	}
+
+	this->fileChunks++;
+	this->fileBytes += len + padLen;
+
+	// Then, end the tape file, once it has enough chunks
+	start = std::chrono::steady_clock::now();
+
+	if(this->fileChunks >= TAPE_CHUNKS_PER_FILE) {
+		TraceScope trace("tape", "filemark", "chunk", chunk->getChunkNumber());
+		err = _endFile();
+	}
+
+	std::chrono::duration<double> filemarkTime = std::chrono::steady_clock::now() - start;
+
+	if(err == IOLIB_ERROR_EOM && this->changer) {
+		LOG(WARNING) << "Reached end of tape in " << this->name
+					 << " after chunk " << chunk->getChunkNumber();
+		return err;
+	} else if(err != 0) {
+		LOG(ERROR) << "Couldn't write filemark after chunk "
+				   << chunk->getChunkNumber() << " to " << this->name << ": "
+				   << err;
+		return err;
+	}
+
+	Metrics::tapeWriteTime.observe(writeTime.count());
+	Metrics::tapeBytesWritten.add(len);
+	Metrics::tapeWriteTotalTime.add(std::chrono::duration_cast<std::chrono::nanoseconds>(writeTime).count());
+
+	double rate;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		this->driveStats.chunksWritten++;
+		this->driveStats.bytesWritten += len;
+		this->driveStats.writeTime += writeTime.count();
+		this->driveStats.filemarkTime += filemarkTime.count();
+
+		this->locations.push_back({
+			chunk->getJobUuid(), chunk->getChunkNumber(), len, this->name,
+			this->tapeLabel, fileNumber, fileOffset, block, dataBlock
+		});
+		this->tapeLocations.push_back(this->locations.back());
+
+		rate = this->driveStats.bytesWritten / this->driveStats.writeTime;
+	}
+
+	// Record it, so the chunk can be found again
+	TapeCatalog::add(this->tapeLocations.back());
+
+	// Let the changer know how full the tape is getting
+	if(this->changer) {
+		this->changer->recordWrite(this->drive, len, rate);
+	}
+
+	LOG(INFO) << "Finished writing chunk " << chunk->getChunkNumber() << " to "
+			  << this->name << " (" << (len / writeTime.count() / (1024 * 1024))
+			  << " MB/s)";
+
+	// Report the write to the chunk's job
+	this->writer->chunkWritten(chunk, len, writeTime.count(), filemarkTime.count());
+
+	return 0;
+}
+
+/**
+ * Writes the buffer at the drive's current position, split into requests that
+ * are submitted asynchronously; as many as the drive allows are kept in flight.
+ * It's followed by the given number of zero bytes of padding.
+ *
+ * Returns the number of bytes written, including the padding, which is less
+ * than the total if an error occurred; in that case, the error is output, and
+ * all requests are completed before returning.
+ */
+size_t DriveWriter::_writeData(const void *buf, size_t len, size_t padLen,
+							   iolib_error_t *outErr) {
+	const uint8_t *data = static_cast<const uint8_t *>(buf);
+
+	size_t depth = std::min(iolibDriveGetQueueDepth(this->drive),
+							(size_t) TAPE_WRITE_MAX_REQUESTS);
+	depth = std::max(depth, (size_t) 1);
+
+	// Requests are a multiple of the drive's block size, so that only the last
+	// block of the buffer can be short
+	size_t requestSize = TAPE_WRITE_REQUEST_SIZE;
+	size_t blockSize = iolibDriveGetBlockSize(this->drive);
+
+	if(blockSize != 0) {
+		requestSize = std::max(blockSize, requestSize - (requestSize % blockSize));
+	}
+
+	// Set up all requests
+	size_t numRequests = (len + requestSize - 1) / requestSize;
+
+	std::vector<struct iovec> iov(numRequests + 1);
+	std::vector<iolib_io_request_t> requests(numRequests);
+
+	for(size_t i = 0; i < numRequests; i++) {
+		size_t offset = i * requestSize;
+
+		iov[i].iov_base = const_cast<uint8_t *>(data + offset);
+		iov[i].iov_len = std::min(requestSize, len - offset);
+
+		requests[i].iov = &iov[i];
+		requests[i].iovcnt = 1;
+	}
+
+	// The padding goes at the end of the last request
+	if(padLen != 0) {
+		if(this->padding.size() < padLen) {
+			this->padding.assign(padLen, 0);
+		}
+
+		iov[numRequests].iov_base = this->padding.data();
+		iov[numRequests].iov_len = padLen;
+
+		requests[numRequests - 1].iovcnt = 2;
+	}
+
+	// Keep the queue full until everything is written, or something fails
+	size_t submitted = 0, completed = 0, written = 0;
+	size_t retries = 0;
+	iolib_error_t err = 0;
+
+	while(completed < numRequests) {
+		while(err == 0 && submitted < numRequests && (submitted - completed) < depth) {
+			iolib_error_t submitErr = iolibDriveSubmitWrite(this->drive, &requests[submitted]);
+
+			if(submitErr == IOLIB_ERROR_QUEUE_FULL && submitted != completed) {
+				// The drive can't queue as many as it said; don't try again
+				depth = submitted - completed;
+
+				VLOG(1) << "Queue of " << this->name << " is full; keeping "
+						<< depth << " requests in flight";
+				break;
+			} else if(submitErr == IOLIB_ERROR_QUEUE_FULL &&
+					  retries < TAPE_WRITE_QUEUE_FULL_RETRIES) {
+				// Nothing of ours is in flight, so wait for the drive to drain
+				double backoff = TAPE_WRITE_QUEUE_FULL_BACKOFF * (1 << retries++);
+				std::this_thread::sleep_for(std::chrono::duration<double>(backoff));
+
+				continue;
+			} else if(submitErr != 0) {
+				err = submitErr;
+				break;
+			}
+
+			submitted++;
+			retries = 0;
+		}
+
+		if(completed == submitted) {
+			break;
+		}
+
+		// Then, wait for the oldest request
+		iolib_error_t completeErr = 0;
+		iolib_io_request_t *req = iolibDriveCompleteRequest(this->drive, &completeErr);
+
+		CHECK(req == &requests[completed]) << "Got wrong request from " << this->name
+										   << " (error " << completeErr << ")";
+
+		completed++;
+
+		size_t reqLen = 0;
+
+		for(int i = 0; i < req->iovcnt; i++) {
+			reqLen += req->iov[i].iov_len;
+		}
+
+		if(err != 0) {
+			continue;
+		} else if(req->error != 0 || req->transferred != reqLen) {
+			err = (req->error != 0) ? req->error : EIO;
+			written += ((ssize_t) req->transferred > 0) ? req->transferred : 0;
+		} else {
+			written += req->transferred;
+		}
+	}
+
+	*outErr = err;
+	return written;
+}
+
+/**
+ * Replaces the full tape that writing stopped at. The partially written tape
+ * file is ended, so the tape reads back cleanly up to it, and the tape's index
+ * is written after it; then, the changer provides the drive to continue on,
+ * which may not be the same one. Returns false if the tape couldn't be
+ * replaced.
+ */
+bool DriveWriter::_changeTape() {
+	auto start = std::chrono::steady_clock::now();
+
+	iolib_error_t err = _endFile();
+	LOG_IF(WARNING, err != 0) << "Couldn't end partial tape file on "
+							  << this->name << ": " << err;
+
+	_writeIndex();
+
+	iolib_drive_t drive = this->changer->replaceTape(this->drive);
+
+	if(drive == NULL) {
+		LOG(ERROR) << "Couldn't replace full tape in " << this->name
+				   << "; failing all remaining chunks";
+		return false;
+	}
+
+	iolib_string_t devFile = iolibDriveGetDevFile(drive);
+	std::string name = devFile;
+	iolibStringFree(devFile);
+
+	std::string label = this->changer->getLabel(drive);
+
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+	LOG(INFO) << "Continuing on " << name << " with tape '" << label
+			  << "' after " << time.count() << " sec";
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	this->drive = drive;
+	this->name = name;
+	this->tapeLabel = label;
+
+	this->driveStats.drive = name;
+	this->driveStats.tape = label;
+	this->driveStats.tapeChanges++;
+	this->driveStats.tapeChangeTime += time.count();
+
+	// The changer only loads blank tapes, and leaves them rewound
+	this->atEndOfData = true;
+
+	return true;
+}
+
+/**
+ * Writes the index of all chunks on the tape as its own tape file, if any were
+ * written to it since it was loaded. If the tape is full, this relies on the drive accepting
+ * some data past the early warning; if it doesn't, the index is lost, but the
+ * catalog still has all chunks.
+ */
+void DriveWriter::_writeIndex() {
+	if(this->tapeLocations.empty()) {
+		return;
+	}
+
+	// Chunks may be left in a tape file that hasn't been ended yet
+	if(this->fileChunks != 0) {
+		iolib_error_t err = _endFile();
+		LOG_IF(WARNING, err != 0) << "Couldn't end tape file on " << this->name
+								  << ": " << err;
+	}
+
+	// List every chunk on the tape, including those written before it was
+	// loaded this time (e.g. by earlier jobs), since only the last index on a
+	// tape is read; if the tape has no label, it can't be looked up, though
+	std::vector<chunk_location_t> chunks = this->tapeLocations;
+
+	if(!this->tapeLabel.empty()) {
+		chunks = TapeCatalog::getChunksOnTape(this->tapeLabel);
+	}
+
+	std::vector<uint8_t> index;
+	TapeCatalog::buildIndex(this->tapeLabel, chunks, &index);
+
+	iolib_error_t err = 0;
+	size_t written;
+
+	{
+		TraceScope trace("tape", "index write");
+		written = iolibDriveWrite(this->drive, index.data(), index.size(), false, &err);
+
+		if(written == index.size()) {
+			err = iolibDriveWriteFileMark(this->drive);
+		}
+	}
+
+	if(written != index.size() || err != 0) {
+		LOG(WARNING) << "Couldn't write index of " << chunks.size()
+					 << " chunks to tape '" << this->tapeLabel << "' in "
+					 << this->name << " (error " << err << ")";
+	} else {
+		LOG(INFO) << "Wrote index of " << chunks.size()
+				  << " chunks to tape '" << this->tapeLabel << "' in " << this->name;
+	}
+
+	this->tapeLocations.clear();
+}
+
+/**
+ * Ends the tape file being written with a filemark, which is buffered unless
+ * configured otherwise; the filemark after the tape's index is always written
+ * immediately, so everything is on the tape once that's done.
+ */
+iolib_error_t DriveWriter::_endFile() {
+	this->fileChunks = 0;
+	this->fileBytes = 0;
+
+	return iolibDriveWriteFileMarks(this->drive, 1, !TAPE_BUFFERED_FILEMARKS);
+}
@@ -0,0 +1,165 @@
+/**
+ * Writes chunks to a single tape drive. Every drive that a tape writer uses
+ * has its own I/O thread, and all of them take chunks from the same queue, so
+ * whichever drive is ready first writes the next chunk.
+ *
+ * Chunks are appended to whatever is on the tape already: before the first
+ * write, the drive is moved to the end of its data.
+ *
+ * For each chunk, the drive records where on tape it went in the catalog, so
+ * that it can be found again during a restore. Once a tape is done (it's full,
+ * or the job is), an index of all chunks on it is written as its last
+ * tape file.
+ *
+ * Each chunk is normally its own tape file; to have the drive stop less often,
+ * several chunks can share a tape file, and the filemarks between tape files
+ * are buffered by the drive.
+ *
+ * Chunks are written as several asynchronous requests that are in flight at
+ * the same time, if the drive supports it, so it never waits for the next one.
+ *
+ * If the library has a loader, full tapes are replaced through it, and the
+ * chunk that hit the end of the tape is written again on the new one. The
+ * writer may continue on a different drive that had a blank tape ready; if
+ * there's no blank tape left, that chunk and all after it fail. Any
+ * other error fails the chunk's job (see TapeWriter), and the drive goes on
+ * with the next chunk in a new tape file.
+ */
+#ifndef DRIVEWRITER_H
+#define DRIVEWRITER_H
+
+/**
+ * If the drive has to wait at least this long (in seconds) for the next chunk,
+ * it's counted as an underrun; by then, the drive's buffer has likely drained
+ * and it had to stop streaming.
+ */
+#define TAPE_UNDERRUN_MIN_IDLE	0.005
+
+/**
+ * Chunks are written to the drive as a series of asynchronous requests of this
+ * many bytes, so the drive always has the next one ready.
+ */
+#define TAPE_WRITE_REQUEST_SIZE	(1024 * 1024 * 8)
+
+/**
+ * Maximum number of write requests kept in flight per drive; fewer are used if
+ * the drive can't queue that many.
+ */
+#define TAPE_WRITE_MAX_REQUESTS	4
+
+/**
+ * If the drive's queue is full even though none of our requests are in flight,
+ * submitting is retried up to this many times, waiting this long (in seconds)
+ * before the first retry and twice as long before each one after it.
+ */
+#define TAPE_WRITE_QUEUE_FULL_RETRIES	10
+#define TAPE_WRITE_QUEUE_FULL_BACKOFF	0.001
+
+/**
+ * Number of chunks written to each tape file. With more than one, chunks are
+ * written back to back, each padded to whole blocks, and are told apart by
+ * their headers, which have their length; there are fewer filemarks, so the
+ * drive doesn't have to stop as often.
+ */
+#define TAPE_CHUNKS_PER_FILE	1
+
+/**
+ * Set to 0 to wait for the filemark after each tape file to be written to the
+ * medium, which flushes the drive's buffer and makes it stop and reposition.
+ * Otherwise, only the filemark after a tape's index is.
+ */
+#define TAPE_BUFFERED_FILEMARKS	1
+
+#include <thread>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include "BoundedQueue.hpp"
+#include "Chunk.hpp"
+#include "JobStats.hpp"
+#include "MediaChanger.hpp"
+#include "TapeCatalog.hpp"
+
+#include "IOLib.h"
+
+class TapeWriter;
+
+class DriveWriter {
+	public:
+		DriveWriter(iolib_drive_t, MediaChanger *, BoundedQueue<Chunk *> *,
+					BoundedQueue<Chunk *> *, TapeWriter *);
+		~DriveWriter();
+
+		void start();
+		void join();
+
+		int getNumaNode() {
+			return this->numaNode;
+		}
+
+		tape_drive_stats_t getStats();
+		std::vector<chunk_location_t> getChunkLocations();
+
+	private:
+		iolib_drive_t drive;
+		// device file of the drive
+		std::string name;
+		// label of the tape in the drive, if known
+		std::string tapeLabel;
+
+		// replaces full tapes; NULL if there's no loader
+		MediaChanger *changer;
+
+		// node the drive's host adapter is attached to; -1 if unknown
+		int numaNode = -1;
+
+		// chunks to write, and where they go once written
+		BoundedQueue<Chunk *> *writeQueue;
+		BoundedQueue<Chunk *> *releaseQueue;
+
+		// writer the drive belongs to; written chunks are reported to it
+		TapeWriter *writer;
+
+		std::thread ioThread;
+
+		// counters and chunk locations; protected by the lock
+		std::mutex lock;
+		tape_drive_stats_t driveStats;
+		std::vector<chunk_location_t> locations;
+
+		// chunks written to the tape in the drive since it was loaded; only
+		// accessed by the I/O thread
+		std::vector<chunk_location_t> tapeLocations;
+
+		// chunks in the tape file being written, and the bytes they take up;
+		// only accessed by the I/O thread
+		size_t fileChunks = 0;
+		uint64_t fileBytes = 0;
+
+		// set once the drive is past the data that was already on its tape,
+		// which it's moved to before the first write. Only accessed by the I/O
+		// thread
+		bool atEndOfData = false;
+
+		// set once a full tape couldn't be replaced; chunks aren't written
+		// after that. Only accessed by the I/O thread
+		bool outOfTapes = false;
+
+		// zeroes that chunks are padded with
+		std::vector<uint8_t> padding;
+
+
+		void _ioEntry();
+		iolib_error_t _writeChunk(Chunk *chunk);
+		size_t _writeData(const void *, size_t, size_t, iolib_error_t *);
+		iolib_error_t _seekToEndOfData();
+		bool _changeTape();
+		void _writeIndex();
+		iolib_error_t _endFile();
+};
+
+#endif
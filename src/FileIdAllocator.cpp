@@ -0,0 +1,56 @@
+#include "FileIdAllocator.hpp"
+
+// Generation for the next allocator; zero is never used.
+static std::atomic<uint64_t> nextGeneration(1);
+
+/**
+ * Block of IDs that the calling thread has reserved, and the allocator that it
+ * was reserved from.
+ */
+typedef struct {
+	uint64_t generation;
+
+	uint64_t next;
+	uint64_t end;
+} file_id_block_t;
+
+static thread_local file_id_block_t currentBlock = { 0, 0, 0 };
+
+/**
+ * Creates an allocator; if `useUuids` is set, files are given random UUIDs
+ * rather than compact IDs.
+ */
+FileIdAllocator::FileIdAllocator(bool useUuids) : nextBlock(1) {
+	this->useUuids = useUuids;
+	this->generation = nextGeneration++;
+}
+
+/**
+ * Returns the next file ID. IDs are unique within this allocator, but not
+ * contiguous between threads; zero is never returned.
+ *
+ * A thread that alternates between several allocators will throw away the
+ * rest of its block each time it switches.
+ */
+uint64_t FileIdAllocator::nextId() {
+	file_id_block_t *block = &currentBlock;
+
+	// Reserve a new block if needed
+	if(block->generation != this->generation || block->next == block->end) {
+		block->generation = this->generation;
+
+		block->next = this->nextBlock.fetch_add(FILE_ID_BLOCK_SIZE);
+		block->end = block->next + FILE_ID_BLOCK_SIZE;
+	}
+
+	return block->next++;
+}
+
+/**
+ * Generates a random UUID for a file.
+ */
+boost::uuids::uuid FileIdAllocator::nextUuid() {
+	std::lock_guard<std::mutex> lock(this->uuidLock);
+
+	return this->uuidGen();
+}
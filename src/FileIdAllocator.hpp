@@ -0,0 +1,50 @@
+/**
+ * Hands out identifiers for the files in a backup job. By default, these are
+ * compact 64-bit IDs that are only unique within the job; the job's UUID makes
+ * them globally unique. Each thread grabs a block of IDs at a time, so getting
+ * an ID is usually just an increment of a thread-local counter.
+ *
+ * For compatibility, files can instead be identified by random UUIDs; these
+ * are produced by a single generator that's shared by the entire job.
+ */
+#ifndef FILEIDALLOCATOR_H
+#define FILEIDALLOCATOR_H
+
+/**
+ * Number of IDs a thread reserves at once.
+ */
+#define FILE_ID_BLOCK_SIZE	1024
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+class FileIdAllocator {
+	public:
+		FileIdAllocator(bool);
+
+		uint64_t nextId();
+		boost::uuids::uuid nextUuid();
+
+		bool usesUuids() {
+			return this->useUuids;
+		}
+
+	private:
+		bool useUuids;
+
+		// distinguishes this allocator from others in the thread-local cache
+		uint64_t generation;
+		// first ID of the next block that will be handed out
+		std::atomic<uint64_t> nextBlock;
+
+		// only used in UUID mode
+		std::mutex uuidLock;
+		boost::uuids::basic_random_generator<boost::mt19937> uuidGen;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "InventoryService.hpp"
+
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <glog/logging.h>
+
+std::mutex InventoryService::iolibLock;
+
+std::mutex InventoryService::lock;
+std::condition_variable InventoryService::refreshRequested;
+std::condition_variable InventoryService::refreshFinished;
+
+std::thread InventoryService::refreshThread;
+bool InventoryService::running = false;
+
+bool InventoryService::pending = false;
+uint64_t InventoryService::refreshesStarted = 0;
+uint64_t InventoryService::refreshesFinished = 0;
+
+std::shared_ptr<const inventory_snapshot_t> InventoryService::snapshot =
+	std::make_shared<inventory_snapshot_t>();
+
+/**
+ * Starts the refresh thread, which takes the first snapshot right away. This
+ * doesn't wait for it; until it's done, the snapshot is empty.
+ */
+void InventoryService::start() {
+	std::lock_guard<std::mutex> lk(lock);
+
+	CHECK(!running) << "Inventory service is already running";
+
+	running = true;
+	pending = true;
+
+	refreshThread = std::thread(&InventoryService::_refreshEntry);
+}
+
+/**
+ * Stops the refresh thread, after waiting for a refresh in progress to finish.
+ */
+void InventoryService::stop() {
+	{
+		std::lock_guard<std::mutex> lk(lock);
+
+		if(!running) {
+			return;
+		}
+
+		running = false;
+	}
+
+	refreshRequested.notify_all();
+	refreshThread.join();
+
+	// Wake anyone still waiting for a refresh
+	refreshFinished.notify_all();
+}
+
+/**
+ * Returns the most recent snapshot.
+ */
+std::shared_ptr<const inventory_snapshot_t> InventoryService::getSnapshot() {
+	std::lock_guard<std::mutex> lk(lock);
+	return snapshot;
+}
+
+/**
+ * Asks for the snapshot to be refreshed soon, e.g. because some tapes were
+ * moved; this returns right away.
+ */
+void InventoryService::requestRefresh() {
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		pending = true;
+	}
+
+	refreshRequested.notify_all();
+}
+
+/**
+ * Refreshes the snapshot, and returns it once done. The refresh may be shared
+ * with other callers, but it always starts after this call; if the service
+ * isn't running, the current snapshot is returned right away.
+ */
+std::shared_ptr<const inventory_snapshot_t> InventoryService::refresh() {
+	std::unique_lock<std::mutex> lk(lock);
+
+	if(!running) {
+		return snapshot;
+	}
+
+	uint64_t needed = refreshesStarted + 1;
+	pending = true;
+
+	refreshRequested.notify_all();
+
+	refreshFinished.wait(lk, [needed]{
+		return (!running || refreshesFinished >= needed);
+	});
+
+	return snapshot;
+}
+
+/**
+ * Entry point for the refresh thread: takes a new snapshot whenever one is
+ * requested, or the refresh interval has passed since the last one.
+ */
+void InventoryService::_refreshEntry() {
+	Trace::setThreadName("inventory");
+
+	std::unique_lock<std::mutex> lk(lock);
+
+	while(running) {
+		refreshRequested.wait_for(lk, std::chrono::seconds(INVENTORY_REFRESH_INTERVAL), []{
+			return (!running || pending);
+		});
+
+		if(!running) {
+			break;
+		}
+
+		// Query the hardware, without holding the lock
+		pending = false;
+		uint64_t version = ++refreshesStarted;
+
+		lk.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::shared_ptr<inventory_snapshot_t> newSnapshot = std::make_shared<inventory_snapshot_t>();
+		bool success = _query(newSnapshot.get());
+
+		std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+		Metrics::inventoryRefreshTime.observe(time.count());
+
+		VLOG(1) << "Inventory refresh " << version << " took " << time.count()
+				<< " sec";
+
+		lk.lock();
+
+		// Keep the old snapshot if the hardware couldn't be queried
+		if(success) {
+			newSnapshot->version = version;
+			snapshot = newSnapshot;
+		}
+
+		refreshesFinished = version;
+		refreshFinished.notify_all();
+	}
+}
+
+/**
+ * Queries all libraries, and their drives and loaders, for the snapshot.
+ * Returns false if that failed.
+ */
+bool InventoryService::_query(inventory_snapshot_t *out) {
+	TraceScope trace("loader", "inventory");
+	std::lock_guard<std::mutex> lk(iolibLock);
+
+	iolib_library_t libs[8];
+	iolib_error_t err = 0;
+
+	int numLibs = iolibEnumerateDevices(libs, 8, &err);
+
+	if(numLibs < 0) {
+		LOG(WARNING) << "Couldn't enumerate libraries: " << err;
+		return false;
+	}
+
+	out->updated = time(NULL);
+
+	bool success = true;
+
+	for(int i = 0; i < numLibs; i++) {
+		inventory_library_t library;
+
+		library.id = libs[i].id;
+		library.name = libs[i].name;
+
+		for(size_t j = 0; j < libs[i].numDrives; j++) {
+			iolib_drive_t drive = libs[i].drives[j];
+
+			library.drives.push_back({
+				_stdStringFromIoLibString(iolibDriveGetUuid(drive)),
+				_stdStringFromIoLibString(iolibDriveGetName(drive)),
+				_stdStringFromIoLibString(iolibDriveGetDevFile(drive))
+			});
+		}
+
+		for(size_t j = 0; j < libs[i].numLoaders; j++) {
+			inventory_loader_t loader;
+
+			if(!_queryLoader(libs[i].loaders[j], &loader)) {
+				success = false;
+				break;
+			}
+
+			library.loaders.push_back(loader);
+		}
+
+		out->libraries.push_back(library);
+	}
+
+	iolibEnumerateDevicesFree(libs, numLibs);
+
+	return success;
+}
+
+/**
+ * Gets a loader's information, and the records for all of its elements.
+ * Returns false if the loader couldn't be queried.
+ */
+bool InventoryService::_queryLoader(iolib_loader_t loader, inventory_loader_t *out) {
+	out->device = {
+		_stdStringFromIoLibString(iolibLoaderGetUuid(loader)),
+		_stdStringFromIoLibString(iolibLoaderGetName(loader)),
+		_stdStringFromIoLibString(iolibLoaderGetDevFile(loader))
+	};
+
+	iolib_error_t err = 0;
+	out->elements.resize(iolibLoaderGetNumElements(loader, kStorageElementAny));
+
+	int num = iolibLoaderGetInventory(loader, out->elements.data(),
+									  out->elements.size(), &err);
+
+	// If elements appeared since we asked, try again with enough space
+	if(num > 0 && (size_t) num > out->elements.size()) {
+		out->elements.resize(num);
+		num = iolibLoaderGetInventory(loader, out->elements.data(),
+									  out->elements.size(), &err);
+	}
+
+	if(num < 0) {
+		LOG(WARNING) << "Couldn't get inventory of loader "
+					 << out->device.file << ": " << err;
+		return false;
+	}
+
+	out->elements.resize(std::min((size_t) num, out->elements.size()));
+	return true;
+}
+
+/**
+ * Creates a standard library string from an iolib string, freeing that iolib
+ * string once done.
+ */
+std::string InventoryService::_stdStringFromIoLibString(iolib_string_t in) {
+	std::string out = std::string(in);
+	iolibStringFree(in);
+
+	return out;
+}
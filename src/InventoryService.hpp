@@ -0,0 +1,116 @@
+/**
+ * Keeps a snapshot of the hardware: all libraries, their drives and loaders,
+ * and what's in every storage element of the loaders. The web API is answered
+ * from the snapshot, so API requests never query the iolib (or wait for a slow
+ * changer) themselves; only the service's thread does.
+ *
+ * The snapshot is refreshed periodically, and whenever a refresh is requested,
+ * e.g. after a loader moved a tape. All requests made while a refresh is
+ * pending are served by that same refresh, so the hardware is only queried
+ * once no matter how many come in. Each refresh produces a new snapshot with
+ * a higher version; snapshots are never modified once published.
+ *
+ * The iolib doesn't expect devices to be enumerated, or a loader to be queried
+ * or moved, from several threads at once; everything that does so holds the
+ * iolib lock. A refresh only reads fixed properties of drives, so drive I/O
+ * doesn't need it.
+ */
+#ifndef INVENTORYSERVICE_H
+#define INVENTORYSERVICE_H
+
+/**
+ * Interval between periodic refreshes of the snapshot, in seconds.
+ */
+#define INVENTORY_REFRESH_INTERVAL	60
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+
+#include "IOLib.h"
+
+/**
+ * A drive or loader.
+ */
+typedef struct {
+	std::string id;
+	std::string name;
+	// device file
+	std::string file;
+} inventory_device_t;
+
+/**
+ * A loader, and all of its storage elements.
+ */
+typedef struct {
+	inventory_device_t device;
+	std::vector<iolib_element_record_t> elements;
+} inventory_loader_t;
+
+/**
+ * A library, and the drives and loaders in it.
+ */
+typedef struct {
+	std::string id;
+	std::string name;
+
+	std::vector<inventory_device_t> drives;
+	std::vector<inventory_loader_t> loaders;
+} inventory_library_t;
+
+/**
+ * The state of all hardware at some point in time.
+ */
+typedef struct {
+	// increases with every refresh; 0 until the first refresh finished
+	uint64_t version = 0;
+	// when the hardware was queried
+	time_t updated = 0;
+
+	std::vector<inventory_library_t> libraries;
+} inventory_snapshot_t;
+
+class InventoryService {
+	public:
+		static void start();
+		static void stop();
+
+		static std::shared_ptr<const inventory_snapshot_t> getSnapshot();
+
+		static void requestRefresh();
+		static std::shared_ptr<const inventory_snapshot_t> refresh();
+
+		// held while enumerating devices, and for all calls on loaders
+		static std::mutex iolibLock;
+
+	private:
+		// protects everything below
+		static std::mutex lock;
+		static std::condition_variable refreshRequested;
+		static std::condition_variable refreshFinished;
+
+		static std::thread refreshThread;
+		static bool running;
+
+		// whether a refresh should start as soon as possible, and the number
+		// of refreshes started and finished
+		static bool pending;
+		static uint64_t refreshesStarted;
+		static uint64_t refreshesFinished;
+
+		static std::shared_ptr<const inventory_snapshot_t> snapshot;
+
+
+		static void _refreshEntry();
+		static bool _query(inventory_snapshot_t *);
+		static bool _queryLoader(iolib_loader_t, inventory_loader_t *);
+
+		static std::string _stdStringFromIoLibString(iolib_string_t);
+};
+
+#endif
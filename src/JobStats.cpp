@@ -0,0 +1,46 @@
+#include "JobStats.hpp"
+
+/**
+ * Initializes all counters, and notes the time the job started.
+ */
+JobStats::JobStats() {
+	this->startTime = this->lastSampleTime = std::chrono::steady_clock::now();
+}
+
+/**
+ * Fills the counters into the given snapshot. The current read and write rates
+ * are calculated over the time since they were last calculated, but at most
+ * once per JOB_STATS_RATE_INTERVAL.
+ */
+void JobStats::fill(job_stats_snapshot_t *out) {
+	auto now = std::chrono::steady_clock::now();
+
+	out->elapsed = std::chrono::duration<double>(now - this->startTime).count();
+
+	out->filesScanned = this->filesScanned.get();
+	out->bytesScanned = this->bytesScanned.get();
+	out->bytesRead = this->bytesRead.get();
+
+	out->chunksBuilt = this->chunksBuilt.get();
+	out->chunksProcessed = this->chunksProcessed.get();
+	out->chunksWritten = this->chunksWritten.get();
+	out->bytesWritten = this->bytesWritten.get();
+	out->chunksFailed = this->chunksFailed.get();
+
+	// Update the rates, if enough time has passed
+	std::lock_guard<std::mutex> lk(this->rateLock);
+
+	double interval = std::chrono::duration<double>(now - this->lastSampleTime).count();
+
+	if(interval >= JOB_STATS_RATE_INTERVAL) {
+		this->readRate = (out->bytesRead - this->lastBytesRead) / interval;
+		this->writeRate = (out->bytesWritten - this->lastBytesWritten) / interval;
+
+		this->lastSampleTime = now;
+		this->lastBytesRead = out->bytesRead;
+		this->lastBytesWritten = out->bytesWritten;
+	}
+
+	out->readRate = this->readRate;
+	out->writeRate = this->writeRate;
+}
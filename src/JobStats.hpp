@@ -0,0 +1,176 @@
+/**
+ * Live counters for a single backup job. These are updated by every stage of
+ * the job's pipeline as it runs, and can be read at any time (i.e. through the
+ * web API) to see how far along the job is, and which stage is limiting it.
+ */
+#ifndef JOBSTATS_H
+#define JOBSTATS_H
+
+/**
+ * Minimum interval, in seconds, over which the current rates are calculated.
+ */
+#define JOB_STATS_RATE_INTERVAL		1.0
+
+#include <chrono>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include "StatCounter.hpp"
+#include "BoundedQueue.hpp"
+
+/**
+ * Time (in seconds, summed over all threads of the stage) that a stage spent
+ * waiting for work from the stage before it, or waiting for the stage after it
+ * to accept its output.
+ */
+typedef struct {
+	double inputWaitTime;
+	double outputWaitTime;
+} job_stage_stats_t;
+
+/**
+ * Counters for a tape drive that a job writes to. Times are in seconds; the
+ * idle time is the time the drive spent waiting for chunks, once it started
+ * writing, and the tape change time is how long writing stopped because tapes
+ * were full.
+ */
+typedef struct {
+	std::string drive;
+	// label of the tape being written to, if known
+	std::string tape;
+
+	uint64_t chunksWritten;
+	uint64_t bytesWritten;
+
+	double writeTime;
+	double filemarkTime;
+	double idleTime;
+
+	// number of times the drive likely had to stop streaming
+	uint64_t underruns;
+
+	uint64_t tapeChanges;
+	double tapeChangeTime;
+} tape_drive_stats_t;
+
+/**
+ * Counters for a job's disk spool. The spool's usage is the space taken up by
+ * chunks on disk; times are in seconds. The drain time is how long the spool
+ * spent draining to tape, so the drain rate is the rate chunks left it while
+ * it was draining.
+ */
+typedef struct {
+	uint64_t bytesUsed;
+	uint64_t maxBytesUsed;
+	uint64_t highWater;
+
+	uint64_t chunksSpooled, bytesSpooled;
+	uint64_t chunksDrained, bytesDrained;
+
+	double spoolTime;
+	// time spent waiting for space in the spool
+	double spaceWaitTime;
+
+	double drainTime;
+	// number of times the spool started draining
+	uint64_t drains;
+	bool draining;
+} chunk_spool_stats_t;
+
+/**
+ * Counters for reading back tapes once they've been written. Times are in
+ * seconds; the read time is spent reading chunks from tape, and the check time
+ * is spent checking them. Mismatches are chunks that couldn't be read, or that
+ * didn't match the catalog.
+ */
+typedef struct {
+	uint64_t tapesVerified;
+	uint64_t tapesInProgress;
+	// tapes that had at least one mismatch
+	uint64_t tapesFailed;
+
+	uint64_t chunksVerified;
+	uint64_t mismatches;
+
+	uint64_t bytesRead;
+	double readTime;
+	double checkTime;
+
+	// descriptions of the most recent mismatches, oldest first
+	std::vector<std::string> errors;
+} tape_verify_stats_t;
+
+/**
+ * Snapshot of a job's counters.
+ */
+typedef struct {
+	std::string id;
+	std::string root;
+
+	// seconds since the job was created
+	double elapsed;
+
+	uint64_t filesScanned, bytesScanned;
+	uint64_t bytesRead;
+
+	uint64_t chunksBuilt, chunksProcessed, chunksWritten;
+	uint64_t bytesWritten;
+
+	// chunks that weren't written because of an error; if there are any, the
+	// job failed
+	uint64_t chunksFailed;
+
+	// current rates, in bytes/sec
+	double readRate, writeRate;
+
+	std::map<std::string, bounded_queue_stats_t> queues;
+	std::map<std::string, job_stage_stats_t> stages;
+
+	std::vector<tape_drive_stats_t> drives;
+
+	// whether chunks are spooled to disk before being written
+	bool hasSpool;
+	chunk_spool_stats_t spool;
+
+	// whether tapes are read back after they're written
+	bool hasVerifier;
+	tape_verify_stats_t verify;
+} job_stats_snapshot_t;
+
+class JobStats {
+	public:
+		JobStats();
+
+		StatCounter filesScanned;
+		StatCounter bytesScanned;
+
+		// bytes of file data copied into chunks
+		StatCounter bytesRead;
+
+		StatCounter chunksBuilt;
+		StatCounter chunksProcessed;
+		StatCounter chunksWritten;
+
+		// bytes of chunks written to tape
+		StatCounter bytesWritten;
+
+		// chunks that weren't written, since writing them (or an earlier
+		// chunk of the job) failed
+		StatCounter chunksFailed;
+
+		void fill(job_stats_snapshot_t *);
+
+	private:
+		std::chrono::steady_clock::time_point startTime;
+
+		// the last sample the current rates were calculated from
+		std::mutex rateLock;
+		std::chrono::steady_clock::time_point lastSampleTime;
+		uint64_t lastBytesRead = 0, lastBytesWritten = 0;
+		double readRate = 0, writeRate = 0;
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "ClientHandler.hpp"
 #include "BackupJob.hpp"
+#include "Metrics.hpp"
 
 #include <glog/logging.h>
 #include <fstream>
@@ -9,6 +10,7 @@
 #include <json.hpp>
 #include <vector>
 #include <algorithm>
+#include <sstream>
 #include <cryptopp/sha.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/filters.h>
@@ -45,13 +47,13 @@ MainLoop::MainLoop() {
 		}
 	};
 
-	this->server.resource["^/api$"]["POST"]=[=](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+	this->server.resource["^/api.*$"]["POST"]=[=](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
 		try {
             // Read the input
 			json jsonIn = json::parse(request->content);
 
             // Perform request
-            json jsonOut = this->handler.handle("POST", request->path, {});
+            json jsonOut = this->handler.handle("POST", request->path, jsonIn);
             string jsonOutStr = jsonOut.dump(4);
 
             // Send response
@@ -64,6 +66,24 @@ MainLoop::MainLoop() {
 		}
 	};
 
+	// Export metrics for Prometheus
+	this->server.resource["^/metrics$"]["GET"]=[=](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+		try {
+            stringstream metrics;
+            Metrics::write(metrics);
+
+            string metricsStr = metrics.str();
+
+            // Send response
+			*response << "HTTP/1.1 200 OK\r\n"
+        			  << "Content-Type: text/plain; version=0.0.4\r\n"
+        			  << "Content-Length: " << metricsStr.length() << "\r\n\r\n"
+        			  << metricsStr;
+		} catch(exception& e) {
+            this->errorForException(e, e.what(), request->path, response);
+		}
+	};
+
     // Default resource: get contents of "webui" directory
     this->server.default_resource["GET"]=[=](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
         try {
@@ -150,9 +170,11 @@ MainLoop::MainLoop() {
 * Destroys the socket and frees resources.
 */
 MainLoop::~MainLoop() {
-    // Kill the server.
-    this->server.stop();
-    this->serverThread.join();
+    // Kill the server, unless the run loop already did
+    if(this->serverThread.joinable()) {
+        this->server.stop();
+        this->serverThread.join();
+    }
 }
 
 /**
@@ -0,0 +1,758 @@
+#include "MediaChanger.hpp"
+
+#include "InventoryService.hpp"
+#include "Metrics.hpp"
+#include "TapeCatalog.hpp"
+#include "TapeReader.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+
+#include <chrono>
+
+#include <glog/logging.h>
+#include <boost/bind.hpp>
+
+/**
+ * Reads the state of the loader's slots and drives. Of the given drives, the
+ * first `numActive` are written to; the others are kept on standby. Full tapes
+ * are verified with the given verifier, if any.
+ */
+MediaChanger::MediaChanger(iolib_loader_t loader, std::vector<iolib_drive_t> drives,
+						   size_t numActive, TapeVerifier *verifier) {
+	this->loader = loader;
+	this->verifier = verifier;
+
+	std::unique_lock<std::mutex> iolib(InventoryService::iolibLock);
+
+	iolib_string_t devFile = iolibLoaderGetDevFile(this->loader);
+	this->name = devFile;
+	iolibStringFree(devFile);
+
+	// Get the state of all slots and drive elements in one go
+	std::vector<iolib_element_record_t> elements;
+	iolib_error_t err = 0;
+
+	elements.resize(iolibLoaderGetNumElements(this->loader, kStorageElementAny));
+
+	int num = iolibLoaderGetInventory(this->loader, elements.data(),
+									  elements.size(), &err);
+
+	// If elements appeared since we asked, try again with enough space
+	if(num > 0 && (size_t) num > elements.size()) {
+		elements.resize(num);
+		num = iolibLoaderGetInventory(this->loader, elements.data(),
+									  elements.size(), &err);
+	}
+
+	CHECK(num >= 0) << "Couldn't get inventory of loader " << this->name
+					<< ": " << err;
+
+	elements.resize(std::min((size_t) num, elements.size()));
+
+	// Records are ordered by address within each type, as drives are
+	for(auto &record : elements) {
+		if(record.type != kStorageElementSlot && record.type != kStorageElementDrive) {
+			continue;
+		}
+
+		media_changer_element_t state;
+
+		state.element = record.element;
+		state.full = (record.flags & kStorageElementFull);
+		state.label = record.label;
+		state.busy = false;
+		state.used = (state.full && !this->_mayBeBlank(state.label));
+
+		if(record.type == kStorageElementSlot) {
+			this->slots.push_back(state);
+		} else {
+			this->driveElements.push_back(state);
+		}
+	}
+
+	iolib.unlock();
+
+	// Only drives that the loader can reach can have their tapes changed
+	this->drives = drives;
+
+	if(this->drives.size() > this->driveElements.size()) {
+		LOG(WARNING) << "Loader " << this->name << " has only "
+					 << this->driveElements.size() << " drives, but the library "
+					 << "has " << drives.size();
+
+		this->drives.resize(this->driveElements.size());
+	}
+
+	this->driveElements.resize(this->drives.size());
+
+	/*
+	 * Tapes in active drives are written to, after any data already on them;
+	 * the catalog knows how much that is, unless they're unlabelled. Those in
+	 * standby drives are read now, so that switching to one doesn't have to
+	 * wait for that; any with data on them are unloaded before a tape is
+	 * staged.
+	 */
+	for(size_t i = 0; i < this->drives.size(); i++) {
+		media_changer_element_t *e = &this->driveElements[i];
+		uint64_t bytes = 0;
+
+		this->standby.push_back(i >= numActive);
+
+		if(i < numActive) {
+			e->used = true;
+
+			if(!e->label.empty()) {
+				for(auto &chunk : TapeCatalog::getChunksOnTape(e->label)) {
+					bytes += chunk.length;
+				}
+			}
+		} else if(e->full && !e->used) {
+			e->used = !this->_isBlank(i);
+		}
+
+		this->bytesOnTape.push_back(bytes);
+	}
+
+	LOG(INFO) << "Loader " << this->name << ": " << this->slots.size()
+			  << " slots, " << this->drives.size() << " drives ("
+			  << (this->drives.size() - std::min(numActive, this->drives.size()))
+			  << " on standby)";
+
+	this->pool = new ctpl::thread_pool(1);
+
+	// Every drive may be reading back a tape at the same time
+	if(this->verifier) {
+		this->verifyPool = new ctpl::thread_pool(this->drives.size());
+	}
+}
+
+/**
+ * Waits for any tapes that are being verified, staged or unloaded.
+ */
+MediaChanger::~MediaChanger() {
+	// Verifying tapes queues their unloads, so it has to finish first
+	if(this->verifyPool) {
+		this->verifyPool->stop(true);
+		delete this->verifyPool;
+	}
+
+	this->pool->stop(true);
+	delete this->pool;
+}
+
+/**
+ * Returns the label of the tape in the given drive; it's empty if the label
+ * isn't known.
+ */
+std::string MediaChanger::getLabel(iolib_drive_t drive) {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	int i = this->_indexForDrive(drive);
+
+	if(i < 0) {
+		return "";
+	}
+
+	return this->driveElements[i].label;
+}
+
+/**
+ * Records that `bytes` were written to the tape in the given drive, which is
+ * currently writing at `rate` bytes/sec. If the tape is expected to be full
+ * soon, a blank tape is staged in a standby drive.
+ */
+void MediaChanger::recordWrite(iolib_drive_t drive, uint64_t bytes, double rate) {
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	int i = this->_indexForDrive(drive);
+
+	if(i < 0) {
+		return;
+	}
+
+	this->bytesOnTape[i] += bytes;
+
+	if(this->staging || this->stagingFailed || rate <= 0) {
+		return;
+	}
+
+	// Is the tape going to be full soon?
+	uint64_t remaining = 0;
+
+	if(this->bytesOnTape[i] < this->capacity) {
+		remaining = this->capacity - this->bytesOnTape[i];
+	}
+
+	double timeLeft = remaining / rate;
+
+	if(timeLeft > MEDIA_CHANGER_PRESTAGE_LEAD) {
+		return;
+	}
+
+	// If so, stage a tape, unless one is ready already
+	if(this->_findStagedDrive() != -1) {
+		return;
+	}
+
+	for(size_t j = 0; j < this->standby.size(); j++) {
+		if(this->standby[j]) {
+			LOG(INFO) << "Tape in drive " << i << " is expected to be full in "
+					  << timeLeft << " sec (" << remaining << " bytes left); "
+					  << "staging a blank tape";
+
+			this->staging = true;
+			this->pool->push(boost::bind(&MediaChanger::_stageEntry, this));
+			break;
+		}
+	}
+}
+
+/**
+ * Replaces the full tape in the given drive with a blank one, and returns the
+ * drive to continue writing to; NULL if the tape couldn't be replaced.
+ *
+ * If a blank tape is staged in a standby drive, that drive is returned right
+ * away, and the full tape is unloaded in the background. Otherwise, the full
+ * tape is swapped out in place, which blocks until the loader is done.
+ */
+iolib_drive_t MediaChanger::replaceTape(iolib_drive_t drive) {
+	int i, staged;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		i = this->_indexForDrive(drive);
+
+		if(i < 0) {
+			LOG(ERROR) << "Tape in a drive without loader access is full";
+			return NULL;
+		}
+
+		LOG(INFO) << "Tape '" << this->driveElements[i].label << "' in drive "
+				  << i << " is full after " << this->bytesOnTape[i] << " bytes";
+
+		/*
+		 * Remember how much fit on it, for the next time; only whole chunks are
+		 * counted, so take the most that fit on any tape.
+		 */
+		if(!this->haveCapacity || this->bytesOnTape[i] > this->capacity) {
+			this->capacity = this->bytesOnTape[i];
+			this->haveCapacity = true;
+		}
+
+		// The next tape may be staged, even if staging this one failed
+		this->stagingFailed = false;
+
+		if((staged = this->_findStagedDrive()) != -1) {
+			return this->_switchDrive(i, staged);
+		}
+	}
+
+	// Wait for a tape being staged, then check again
+	std::unique_lock<std::mutex> robot(this->robotLock);
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		if((staged = this->_findStagedDrive()) != -1) {
+			return this->_switchDrive(i, staged);
+		}
+	}
+
+	// Otherwise, swap the tape in the drive itself
+	if(!this->_swapInPlace(i)) {
+		LOG(ERROR) << "Couldn't replace full tape in drive " << i;
+		return NULL;
+	}
+
+	return this->drives[i];
+}
+
+/**
+ * Continues writing on the staged drive instead of the one with the full tape,
+ * which goes on standby, and is unloaded in the background; if tapes are
+ * verified, that happens first. The lock must be held.
+ */
+iolib_drive_t MediaChanger::_switchDrive(size_t full, size_t staged) {
+	this->standby[staged] = false;
+	this->standby[full] = true;
+
+	this->driveElements[staged].used = true;
+	this->bytesOnTape[staged] = 0;
+
+	LOG(INFO) << "Continuing on drive " << staged << " with tape '"
+			  << this->driveElements[staged].label << "'";
+
+	if(this->verifier) {
+		this->driveElements[full].busy = true;
+		this->verifyPool->push(boost::bind(&MediaChanger::_verifyEntry, this, full));
+	} else {
+		this->pool->push(boost::bind(&MediaChanger::_unloadStandby, this));
+	}
+
+	return this->drives[staged];
+}
+
+/**
+ * Returns the index of the given drive; -1 if the loader can't reach it.
+ */
+int MediaChanger::_indexForDrive(iolib_drive_t drive) {
+	for(size_t i = 0; i < this->drives.size(); i++) {
+		if(this->drives[i] == drive) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Returns the index of a standby drive that has a blank tape loaded; -1 if
+ * there isn't one. The lock must be held.
+ */
+int MediaChanger::_findStagedDrive() {
+	for(size_t i = 0; i < this->drives.size(); i++) {
+		media_changer_element_t *e = &this->driveElements[i];
+
+		if(this->standby[i] && e->full && !e->used && !e->busy) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Returns the index of a slot holding a blank tape, or of an empty slot; -1 if
+ * there's no such slot. The lock must be held.
+ */
+int MediaChanger::_findSlot(bool blank) {
+	for(size_t i = 0; i < this->slots.size(); i++) {
+		media_changer_element_t *e = &this->slots[i];
+
+		if(blank && e->full && !e->used) {
+			return i;
+		} else if(!blank && !e->full) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Checks whether the tape with the given label may be blank: it's in the
+ * scratch pool, and the catalog has no chunks on it. Tapes without a label
+ * can't be looked up in the catalog; they're only candidates if there's no
+ * scratch pool, and loading them shows whether they're blank.
+ */
+bool MediaChanger::_mayBeBlank(const std::string &label) {
+	const std::string prefix = MEDIA_CHANGER_SCRATCH_PREFIX;
+
+	if(label.empty()) {
+		return prefix.empty();
+	} else if(label.compare(0, prefix.size(), prefix) != 0) {
+		return false;
+	}
+
+	return TapeCatalog::getChunksOnTape(label).empty();
+}
+
+/**
+ * Reads the start of the tape in the given drive, and checks that it's blank:
+ * its first tape file is empty. If it can't be read, it's not assumed to be
+ * blank. The tape is left rewound.
+ */
+bool MediaChanger::_isBlank(size_t drive) {
+	iolib_error_t err = iolibDriveRewind(this->drives[drive]);
+	size_t read = -1;
+
+	if(err == 0) {
+		std::vector<uint8_t> probe(std::max((size_t) TAPE_READER_BLOCK_SIZE,
+											iolibDriveGetBlockSize(this->drives[drive])));
+		read = TapeReader::readFile(this->drives[drive], probe.data(), probe.size(), &err);
+
+		iolibDriveRewind(this->drives[drive]);
+	}
+
+	if((ssize_t) read < 0) {
+		LOG(WARNING) << "Couldn't read tape '" << this->driveElements[drive].label
+					 << "' in drive " << drive << " (" << err << "); not using "
+					 << "it as a blank tape";
+		return false;
+	} else if(read != 0) {
+		LOG(WARNING) << "Tape '" << this->driveElements[drive].label << "' in "
+					 << "drive " << drive << " has data on it; not using it as "
+					 << "a blank tape";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Makes sure the tape just loaded into the given drive is blank; if it's not,
+ * it's exchanged with the next blank tape until one is. Returns false if no
+ * blank tape could be loaded; the tape left in the drive is marked as used
+ * then. The robot lock must be held.
+ */
+bool MediaChanger::_ensureBlank(size_t drive) {
+	while(!this->_isBlank(drive)) {
+		int slot;
+
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+
+			this->driveElements[drive].used = true;
+			slot = this->_findSlot(true);
+		}
+
+		if(slot == -1) {
+			LOG(WARNING) << "No blank tapes left in " << this->name;
+			return false;
+		}
+
+		if(!this->_ejectDrive(drive) ||
+		   !this->_exchange(&this->driveElements[drive], &this->slots[slot]) ||
+		   !this->_rewindDrive(drive)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Loads a blank tape into a standby drive, unloading the full tape in it first
+ * if needed.
+ */
+void MediaChanger::_stageEntry() {
+	Trace::setThreadName("media changer");
+
+	{
+		std::unique_lock<std::mutex> robot(this->robotLock);
+		int drive = -1;
+
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+
+			// Prefer an empty standby drive
+			if(this->_findStagedDrive() == -1) {
+				for(size_t i = 0; i < this->drives.size(); i++) {
+					if(!this->standby[i] || this->driveElements[i].busy) {
+						continue;
+					} else if(!this->driveElements[i].full) {
+						drive = i;
+						break;
+					} else if(drive == -1) {
+						drive = i;
+					}
+				}
+			}
+		}
+
+		if(drive != -1 && !this->_stageDrive(drive)) {
+			LOG(WARNING) << "Couldn't stage a blank tape in drive " << drive
+						 << "; the full tape will be swapped in place";
+
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->stagingFailed = true;
+		}
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+	this->staging = false;
+}
+
+/**
+ * Loads a blank tape into the given standby drive, unloading the tape in it
+ * first if needed. Nothing is moved unless there's a blank tape, and a slot to
+ * unload into. The robot lock must be held.
+ */
+bool MediaChanger::_stageDrive(size_t drive) {
+	bool full;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		full = this->driveElements[drive].full;
+
+		if(this->_findSlot(true) == -1) {
+			LOG(WARNING) << "No blank tapes left in " << this->name;
+			return false;
+		} else if(full && this->_findSlot(false) == -1) {
+			LOG(WARNING) << "No empty slot to unload drive " << drive << " into";
+			return false;
+		}
+	}
+
+	if(full && !this->_unloadDrive(drive)) {
+		return false;
+	}
+
+	return this->_loadDrive(drive);
+}
+
+/**
+ * Unloads full tapes from all standby drives, except those being verified.
+ */
+void MediaChanger::_unloadStandby() {
+	std::unique_lock<std::mutex> robot(this->robotLock);
+
+	for(size_t i = 0; i < this->drives.size(); i++) {
+		bool unload;
+
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+
+			media_changer_element_t *e = &this->driveElements[i];
+			unload = (this->standby[i] && e->full && e->used && !e->busy);
+		}
+
+		if(unload) {
+			this->_unloadDrive(i);
+		}
+	}
+}
+
+/**
+ * Reads back the full tape in the given standby drive, then queues it to be
+ * unloaded.
+ */
+void MediaChanger::_verifyEntry(size_t drive) {
+	std::string label;
+
+	Trace::setThreadName("tape verifier");
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		label = this->driveElements[drive].label;
+	}
+
+	this->verifier->verifyTape(this->drives[drive], label);
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->driveElements[drive].busy = false;
+	}
+
+	this->pool->push(boost::bind(&MediaChanger::_unloadStandby, this));
+}
+
+/**
+ * Replaces the tape in the given drive with a blank one. If there's no empty
+ * slot for the full tape, it's exchanged with the blank tape in one go. Returns
+ * false if there's no blank tape, or the loader failed. The robot lock must be
+ * held.
+ */
+bool MediaChanger::_swapInPlace(size_t drive) {
+	int empty, blank;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		empty = this->_findSlot(false);
+		blank = this->_findSlot(true);
+	}
+
+	if(blank == -1) {
+		LOG(WARNING) << "No blank tapes left in " << this->name;
+		return false;
+	}
+
+	if(empty != -1) {
+		return (this->_unloadDrive(drive) && this->_loadDrive(drive));
+	}
+
+	bool loaded = (this->_ejectDrive(drive) &&
+				   this->_exchange(&this->driveElements[drive], &this->slots[blank]) &&
+				   this->_rewindDrive(drive) && this->_ensureBlank(drive));
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	if(!loaded) {
+		this->driveElements[drive].used = this->driveElements[drive].full;
+		return false;
+	}
+
+	this->bytesOnTape[drive] = 0;
+	this->driveElements[drive].used = !this->standby[drive];
+
+	return true;
+}
+
+/**
+ * Ejects the tape in the given drive, and puts it into an empty slot. Returns
+ * false if there's no empty slot, or the loader failed. The robot lock must be
+ * held.
+ */
+bool MediaChanger::_unloadDrive(size_t drive) {
+	int slot;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		slot = this->_findSlot(false);
+	}
+
+	if(slot == -1) {
+		LOG(WARNING) << "No empty slot to unload drive " << drive << " into";
+		return false;
+	}
+
+	return (this->_ejectDrive(drive) &&
+			this->_move(&this->driveElements[drive], &this->slots[slot]));
+}
+
+/**
+ * Loads a blank tape into the given (empty) drive, and waits for the drive to
+ * be ready. Returns false if there's no blank tape, or it couldn't be loaded.
+ * The robot lock must be held.
+ */
+bool MediaChanger::_loadDrive(size_t drive) {
+	int slot;
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		slot = this->_findSlot(true);
+
+		if(slot == -1) {
+			LOG(WARNING) << "No blank tapes left in " << this->name;
+			return false;
+		}
+
+		this->driveElements[drive].busy = true;
+	}
+
+	bool loaded = (this->_move(&this->slots[slot], &this->driveElements[drive]) &&
+				   this->_rewindDrive(drive) && this->_ensureBlank(drive));
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	media_changer_element_t *e = &this->driveElements[drive];
+	e->busy = false;
+
+	if(!loaded) {
+		// Whatever ended up in the drive can't be written to
+		e->used = e->full;
+		return false;
+	}
+
+	this->bytesOnTape[drive] = 0;
+	// A drive written to right away uses its tape; standby tapes stay blank
+	e->used = !this->standby[drive];
+
+	return true;
+}
+
+/**
+ * Ejects the tape in the given drive, so the loader can take it. The robot
+ * lock must be held.
+ */
+bool MediaChanger::_ejectDrive(size_t drive) {
+	iolib_error_t err = iolibDriveEject(this->drives[drive]);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't eject tape from drive " << drive << ": " << err;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Rewinds the tape just loaded into the given drive, which only returns once
+ * the tape is threaded. The robot lock must be held.
+ */
+bool MediaChanger::_rewindDrive(size_t drive) {
+	iolib_error_t err = iolibDriveRewind(this->drives[drive]);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't load tape in drive " << drive << ": " << err;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Moves the tape from one element to another; returns false if the loader
+ * failed. The robot lock must be held.
+ */
+bool MediaChanger::_move(media_changer_element_t *from, media_changer_element_t *to) {
+	LOG(INFO) << "Moving tape '" << from->label << "' from element "
+			  << iolibElementGetAddress(from->element) << " to "
+			  << iolibElementGetAddress(to->element);
+
+	auto start = std::chrono::steady_clock::now();
+	iolib_error_t err;
+
+	{
+		TraceScope trace("loader", "loader move");
+		std::lock_guard<std::mutex> iolib(InventoryService::iolibLock);
+
+		err = iolibLoaderMove(this->loader, from->element, to->element);
+	}
+
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+	Metrics::loaderMoveTime.observe(time.count());
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't move tape '" << from->label << "': " << err;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	to->full = true;
+	to->label = from->label;
+	to->used = from->used;
+
+	from->full = false;
+	from->label.clear();
+	from->used = false;
+
+	// The hardware changed, so the API should show it
+	InventoryService::requestRefresh();
+
+	return true;
+}
+
+/**
+ * Exchanges the tapes in two elements; returns false if the loader failed. The
+ * robot lock must be held.
+ */
+bool MediaChanger::_exchange(media_changer_element_t *a, media_changer_element_t *b) {
+	LOG(INFO) << "Exchanging tapes '" << a->label << "' and '" << b->label
+			  << "' in elements " << iolibElementGetAddress(a->element)
+			  << " and " << iolibElementGetAddress(b->element);
+
+	auto start = std::chrono::steady_clock::now();
+	iolib_error_t err;
+
+	{
+		TraceScope trace("loader", "loader move");
+		std::lock_guard<std::mutex> iolib(InventoryService::iolibLock);
+
+		err = iolibLoaderExchange(this->loader, a->element, b->element);
+	}
+
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+	Metrics::loaderMoveTime.observe(time.count());
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't exchange tapes '" << a->label << "' and '"
+				   << b->label << "': " << err;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	std::swap(a->full, b->full);
+	std::swap(a->label, b->label);
+	std::swap(a->used, b->used);
+
+	InventoryService::requestRefresh();
+
+	return true;
+}
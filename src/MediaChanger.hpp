@@ -0,0 +1,153 @@
+/**
+ * Drives a library's media changer, so that writing can go on once a tape is
+ * full. The changer's idea of which element holds which tape is read once, and
+ * then kept up to date with every move made here; the loader doesn't need to
+ * be re-inventoried.
+ *
+ * Some of the library's drives may be kept on standby: as soon as any drive is
+ * expected to fill its tape within MEDIA_CHANGER_PRESTAGE_LEAD seconds, a blank
+ * tape is loaded into a standby drive. When the tape does fill, the writer just
+ * switches over to that drive, and the full tape is unloaded in the background;
+ * the drive is idle for seconds rather than for the minutes it takes to unload
+ * a tape and fetch a new one. Without a staged tape, the full tape is swapped
+ * in place.
+ *
+ * If a verifier is given, a full tape that was switched away from is read back
+ * in its drive before it's unloaded; the drive can't have a tape staged in it
+ * until then. Tapes that are swapped in place aren't verified, since writing
+ * has to wait for them.
+ *
+ * A tape is only used as a blank tape if it's in the scratch pool (its label
+ * starts with MEDIA_CHANGER_SCRATCH_PREFIX), the catalog has no chunks on it,
+ * and once it's loaded, there's no data at its start; a tape that turns out to
+ * have data is put back, and another one is tried. Tapes without a label are
+ * only considered if there's no scratch prefix.
+ *
+ * If a tape can't be staged (there's no blank tape, or no slot to unload into)
+ * that's only logged, since the tape that's being written isn't full yet. If
+ * a full tape can't be replaced, the writer fails the chunks that don't fit.
+ *
+ * Drive elements of the loader are assumed to be in the same order as the
+ * library's drives.
+ */
+#ifndef MEDIACHANGER_H
+#define MEDIACHANGER_H
+
+/**
+ * Capacity, in bytes, assumed for a tape until one has actually been filled;
+ * this is the native capacity of an LTO-6 tape.
+ */
+#define MEDIA_CHANGER_DEFAULT_CAPACITY	(2500ULL * 1000 * 1000 * 1000)
+
+/**
+ * Once a drive is expected to fill its tape within this many seconds, a blank
+ * tape is loaded into a standby drive. This should comfortably cover the time
+ * the loader takes to unload a tape and load another.
+ */
+#define MEDIA_CHANGER_PRESTAGE_LEAD		600
+
+/**
+ * Only tapes whose labels start with this prefix are considered blank; if it's
+ * empty, any tape may be, including those without a label.
+ */
+#define MEDIA_CHANGER_SCRATCH_PREFIX	""
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <CTPL/ctpl.h>
+
+#include "TapeVerifier.hpp"
+
+#include "IOLib.h"
+
+/**
+ * State of a slot or drive in the loader.
+ */
+typedef struct {
+	iolib_storage_element_t element;
+
+	// whether there's a tape in the element, and its label (empty if unknown)
+	bool full;
+	std::string label;
+	// whether the tape has been written to (or is in use), and can't be used
+	// as a blank tape
+	bool used;
+	// set while a tape is being loaded into it, or verified
+	bool busy;
+} media_changer_element_t;
+
+class MediaChanger {
+	public:
+		MediaChanger(iolib_loader_t, std::vector<iolib_drive_t>, size_t,
+					 TapeVerifier *);
+		~MediaChanger();
+
+		std::string getLabel(iolib_drive_t);
+
+		void recordWrite(iolib_drive_t, uint64_t, double);
+		iolib_drive_t replaceTape(iolib_drive_t);
+
+	private:
+		iolib_loader_t loader;
+		std::string name;
+
+		// all drives of the library, and the drive elements that hold them
+		std::vector<iolib_drive_t> drives;
+		std::vector<media_changer_element_t> driveElements;
+
+		std::vector<media_changer_element_t> slots;
+
+		// which drives are on standby, and the data on each drive's tape
+		std::vector<bool> standby;
+		std::vector<uint64_t> bytesOnTape;
+
+		// expected capacity of a tape, once one has filled up
+		uint64_t capacity = MEDIA_CHANGER_DEFAULT_CAPACITY;
+		bool haveCapacity = false;
+		// set while a blank tape is being staged; and if that failed, until
+		// the next tape is full, so it's not retried after every write
+		bool staging = false;
+		bool stagingFailed = false;
+
+		// protects all of the above
+		std::mutex lock;
+		// held for all operations on the loader; the robot can only do one
+		// thing at a time anyways
+		std::mutex robotLock;
+
+		// stages tapes in the background
+		ctpl::thread_pool *pool;
+
+		// reads back full tapes before they're unloaded; NULL if they aren't
+		// verified
+		TapeVerifier *verifier;
+		ctpl::thread_pool *verifyPool = NULL;
+
+
+		int _indexForDrive(iolib_drive_t);
+		int _findStagedDrive();
+		int _findSlot(bool);
+		bool _mayBeBlank(const std::string &);
+		bool _isBlank(size_t);
+		bool _ensureBlank(size_t);
+		iolib_drive_t _switchDrive(size_t, size_t);
+
+		void _stageEntry();
+		bool _stageDrive(size_t);
+		void _unloadStandby();
+		void _verifyEntry(size_t);
+
+		bool _swapInPlace(size_t);
+		bool _unloadDrive(size_t);
+		bool _loadDrive(size_t);
+
+		bool _ejectDrive(size_t);
+		bool _rewindDrive(size_t);
+		bool _move(media_changer_element_t *, media_changer_element_t *);
+		bool _exchange(media_changer_element_t *, media_changer_element_t *);
+};
+
+#endif
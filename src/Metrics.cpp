@@ -0,0 +1,196 @@
+#include "Metrics.hpp"
+
+#include "BackupJob.hpp"
+
+#include <iomanip>
+#include <map>
+#include <vector>
+
+StatHistogram Metrics::chunkBuildTime({
+	0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250
+});
+StatHistogram Metrics::chunkFinalizeTime({
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25,
+	50
+});
+
+StatCounter Metrics::chunksBuilt;
+
+StatCounter Metrics::crcBytes;
+StatCounter Metrics::crcTime;
+
+StatHistogram Metrics::tapeWriteTime({
+	0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250
+});
+StatCounter Metrics::tapeBytesWritten;
+StatCounter Metrics::tapeWriteTotalTime;
+StatCounter Metrics::tapeUnderruns;
+StatCounter Metrics::tapeWriteErrors;
+
+StatCounter Metrics::tapeVerifyBytesRead;
+StatCounter Metrics::tapeVerifyTotalTime;
+StatCounter Metrics::tapeVerifyMismatches;
+
+StatHistogram Metrics::loaderMoveTime({
+	1, 2.5, 5, 10, 15, 20, 30, 45, 60, 90, 120, 180, 300, 600
+});
+StatHistogram Metrics::inventoryRefreshTime({
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25,
+	50
+});
+
+StatCounter Metrics::chunkBufferBytesAllocated;
+StatCounter Metrics::chunkBufferBytesFreed;
+
+/**
+ * Writes all metrics to the stream, in the Prometheus text exposition format.
+ *
+ * Throughputs aren't exported directly; rather, there are counters for both the
+ * bytes processed and the time taken, and the rate of one is divided by the
+ * rate of the other.
+ */
+void Metrics::write(std::ostream &out) {
+	out << std::setprecision(12);
+
+	// Chunk building
+	_writeHistogram(out, "chunk_build_seconds",
+					"Time from creating a chunk until it is built",
+					chunkBuildTime);
+	_writeHistogram(out, "chunk_finalize_seconds",
+					"Time taken to finalize a chunk", chunkFinalizeTime);
+	_writeCounter(out, "chunks_built_total", "Number of chunks built",
+				  chunksBuilt.get());
+
+	_writeCounter(out, "crc_bytes_total",
+				  "Bytes of file data checksummed with CRC32C", crcBytes.get());
+	_writeCounter(out, "crc_seconds_total",
+				  "Time spent calculating CRC32C checksums",
+				  crcTime.get() / 1000000000.0);
+
+	// Tape writing
+	_writeHistogram(out, "tape_write_seconds",
+					"Time taken to write a chunk to tape", tapeWriteTime);
+	_writeCounter(out, "tape_written_bytes_total",
+				  "Bytes of chunks written to tape", tapeBytesWritten.get());
+	_writeCounter(out, "tape_write_seconds_total",
+				  "Time spent writing chunks to tape",
+				  tapeWriteTotalTime.get() / 1000000000.0);
+	_writeCounter(out, "tape_underruns_total",
+				  "Times a drive ran out of data between chunks",
+				  tapeUnderruns.get());
+	_writeCounter(out, "tape_write_errors_total",
+				  "Chunks that couldn't be written to tape because of an error",
+				  tapeWriteErrors.get());
+
+	// Verification
+	_writeCounter(out, "tape_verify_read_bytes_total",
+				  "Bytes of chunks read back to verify tapes",
+				  tapeVerifyBytesRead.get());
+	_writeCounter(out, "tape_verify_read_seconds_total",
+				  "Time spent reading chunks back to verify tapes",
+				  tapeVerifyTotalTime.get() / 1000000000.0);
+	_writeCounter(out, "tape_verify_mismatches_total",
+				  "Chunks that failed verification after being written",
+				  tapeVerifyMismatches.get());
+
+	// Loaders
+	_writeHistogram(out, "loader_move_seconds",
+					"Time taken by a loader to move a tape", loaderMoveTime);
+	_writeHistogram(out, "inventory_refresh_seconds",
+					"Time taken to query the inventory of all libraries",
+					inventoryRefreshTime);
+
+	// Memory; the difference is calculated from the totals, which are only
+	// ever incremented
+	uint64_t freed = chunkBufferBytesFreed.get();
+	uint64_t allocated = chunkBufferBytesAllocated.get();
+
+	_writeGauge(out, "chunk_buffer_bytes",
+				"Memory currently allocated for chunk backing stores",
+				(allocated > freed) ? (allocated - freed) : 0);
+
+	// Queues of all running jobs
+	_writeQueueDepths(out);
+}
+
+/**
+ * Writes the HELP and TYPE lines for a metric.
+ */
+void Metrics::_writeHeader(std::ostream &out, std::string name,
+						   std::string help, std::string type) {
+	out << "# HELP " << METRICS_PREFIX << name << " " << help << "\n"
+		<< "# TYPE " << METRICS_PREFIX << name << " " << type << "\n";
+}
+
+/**
+ * Writes a metric consisting of a single counter.
+ */
+void Metrics::_writeCounter(std::ostream &out, std::string name,
+							std::string help, double value) {
+	_writeHeader(out, name, help, "counter");
+	out << METRICS_PREFIX << name << " " << value << "\n";
+}
+
+/**
+ * Writes a metric consisting of a single gauge.
+ */
+void Metrics::_writeGauge(std::ostream &out, std::string name,
+						  std::string help, double value) {
+	_writeHeader(out, name, help, "gauge");
+	out << METRICS_PREFIX << name << " " << value << "\n";
+}
+
+/**
+ * Writes a histogram, with a bucket series for each bound, and its sum and
+ * count.
+ */
+void Metrics::_writeHistogram(std::ostream &out, std::string name,
+							  std::string help, StatHistogram &histogram) {
+	stat_histogram_snapshot_t snapshot;
+	histogram.get(&snapshot);
+
+	_writeHeader(out, name, help, "histogram");
+
+	for(size_t i = 0; i < snapshot.bounds.size(); i++) {
+		out << METRICS_PREFIX << name << "_bucket{le=\"" << snapshot.bounds[i]
+			<< "\"} " << snapshot.buckets[i] << "\n";
+	}
+
+	out << METRICS_PREFIX << name << "_bucket{le=\"+Inf\"} " << snapshot.count
+		<< "\n"
+		<< METRICS_PREFIX << name << "_sum " << snapshot.sum << "\n"
+		<< METRICS_PREFIX << name << "_count " << snapshot.count << "\n";
+}
+
+/**
+ * Writes the current depth of each of the pipeline's queues, summed over all
+ * running jobs, as well as the number of jobs.
+ */
+void Metrics::_writeQueueDepths(std::ostream &out) {
+	std::vector<std::string> ids = BackupJob::getJobIds();
+	std::map<std::string, size_t> depths;
+
+	for(auto it = ids.begin(); it != ids.end(); it++) {
+		job_stats_snapshot_t stats;
+
+		// the job may have finished in the meantime
+		if(!BackupJob::getStatsForJob(*it, &stats)) {
+			continue;
+		}
+
+		for(auto queue = stats.queues.begin(); queue != stats.queues.end(); queue++) {
+			depths[queue->first] += queue->second.depth;
+		}
+	}
+
+	_writeGauge(out, "jobs_running", "Number of backup jobs running",
+				ids.size());
+
+	_writeHeader(out, "queue_depth",
+				 "Items waiting in each pipeline queue, over all jobs", "gauge");
+
+	for(auto it = depths.begin(); it != depths.end(); it++) {
+		out << METRICS_PREFIX << "queue_depth{queue=\"" << it->first << "\"} "
+			<< it->second << "\n";
+	}
+}
@@ -0,0 +1,76 @@
+/**
+ * Daemon-wide metrics, shared by all jobs. They can be exported in the text
+ * format understood by Prometheus, so that backup throughput can be graphed,
+ * and alerted on, by an existing monitoring setup.
+ *
+ * All counters and histograms are sharded per thread, so updating them from
+ * the pipeline's hot paths never takes a lock.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * Prefix for the names of all exported metrics.
+ */
+#define METRICS_PREFIX				"backuperator_"
+
+#include <ostream>
+#include <string>
+#include <cstdint>
+
+#include "StatCounter.hpp"
+#include "StatHistogram.hpp"
+
+class Metrics {
+	public:
+		// time from creating a chunk until it's built, and for finalizing it
+		static StatHistogram chunkBuildTime;
+		static StatHistogram chunkFinalizeTime;
+
+		static StatCounter chunksBuilt;
+
+		// data checksummed while building chunks, and time spent on it (ns)
+		static StatCounter crcBytes;
+		static StatCounter crcTime;
+
+		// time to write a chunk to tape, and the totals over all chunks (ns)
+		static StatHistogram tapeWriteTime;
+		static StatCounter tapeBytesWritten;
+		static StatCounter tapeWriteTotalTime;
+		// times a drive had to wait for the next chunk
+		static StatCounter tapeUnderruns;
+		// chunks that couldn't be written, other than because a tape was full
+		static StatCounter tapeWriteErrors;
+
+		// chunks read back to verify tapes, the time taken to read them (ns),
+		// and the number of chunks that didn't match
+		static StatCounter tapeVerifyBytesRead;
+		static StatCounter tapeVerifyTotalTime;
+		static StatCounter tapeVerifyMismatches;
+
+		// time taken by the loader to move a tape between elements
+		static StatHistogram loaderMoveTime;
+		// time taken to refresh the hardware inventory
+		static StatHistogram inventoryRefreshTime;
+
+		// memory allocated and released for chunk backing stores
+		static StatCounter chunkBufferBytesAllocated;
+		static StatCounter chunkBufferBytesFreed;
+
+		static void write(std::ostream &);
+
+	private:
+		static void _writeHeader(std::ostream &, std::string, std::string,
+								 std::string);
+
+		static void _writeCounter(std::ostream &, std::string, std::string,
+								  double);
+		static void _writeGauge(std::ostream &, std::string, std::string,
+								double);
+		static void _writeHistogram(std::ostream &, std::string, std::string,
+									StatHistogram &);
+
+		static void _writeQueueDepths(std::ostream &);
+};
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * A set of bounded queues, one per NUMA node, so that work on a chunk can be
+ * picked up by a worker running on the node that the chunk's memory lives on.
+ * Each node's workers only pop from their own node's queue.
+ *
+ * On machines with a single node, this behaves exactly like a single
+ * BoundedQueue.
+ */
+#ifndef NUMAQUEUE_H
+#define NUMAQUEUE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "BoundedQueue.hpp"
+#include "NumaTopology.hpp"
+
+template <typename T> class NumaQueue {
+	public:
+		/**
+		 * Creates a queue for each node, each of which holds at most
+		 * `capacity` items. The queues are named after the node, except for
+		 * the first one.
+		 */
+		NumaQueue(std::string name, size_t capacity) {
+			size_t numNodes = NumaTopology::getNumNodes();
+
+			for(size_t i = 0; i < numNodes; i++) {
+				std::string nodeName = name;
+
+				if(i != 0) {
+					nodeName += "." + std::to_string(i);
+				}
+
+				this->queues.push_back(new BoundedQueue<T>(nodeName, capacity));
+			}
+		}
+
+		~NumaQueue() {
+			for(auto it = this->queues.begin(); it != this->queues.end(); it++) {
+				delete *it;
+			}
+		}
+
+		/**
+		 * Adds an item to the queue of the given node; a negative node means
+		 * the item has no preference, and goes to the first node.
+		 */
+		bool push(T item, int node) {
+			return this->_queueForNode(node)->push(item);
+		}
+
+		/**
+		 * Removes an item from the queue of the given node.
+		 */
+		bool pop(int node, T *out) {
+			return this->_queueForNode(node)->pop(out);
+		}
+
+		/**
+		 * Closes the queues of all nodes.
+		 */
+		void close() {
+			for(auto it = this->queues.begin(); it != this->queues.end(); it++) {
+				(*it)->close();
+			}
+		}
+
+		/**
+		 * Returns the counters of all nodes' queues, added up.
+		 */
+		bounded_queue_stats_t getStats() {
+			bounded_queue_stats_t total = this->queues[0]->getStats();
+
+			for(size_t i = 1; i < this->queues.size(); i++) {
+				bounded_queue_stats_t stats = this->queues[i]->getStats();
+
+				total.depth += stats.depth;
+				total.capacity += stats.capacity;
+				total.maxDepth = std::max(total.maxDepth, stats.maxDepth);
+				total.pushed += stats.pushed;
+				total.popped += stats.popped;
+				total.pushWaits += stats.pushWaits;
+				total.popWaits += stats.popWaits;
+				total.pushWaitTime += stats.pushWaitTime;
+				total.popWaitTime += stats.popWaitTime;
+			}
+
+			return total;
+		}
+
+		size_t getNumNodes() {
+			return this->queues.size();
+		}
+
+	private:
+		std::vector<BoundedQueue<T> *> queues;
+
+		BoundedQueue<T> *_queueForNode(int node) {
+			if(node < 0) {
+				return this->queues[0];
+			}
+
+			return this->queues[node % this->queues.size()];
+		}
+
+		NumaQueue(const NumaQueue &) = delete;
+		NumaQueue &operator=(const NumaQueue &) = delete;
+};
+
+#endif
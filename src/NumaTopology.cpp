@@ -0,0 +1,206 @@
+#include "NumaTopology.hpp"
+
+#include <glog/logging.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <climits>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+std::once_flag NumaTopology::discoverOnce;
+std::vector<NumaTopology::node_t> NumaTopology::nodes;
+
+/**
+ * Returns the number of NUMA nodes; this is at least 1.
+ */
+size_t NumaTopology::getNumNodes() {
+	std::call_once(discoverOnce, &NumaTopology::_discover);
+
+	return nodes.size();
+}
+
+/**
+ * Sets the memory policy of the given range so its pages are allocated on the
+ * given node. This must be called before the memory is first touched; it is a
+ * preference rather than a hard binding, so allocations fall back to other
+ * nodes rather than failing if the node runs out of memory.
+ */
+bool NumaTopology::bindMemory(void *addr, size_t len, int node) {
+	if(node < 0 || (size_t) node >= getNumNodes() || nodes.size() < 2) {
+		return false;
+	}
+
+#ifdef __linux__
+	unsigned long mask[(1024 / (sizeof(unsigned long) * 8))] = { 0 };
+	const size_t bitsPerLong = sizeof(unsigned long) * 8;
+
+	int id = nodes[node].id;
+	mask[id / bitsPerLong] |= (1UL << (id % bitsPerLong));
+
+	long err = syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+					   sizeof(mask) * 8, 0);
+
+	if(err != 0) {
+		PLOG(WARNING) << "Couldn't bind " << len << " bytes to node " << id;
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Restricts the calling thread to the CPUs of the given node.
+ */
+bool NumaTopology::bindThread(int node) {
+	if(node < 0 || (size_t) node >= getNumNodes() || nodes.size() < 2) {
+		return false;
+	}
+
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for(auto it = nodes[node].cpus.begin(); it != nodes[node].cpus.end(); it++) {
+		if(*it < CPU_SETSIZE) {
+			CPU_SET(*it, &set);
+		}
+	}
+
+	int err = sched_setaffinity(0, sizeof(set), &set);
+
+	if(err != 0) {
+		PLOG(WARNING) << "Couldn't bind thread to node " << nodes[node].id;
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Finds the node that the host adapter of the given device (i.e. a tape drive's
+ * device node) is attached to, by walking up the device's parents in sysfs
+ * until one (usually the PCI device) specifies its node. Returns -1 if it can't
+ * be determined.
+ */
+int NumaTopology::nodeForDevice(std::string devFile) {
+	if(getNumNodes() < 2) {
+		return -1;
+	}
+
+#ifdef __linux__
+	std::string name = devFile.substr(devFile.find_last_of('/') + 1);
+
+	static const char *classes[] = {
+		"scsi_tape", "scsi_generic", "block"
+	};
+
+	for(size_t i = 0; i < (sizeof(classes) / sizeof(*classes)); i++) {
+		std::string link = std::string("/sys/class/") + classes[i] + "/" + name
+						 + "/device";
+		char resolved[PATH_MAX];
+
+		if(realpath(link.c_str(), resolved) == NULL) {
+			continue;
+		}
+
+		// Walk up until a parent knows its node
+		std::string path = resolved;
+
+		while(path.size() > 1 && path.find("/sys/devices") == 0) {
+			std::ifstream nodeFile(path + "/numa_node");
+			int id = -1;
+
+			if(nodeFile >> id && id >= 0) {
+				for(size_t j = 0; j < nodes.size(); j++) {
+					if(nodes[j].id == id) {
+						LOG(INFO) << devFile << " is attached to node " << id;
+						return j;
+					}
+				}
+			}
+
+			path = path.substr(0, path.find_last_of('/'));
+		}
+	}
+
+	LOG(WARNING) << "Couldn't determine NUMA node of " << devFile;
+#endif
+
+	return -1;
+}
+
+/**
+ * Reads the list of nodes and their CPUs from sysfs. If this fails, all CPUs
+ * are assumed to be part of a single node.
+ */
+void NumaTopology::_discover() {
+#if NUMA_ENABLED && defined(__linux__)
+	for(int id = 0; id < 1024; id++) {
+		std::ifstream cpuList("/sys/devices/system/node/node" +
+							  std::to_string(id) + "/cpulist");
+
+		if(!cpuList) {
+			continue;
+		}
+
+		std::string list;
+		std::getline(cpuList, list);
+
+		node_t node = { id, _parseCpuList(list) };
+
+		// Nodes without CPUs (i.e. memory only) don't get any workers
+		if(!node.cpus.empty()) {
+			nodes.push_back(node);
+		}
+	}
+#endif
+
+	if(nodes.empty()) {
+		nodes.push_back({ 0, std::vector<int>() });
+	}
+
+	LOG(INFO) << "Found " << nodes.size() << " NUMA node(s)";
+
+	for(auto it = nodes.begin(); it != nodes.end(); it++) {
+		DLOG(INFO) << "Node " << it->id << ": " << it->cpus.size() << " CPUs";
+	}
+}
+
+/**
+ * Parses a list of CPUs in the format used by sysfs, i.e. "0-7,16-23".
+ */
+std::vector<int> NumaTopology::_parseCpuList(std::string list) {
+	std::vector<int> cpus;
+	std::stringstream stream(list);
+	std::string range;
+
+	while(std::getline(stream, range, ',')) {
+		if(range.empty()) {
+			continue;
+		}
+
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+
+		for(int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
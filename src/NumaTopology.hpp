@@ -0,0 +1,47 @@
+/**
+ * Discovers the NUMA layout of the machine, and places memory and threads on
+ * specific nodes. Copying file data into chunks, checksumming and writing them
+ * are all limited by memory bandwidth, which suffers badly if a chunk's buffer
+ * lives on a different node than the threads working on it.
+ *
+ * Nodes are referred to by their index (0 to getNumNodes() - 1) rather than the
+ * system's node numbers, which need not be contiguous. On systems without NUMA
+ * support (or where it can't be detected) there's a single node, and binding
+ * memory or threads does nothing.
+ */
+#ifndef NUMATOPOLOGY_H
+#define NUMATOPOLOGY_H
+
+/**
+ * Set to 0 to ignore the NUMA layout, and treat the machine as a single node.
+ */
+#define NUMA_ENABLED	1
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+class NumaTopology {
+	public:
+		static size_t getNumNodes();
+
+		static bool bindMemory(void *, size_t, int);
+		static bool bindThread(int);
+
+		static int nodeForDevice(std::string);
+
+	private:
+		// a single node, and the CPUs that belong to it
+		typedef struct {
+			int id;
+			std::vector<int> cpus;
+		} node_t;
+
+		static std::once_flag discoverOnce;
+		static std::vector<node_t> nodes;
+
+		static void _discover();
+		static std::vector<int> _parseCpuList(std::string);
+};
+
+#endif
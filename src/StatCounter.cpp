@@ -0,0 +1,37 @@
+#include "StatCounter.hpp"
+
+// Shard that the next thread to use a counter will be assigned
+static std::atomic<size_t> nextShard(0);
+
+/**
+ * Initializes all shards to zero.
+ */
+StatCounter::StatCounter() {
+	for(size_t i = 0; i < STAT_COUNTER_SHARDS; i++) {
+		this->shards[i].value = 0;
+	}
+}
+
+/**
+ * Returns the sum of all shards. Since the shards are read one by one, this
+ * is not an atomic snapshot if other threads are adding to the counter.
+ */
+uint64_t StatCounter::get() {
+	uint64_t sum = 0;
+
+	for(size_t i = 0; i < STAT_COUNTER_SHARDS; i++) {
+		sum += this->shards[i].value.load(std::memory_order_relaxed);
+	}
+
+	return sum;
+}
+
+/**
+ * Returns the shard used by the calling thread; this is the same for all
+ * counters.
+ */
+size_t StatCounter::shardIndex() {
+	static thread_local size_t shard = (nextShard++ % STAT_COUNTER_SHARDS);
+
+	return shard;
+}
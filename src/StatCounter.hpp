@@ -0,0 +1,48 @@
+/**
+ * A counter that can be incremented from many threads at once without them
+ * contending for the same cache line. Each thread adds to one of several
+ * shards; the shards are only summed up when the counter is read.
+ */
+#ifndef STATCOUNTER_H
+#define STATCOUNTER_H
+
+/**
+ * Number of shards per counter; threads are spread over them round-robin.
+ */
+#define STAT_COUNTER_SHARDS		16
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class StatCounter {
+	public:
+		StatCounter();
+
+		/**
+		 * Adds the given value to the calling thread's shard.
+		 */
+		void add(uint64_t value) {
+			this->shards[shardIndex()].value.fetch_add(value,
+													   std::memory_order_relaxed);
+		}
+
+		uint64_t get();
+
+		static size_t shardIndex();
+
+	private:
+		// each shard takes up an entire cache line
+		typedef struct {
+			std::atomic<uint64_t> value;
+			char padding[64 - sizeof(std::atomic<uint64_t>)];
+		} shard_t;
+
+		shard_t shards[STAT_COUNTER_SHARDS];
+
+		// counters can't be copied
+		StatCounter(const StatCounter &) = delete;
+		StatCounter &operator=(const StatCounter &) = delete;
+};
+
+#endif
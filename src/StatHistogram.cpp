@@ -0,0 +1,75 @@
+#include "StatHistogram.hpp"
+
+#include <glog/logging.h>
+
+/**
+ * Creates a histogram with the given bucket bounds, which must be in ascending
+ * order.
+ */
+StatHistogram::StatHistogram(std::initializer_list<double> bounds) {
+	CHECK(bounds.size() <= STAT_HISTOGRAM_MAX_BUCKETS) << "Too many buckets";
+
+	this->numBounds = 0;
+
+	for(auto it = bounds.begin(); it != bounds.end(); it++) {
+		this->bounds[this->numBounds++] = *it;
+	}
+
+	for(size_t i = 0; i < STAT_COUNTER_SHARDS; i++) {
+		for(size_t j = 0; j <= STAT_HISTOGRAM_MAX_BUCKETS; j++) {
+			this->shards[i].counts[j] = 0;
+		}
+
+		this->shards[i].sum = 0;
+	}
+}
+
+/**
+ * Records a single observation in the calling thread's shard. Negative values
+ * are counted, but don't contribute to the sum.
+ */
+void StatHistogram::observe(double value) {
+	shard_t &shard = this->shards[StatCounter::shardIndex()];
+
+	// Find the first bucket the value fits into; there are only a few of them
+	size_t bucket = 0;
+
+	while(bucket < this->numBounds && value > this->bounds[bucket]) {
+		bucket++;
+	}
+
+	shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	if(value > 0) {
+		shard.sum.fetch_add((uint64_t) (value * kSumScale),
+							std::memory_order_relaxed);
+	}
+}
+
+/**
+ * Sums up all shards into the given snapshot. As with StatCounter, this is not
+ * an atomic snapshot if observations are recorded at the same time.
+ */
+void StatHistogram::get(stat_histogram_snapshot_t *out) {
+	out->bounds.assign(this->bounds, this->bounds + this->numBounds);
+	out->buckets.assign(this->numBounds, 0);
+
+	uint64_t overflow = 0, sum = 0;
+
+	for(size_t i = 0; i < STAT_COUNTER_SHARDS; i++) {
+		for(size_t j = 0; j < this->numBounds; j++) {
+			out->buckets[j] += this->shards[i].counts[j].load(std::memory_order_relaxed);
+		}
+
+		overflow += this->shards[i].counts[this->numBounds].load(std::memory_order_relaxed);
+		sum += this->shards[i].sum.load(std::memory_order_relaxed);
+	}
+
+	// Make the bucket counts cumulative
+	for(size_t j = 1; j < this->numBounds; j++) {
+		out->buckets[j] += out->buckets[j - 1];
+	}
+
+	out->count = overflow + (this->numBounds ? out->buckets.back() : 0);
+	out->sum = sum / kSumScale;
+}
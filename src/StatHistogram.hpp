@@ -0,0 +1,70 @@
+/**
+ * A histogram that can be updated from many threads at once. Like StatCounter,
+ * each thread records observations into one of several shards, which are only
+ * combined when the histogram is read; updates never take a lock.
+ *
+ * Buckets are defined by their (inclusive) upper bounds; an implicit last
+ * bucket holds all observations larger than the largest bound.
+ */
+#ifndef STATHISTOGRAM_H
+#define STATHISTOGRAM_H
+
+/**
+ * Maximum number of bucket bounds a histogram may have.
+ */
+#define STAT_HISTOGRAM_MAX_BUCKETS	22
+
+#include <atomic>
+#include <initializer_list>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "StatCounter.hpp"
+
+/**
+ * Snapshot of a histogram. Bucket counts are cumulative, i.e. each holds the
+ * number of observations less than or equal to its bound; the count of the
+ * implicit last bucket is `count`.
+ */
+typedef struct {
+	std::vector<double> bounds;
+	std::vector<uint64_t> buckets;
+
+	uint64_t count;
+	double sum;
+} stat_histogram_snapshot_t;
+
+class StatHistogram {
+	public:
+		StatHistogram(std::initializer_list<double>);
+
+		void observe(double);
+
+		void get(stat_histogram_snapshot_t *);
+
+	private:
+		// the sum is stored in fixed point, with this many units per 1.0
+		static constexpr double kSumScale = 1000000000.0;
+
+		// one counter per bucket, plus the overflow bucket and the sum; this is
+		// a multiple of the cache line size
+		typedef struct {
+			std::atomic<uint64_t> counts[STAT_HISTOGRAM_MAX_BUCKETS + 1];
+			std::atomic<uint64_t> sum;
+		} shard_t;
+
+		static_assert((sizeof(shard_t) % 64) == 0,
+					  "histogram shards must fill whole cache lines");
+
+		double bounds[STAT_HISTOGRAM_MAX_BUCKETS];
+		size_t numBounds;
+
+		shard_t shards[STAT_COUNTER_SHARDS];
+
+		// histograms can't be copied
+		StatHistogram(const StatHistogram &) = delete;
+		StatHistogram &operator=(const StatHistogram &) = delete;
+};
+
+#endif
@@ -0,0 +1,400 @@
+#include "TapeCatalog.hpp"
+
+#include <glog/logging.h>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include "TapeStructs.h"
+#include "crc32.h"
+
+/**
+ * Header at the start of the catalog file.
+ */
+#define TAPE_CATALOG_MAGIC		0x544150454341544CLL
+
+typedef struct __attribute__((packed)) {
+	// identifies the file; TAPE_CATALOG_MAGIC
+	uint64_t magic;
+	// version of all records in the file; same as for the tape index
+	uint32_t version;
+
+	// CRC32C over the magic and version
+	uint32_t checksum;
+} catalog_header_t;
+
+/**
+ * A single record in the catalog file.
+ */
+typedef struct __attribute__((packed)) {
+	// label of the tape; NUL padded
+	char label[32];
+	tape_index_entry_t entry;
+
+	// CRC32C over the label and entry, so a torn write can be detected
+	uint32_t checksum;
+} catalog_record_t;
+
+std::mutex TapeCatalog::lock;
+
+bool TapeCatalog::loaded = false;
+int TapeCatalog::fd = -1;
+
+std::map<TapeCatalog::chunk_key_t, chunk_location_t> TapeCatalog::chunks;
+std::map<std::string, std::map<TapeCatalog::tape_position_t, TapeCatalog::chunk_key_t>> TapeCatalog::tapes;
+
+/**
+ * Converts a chunk's location into an index entry.
+ */
+static void _entryForLocation(const chunk_location_t &loc, tape_index_entry_t *entry) {
+	memset(entry, 0, sizeof(tape_index_entry_t));
+
+	std::copy(loc.job.begin(), loc.job.end(), entry->jobUuid);
+	entry->chunkIndex = loc.chunkIndex;
+	entry->chunkLenBytes = loc.length;
+
+	entry->fileNumber = (loc.fileNumber >= 0) ? loc.fileNumber : TAPE_POSITION_UNKNOWN;
+	entry->fileOffset = loc.fileOffset;
+	entry->block = (loc.block >= 0) ? loc.block : TAPE_POSITION_UNKNOWN;
+	entry->dataBlock = (loc.dataBlock >= 0) ? loc.dataBlock : TAPE_POSITION_UNKNOWN;
+}
+
+/**
+ * Converts an index entry for a chunk on the given tape into its location.
+ */
+static chunk_location_t _locationForEntry(const tape_index_entry_t &entry,
+										  std::string label) {
+	chunk_location_t loc;
+
+	std::copy(entry.jobUuid, entry.jobUuid + sizeof(entry.jobUuid), loc.job.begin());
+	loc.chunkIndex = entry.chunkIndex;
+	loc.length = entry.chunkLenBytes;
+
+	loc.tape = label;
+
+	loc.fileNumber = (entry.fileNumber != TAPE_POSITION_UNKNOWN) ? entry.fileNumber : -1;
+	loc.fileOffset = entry.fileOffset;
+	loc.block = (entry.block != TAPE_POSITION_UNKNOWN) ? entry.block : -1;
+	loc.dataBlock = (entry.dataBlock != TAPE_POSITION_UNKNOWN) ? entry.dataBlock : -1;
+
+	return loc;
+}
+
+/**
+ * Copies a label into a fixed size, NUL padded field; longer labels are cut
+ * short.
+ */
+static void _copyLabel(std::string label, char *out, size_t len) {
+	memset(out, 0, len);
+	memcpy(out, label.data(), std::min(label.size(), len));
+}
+
+/**
+ * Writes the header for a catalog to the given file.
+ * Returns false if that failed.
+ */
+static bool _writeHeader(int fd) {
+	catalog_header_t header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = TAPE_CATALOG_MAGIC;
+	header.version = TAPE_INDEX_VERSION;
+	header.checksum = crc32c(0, &header, offsetof(catalog_header_t, checksum));
+
+	return (write(fd, &header, sizeof(header)) == sizeof(header));
+}
+
+/**
+ * Appends a record for a chunk's location to the given file. Returns false if
+ * that failed.
+ */
+static bool _writeRecord(int fd, const chunk_location_t &loc) {
+	catalog_record_t record;
+
+	_copyLabel(loc.tape, record.label, sizeof(record.label));
+	_entryForLocation(loc, &record.entry);
+	record.checksum = crc32c(0, &record, offsetof(catalog_record_t, checksum));
+
+	return (write(fd, &record, sizeof(record)) == sizeof(record));
+}
+
+/**
+ * Records where a chunk was written, and appends it to the catalog file.
+ */
+void TapeCatalog::add(const chunk_location_t &loc) {
+	std::lock_guard<std::mutex> lk(lock);
+
+	_load();
+	_insert(loc);
+
+	// Append it to the file
+	if(!_writeRecord(fd, loc) || fdatasync(fd) != 0) {
+		PLOG(ERROR) << "Couldn't add chunk " << loc.chunkIndex << " of job "
+					<< loc.job << " to catalog " << TAPE_CATALOG_PATH;
+	}
+}
+
+/**
+ * Looks up where the given chunk of a job was written. Returns false if it's
+ * not in the catalog.
+ */
+bool TapeCatalog::find(boost::uuids::uuid job, uint64_t index, chunk_location_t *out) {
+	std::lock_guard<std::mutex> lk(lock);
+
+	_load();
+
+	auto it = chunks.find(chunk_key_t(job, index));
+
+	if(it == chunks.end()) {
+		return false;
+	}
+
+	*out = it->second;
+	return true;
+}
+
+/**
+ * Returns the locations of all chunks of a job, ordered by their index.
+ */
+std::vector<chunk_location_t> TapeCatalog::getChunksForJob(boost::uuids::uuid job) {
+	std::lock_guard<std::mutex> lk(lock);
+	std::vector<chunk_location_t> out;
+
+	_load();
+
+	for(auto it = chunks.lower_bound(chunk_key_t(job, 0));
+		it != chunks.end() && it->first.first == job; it++) {
+		out.push_back(it->second);
+	}
+
+	return out;
+}
+
+/**
+ * Returns the locations of all chunks on the given tape, ordered by the
+ * position they start at.
+ */
+std::vector<chunk_location_t> TapeCatalog::getChunksOnTape(std::string label) {
+	std::lock_guard<std::mutex> lk(lock);
+	std::vector<chunk_location_t> out;
+
+	_load();
+
+	auto tape = tapes.find(label);
+
+	if(tape == tapes.end()) {
+		return out;
+	}
+
+	for(auto it = tape->second.begin(); it != tape->second.end(); it++) {
+		out.push_back(chunks[it->second]);
+	}
+
+	return out;
+}
+
+/**
+ * Builds the index for a tape with the given label, holding the given chunks.
+ */
+void TapeCatalog::buildIndex(std::string label, const std::vector<chunk_location_t> &locations,
+							 std::vector<uint8_t> *out) {
+	size_t len = sizeof(tape_index_t) + (locations.size() * sizeof(tape_index_entry_t));
+	out->assign(len, 0);
+
+	tape_index_t *index = reinterpret_cast<tape_index_t *>(out->data());
+
+	index->magic = TAPE_INDEX_MAGIC;
+	index->version = TAPE_INDEX_VERSION;
+	_copyLabel(label, index->label, sizeof(index->label));
+
+	index->numEntries = locations.size();
+
+	for(size_t i = 0; i < locations.size(); i++) {
+		_entryForLocation(locations[i], &index->entries[i]);
+	}
+
+	// Checksum everything, with the checksum field still zeroed
+	index->checksum = crc32c(0, out->data(), len);
+}
+
+/**
+ * Parses a tape index, outputting the tape's label and the locations of all
+ * chunks on it. Returns false if the data isn't a valid index.
+ */
+bool TapeCatalog::parseIndex(const void *data, size_t len, std::string *labelOut,
+							 std::vector<chunk_location_t> *out) {
+	if(len < sizeof(tape_index_t)) {
+		return false;
+	}
+
+	const tape_index_t *index = static_cast<const tape_index_t *>(data);
+
+	if(index->magic != TAPE_INDEX_MAGIC) {
+		return false;
+	}
+
+	if(index->version != TAPE_INDEX_VERSION) {
+		LOG(WARNING) << "Tape index has unknown version " << std::hex
+					 << index->version << std::dec;
+		return false;
+	}
+
+	// Make sure all entries are there
+	size_t maxEntries = (len - sizeof(tape_index_t)) / sizeof(tape_index_entry_t);
+
+	if(index->numEntries > maxEntries) {
+		LOG(WARNING) << "Tape index has " << index->numEntries << " entries, but "
+					 << "only " << maxEntries << " fit";
+		return false;
+	}
+
+	// Verify the checksum
+	size_t indexLen = sizeof(tape_index_t) + (index->numEntries * sizeof(tape_index_entry_t));
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	static const uint8_t zeroes[sizeof(uint32_t)] = { 0 };
+	const size_t fieldOff = offsetof(tape_index_t, checksum);
+	const size_t fieldEnd = fieldOff + sizeof(uint32_t);
+
+	uint32_t crc = crc32c(0, bytes, fieldOff);
+	crc = crc32c(crc, zeroes, sizeof(zeroes));
+	crc = crc32c(crc, bytes + fieldEnd, indexLen - fieldEnd);
+
+	if(crc != index->checksum) {
+		LOG(WARNING) << "Tape index checksum mismatch: expected " << std::hex
+					 << index->checksum << ", got " << crc << std::dec;
+		return false;
+	}
+
+	// Get the entries
+	*labelOut = std::string(index->label, strnlen(index->label, sizeof(index->label)));
+
+	out->clear();
+
+	for(uint64_t i = 0; i < index->numEntries; i++) {
+		out->push_back(_locationForEntry(index->entries[i], *labelOut));
+	}
+
+	return true;
+}
+
+/**
+ * Opens the catalog file and reads all records from it, if that hasn't been
+ * done yet. A partially written record at the end of the file is discarded;
+ * if any other record is damaged, or the file has an unknown version, it's
+ * not touched and this fails. The lock must be held.
+ */
+void TapeCatalog::_load() {
+	if(loaded) {
+		return;
+	}
+
+	loaded = true;
+
+	fd = open(TAPE_CATALOG_PATH, O_RDWR | O_CREAT | O_APPEND, 0644);
+	PCHECK(fd >= 0) << "Couldn't open catalog " << TAPE_CATALOG_PATH;
+
+	off_t end = lseek(fd, 0, SEEK_END);
+	PCHECK(end >= 0) << "Couldn't get size of catalog " << TAPE_CATALOG_PATH;
+
+	// Start new files with a header
+	if(end == 0) {
+		PCHECK(_writeHeader(fd) && fdatasync(fd) == 0)
+			<< "Couldn't write header of catalog " << TAPE_CATALOG_PATH;
+
+		LOG(INFO) << "Created catalog " << TAPE_CATALOG_PATH;
+		return;
+	}
+
+	// Make sure the records are the version we know
+	catalog_header_t header;
+	memset(&header, 0, sizeof(header));
+
+	CHECK(pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+		  header.magic == TAPE_CATALOG_MAGIC &&
+		  header.checksum == crc32c(0, &header, offsetof(catalog_header_t, checksum)))
+		<< "Catalog " << TAPE_CATALOG_PATH << " doesn't have a valid header";
+	CHECK(header.version == TAPE_INDEX_VERSION) << "Catalog " << TAPE_CATALOG_PATH
+												<< " has unknown version " << std::hex
+												<< header.version;
+
+	// Read all records
+	catalog_record_t record;
+	off_t offset = sizeof(header);
+	size_t numRecords = 0;
+
+	while(pread(fd, &record, sizeof(record), offset) == sizeof(record)) {
+		uint32_t crc = crc32c(0, &record, offsetof(catalog_record_t, checksum));
+
+		if(crc != record.checksum) {
+			break;
+		}
+
+		std::string label(record.label, strnlen(record.label, sizeof(record.label)));
+		_insert(_locationForEntry(record.entry, label));
+
+		offset += sizeof(record);
+		numRecords++;
+	}
+
+	// Only the last record can be cut short by a crash; anything more is damage
+	CHECK((size_t) (end - offset) < sizeof(record)) << "Catalog " << TAPE_CATALOG_PATH
+													<< " is damaged at offset " << offset;
+
+	LOG(INFO) << "Loaded " << numRecords << " records from catalog "
+			  << TAPE_CATALOG_PATH;
+
+	if(end > offset) {
+		LOG(WARNING) << "Discarding " << (end - offset) << " bytes of a partially "
+					 << "written record at the end of catalog " << TAPE_CATALOG_PATH;
+
+		int err = ftruncate(fd, offset);
+		PLOG_IF(ERROR, err != 0) << "Couldn't truncate catalog";
+	}
+}
+
+/**
+ * Adds a chunk's location to the in-memory catalog. Anything after it on the
+ * same tape is gone, since writing to a tape discards all data after the
+ * position that's written at. The lock must be held.
+ */
+void TapeCatalog::_insert(const chunk_location_t &loc) {
+	chunk_key_t key(loc.job, loc.chunkIndex);
+
+	// If the chunk was written before, forget that copy
+	auto old = chunks.find(key);
+
+	if(old != chunks.end()) {
+		auto tape = tapes.find(old->second.tape);
+
+		if(tape != tapes.end()) {
+			auto pos = tape->second.find(tape_position_t(old->second.fileNumber,
+														 old->second.fileOffset));
+
+			if(pos != tape->second.end() && pos->second == key) {
+				tape->second.erase(pos);
+			}
+		}
+	}
+
+	// Forget about all chunks after this one on the tape
+	if(!loc.tape.empty() && loc.fileNumber >= 0) {
+		std::map<tape_position_t, chunk_key_t> &positions = tapes[loc.tape];
+		tape_position_t position(loc.fileNumber, loc.fileOffset);
+
+		for(auto it = positions.lower_bound(position); it != positions.end(); ) {
+			chunks.erase(it->second);
+			it = positions.erase(it);
+		}
+
+		positions[position] = key;
+	}
+
+	chunks[key] = loc;
+}
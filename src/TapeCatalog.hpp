@@ -0,0 +1,98 @@
+/**
+ * Local catalog of where every chunk went on tape: the tape's label, the tape
+ * file the chunk starts at, and (if the drive can report it) its block and the
+ * block its data starts at. With it, a single chunk can be restored by seeking
+ * straight to it, and a single file in a chunk by locating the block it's in.
+ * If several chunks were written to the same tape file, each also has its
+ * offset within that file.
+ *
+ * The catalog is kept in memory, and every record is appended to a file as
+ * soon as the chunk is written; the file is read back the first time the
+ * catalog is used. Its records have the same version as the tape index, which
+ * is stored in a header at the start of the file. Writing a chunk at some
+ * position on a tape discards all records for later positions on the same
+ * tape, as on the tape itself.
+ *
+ * This class also builds and parses the index that's written at the end of
+ * every tape (see tape_index_t), which holds the same records for that tape.
+ */
+#ifndef TAPECATALOG_H
+#define TAPECATALOG_H
+
+/**
+ * Path of the file the catalog is stored in.
+ */
+#define TAPE_CATALOG_PATH		"./tape-catalog"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include <boost/uuid/uuid.hpp>
+
+/**
+ * Location of a chunk on tape.
+ */
+typedef struct {
+	// backup job the chunk belongs to, and its index in that job
+	boost::uuids::uuid job;
+	uint64_t chunkIndex;
+	uint64_t length;
+
+	// device file of the drive (this is empty for records read back from the
+	// catalog), and label of the tape it was written to (this is empty if the
+	// tape isn't known)
+	std::string drive;
+	std::string tape;
+
+	// tape file the chunk starts at, and its offset in bytes within that file
+	off_t fileNumber;
+	uint64_t fileOffset;
+
+	// logical block the chunk starts at, and the block its data starts at; -1
+	// if the position couldn't be determined
+	off_t block;
+	off_t dataBlock;
+} chunk_location_t;
+
+class TapeCatalog {
+	public:
+		static void add(const chunk_location_t &);
+
+		static bool find(boost::uuids::uuid, uint64_t, chunk_location_t *);
+		static std::vector<chunk_location_t> getChunksForJob(boost::uuids::uuid);
+		static std::vector<chunk_location_t> getChunksOnTape(std::string);
+
+		static void buildIndex(std::string, const std::vector<chunk_location_t> &,
+							   std::vector<uint8_t> *);
+		static bool parseIndex(const void *, size_t, std::string *,
+							   std::vector<chunk_location_t> *);
+
+	private:
+		typedef std::pair<boost::uuids::uuid, uint64_t> chunk_key_t;
+		// tape file and offset within it
+		typedef std::pair<off_t, uint64_t> tape_position_t;
+
+		// protects everything below
+		static std::mutex lock;
+
+		// whether the file was read, and its descriptor
+		static bool loaded;
+		static int fd;
+
+		// location of every chunk by job and index, and the chunks on each tape
+		// by the position they start at
+		static std::map<chunk_key_t, chunk_location_t> chunks;
+		static std::map<std::string, std::map<tape_position_t, chunk_key_t>> tapes;
+
+
+		static void _load();
+		static void _insert(const chunk_location_t &);
+};
+
+#endif
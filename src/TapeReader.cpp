@@ -0,0 +1,500 @@
+#include "TapeReader.hpp"
+
+#include "Trace.hpp"
+
+#include <glog/logging.h>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#include "TapeStructs.h"
+#include "crc32.h"
+
+/**
+ * Reads the chunk at the given location from the tape in the drive, into the
+ * buffer, which must hold at least as many bytes as the chunk. The drive seeks
+ * to the chunk first (see readRange.) The chunk's header is checked to make
+ * sure it's really the chunk that was asked for.
+ */
+bool TapeReader::readChunk(iolib_drive_t drive, const chunk_location_t &loc,
+						   void *buf) {
+	TraceScope trace("tape", "chunk read", "chunk", loc.chunkIndex);
+
+	if(!readRange(drive, loc, 0, loc.length, buf)) {
+		return false;
+	}
+
+	// Make sure it's the chunk we wanted; the UUID is at a different offset
+	// in each header version
+	const uint8_t *jobUuid;
+	uint64_t chunkIndex;
+
+	if(*static_cast<uint32_t *>(buf) == CHUNK_VERSION_2) {
+		chunk_header_v2_t *header = static_cast<chunk_header_v2_t *>(buf);
+
+		jobUuid = header->jobUuid;
+		chunkIndex = header->chunkIndex;
+	} else {
+		chunk_header_t *header = static_cast<chunk_header_t *>(buf);
+
+		jobUuid = header->jobUuid;
+		chunkIndex = header->chunkIndex;
+	}
+
+	if(!std::equal(loc.job.begin(), loc.job.end(), jobUuid) ||
+	   chunkIndex != loc.chunkIndex) {
+		LOG(ERROR) << "Tape file " << loc.fileNumber << " doesn't hold chunk "
+				   << loc.chunkIndex << " of job " << loc.job;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads up to `len` bytes from the current tape file into the buffer, stopping
+ * early at the filemark that ends it. The drive is only ever asked for whole
+ * blocks, since a tape record can't be read in pieces; if `len` doesn't end on
+ * a block boundary, the last block is read into a scratch buffer, and the rest
+ * of it is discarded. Returns the number of bytes read, or -1 if an error
+ * occurred.
+ */
+size_t TapeReader::readFile(iolib_drive_t drive, void *buf, size_t len,
+							iolib_error_t *outErr) {
+	size_t blockSize = iolibDriveGetBlockSize(drive);
+	size_t pieceSize = _roundToBlocks(TAPE_READER_BLOCK_SIZE, blockSize);
+
+	uint8_t *ptr = static_cast<uint8_t *>(buf);
+	size_t total = 0;
+
+	// Whole blocks are read straight into the buffer
+	size_t wholeLen = (blockSize != 0) ? (len - (len % blockSize)) : len;
+
+	while(total < wholeLen) {
+		size_t toRead = std::min(pieceSize, wholeLen - total);
+		size_t read = iolibDriveRead(drive, ptr + total, toRead, outErr);
+
+		if((ssize_t) read < 0) {
+			return -1;
+		}
+
+		total += read;
+
+		// A short read means we hit the filemark
+		if(read < toRead) {
+			return total;
+		}
+	}
+
+	// Then, the block the buffer ends in
+	if(total < len) {
+		std::vector<uint8_t> block(blockSize);
+		size_t read = iolibDriveRead(drive, block.data(), block.size(), outErr);
+
+		if((ssize_t) read < 0) {
+			return -1;
+		}
+
+		read = std::min(read, len - total);
+		std::copy(block.begin(), block.begin() + read, ptr + total);
+
+		total += read;
+	}
+
+	return total;
+}
+
+/**
+ * Reads and discards the given number of bytes from the current tape file; if
+ * that doesn't end on a block boundary, the rest of the last block is skipped
+ * too. Returns the number of bytes skipped, which is less if the file ended
+ * first, or -1 if an error occurred.
+ */
+size_t TapeReader::skipBytes(iolib_drive_t drive, uint64_t len, iolib_error_t *outErr) {
+	size_t blockSize = iolibDriveGetBlockSize(drive);
+	std::vector<uint8_t> scratch(_roundToBlocks(std::min((uint64_t) TAPE_READER_BLOCK_SIZE, len),
+												blockSize));
+	uint64_t total = 0;
+
+	while(total < len) {
+		size_t toRead = std::min((uint64_t) scratch.size(), len - total);
+		size_t read = readFile(drive, scratch.data(), toRead, outErr);
+
+		if((ssize_t) read < 0) {
+			return -1;
+		}
+
+		total += read;
+
+		if(read < toRead) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+/**
+ * Reads `len` bytes, starting at the given offset into the chunk at the given
+ * location, into the buffer. If the drive supports block addressing and the
+ * chunk's block is known, the drive locates the block holding the first byte;
+ * otherwise, it seeks to the chunk's tape file, and everything in the file
+ * before the range is read and discarded. Returns false if the range couldn't
+ * be read.
+ */
+bool TapeReader::readRange(iolib_drive_t drive, const chunk_location_t &loc,
+						   uint64_t offset, size_t len, void *buf) {
+	TraceScope trace("tape", "range read", "chunk", loc.chunkIndex);
+
+	if(offset + len > loc.length) {
+		LOG(ERROR) << "Range " << offset << "+" << len << " is outside chunk "
+				   << loc.chunkIndex << " of job " << loc.job;
+		return false;
+	}
+
+	iolib_error_t err = 0;
+	size_t blockSize = iolibDriveGetBlockSize(drive);
+
+	// Go as close to the first byte as possible
+	uint64_t skip;
+
+	if(loc.block >= 0 && blockSize != 0) {
+		off_t block = loc.block + (offset / blockSize);
+		skip = offset % blockSize;
+
+		err = iolibDriveLocateBlock(drive, block);
+		LOG_IF(ERROR, err != 0) << "Couldn't locate block " << block << ": " << err;
+	} else if(loc.fileNumber >= 0) {
+		skip = loc.fileOffset + offset;
+
+		err = iolibDriveSeekToPosition(drive, loc.fileNumber);
+		LOG_IF(ERROR, err != 0) << "Couldn't seek to tape file " << loc.fileNumber
+								<< ": " << err;
+	} else {
+		LOG(ERROR) << "Position of chunk " << loc.chunkIndex << " of job "
+				   << loc.job << " isn't known";
+		return false;
+	}
+
+	if(err != 0) {
+		return false;
+	}
+
+	// Skip the whole blocks before the range, then read the blocks holding it;
+	// if it doesn't start on a block boundary, they're read into a scratch
+	// buffer, and the range is copied out of it
+	uint64_t head = (blockSize != 0) ? (skip % blockSize) : 0;
+	size_t skipped = skipBytes(drive, skip - head, &err);
+	size_t read = 0;
+
+	if(skipped == (skip - head)) {
+		if(head == 0) {
+			read = readFile(drive, buf, len, &err);
+		} else {
+			std::vector<uint8_t> scratch(head + len);
+			read = readFile(drive, scratch.data(), scratch.size(), &err);
+
+			if((ssize_t) read >= 0) {
+				read = (read > head) ? (read - head) : 0;
+				std::copy(scratch.begin() + head, scratch.begin() + head + read,
+						  static_cast<uint8_t *>(buf));
+			}
+		}
+	}
+
+	if(skipped != (skip - head) || read != len) {
+		LOG(ERROR) << "Couldn't read " << len << " bytes at offset " << offset
+				   << " of chunk " << loc.chunkIndex << " in tape file "
+				   << loc.fileNumber << ": got " << (ssize_t) read << " bytes"
+				   << " (error " << err << ")";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads the header of the chunk at the given location, including its file
+ * entries, and checks its checksum and that it's really the chunk that was
+ * asked for. Only version 2 chunks are supported.
+ */
+bool TapeReader::readChunkHeader(iolib_drive_t drive, const chunk_location_t &loc,
+								 std::vector<uint8_t> *out) {
+	// Read the fixed part first, to find out how long the header is
+	chunk_header_v2_t fixed;
+
+	if(loc.length < sizeof(fixed) || !readRange(drive, loc, 0, sizeof(fixed), &fixed)) {
+		return false;
+	}
+
+	if(fixed.version != CHUNK_VERSION_2 || fixed.headerLenBytes < sizeof(fixed) ||
+	   fixed.headerLenBytes > loc.length) {
+		LOG(ERROR) << "Chunk " << loc.chunkIndex << " of job " << loc.job
+				   << " doesn't have a valid version 2 header";
+		return false;
+	}
+
+	if(!std::equal(loc.job.begin(), loc.job.end(), fixed.jobUuid) ||
+	   fixed.chunkIndex != loc.chunkIndex) {
+		LOG(ERROR) << "Tape file " << loc.fileNumber << " doesn't hold chunk "
+				   << loc.chunkIndex << " of job " << loc.job;
+		return false;
+	}
+
+	// Then, the whole thing
+	out->resize(fixed.headerLenBytes);
+
+	if(!readRange(drive, loc, 0, out->size(), out->data())) {
+		return false;
+	}
+
+	const chunk_header_v2_t *header = reinterpret_cast<const chunk_header_v2_t *>(out->data());
+
+	if(ChunkFormat::headerChecksum(header, header->headerLenBytes) != header->headerChecksum) {
+		LOG(ERROR) << "Chunk " << loc.chunkIndex << " of job " << loc.job
+				   << " has a bad header checksum";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads the blob of the given entry, which was taken from the header of the
+ * chunk at the given location, and checks its CRC. Only the blocks holding the
+ * blob are read, if the drive supports it.
+ */
+bool TapeReader::readBlob(iolib_drive_t drive, const chunk_location_t &loc,
+						  const chunk_entry_t &entry, std::vector<uint8_t> *out) {
+	TraceScope trace("tape", "blob read", "chunk", loc.chunkIndex);
+
+	out->resize(entry.blobLenBytes);
+
+	if(!readRange(drive, loc, entry.blobStartOff, out->size(), out->data())) {
+		return false;
+	}
+
+	if(crc32c(0, out->data(), out->size()) != entry.checksum) {
+		LOG(ERROR) << "Blob of '" << entry.name << "' in chunk " << loc.chunkIndex
+				   << " of job " << loc.job << " has a bad checksum";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Finds the index at the end of the tape in the drive, and outputs the tape's
+ * label and the chunks on it. Starting at the beginning of the tape, the first
+ * few bytes of each tape file are read to find the last index on the tape.
+ * Returns false if the tape doesn't have one.
+ */
+bool TapeReader::readIndex(iolib_drive_t drive, std::string *labelOut,
+						   std::vector<chunk_location_t> *out) {
+	TraceScope trace("tape", "index read");
+
+	iolib_error_t err = iolibDriveRewind(drive);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't rewind tape: " << err;
+		return false;
+	}
+
+	// Find the tape file with the last index
+	size_t blockSize = iolibDriveGetBlockSize(drive);
+	off_t indexFile = -1;
+	uint64_t numEntries = 0;
+
+	for(off_t file = 0; ; file++) {
+		// Read one byte more than the header (in whole blocks), to see if the
+		// file goes on
+		std::vector<uint8_t> probe(_roundToBlocks(sizeof(tape_index_t) + 1, blockSize));
+		size_t read = readFile(drive, probe.data(), probe.size(), &err);
+
+		// An empty tape file means we're at the end of the data
+		if((ssize_t) read <= 0) {
+			break;
+		}
+
+		tape_index_t *header = reinterpret_cast<tape_index_t *>(probe.data());
+
+		if(read >= sizeof(tape_index_t) && header->magic == TAPE_INDEX_MAGIC) {
+			indexFile = file;
+			numEntries = header->numEntries;
+		}
+
+		// Go to the next file, unless the read already ended this one
+		if(read == probe.size() && iolibDriveSkipFile(drive) != 0) {
+			break;
+		}
+	}
+
+	if(indexFile < 0) {
+		return false;
+	}
+
+	// Then, read all of it
+	std::vector<uint8_t> buf(sizeof(tape_index_t) +
+							 (numEntries * sizeof(tape_index_entry_t)));
+
+	err = iolibDriveSeekToPosition(drive, indexFile);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't seek to index in tape file " << indexFile << ": " << err;
+		return false;
+	}
+
+	size_t read = readFile(drive, buf.data(), buf.size(), &err);
+
+	if((ssize_t) read < 0) {
+		LOG(ERROR) << "Couldn't read index in tape file " << indexFile << ": " << err;
+		return false;
+	}
+
+	return TapeCatalog::parseIndex(buf.data(), read, labelOut, out);
+}
+
+/**
+ * Finds all chunks on the tape in the drive by reading all of it, for when it
+ * doesn't have an index. Each tape file holds one or more chunks back to back,
+ * which are recognized by their headers; the length in a chunk's header says
+ * where the next one starts (after padding it to whole blocks.) Tape files that
+ * don't start with a chunk, such as indexes, are skipped, as are chunks that
+ * were cut short. Returns false if the tape couldn't be read.
+ */
+bool TapeReader::scanTape(iolib_drive_t drive, std::vector<chunk_location_t> *out) {
+	TraceScope trace("tape", "tape scan");
+
+	iolib_error_t err = iolibDriveRewind(drive);
+
+	if(err != 0) {
+		LOG(ERROR) << "Couldn't rewind tape: " << err;
+		return false;
+	}
+
+	size_t blockSize = iolibDriveGetBlockSize(drive);
+	out->clear();
+
+	for(off_t file = 0; ; file++) {
+		uint64_t offset = 0;
+
+		while(true) {
+			off_t block = -1;
+
+			if(blockSize != 0) {
+				block = std::max(iolibDriveGetBlockPosition(drive, &err), (off_t) -1);
+			}
+
+			// Read the blocks holding the fixed part of the header
+			std::vector<uint8_t> first(_roundToBlocks(sizeof(chunk_header_v2_t), blockSize));
+			size_t read = readFile(drive, first.data(), first.size(), &err);
+
+			if((ssize_t) read < 0) {
+				LOG(ERROR) << "Couldn't read tape file " << file << ": " << err;
+				return false;
+			}
+
+			// An empty tape file means we're at the end of the data
+			if(read == 0 && offset == 0) {
+				return true;
+			}
+
+			// Otherwise, a short read means the tape file ended
+			if(read < sizeof(chunk_header_v2_t)) {
+				break;
+			}
+
+			chunk_header_v2_t header;
+			memcpy(&header, first.data(), sizeof(header));
+
+			// If it's not a chunk, go to the next file, unless the read ended it
+			if(header.version != CHUNK_VERSION_2 || header.headerLenBytes < sizeof(header) ||
+			   header.chunkLenBytes < header.headerLenBytes) {
+				if(read == first.size() && iolibDriveSkipFile(drive) != 0) {
+					return false;
+				}
+
+				break;
+			}
+
+			// Skip over the rest of the chunk and its padding, which end on a
+			// block boundary; if the chunk was cut short, it ends the file
+			uint64_t span = _roundToBlocks(header.chunkLenBytes, blockSize);
+			size_t skipped = skipBytes(drive, span - read, &err);
+
+			if((ssize_t) skipped < 0 || (read + skipped) < header.chunkLenBytes) {
+				LOG(WARNING) << "Chunk " << header.chunkIndex << " in tape file "
+							 << file << " at offset " << offset << " is incomplete";
+				break;
+			}
+
+			chunk_location_t loc;
+
+			std::copy(header.jobUuid, header.jobUuid + sizeof(header.jobUuid), loc.job.begin());
+			loc.chunkIndex = header.chunkIndex;
+			loc.length = header.chunkLenBytes;
+
+			loc.fileNumber = file;
+			loc.fileOffset = offset;
+
+			loc.block = block;
+			loc.dataBlock = (block >= 0) ? (block + (header.headerLenBytes / blockSize)) : -1;
+
+			out->push_back(loc);
+
+			// If there was less padding than that, the file ended
+			if((read + skipped) < span) {
+				break;
+			}
+
+			offset += span;
+		}
+	}
+}
+
+/**
+ * Positions the drive at the end of the data on its tape, i.e. at the start of
+ * the first empty tape file, by counting the tape files from the beginning.
+ */
+iolib_error_t TapeReader::seekToEndOfData(iolib_drive_t drive) {
+	iolib_error_t err = iolibDriveRewind(drive);
+
+	if(err != 0) {
+		return err;
+	}
+
+	std::vector<uint8_t> probe(_roundToBlocks(TAPE_READER_BLOCK_SIZE,
+											  iolibDriveGetBlockSize(drive)));
+	off_t file;
+
+	for(file = 0; ; file++) {
+		size_t read = readFile(drive, probe.data(), probe.size(), &err);
+
+		if((ssize_t) read < 0) {
+			return err;
+		} else if(read == 0) {
+			break;
+		}
+
+		// Go to the next file, unless the read already ended this one
+		if(read == probe.size() && (err = iolibDriveSkipFile(drive)) != 0) {
+			return err;
+		}
+	}
+
+	return iolibDriveSeekToPosition(drive, file);
+}
+
+
+/**
+ * Rounds the given length up to whole blocks of the given size; a block size
+ * of 0 means the drive uses variable blocks, so the length is left as is.
+ */
+uint64_t TapeReader::_roundToBlocks(uint64_t len, size_t blockSize) {
+	if(blockSize == 0) {
+		return len;
+	}
+
+	return ((len + blockSize - 1) / blockSize) * blockSize;
+}
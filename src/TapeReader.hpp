@@ -0,0 +1,57 @@
+/**
+ * Reads chunks back from tape. Using the catalog (or a tape's index), a chunk
+ * is read by seeking straight to the tape file it starts at, rather than by
+ * reading the tape from the start.
+ *
+ * If the drive supports block addressing and the chunk's block is known, a
+ * part of a chunk (such as its header, or a single file's blob) can be read by
+ * locating the blocks that hold it, without reading the rest of the chunk.
+ *
+ * Several chunks may share a tape file; they're found by their offset in it,
+ * or, without an index, by scanning the tape for chunk headers.
+ *
+ * Every read issued to the drive is made up of whole blocks, since a record
+ * on a real tape can only be read all at once; the bytes that were wanted are
+ * then copied out of them.
+ */
+#ifndef TAPEREADER_H
+#define TAPEREADER_H
+
+/**
+ * Size of the reads issued to the drive, in bytes.
+ */
+#define TAPE_READER_BLOCK_SIZE		(1024 * 1024)
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "TapeCatalog.hpp"
+
+#include "IOLib.h"
+#include "ChunkFormat.h"
+
+class TapeReader {
+	public:
+		static bool readChunk(iolib_drive_t, const chunk_location_t &, void *);
+		static size_t readFile(iolib_drive_t, void *, size_t, iolib_error_t *);
+		static size_t skipBytes(iolib_drive_t, uint64_t, iolib_error_t *);
+		static bool readRange(iolib_drive_t, const chunk_location_t &, uint64_t,
+							  size_t, void *);
+
+		static bool readChunkHeader(iolib_drive_t, const chunk_location_t &,
+									std::vector<uint8_t> *);
+		static bool readBlob(iolib_drive_t, const chunk_location_t &,
+							 const chunk_entry_t &, std::vector<uint8_t> *);
+
+		static bool readIndex(iolib_drive_t, std::string *,
+							  std::vector<chunk_location_t> *);
+		static bool scanTape(iolib_drive_t, std::vector<chunk_location_t> *);
+
+		static iolib_error_t seekToEndOfData(iolib_drive_t);
+
+	private:
+		static uint64_t _roundToBlocks(uint64_t, size_t);
+};
+
+#endif
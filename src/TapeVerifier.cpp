@@ -0,0 +1,290 @@
+#include "TapeVerifier.hpp"
+
+#include "Metrics.hpp"
+#include "TapeReader.hpp"
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#include <glog/logging.h>
+#include <boost/uuid/uuid_io.hpp>
+
+#include "TapeStructs.h"
+#include "ChunkFormat.h"
+#include "MerkleTree.h"
+#include "crc32.h"
+
+/**
+ * Sets up the verifier.
+ */
+TapeVerifier::TapeVerifier() {
+	this->stats = tape_verify_stats_t();
+}
+
+/**
+ * Reads back every chunk on the tape in the given drive, and checks it against
+ * the catalog. Returns true if all chunks were read and matched. This blocks
+ * until the whole tape has been read.
+ */
+bool TapeVerifier::verifyTape(iolib_drive_t drive, std::string label) {
+	TraceScope trace("tape", "tape verify");
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->stats.tapesInProgress++;
+	}
+
+	LOG(INFO) << "Verifying tape '" << label << "'";
+
+	// Note where the data ends, to go back there once done
+	iolib_error_t err = 0;
+	off_t endFile = iolibDriveGetPosition(drive, &err);
+
+	if(err != 0) {
+		endFile = -1;
+	}
+
+	// Find out what should be on it
+	std::vector<chunk_location_t> chunks;
+	bool success = _getExpectedChunks(drive, label, &chunks);
+
+	// Then, read back and check each chunk
+	std::vector<uint8_t> buf;
+	uint64_t chunksVerified = 0, bytesRead = 0;
+	auto tapeStart = std::chrono::steady_clock::now();
+
+	for(auto it = chunks.begin(); it != chunks.end(); it++) {
+		if(buf.size() < it->length) {
+			buf.resize(it->length);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		bool read = TapeReader::readChunk(drive, *it, buf.data());
+		std::chrono::duration<double> readTime = std::chrono::steady_clock::now() - start;
+
+		std::string error = "couldn't be read";
+
+		if(read) {
+			Metrics::tapeVerifyBytesRead.add(it->length);
+			Metrics::tapeVerifyTotalTime.add(std::chrono::duration_cast<std::chrono::nanoseconds>(readTime).count());
+
+			bytesRead += it->length;
+		}
+
+		if(!read || !_verifyChunk(*it, buf.data(), &error)) {
+			std::stringstream msg;
+			msg << "Chunk " << it->chunkIndex << " of job " << it->job
+				<< " in tape file " << it->fileNumber << " " << error;
+
+			_recordError(label, msg.str());
+			success = false;
+		}
+
+		std::chrono::duration<double> checkTime = std::chrono::steady_clock::now() - start;
+
+		std::lock_guard<std::mutex> lk(this->lock);
+
+		this->stats.chunksVerified++;
+		this->stats.bytesRead += (read ? it->length : 0);
+		this->stats.readTime += readTime.count();
+		this->stats.checkTime += (checkTime - readTime).count();
+
+		chunksVerified++;
+	}
+
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - tapeStart;
+
+	// Leave the tape at the end of its data, so that anything written to it
+	// next is appended, rather than overwriting what was just verified
+	if(endFile >= 0) {
+		err = iolibDriveSeekToPosition(drive, endFile);
+	} else {
+		err = TapeReader::seekToEndOfData(drive);
+	}
+
+	LOG_IF(WARNING, err != 0) << "Couldn't go to end of data on tape '" << label
+							  << "': " << err;
+
+	if(success) {
+		LOG(INFO) << "Verified " << chunksVerified << " chunks (" << bytesRead
+				  << " bytes) on tape '" << label << "' in " << time.count()
+				  << " sec";
+	} else {
+		LOG(ERROR) << "Tape '" << label << "' FAILED VERIFICATION; checked "
+				   << chunksVerified << " chunks";
+	}
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	this->stats.tapesInProgress--;
+	this->stats.tapesVerified++;
+
+	if(!success) {
+		this->stats.tapesFailed++;
+	}
+
+	return success;
+}
+
+/**
+ * Returns a copy of the verifier's counters.
+ */
+tape_verify_stats_t TapeVerifier::getStats() {
+	std::lock_guard<std::mutex> lk(this->lock);
+	return this->stats;
+}
+
+/**
+ * Gets the chunks that should be on the tape in the drive: these are the ones
+ * the catalog has for its label, if it's known, or those in the tape's index.
+ * If both are available, they must list the same chunks at the same places;
+ * if not, the catalog wins, and false is returned.
+ */
+bool TapeVerifier::_getExpectedChunks(iolib_drive_t drive, std::string label,
+									  std::vector<chunk_location_t> *out) {
+	if(!label.empty()) {
+		*out = TapeCatalog::getChunksOnTape(label);
+	}
+
+	std::string indexLabel;
+	std::vector<chunk_location_t> index;
+
+	if(!TapeReader::readIndex(drive, &indexLabel, &index)) {
+		// Without a label either, find the chunks by their headers
+		if(label.empty()) {
+			LOG(WARNING) << "Tape has no readable index; scanning it for chunks";
+
+			if(TapeReader::scanTape(drive, out) && !out->empty()) {
+				return true;
+			}
+		}
+
+		_recordError(label, "Tape has no readable index");
+		return false;
+	}
+
+	if(label.empty()) {
+		*out = index;
+		return true;
+	}
+
+	// Compare the index against the catalog
+	bool same = (index.size() == out->size());
+
+	for(size_t i = 0; same && i < index.size(); i++) {
+		const chunk_location_t &a = index[i], &b = (*out)[i];
+
+		same = (a.job == b.job && a.chunkIndex == b.chunkIndex &&
+				a.length == b.length && a.fileNumber == b.fileNumber &&
+				a.fileOffset == b.fileOffset);
+	}
+
+	if(!same) {
+		std::stringstream msg;
+		msg << "Tape index lists " << index.size() << " chunks, but the catalog "
+			<< "has " << out->size();
+
+		_recordError(label, msg.str());
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Checks a chunk that was read back from tape: the header checksum, the CRC of
+ * every blob, and the Merkle tree, if it has one. The chunk was already checked
+ * to be the one that was written there. If it doesn't match, a description of
+ * the problem is output, and false is returned.
+ */
+bool TapeVerifier::_verifyChunk(const chunk_location_t &loc, const uint8_t *data,
+								std::string *error) {
+	const chunk_header_v2_t *header = reinterpret_cast<const chunk_header_v2_t *>(data);
+
+	if(loc.length < sizeof(chunk_header_v2_t) || header->version != CHUNK_VERSION_2) {
+		*error = "isn't a version 2 chunk";
+		return false;
+	} else if(header->chunkLenBytes != loc.length) {
+		*error = "has the wrong length";
+		return false;
+	} else if(!ChunkFormat::checkHeader(header, loc.length)) {
+		*error = "has a header that points outside of it";
+		return false;
+	}
+
+	// Check the header
+	if(ChunkFormat::headerChecksum(header, header->headerLenBytes) != header->headerChecksum) {
+		*error = "has a bad header checksum";
+		return false;
+	}
+
+	// Then, every blob
+	const uint32_t *entryTable = reinterpret_cast<const uint32_t *>(data + header->entryTableOff);
+
+	for(size_t i = 0; i < header->numFileEntries; i++) {
+		chunk_entry_t entry;
+		uint32_t offset = entryTable[i];
+
+		if(offset >= header->entriesLenBytes ||
+		   ChunkFormat::decodeEntry(data + header->entriesOff + offset,
+									header->entriesLenBytes - offset, header->flags,
+									&entry) == 0) {
+			*error = "has a malformed entry " + std::to_string(i);
+			return false;
+		}
+
+		if(entry.type == kTypeDirectory) {
+			continue;
+		}
+
+		if(entry.blobStartOff > loc.length ||
+		   entry.blobLenBytes > (loc.length - entry.blobStartOff) ||
+		   crc32c(0, data + entry.blobStartOff, entry.blobLenBytes) != entry.checksum) {
+			*error = "has a bad checksum for '" + entry.name + "'";
+			return false;
+		}
+	}
+
+	// Lastly, the Merkle tree
+	const chunk_merkle_info_t *merkle = &header->merkle;
+
+	if(!ChunkFormat::checkMerkleInfo(*merkle, loc.length)) {
+		*error = "has an invalid Merkle tree";
+		return false;
+	} else if(merkle->hashType == CHUNK_HASH_SHA256) {
+		const uint8_t *leaves = data + merkle->leavesStartOff;
+		uint8_t root[MERKLE_HASH_SIZE];
+
+		MerkleTree::computeRoot(leaves, merkle->numSegments, root);
+
+		if(memcmp(root, merkle->rootHash, MERKLE_HASH_SIZE) != 0 ||
+		   !MerkleTree::verifySegments(data + merkle->dataStartOff, merkle->dataLenBytes,
+									   merkle->segmentSize, leaves, 0,
+									   merkle->numSegments)) {
+			*error = "doesn't match its Merkle tree";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Logs a verification error for the given tape, and keeps it for the API.
+ */
+void TapeVerifier::_recordError(std::string label, std::string error) {
+	LOG(ERROR) << "Verification of tape '" << label << "' failed: " << error;
+
+	Metrics::tapeVerifyMismatches.add(1);
+
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	this->stats.mismatches++;
+	this->stats.errors.push_back("Tape '" + label + "': " + error);
+
+	if(this->stats.errors.size() > TAPE_VERIFY_MAX_ERRORS) {
+		this->stats.errors.erase(this->stats.errors.begin());
+	}
+}
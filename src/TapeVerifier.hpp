@@ -0,0 +1,62 @@
+/**
+ * Verifies tapes after they've been written, by reading every chunk on them
+ * back, and checking it against the catalog: the chunk must be in the tape
+ * file the catalog says, be the chunk (of the job) that was written there, and
+ * its header checksum, the CRC of every blob and its Merkle tree (if any) must
+ * match.
+ *
+ * The chunks to check are taken from the catalog, if the tape's label is known,
+ * and from the index at the end of the tape otherwise; if both are available,
+ * they must agree. A tape with neither is scanned for chunks.
+ *
+ * Verifying doesn't block writing: when a tape fills up, writing continues on
+ * another drive, and the full tape is read back in the drive it was written in
+ * before it's unloaded (see MediaChanger.) The last tape of a job is verified
+ * in its drive once writing is done.
+ */
+#ifndef TAPEVERIFIER_H
+#define TAPEVERIFIER_H
+
+/**
+ * Set to 0 to not read back tapes after they have been written.
+ */
+#define TAPE_VERIFY_AFTER_WRITE		1
+
+/**
+ * Maximum number of verification errors that are kept for the API; the oldest
+ * errors are dropped first.
+ */
+#define TAPE_VERIFY_MAX_ERRORS		32
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "JobStats.hpp"
+#include "TapeCatalog.hpp"
+
+#include "IOLib.h"
+
+class TapeVerifier {
+	public:
+		TapeVerifier();
+
+		bool verifyTape(iolib_drive_t, std::string);
+
+		tape_verify_stats_t getStats();
+
+	private:
+		// counters; protected by the lock
+		std::mutex lock;
+		tape_verify_stats_t stats;
+
+
+		bool _getExpectedChunks(iolib_drive_t, std::string,
+								std::vector<chunk_location_t> *);
+		bool _verifyChunk(const chunk_location_t &, const uint8_t *, std::string *);
+
+		void _recordError(std::string, std::string);
+};
+
+#endif
@@ -1,113 +1,377 @@
 #include "TapeWriter.hpp"
 
-#include <chrono>
+#include "InventoryService.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <iterator>
 
 #include <glog/logging.h>
 #include <boost/thread.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+std::mutex TapeWriter::sharedLock;
+TapeWriter *TapeWriter::shared = NULL;
+size_t TapeWriter::sharedUsers = 0;
 
 /**
- * Initializes the tape writer.
+ * Returns a writer for a job to use. With TAPE_WRITER_MULTIPLEX, this is the
+ * writer shared by all jobs, which is created if no job is using it yet;
+ * otherwise, it's a new writer.
  */
-TapeWriter::TapeWriter() {
-	// Initialize the worker thread
-	this->workerThread = std::thread(boost::bind(&TapeWriter::_workerEntry, this));
+TapeWriter *TapeWriter::acquire() {
+	if(!TAPE_WRITER_MULTIPLEX) {
+		return new TapeWriter();
+	}
+
+	std::lock_guard<std::mutex> lk(sharedLock);
+
+	if(!shared) {
+		shared = new TapeWriter();
+	}
+
+	sharedUsers++;
+	return shared;
 }
 
 /**
- * Instructs the tape writing thread to stop. This will finish writing any data
- * that was started prior to this call, but no new work will be begun.
+ * Releases a writer acquired with acquire(). Once no job is using it anymore,
+ * all queued chunks are written, and it's shut down.
  */
-TapeWriter::~TapeWriter() {
-	// Set flag to false, and wait for the thread to finish.
-	this->shouldRun = false;
-	this->newChunksAvailableSignal.notify_all();
+void TapeWriter::release(TapeWriter *writer) {
+	if(!TAPE_WRITER_MULTIPLEX) {
+		delete writer;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(sharedLock);
 
-	this->workerThread.join();
+	CHECK(writer == shared && sharedUsers > 0) << "Released a writer that isn't in use";
+
+	if(--sharedUsers == 0) {
+		delete shared;
+		shared = NULL;
+	}
 }
 
 /**
- * Adds a chunk to the write queue.
+ * Initializes the tape writer, and finds the drives to write to.
  */
-void TapeWriter::addChunkToQueue(Chunk *chunk) {
-	// Check the number of chunks in the queue; block if too many
-	while(this->writeQueue.size() >= MAX_CHUNKS_WAITING) {
-		DLOG(INFO) << "More than " << MAX_CHUNKS_WAITING << " chunks waiting "
-				   << "to be written to tape; waiting";
+TapeWriter::TapeWriter() : releaseQueue("release", MAX_CHUNKS_WAITING) {
+	// Find the drives to write to
+	std::vector<iolib_drive_t> handles = this->_openDrives();
+
+	size_t numActive = handles.size();
+
+	if(TAPE_VERIFY_AFTER_WRITE) {
+		this->verifier = new TapeVerifier();
+	}
+
+	// With a loader, keep some drives on standby for tape changes
+	if(this->loader) {
+		if(numActive > TAPE_WRITER_STANDBY_DRIVES) {
+			numActive -= TAPE_WRITER_STANDBY_DRIVES;
+		}
+
+		this->changer = new MediaChanger(this->loader, handles, numActive,
+										 this->verifier);
+	}
+
+	// Keep enough chunks queued that every drive has its next one ready
+	this->writeQueue = new BoundedQueue<Chunk *>("write",
+									MAX_CHUNKS_WAITING * numActive);
+
+	for(size_t i = 0; i < numActive; i++) {
+		this->drives.push_back(new DriveWriter(handles[i], this->changer,
+							   this->writeQueue, &this->releaseQueue, this));
+	}
+
+	// Work out whether all drives are on the same node
+	this->numaNode = this->drives[0]->getNumaNode();
+
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		if((*it)->getNumaNode() != this->numaNode) {
+			this->numaNode = -1;
+			break;
+		}
+	}
+
+	// Initialize the worker threads
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		(*it)->start();
+	}
+
+	this->releaseThread = std::thread(boost::bind(&TapeWriter::_releaseEntry, this));
+}
 
-		// Wait on the "chunk processor completed" signal.
-		std::mutex m;
-		std::unique_lock<std::mutex> lk(m);
-		this->chunkProcessedSignal.wait(lk);
+/**
+ * Instructs the tape writing threads to stop. This will finish writing any
+ * data that was queued prior to this call, but no new work will be accepted.
+ */
+TapeWriter::~TapeWriter() {
+	// Close the queue, and wait for the drives to drain it.
+	this->writeQueue->close();
+
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		(*it)->join();
+	}
+
+	// Then, free all chunks that have been written
+	this->releaseQueue.close();
+	this->releaseThread.join();
+
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		delete *it;
+	}
+
+	delete this->writeQueue;
+
+	// Finish verifying and unloading any full tapes
+	if(this->changer) {
+		delete this->changer;
 	}
 
-	// Push the chunk onto the queue
-	this->writeQueueMutex.lock();
-	this->writeQueue.push(chunk);
-	this->writeQueueMutex.unlock();
+	if(this->verifier) {
+		delete this->verifier;
+	}
 
-	// notify the worker thread
-	this->newChunksAvailableSignal.notify_all();
+	if(this->numLibraries > 0) {
+		std::lock_guard<std::mutex> lk(InventoryService::iolibLock);
+		iolibEnumerateDevicesFree(this->libraries, this->numLibraries);
+	}
 }
 
 /**
- * Worker thread entry point.
+ * Picks the drives that chunks are written to: this is every drive (up to
+ * TAPE_WRITER_MAX_DRIVES) of the first library that has any. That library's
+ * first loader, if any, is used to change tapes.
  */
-void TapeWriter::_workerEntry() {
-	while(this->shouldRun) {
-		/*
-		 * Only wait for a "new chunk available" signal if the queue does not
-		 * have any chunks in it right now. Otherwise, this thread will wait for
-		 * such a signal with chunks still left to be written.
-		 */
-		if(this->writeQueue.empty()) {
-			std::mutex m;
-		    std::unique_lock<std::mutex> lk(m);
-			// this->newChunksAvailableSignal.wait_for(lk, std::chrono::seconds(60));
-			this->newChunksAvailableSignal.wait(lk);
-
-			DLOG(INFO) << this->writeQueue.size() << " chunk(s) waiting";
+std::vector<iolib_drive_t> TapeWriter::_openDrives() {
+	iolib_error_t err = 0;
+	std::vector<iolib_drive_t> drives;
+
+	{
+		std::lock_guard<std::mutex> lk(InventoryService::iolibLock);
+		this->numLibraries = iolibEnumerateDevices(this->libraries,
+												   TAPE_WRITER_MAX_LIBRARIES, &err);
+	}
+
+	CHECK(this->numLibraries >= 0) << "Couldn't enumerate libraries: " << err;
+
+	for(int i = 0; i < this->numLibraries; i++) {
+		iolib_library_t *library = &this->libraries[i];
+
+		if(library->numDrives == 0) {
+			continue;
+		}
+
+		size_t numDrives = std::min(library->numDrives,
+									(size_t) TAPE_WRITER_MAX_DRIVES);
+
+		for(size_t j = 0; j < numDrives; j++) {
+			drives.push_back(library->drives[j]);
 		}
 
-		// If there are things in the queue, process them.
-		if(!this->writeQueue.empty()) {
-			// Get the chunk out of the queue…
-			this->writeQueueMutex.lock();
+		if(library->numLoaders > 0) {
+			this->loader = library->loaders[0];
+		}
+
+		break;
+	}
 
-			Chunk *chunk = this->writeQueue.front();
-			this->writeQueue.pop();
+	CHECK(!drives.empty()) << "No tape drives available";
 
-			this->writeQueueMutex.unlock();
+	LOG(INFO) << "Striping chunks across " << drives.size() << " drive(s)";
 
-			// …then write it.
-			_writeChunk(chunk);
+	return drives;
+}
+
+/**
+ * Registers a job, so its chunks can be queued. Write measurements are reported
+ * to the given chunk sizer, and the job's counters are updated as its chunks
+ * are written.
+ */
+void TapeWriter::addJob(boost::uuids::uuid uuid, ChunkSizer *sizer, JobStats *stats) {
+	std::lock_guard<std::mutex> lk(this->jobsLock);
+
+	CHECK(this->jobs.find(uuid) == this->jobs.end()) << "Job " << uuid
+		<< " is already registered with the writer";
+
+	this->jobs[uuid] = { sizer, stats, 0, false };
+
+	LOG_IF(INFO, this->jobs.size() > 1) << "Job " << uuid << " shares the drives with "
+										<< (this->jobs.size() - 1) << " other job(s)";
+}
+
+/**
+ * Waits for all of a job's queued chunks to be written, then unregisters it.
+ */
+void TapeWriter::removeJob(boost::uuids::uuid uuid) {
+	std::unique_lock<std::mutex> lk(this->jobsLock);
+
+	auto it = this->jobs.find(uuid);
+	CHECK(it != this->jobs.end()) << "Job " << uuid << " isn't registered with the writer";
+
+	this->jobWritten.wait(lk, [it] {
+		return (it->second.pending == 0);
+	});
+
+	this->jobs.erase(it);
+}
+
+/**
+ * Adds a chunk to the write queue; its job must be registered. If there are
+ * already MAX_CHUNKS_WAITING chunks per drive waiting to be written, this
+ * blocks until one of them is picked up. If the job failed, the chunk is freed
+ * without being written.
+ */
+void TapeWriter::addChunkToQueue(Chunk *chunk) {
+	boost::uuids::uuid uuid = chunk->getJobUuid();
+	bool failed;
+
+	{
+		std::lock_guard<std::mutex> lk(this->jobsLock);
+
+		auto it = this->jobs.find(uuid);
+		CHECK(it != this->jobs.end()) << "Chunk " << chunk->getChunkNumber()
+			<< " belongs to job " << uuid << ", which isn't registered";
+
+		failed = it->second.failed;
+
+		if(failed) {
+			it->second.stats->chunksFailed.add(1);
+		} else {
+			it->second.pending++;
 		}
+	}
 
-		// When we've finished this chunk, notify any waiting threads.
-		this->chunkProcessedSignal.notify_all();
+	if(failed) {
+		this->releaseQueue.push(chunk);
+		return;
 	}
+
+	bool queued = this->writeQueue->push(chunk);
+
+	CHECK(queued) << "Tried to queue chunk " << chunk->getChunkNumber()
+				  << " after the writer was shut down";
 }
 
 /**
- * Writes a chunk to tape. This is a blocking operation; if an error occurs
- * during writing, determine whether the tape is at the end (in which case the
- * a new tape is swapped in and the write is retried), or if there was some
- * other unrecoverable I/O error.
+ * Called by the drives once a chunk has been written; the measurements are
+ * reported to the chunk's job. After this, the job may be unregistered.
  */
-void TapeWriter::_writeChunk(Chunk *chunk) {
-	LOG(INFO) << "Writing chunk " << chunk->getChunkNumber() << " to tape";
+void TapeWriter::chunkWritten(Chunk *chunk, size_t len, double writeTime,
+							  double filemarkTime) {
+	{
+		std::lock_guard<std::mutex> lk(this->jobsLock);
+
+		auto it = this->jobs.find(chunk->getJobUuid());
+		CHECK(it != this->jobs.end()) << "Wrote chunk " << chunk->getChunkNumber()
+									  << " of a job that isn't registered";
+
+		job_t &job = it->second;
 
-	/*// For now, just write to a file.
-	std::ostringstream nameStr;
-	nameStr << chunk->getChunkNumber() << ".chunk";
-	std::string name  = nameStr.str();
-	const char *nameC = name.c_str();
+		// Report how long the data took to write, and the fixed cost of the chunk
+		job.sizer->recordWrite(len, writeTime);
+		job.sizer->recordFixedCost(filemarkTime);
 
-	FILE *fp = fopen(nameC, "w+b");
-	fwrite(chunk->backingStore, chunk->backingStoreActualSize, 1, fp);
-	fclose(fp);*/
+		job.stats->chunksWritten.add(1);
+		job.stats->bytesWritten.add(len);
 
+		job.pending--;
+	}
+
+	this->jobWritten.notify_all();
+}
 
-	// When done writing, delete the chunk.
-	LOG(INFO) << "Finished writing chunk " << chunk->getChunkNumber();
-	delete chunk;
+/**
+ * Called by the drives if a chunk couldn't be written, other than because the
+ * tape was full; the chunk's job fails. After this, the job may be
+ * unregistered.
+ */
+void TapeWriter::chunkFailed(Chunk *chunk, iolib_error_t err) {
+	{
+		std::lock_guard<std::mutex> lk(this->jobsLock);
+
+		auto it = this->jobs.find(chunk->getJobUuid());
+		CHECK(it != this->jobs.end()) << "Failed to write chunk " << chunk->getChunkNumber()
+									  << " of a job that isn't registered";
+
+		job_t &job = it->second;
+
+		LOG_IF(ERROR, !job.failed) << "Job " << it->first << " failed: couldn't "
+								   << "write chunk " << chunk->getChunkNumber()
+								   << " (error " << err << ")";
+
+		job.stats->chunksFailed.add(1);
+		job.failed = true;
+
+		job.pending--;
+	}
+
+	Metrics::tapeWriteErrors.add(1);
+
+	this->jobWritten.notify_all();
+}
+
+/**
+ * Returns whether the given job failed, because one of its chunks couldn't be
+ * written.
+ */
+bool TapeWriter::hasJobFailed(boost::uuids::uuid uuid) {
+	std::lock_guard<std::mutex> lk(this->jobsLock);
+
+	auto it = this->jobs.find(uuid);
+	return (it != this->jobs.end() && it->second.failed);
+}
+
+/**
+ * Returns a copy of the counters of every drive.
+ */
+std::vector<tape_drive_stats_t> TapeWriter::getDriveStats() {
+	std::vector<tape_drive_stats_t> stats;
+
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		stats.push_back((*it)->getStats());
+	}
+
+	return stats;
+}
+
+/**
+ * Returns the location of every chunk of the given job written so far, over all
+ * drives, ordered by chunk index.
+ */
+std::vector<chunk_location_t> TapeWriter::getChunkLocations(boost::uuids::uuid uuid) {
+	std::vector<chunk_location_t> locations;
+
+	for(auto it = this->drives.begin(); it != this->drives.end(); it++) {
+		std::vector<chunk_location_t> drive = (*it)->getChunkLocations();
+
+		std::copy_if(drive.begin(), drive.end(), std::back_inserter(locations),
+					 [&uuid](const chunk_location_t &loc) {
+			return (loc.job == uuid);
+		});
+	}
+
+	std::sort(locations.begin(), locations.end(),
+			  [](const chunk_location_t &a, const chunk_location_t &b) {
+		return (a.chunkIndex < b.chunkIndex);
+	});
+
+	return locations;
+}
+
+/**
+ * Entry point for the thread that frees chunks once they've been written.
+ */
+void TapeWriter::_releaseEntry() {
+	Chunk *chunk;
+
+	Trace::setThreadName("chunk release");
+
+	while(this->releaseQueue.pop(&chunk)) {
+		delete chunk;
+	}
 }
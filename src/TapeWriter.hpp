@@ -2,44 +2,168 @@
  * Writes chunks directly out to tape as they come in. Autoloader interfacing is
  * also done in this class - this mostly extends to swapping tapes when they
  * are full, however.
+ *
+ * Each chunk is written as its own tape file, i.e. followed by a filemark. The
+ * writer owns all drives of a library, and stripes chunks across them: each
+ * drive has its own I/O thread that takes the next chunk from a shared queue
+ * as soon as it's done with the last one, so a faster (or less busy) drive
+ * simply writes more chunks. Written chunks are handed to a separate thread to
+ * be freed (unmapping a large backing store isn't free), so no drive is kept
+ * waiting between chunks.
+ *
+ * If the library has a loader, it's used to replace tapes once they're full;
+ * see MediaChanger.
+ *
+ * Jobs register with the writer before queuing chunks, so that writes are
+ * reported to the right job. Usually, every job has a writer of its own; with
+ * TAPE_WRITER_MULTIPLEX, all jobs share one instead, and their chunks are
+ * interleaved on tape in the order they become ready. Each job's chunks still
+ * reach the writer in order, and every chunk is tagged with its job's UUID, so
+ * the catalog has the chunks of each job.
+ *
+ * If a chunk can't be written (other than because the tape is full), its job
+ * fails: the rest of its chunks are dropped rather than written, and the job
+ * stops creating new ones. Other jobs using the same drives carry on.
  */
 #ifndef TAPEWRITER_H
 #define TAPEWRITER_H
 
 /**
  * Defines the maximum number of chunks that may be waiting in the queue at a
- * time, before further calls to add chunks will block.
+ * time, per drive, before further calls to add chunks will block. With two,
+ * the next chunk is ready while the current one is being written.
  */
 #define MAX_CHUNKS_WAITING		2
 
-#include <queue>
-#include <mutex>
+/**
+ * Maximum number of libraries that are enumerated when looking for drives.
+ */
+#define TAPE_WRITER_MAX_LIBRARIES	8
+
+/**
+ * Maximum number of drives that chunks are striped across.
+ */
+#define TAPE_WRITER_MAX_DRIVES		16
+
+/**
+ * Number of drives that are kept on standby, to have a blank tape ready when a
+ * tape is full, if the library has a loader. At least one drive is always
+ * written to.
+ */
+#define TAPE_WRITER_STANDBY_DRIVES	1
+
+/**
+ * Set to 1 to have all concurrent jobs share one writer (and thus the same
+ * drives), rather than each opening the drives for itself. This lets several
+ * slow jobs together keep a fast drive streaming.
+ */
+#define TAPE_WRITER_MULTIPLEX		0
+
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <string>
+#include <vector>
 
+#include "BoundedQueue.hpp"
 #include "Chunk.hpp"
+#include "ChunkSizer.hpp"
+#include "DriveWriter.hpp"
+#include "MediaChanger.hpp"
+#include "TapeVerifier.hpp"
+#include "JobStats.hpp"
+
+#include <boost/uuid/uuid.hpp>
 
 #include "IOLib.h"
 
 class TapeWriter {
 	public:
-		TapeWriter();
-		~TapeWriter();
+		static TapeWriter *acquire();
+		static void release(TapeWriter *);
+
+		void addJob(boost::uuids::uuid, ChunkSizer *, JobStats *);
+		void removeJob(boost::uuids::uuid);
 
 		void addChunkToQueue(Chunk *);
+		void chunkWritten(Chunk *, size_t, double, double);
+		void chunkFailed(Chunk *, iolib_error_t);
+
+		bool hasJobFailed(boost::uuids::uuid);
+
+		bounded_queue_stats_t getQueueStats() {
+			return this->writeQueue->getStats();
+		}
+
+		std::vector<tape_drive_stats_t> getDriveStats();
+		std::vector<chunk_location_t> getChunkLocations(boost::uuids::uuid);
+
+		size_t getNumDrives() {
+			return this->drives.size();
+		}
+		int getNumaNode() {
+			return this->numaNode;
+		}
+		TapeVerifier *getVerifier() {
+			return this->verifier;
+		}
 
 	private:
-		std::queue<Chunk *> writeQueue;
-		std::mutex writeQueueMutex;
+		// a job whose chunks are written by this writer
+		typedef struct {
+			// receives the measured write rate, and the job's counters
+			ChunkSizer *sizer;
+			JobStats *stats;
+
+			// chunks that were queued, but not yet written
+			uint64_t pending;
+
+			// whether a chunk couldn't be written; later chunks are dropped
+			bool failed;
+		} job_t;
+
+		// writer shared by all jobs, and the number of jobs using it
+		static std::mutex sharedLock;
+		static TapeWriter *shared;
+		static size_t sharedUsers;
+
+		// jobs registered with the writer, by UUID
+		std::mutex jobsLock;
+		std::condition_variable jobWritten;
+		std::map<boost::uuids::uuid, job_t> jobs;
+
+		// chunks waiting to be written, and chunks waiting to be freed; the
+		// write queue is sized once the number of drives is known
+		BoundedQueue<Chunk *> *writeQueue = NULL;
+		BoundedQueue<Chunk *> releaseQueue;
 
-		std::thread workerThread;
+		std::thread releaseThread;
 
-		std::condition_variable chunkProcessedSignal;
-		std::condition_variable newChunksAvailableSignal;
-		bool shouldRun = true;
+		// all libraries that were enumerated, and the drives we write to
+		iolib_library_t libraries[TAPE_WRITER_MAX_LIBRARIES];
+		int numLibraries = 0;
+
+		std::vector<DriveWriter *> drives;
+
+		// replaces full tapes; NULL if the library has no loader
+		iolib_loader_t loader = NULL;
+		MediaChanger *changer = NULL;
+
+		// reads back tapes once they're done; NULL if they aren't verified
+		TapeVerifier *verifier = NULL;
+
+		// node all drives are attached to; -1 if unknown, or if the drives are
+		// attached to different nodes
+		int numaNode = -1;
+
+
+		TapeWriter();
+		~TapeWriter();
 
+		std::vector<iolib_drive_t> _openDrives();
 
-		void _workerEntry();
-		void _writeChunk(Chunk *chunk);
+		void _releaseEntry();
 };
 
 #endif
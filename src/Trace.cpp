@@ -0,0 +1,244 @@
+#include "Trace.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+std::atomic<bool> Trace::enabled(false);
+std::atomic<uint64_t> Trace::enabledAt(0);
+
+// All times are relative to this point
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+/**
+ * A single slot in a ring buffer. The sequence number is zero while the slot
+ * is being written, which lets readers detect events that changed while they
+ * were copying them.
+ */
+typedef struct {
+	std::atomic<uint64_t> seq;
+
+	uint64_t start;
+	uint64_t duration;
+	int64_t arg;
+
+	const char *category;
+	const char *argName;
+
+	uint32_t thread;
+	char name[TRACE_MAX_NAME_LEN + 1];
+} trace_slot_t;
+
+static_assert(sizeof(trace_slot_t) == 64, "trace slots should fill a cache line");
+
+/**
+ * A thread's ring buffer. Rings are never freed; when a thread exits, its ring
+ * is reused by the next thread that records an event, so events of threads
+ * that have exited remain until they're overwritten.
+ */
+typedef struct {
+	trace_slot_t slots[TRACE_RING_SIZE];
+	// number of events ever written; only touched by the owning thread
+	uint64_t next;
+
+	bool inUse;
+} trace_ring_t;
+
+// All rings ever allocated, and the names of all threads that recorded events,
+// indexed by thread ID - 1; protected by the lock
+static std::mutex ringsLock;
+static std::vector<trace_ring_t *> rings;
+static std::vector<std::string> threadNames;
+
+/**
+ * Per-thread state: the ring it records to and its thread ID, which are
+ * assigned when the first event is recorded, and its name. The ring is
+ * released when the thread exits.
+ */
+class TraceThread {
+	public:
+		trace_ring_t *ring = NULL;
+		uint32_t thread = 0;
+		const char *name = NULL;
+
+		~TraceThread() {
+			if(this->ring != NULL) {
+				std::lock_guard<std::mutex> lk(ringsLock);
+				this->ring->inUse = false;
+			}
+		}
+};
+
+static thread_local TraceThread currentThread;
+
+/**
+ * Returns the calling thread's ring buffer, setting one up if needed.
+ */
+static trace_ring_t *ringForThread() {
+	if(currentThread.ring != NULL) {
+		return currentThread.ring;
+	}
+
+	std::lock_guard<std::mutex> lk(ringsLock);
+	trace_ring_t *ring = NULL;
+
+	// Reuse the ring of a thread that has exited, if there is one
+	for(auto it = rings.begin(); it != rings.end(); it++) {
+		if(!(*it)->inUse) {
+			ring = *it;
+			break;
+		}
+	}
+
+	if(ring == NULL) {
+		ring = new trace_ring_t;
+		ring->next = 0;
+
+		for(size_t i = 0; i < TRACE_RING_SIZE; i++) {
+			ring->slots[i].seq = 0;
+		}
+
+		rings.push_back(ring);
+	}
+
+	ring->inUse = true;
+
+	// Threads get a new ID, even if their ring is reused
+	threadNames.push_back((currentThread.name != NULL) ? currentThread.name : "");
+
+	currentThread.ring = ring;
+	currentThread.thread = threadNames.size();
+
+	return ring;
+}
+
+/**
+ * Enables or disables tracing. When enabled, only events recorded from then on
+ * are collected.
+ */
+void Trace::setEnabled(bool enable) {
+	if(enable) {
+		enabledAt = now();
+	}
+
+	enabled = enable;
+
+	LOG(INFO) << "Tracing " << (enable ? "enabled" : "disabled");
+}
+
+/**
+ * Returns the current time, in nanoseconds since the tracing epoch. This is
+ * never zero.
+ */
+uint64_t Trace::now() {
+	std::chrono::nanoseconds time = std::chrono::steady_clock::now() - epoch;
+	return time.count() + 1;
+}
+
+/**
+ * Records an event that took place between the given times, in the calling
+ * thread's ring buffer.
+ */
+void Trace::record(const char *category, const char *name, uint64_t start,
+				   uint64_t end, const char *argName, int64_t arg) {
+	trace_ring_t *ring = ringForThread();
+
+	uint64_t seq = ++ring->next;
+	trace_slot_t &slot = ring->slots[(seq - 1) % TRACE_RING_SIZE];
+
+	// Invalidate the slot while it's being written
+	slot.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.start = start;
+	slot.duration = (end > start) ? (end - start) : 0;
+	slot.arg = arg;
+	slot.category = category;
+	slot.argName = argName;
+	slot.thread = currentThread.thread;
+
+	strncpy(slot.name, name, TRACE_MAX_NAME_LEN);
+	slot.name[TRACE_MAX_NAME_LEN] = '\0';
+
+	slot.seq.store(seq, std::memory_order_release);
+}
+
+/**
+ * Sets the name under which the calling thread's events are shown. The name
+ * must be a string literal.
+ */
+void Trace::setThreadName(const char *name) {
+	if(currentThread.name == name) {
+		return;
+	}
+
+	currentThread.name = name;
+
+	if(currentThread.thread != 0) {
+		std::lock_guard<std::mutex> lk(ringsLock);
+		threadNames[currentThread.thread - 1] = name;
+	}
+}
+
+/**
+ * Copies all events recorded since tracing was last enabled out of the ring
+ * buffers of all threads, sorted by their start time, as well as the list of
+ * threads that recorded them. Events being written while they're copied are
+ * skipped.
+ */
+void Trace::collect(std::vector<trace_event_t> *events,
+					std::vector<trace_thread_t> *threads) {
+	uint64_t since = enabledAt.load();
+
+	std::lock_guard<std::mutex> lk(ringsLock);
+	std::vector<bool> haveThread(threadNames.size() + 1, false);
+
+	for(auto it = rings.begin(); it != rings.end(); it++) {
+		trace_ring_t *ring = *it;
+
+		for(size_t i = 0; i < TRACE_RING_SIZE; i++) {
+			trace_slot_t &slot = ring->slots[i];
+
+			uint64_t seq = slot.seq.load(std::memory_order_acquire);
+
+			if(seq == 0) {
+				continue;
+			}
+
+			trace_event_t event;
+			event.thread = slot.thread;
+			event.start = slot.start;
+			event.duration = slot.duration;
+			event.category = slot.category;
+			event.argName = slot.argName;
+			event.arg = slot.arg;
+			event.name.assign(slot.name, strnlen(slot.name, TRACE_MAX_NAME_LEN));
+
+			// Discard the event if it was overwritten while we copied it
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if(slot.seq.load(std::memory_order_relaxed) != seq) {
+				continue;
+			}
+
+			if(event.start >= since) {
+				events->push_back(event);
+				haveThread[event.thread] = true;
+			}
+		}
+	}
+
+	for(size_t i = 1; i < haveThread.size(); i++) {
+		if(haveThread[i]) {
+			threads->push_back({ (uint32_t) i, threadNames[i - 1] });
+		}
+	}
+
+	std::sort(events->begin(), events->end(), [](const trace_event_t &a,
+												 const trace_event_t &b) {
+		return (a.start < b.start);
+	});
+}
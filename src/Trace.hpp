@@ -0,0 +1,122 @@
+/**
+ * A low-overhead tracing facility, used to find out where a backup job spends
+ * its time. Each thread records timestamped events (the start and duration of
+ * some piece of work) into its own ring buffer, without taking any locks; the
+ * most recent events of all threads can then be collected on demand, and are
+ * exported through the web API in the Chrome trace-event format.
+ *
+ * Tracing is disabled by default. While disabled, a trace point only costs a
+ * single relaxed atomic load, and no ring buffers are allocated.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Number of events each thread's ring buffer holds; once full, the oldest
+ * events are overwritten.
+ */
+#define TRACE_RING_SIZE			16384
+
+/**
+ * Maximum length of an event's name; longer names are truncated.
+ */
+#define TRACE_MAX_NAME_LEN		11
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * A single event, as returned when collecting the trace. Times are in
+ * nanoseconds since the tracing epoch.
+ */
+typedef struct {
+	uint32_t thread;
+
+	uint64_t start;
+	uint64_t duration;
+
+	const char *category;
+	std::string name;
+
+	// optional argument; argName is NULL if there is none
+	const char *argName;
+	int64_t arg;
+} trace_event_t;
+
+/**
+ * A thread that recorded events.
+ */
+typedef struct {
+	uint32_t thread;
+	std::string name;
+} trace_thread_t;
+
+class Trace {
+	public:
+		/**
+		 * Returns whether trace events should be recorded.
+		 */
+		static bool isEnabled() {
+			return enabled.load(std::memory_order_relaxed);
+		}
+
+		static void setEnabled(bool);
+
+		static uint64_t now();
+
+		static void record(const char *, const char *, uint64_t, uint64_t,
+						   const char * = NULL, int64_t = 0);
+
+		static void setThreadName(const char *);
+
+		static void collect(std::vector<trace_event_t> *,
+							std::vector<trace_thread_t> *);
+
+	private:
+		static std::atomic<bool> enabled;
+		// time at which tracing was last enabled; older events are ignored
+		static std::atomic<uint64_t> enabledAt;
+};
+
+/**
+ * Records an event spanning the lifetime of the object, i.e. the enclosing
+ * scope. The category, name and argument name must be string literals, except
+ * for the name, which is copied.
+ */
+class TraceScope {
+	public:
+		TraceScope(const char *category, const char *name,
+				   const char *argName = NULL, int64_t arg = 0) {
+			if(Trace::isEnabled()) {
+				this->category = category;
+				this->name = name;
+				this->argName = argName;
+				this->arg = arg;
+
+				this->start = Trace::now();
+			}
+		}
+
+		~TraceScope() {
+			if(this->start != 0) {
+				Trace::record(this->category, this->name, this->start,
+							  Trace::now(), this->argName, this->arg);
+			}
+		}
+
+	private:
+		uint64_t start = 0;
+
+		const char *category;
+		const char *name;
+
+		const char *argName;
+		int64_t arg;
+
+		TraceScope(const TraceScope &) = delete;
+		TraceScope &operator=(const TraceScope &) = delete;
+};
+
+#endif
@@ -1,10 +1,15 @@
 #include "WWWAPIHandler.hpp"
 
 #include "IOLib.h"
+#include "BackupJob.hpp"
+#include "InventoryService.hpp"
+#include "Trace.hpp"
+#include "TapeCatalog.hpp"
 
 #include <stdlib.h>
 #include <glog/logging.h>
 #include <boost/regex.hpp>
+#include <boost/uuid/string_generator.hpp>
 
 using json = nlohmann::json;
 using namespace boost;
@@ -12,6 +17,10 @@ using namespace std;
 
 // Create regexes for all URLs we support.
 static regex _exprLibraries("^\\/api\\/libraries$");
+static regex _exprJobs("^\\/api\\/jobs$");
+static regex _exprJobStats("^\\/api\\/jobs\\/([^\\/]+)\\/stats$");
+static regex _exprJobChunks("^\\/api\\/jobs\\/([^\\/]+)\\/chunks$");
+static regex _exprTrace("^\\/api\\/trace$");
 
 
 /**
@@ -40,8 +49,32 @@ json WWWAPIHandler::handle(string method, string url, json params) {
 
     // Listing all libraries?
     if(regex_match(url.c_str(), what, _exprLibraries)) {
+        if(method == "POST") {
+            return _refreshLibraries();
+        }
+
         return _getAllLibraries();
     }
+    // Listing all jobs?
+    else if(regex_match(url.c_str(), what, _exprJobs)) {
+        return _getAllJobs();
+    }
+    // Statistics for a single job?
+    else if(regex_match(url.c_str(), what, _exprJobStats)) {
+        return _getJobStats(what[1]);
+    }
+    // Where a job's chunks were written?
+    else if(regex_match(url.c_str(), what, _exprJobChunks)) {
+        return _getJobChunks(what[1]);
+    }
+    // Reading or configuring the trace?
+    else if(regex_match(url.c_str(), what, _exprTrace)) {
+        if(method == "POST") {
+            return _setTraceEnabled(params);
+        }
+
+        return _getTrace();
+    }
 
     // Unknown API request; log it.
     else {
@@ -55,96 +88,68 @@ json WWWAPIHandler::handle(string method, string url, json params) {
 }
 
 /**
- * Fetches all libraries, including drives and loaders.
+ * Returns all libraries, including drives and loaders, from the inventory
+ * snapshot; the hardware isn't queried.
  */
 json WWWAPIHandler::_getAllLibraries() {
+	return _jsonForInventory(*InventoryService::getSnapshot());
+}
+
+/**
+ * Refreshes the inventory, then returns it like _getAllLibraries. This waits
+ * for the hardware to be queried.
+ */
+json WWWAPIHandler::_refreshLibraries() {
+	return _jsonForInventory(*InventoryService::refresh());
+}
+
+/**
+ * Constructs the json object for an inventory snapshot.
+ */
+json WWWAPIHandler::_jsonForInventory(const inventory_snapshot_t &snapshot) {
     vector<json> libraries;
     vector<json> drives;
     vector<json> loaders;
 	vector<json> elements;
 
-    // Fetch all libraries
-	iolib_library_t libs[8];
-	size_t numLibs = iolibEnumerateDevices((iolib_library_t *) &libs, 8, NULL);
-
-	for(size_t i = 0; i < numLibs; i++) {
+	for(auto lib = snapshot.libraries.begin(); lib != snapshot.libraries.end(); lib++) {
         vector<string> driveIds;
         vector<string> loaderIds;
 
         // Create JSON objects for any drives.
-        for(size_t j = 0; j < libs[i].numDrives; j++) {
-            iolib_drive_t drive = libs[i].drives[j];
-
-			// Get UUID
-			string uuid = _stdStringFromIoLibString(iolibDriveGetUuid(drive));
-
-			// Create drive object
+        for(auto drive = lib->drives.begin(); drive != lib->drives.end(); drive++) {
             drives.push_back({
-                {"id", uuid},
-                {"name", _stdStringFromIoLibString(iolibDriveGetName(drive))},
-                {"file", _stdStringFromIoLibString(iolibDriveGetDevFile(drive))}
-                // {"library", libs[i].id}
+                {"id", drive->id},
+                {"name", drive->name},
+                {"file", drive->file}
             });
-            driveIds.push_back(uuid);
+            driveIds.push_back(drive->id);
         }
 
-        // Create JSON objects for any loaders.
-        for(size_t j = 0; j < libs[i].numLoaders; j++) {
-            iolib_loader_t loader = libs[i].loaders[j];
-
-			string uuid = _stdStringFromIoLibString(iolibLoaderGetUuid(loader));
-
-
-			// Process all of the elements
+        // Create JSON objects for any loaders, and their elements.
+        for(auto loader = lib->loaders.begin(); loader != lib->loaders.end(); loader++) {
 			vector<string> loaderElementIds;
-			size_t numElements = 0;
 
-			static const iolib_storage_element_type_t types[] = {
-				kStorageElementTransport,
-				kStorageElementDrive,
-				kStorageElementPortal,
-				kStorageElementSlot
-			};
+			for(auto it = loader->elements.begin(); it != loader->elements.end(); it++) {
+				json elementJson = _jsonForElement(*it);
 
-			for(size_t i = 0; i < (sizeof(types) / sizeof(*types)); i++) {
-				// Get the number of elements
-				size_t elmsOfType = iolibLoaderGetNumElements(loader, types[i]);
-				numElements += elmsOfType;
-
-				iolib_storage_element_t elms[elmsOfType];
-
-				// Get all the elements
-				iolibLoaderGetElements(loader, types[i],
-					reinterpret_cast<iolib_storage_element_t *>(&elms),
-					elmsOfType);
-
-				// ...and now, process them.
-				for(size_t j = 0; j < elmsOfType; j++) {
-					iolib_storage_element_t element = elms[j];
-
-					json elementJson = _jsonForElement(element);
-
-					elements.push_back(elementJson);
-					loaderElementIds.push_back(elementJson["id"]);
-				}
+				elements.push_back(elementJson);
+				loaderElementIds.push_back(elementJson["id"]);
 			}
 
-
-			// Create loader entry
             loaders.push_back({
-                {"id", uuid},
-                {"name", _stdStringFromIoLibString(iolibLoaderGetName(loader))},
-                {"file", _stdStringFromIoLibString(iolibLoaderGetDevFile(loader))},
+                {"id", loader->device.id},
+                {"name", loader->device.name},
+                {"file", loader->device.file},
 				{"elements", loaderElementIds}
-                // {"library", libs[i].id}
             });
-            loaderIds.push_back(uuid);
+            loaderIds.push_back(loader->device.id);
         }
 
         // Insert the JSON object for the library.
         libraries.push_back({
-            {"id", _stdStringFromIoLibString(libs[i].id)},
-            {"name", _stdStringFromIoLibString(libs[i].name)},
+            {"id", lib->id},
+            {"name", lib->name},
             {"drives", driveIds},
             {"loaders", loaderIds},
         });
@@ -152,6 +157,8 @@ json WWWAPIHandler::_getAllLibraries() {
 
     // Construct the response
     return {
+        {"version", snapshot.version},
+        {"updated", snapshot.updated},
         {"libraries", libraries},
         {"drives", drives},
 		{"loaders", loaders},
@@ -162,18 +169,18 @@ json WWWAPIHandler::_getAllLibraries() {
 /**
  * Constructs a json object for a loader's storage element.
  */
-json WWWAPIHandler::_jsonForElement(iolib_storage_element_t element) {
+json WWWAPIHandler::_jsonForElement(const iolib_element_record_t &element) {
 	json elementJson;
 
 	// Get UUID
-	elementJson["id"] = _stdStringFromIoLibString(iolibElementGetUuid(element));
+	elementJson["id"] = string(element.uuid);
 	// Get logical element address
-	elementJson["address"] = iolibElementGetAddress(element);
+	elementJson["address"] = element.address;
 	// Check the flags - is it empty?
-	elementJson["isEmpty"] = !(iolibElementGetFlags(element) & kStorageElementFull);
+	elementJson["isEmpty"] = !(element.flags & kStorageElementFull);
 
 	// Populate the type
-	switch(iolibElementGetType(element)) {
+	switch(element.type) {
 		case kStorageElementDrive:
 			elementJson["kind"] = "drive";
 			break;
@@ -195,22 +202,298 @@ json WWWAPIHandler::_jsonForElement(iolib_storage_element_t element) {
 	}
 
 	// And lastly, the volume tag.
-	iolib_string_t rawLabel = iolibElementGetLabel(element);
-	string label = string(rawLabel);
-	iolibStringFree(rawLabel);
-
-	elementJson["label"] = label;
+	elementJson["label"] = string(element.label);
 
 	return elementJson;
 }
 
 /**
- * Creates a standard library string from an iolib string, freeing that iolib
- * string once done.
+ * Lists the IDs of all backup jobs.
  */
-string WWWAPIHandler::_stdStringFromIoLibString(iolib_string_t in) {
-	string out = string(in);
-	iolibStringFree(in);
+json WWWAPIHandler::_getAllJobs() {
+	return {
+		{"jobs", BackupJob::getJobIds()}
+	};
+}
+
+/**
+ * Returns the live counters of a backup job: how much work each stage of its
+ * pipeline has done, the state of the queues between them, and how long each
+ * stage has spent waiting for input or output.
+ */
+json WWWAPIHandler::_getJobStats(string id) {
+	job_stats_snapshot_t stats;
+
+	if(!BackupJob::getStatsForJob(id, &stats)) {
+		return {
+			{ "error", "No such job" }
+		};
+	}
+
+	json queues, stages;
+	json drives = json::array();
+
+	for(auto it = stats.queues.begin(); it != stats.queues.end(); it++) {
+		queues[it->first] = _jsonForQueueStats(it->second);
+	}
+
+	for(auto it = stats.stages.begin(); it != stats.stages.end(); it++) {
+		stages[it->first] = {
+			{"inputWaitSec", it->second.inputWaitTime},
+			{"outputWaitSec", it->second.outputWaitTime}
+		};
+	}
+
+	for(auto it = stats.drives.begin(); it != stats.drives.end(); it++) {
+		drives.push_back(_jsonForDriveStats(*it));
+	}
+
+	json spool = nullptr;
+
+	if(stats.hasSpool) {
+		spool = _jsonForSpoolStats(stats.spool);
+	}
+
+	json verify = nullptr;
+
+	if(stats.hasVerifier) {
+		verify = _jsonForVerifyStats(stats.verify);
+	}
+
+	return {
+		{"id", stats.id},
+		{"root", stats.root},
+		{"elapsedSec", stats.elapsed},
+		{"files", {
+			{"scanned", stats.filesScanned},
+			{"bytesScanned", stats.bytesScanned}
+		}},
+		{"bytesRead", stats.bytesRead},
+		{"chunks", {
+			{"built", stats.chunksBuilt},
+			{"postprocessed", stats.chunksProcessed},
+			{"written", stats.chunksWritten},
+			{"failed", stats.chunksFailed}
+		}},
+		{"failed", (stats.chunksFailed != 0)},
+		{"bytesWritten", stats.bytesWritten},
+		{"readMBps", stats.readRate / (1024 * 1024)},
+		{"writeMBps", stats.writeRate / (1024 * 1024)},
+		{"queues", queues},
+		{"stages", stages},
+		{"drives", drives},
+		{"spool", spool},
+		{"verify", verify}
+	};
+}
+
+/**
+ * Lists where on tape each chunk of a backup job was written, i.e. the drive,
+ * the tape in it, and the tape file the chunk starts at. Once the job is done,
+ * this comes from the catalog instead, which doesn't know the drive.
+ */
+json WWWAPIHandler::_getJobChunks(string id) {
+	vector<chunk_location_t> locations;
+
+	if(!BackupJob::getChunkLocationsForJob(id, &locations)) {
+		try {
+			locations = TapeCatalog::getChunksForJob(uuids::string_generator()(id));
+		} catch(std::runtime_error &) {
+			// not a valid UUID
+		}
+
+		if(locations.empty()) {
+			return {
+				{ "error", "No such job" }
+			};
+		}
+	}
 
-	 return out;
- }
+	json chunks = json::array();
+
+	for(auto it = locations.begin(); it != locations.end(); it++) {
+		chunks.push_back({
+			{"index", it->chunkIndex},
+			{"length", it->length},
+			{"drive", it->drive},
+			{"tape", it->tape},
+			{"file", (int64_t) it->fileNumber},
+			{"fileOffset", it->fileOffset},
+			{"block", (int64_t) it->block},
+			{"dataBlock", (int64_t) it->dataBlock}
+		});
+	}
+
+	return {
+		{"id", id},
+		{"chunks", chunks}
+	};
+}
+
+/**
+ * Constructs a json object for the counters of a drive. The sustained rate is
+ * the rate at which data was written while the drive was streaming, i.e. not
+ * counting filemarks or time spent waiting for chunks.
+ */
+json WWWAPIHandler::_jsonForDriveStats(tape_drive_stats_t stats) {
+	double sustained = 0;
+
+	if(stats.writeTime > 0) {
+		sustained = (stats.bytesWritten / stats.writeTime) / (1024 * 1024);
+	}
+
+	return {
+		{"drive", stats.drive},
+		{"tape", stats.tape},
+		{"chunksWritten", stats.chunksWritten},
+		{"bytesWritten", stats.bytesWritten},
+		{"sustainedMBps", sustained},
+		{"writeSec", stats.writeTime},
+		{"filemarkSec", stats.filemarkTime},
+		{"idleSec", stats.idleTime},
+		{"underruns", stats.underruns},
+		{"tapeChanges", stats.tapeChanges},
+		{"tapeChangeSec", stats.tapeChangeTime}
+	};
+}
+
+/**
+ * Constructs a json object for the counters of a job's spool. The drain rate
+ * is the rate chunks left the spool while it was draining.
+ */
+json WWWAPIHandler::_jsonForSpoolStats(chunk_spool_stats_t stats) {
+	double drainRate = 0;
+
+	if(stats.drainTime > 0) {
+		drainRate = (stats.bytesDrained / stats.drainTime) / (1024 * 1024);
+	}
+
+	return {
+		{"bytesUsed", stats.bytesUsed},
+		{"maxBytesUsed", stats.maxBytesUsed},
+		{"highWater", stats.highWater},
+		{"chunksSpooled", stats.chunksSpooled},
+		{"bytesSpooled", stats.bytesSpooled},
+		{"chunksDrained", stats.chunksDrained},
+		{"bytesDrained", stats.bytesDrained},
+		{"spoolSec", stats.spoolTime},
+		{"spaceWaitSec", stats.spaceWaitTime},
+		{"drainSec", stats.drainTime},
+		{"drainMBps", drainRate},
+		{"drains", stats.drains},
+		{"draining", stats.draining}
+	};
+}
+
+/**
+ * Constructs a json object for the counters of tape verification. The read
+ * rate is the rate at which chunks were read back, not counting the time it
+ * took to check them.
+ */
+json WWWAPIHandler::_jsonForVerifyStats(tape_verify_stats_t stats) {
+	double readRate = 0;
+
+	if(stats.readTime > 0) {
+		readRate = (stats.bytesRead / stats.readTime) / (1024 * 1024);
+	}
+
+	return {
+		{"tapesVerified", stats.tapesVerified},
+		{"tapesInProgress", stats.tapesInProgress},
+		{"tapesFailed", stats.tapesFailed},
+		{"chunksVerified", stats.chunksVerified},
+		{"mismatches", stats.mismatches},
+		{"bytesRead", stats.bytesRead},
+		{"readSec", stats.readTime},
+		{"checkSec", stats.checkTime},
+		{"readMBps", readRate},
+		{"errors", stats.errors}
+	};
+}
+
+/**
+ * Constructs a json object for the counters of a pipeline queue.
+ */
+json WWWAPIHandler::_jsonForQueueStats(bounded_queue_stats_t stats) {
+	return {
+		{"depth", stats.depth},
+		{"capacity", stats.capacity},
+		{"maxDepth", stats.maxDepth},
+		{"pushed", stats.pushed},
+		{"popped", stats.popped},
+		{"producerWaits", stats.pushWaits},
+		{"producerWaitSec", stats.pushWaitTime},
+		{"consumerWaits", stats.popWaits},
+		{"consumerWaitSec", stats.popWaitTime}
+	};
+}
+
+/**
+ * Enables or disables tracing, as specified by the "enabled" key of the input.
+ */
+json WWWAPIHandler::_setTraceEnabled(json params) {
+	if(!params.is_object() || !params["enabled"].is_boolean()) {
+		return {
+			{ "error", "Expected a boolean 'enabled' key" }
+		};
+	}
+
+	Trace::setEnabled(params["enabled"]);
+
+	return {
+		{"enabled", Trace::isEnabled()}
+	};
+}
+
+/**
+ * Returns all events recorded since tracing was enabled, in the Chrome
+ * trace-event format; this can be loaded directly into chrome://tracing or
+ * Perfetto.
+ */
+json WWWAPIHandler::_getTrace() {
+	vector<trace_event_t> events;
+	vector<trace_thread_t> threads;
+
+	Trace::collect(&events, &threads);
+
+	json traceEvents = json::array();
+
+	// Name each thread
+	for(auto it = threads.begin(); it != threads.end(); it++) {
+		traceEvents.push_back({
+			{"name", "thread_name"},
+			{"ph", "M"},
+			{"pid", 1},
+			{"tid", it->thread},
+			{"args", {
+				{"name", it->name}
+			}}
+		});
+	}
+
+	// Then add the events themselves; times are in microseconds
+	for(auto it = events.begin(); it != events.end(); it++) {
+		json event = {
+			{"name", it->name},
+			{"cat", it->category},
+			{"ph", "X"},
+			{"ts", it->start / 1000.0},
+			{"dur", it->duration / 1000.0},
+			{"pid", 1},
+			{"tid", it->thread}
+		};
+
+		if(it->argName != NULL) {
+			event["args"] = {
+				{it->argName, it->arg}
+			};
+		}
+
+		traceEvents.push_back(event);
+	}
+
+	return {
+		{"traceEvents", traceEvents},
+		{"displayTimeUnit", "ms"}
+	};
+}
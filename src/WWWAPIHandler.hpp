@@ -14,6 +14,8 @@
 #include <json.hpp>
 
 #include "IOLib.h"
+#include "InventoryService.hpp"
+#include "JobStats.hpp"
 
 class WWWAPIHandler {
 	public:
@@ -24,9 +26,20 @@ class WWWAPIHandler {
 
 	private:
 		nlohmann::json _getAllLibraries();
-		nlohmann::json _jsonForElement(iolib_storage_element_t);
+		nlohmann::json _refreshLibraries();
+		nlohmann::json _jsonForInventory(const inventory_snapshot_t &);
+		nlohmann::json _jsonForElement(const iolib_element_record_t &);
 
-		std::string _stdStringFromIoLibString(iolib_string_t);
+		nlohmann::json _getAllJobs();
+		nlohmann::json _getJobStats(std::string);
+		nlohmann::json _getJobChunks(std::string);
+		nlohmann::json _jsonForQueueStats(bounded_queue_stats_t);
+		nlohmann::json _jsonForDriveStats(tape_drive_stats_t);
+		nlohmann::json _jsonForSpoolStats(chunk_spool_stats_t);
+		nlohmann::json _jsonForVerifyStats(tape_verify_stats_t);
+
+		nlohmann::json _setTraceEnabled(nlohmann::json);
+		nlohmann::json _getTrace();
 };
 
 #endif
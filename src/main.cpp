@@ -1,4 +1,5 @@
 #include "MainLoop.hpp"
+#include "InventoryService.hpp"
 #include "Logging.hpp"
 #include "IOLib.h"
 
@@ -17,10 +18,20 @@ int main(int argc, char *argv[]) {
 	iolib_error_t ioErr = iolibInit();
 	CHECK(ioErr == 0) << "Error initializing IOLib: " << ioErr;
 
+	// Take the hardware inventory in the background
+	InventoryService::start();
+
     // Set up the main run loop
-    MainLoop listener;
+    {
+        MainLoop listener;
+
+        listener.run();
+    }
+
+    // Nothing queries the inventory anymore; its thread must be gone by exit
+    InventoryService::stop();
 
-    listener.run();
+    iolibExit();
 
     return 0;
 }